@@ -0,0 +1,219 @@
+// Bookmark
+// Binary resume records journaled in /bookmark.
+//
+// Besides track, position and volume a record carries the shuffle seed and
+// cursor plus the last few tracks played, so after a power cycle the order
+// continues where it stopped and "previous" still works.  A record is a fixed
+// 72 bytes, little-endian: magic, version byte, sequence number, payload and a
+// CRC32 over everything before it.  Version 2 records, 68 bytes without the
+// play time, are still read.
+//
+// /bookmark is a ring of slotCount preallocated 512-byte slots.  Record n goes
+// to slot n % slotCount as one whole, sector-aligned write, so no sector is
+// read back or rewritten more than once per slotCount saves.  At boot the
+// valid record with the newest sequence number wins; a write torn by power
+// loss fails its CRC and the one before it is used.
+//
+// Older firmware wrote a single text line, which parseLegacy() still reads.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace Bookmark
+{
+
+static constexpr uint8_t version = 3;
+static constexpr size_t historySize = 8;
+static constexpr size_t recordSize = 72;
+static constexpr size_t recordSizeV2 = 68;
+static constexpr size_t slotSize = 512;
+static constexpr uint32_t slotCount = 16;
+static const uint8_t magic[3] = {'B', 'M', 'K'};
+
+struct Record
+{
+    uint32_t seq;
+    uint32_t totalFiles;
+    int32_t track;
+    uint32_t offset;     // byte offset in the file, for formats that can't seek by time
+    uint32_t positionMs; // play time, 0 if the decoder can't tell
+    uint8_t volume;
+    uint32_t shuffleSeed;
+    uint32_t shuffleCursor;
+    uint8_t historyCount; // valid entries in history, oldest first
+    uint32_t history[historySize];
+};
+
+// Remember a track that started playing, dropping the oldest when full
+inline void pushHistory(Record &r, uint32_t track)
+{
+    if (r.historyCount == historySize)
+    {
+        memmove(r.history, r.history + 1, (historySize - 1) * sizeof(r.history[0]));
+        r.historyCount--;
+    }
+    r.history[r.historyCount++] = track;
+}
+
+// Forget the current track and return the one before it, or -1
+inline int popHistory(Record &r)
+{
+    if (r.historyCount < 2)
+        return -1;
+    r.historyCount--;
+    return r.history[r.historyCount - 1];
+}
+
+namespace detail
+{
+inline uint8_t *put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+    return p + 4;
+}
+
+inline const uint8_t *get32(const uint8_t *p, uint32_t &v)
+{
+    v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    return p + 4;
+}
+
+// Bitwise CRC-32 (IEEE); a record is only 72 bytes, so no table
+inline uint32_t crc32(const uint8_t *p, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+    while (len--)
+    {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+} // namespace detail
+
+// Serialise r into buf, which must hold recordSize bytes
+inline size_t encode(const Record &r, uint8_t *buf)
+{
+    memset(buf, 0, recordSize);
+    memcpy(buf, magic, sizeof(magic));
+    buf[3] = version;
+    uint8_t *p = buf + 4;
+    p = detail::put32(p, r.seq);
+    p = detail::put32(p, r.totalFiles);
+    p = detail::put32(p, (uint32_t)r.track);
+    p = detail::put32(p, r.offset);
+    p = detail::put32(p, r.shuffleSeed);
+    p = detail::put32(p, r.shuffleCursor);
+    *p++ = r.volume;
+    *p++ = r.historyCount;
+    p += 2;
+    for (size_t i = 0; i < historySize; i++)
+        p = detail::put32(p, r.history[i]);
+    p = detail::put32(p, r.positionMs);
+    detail::put32(p, detail::crc32(buf, p - buf));
+    return recordSize;
+}
+
+inline bool decode(const uint8_t *buf, size_t len, Record &r)
+{
+    if (len < 4 || memcmp(buf, magic, sizeof(magic)) != 0 || (buf[3] != version && buf[3] != 2))
+        return false;
+    size_t size = (buf[3] == 2) ? recordSizeV2 : recordSize;
+    uint32_t crc;
+    if (len < size)
+        return false;
+    detail::get32(buf + size - 4, crc);
+    if (crc != detail::crc32(buf, size - 4))
+        return false;
+    const uint8_t *p = buf + 4;
+    uint32_t track;
+    p = detail::get32(p, r.seq);
+    p = detail::get32(p, r.totalFiles);
+    p = detail::get32(p, track);
+    p = detail::get32(p, r.offset);
+    p = detail::get32(p, r.shuffleSeed);
+    p = detail::get32(p, r.shuffleCursor);
+    r.track = (int32_t)track;
+    r.volume = *p++;
+    r.historyCount = *p++;
+    p += 2;
+    for (size_t i = 0; i < historySize; i++)
+        p = detail::get32(p, r.history[i]);
+    r.positionMs = 0;
+    if (size == recordSize)
+        detail::get32(p, r.positionMs);
+    if (r.historyCount > historySize)
+        r.historyCount = historySize;
+    return true;
+}
+
+// Size /bookmark to the full ring so later saves never grow the file
+template <class F>
+bool format(F &journal)
+{
+    uint8_t zero[slotSize] = {};
+    journal.seek(0);
+    for (uint32_t i = 0; i < slotCount; i++)
+        if (journal.write(zero, slotSize) != slotSize)
+            return false;
+    return true;
+}
+
+// Write r into the slot picked by its sequence number
+template <class F>
+bool append(F &journal, const Record &r)
+{
+    uint8_t slot[slotSize] = {};
+    encode(r, slot);
+    return journal.seek((r.seq % slotCount) * slotSize) && journal.write(slot, slotSize) == slotSize;
+}
+
+// Find the newest valid record.  Sequence numbers are compared with wrap
+// around, so the ring keeps working after 2^32 saves.
+template <class F>
+bool recover(F &journal, Record &r)
+{
+    uint8_t buf[recordSize];
+    Record rec;
+    bool found = false;
+    for (uint32_t i = 0; i < slotCount; i++)
+    {
+        if (!journal.seek(i * slotSize) || journal.read(buf, recordSize) != recordSize)
+            break;
+        if (!decode(buf, recordSize, rec))
+            continue;
+        if (!found || (int32_t)(rec.seq - r.seq) > 0)
+        {
+            r = rec;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Text line written by older firmware: "<totalFiles> <track> <offset> <volume>".
+// The shuffle fields are left untouched for the caller to seed.
+inline bool parseLegacy(const char *line, Record &r)
+{
+    int files, track, vol;
+    unsigned off;
+    if (sscanf(line, "%d %d %u %d", &files, &track, &off, &vol) != 4)
+        return false;
+    r.totalFiles = files;
+    r.track = track;
+    r.offset = off;
+    r.positionMs = 0;
+    r.volume = vol;
+    r.historyCount = 0;
+    return true;
+}
+
+} // namespace Bookmark
@@ -124,6 +124,40 @@ bool AudioFileSourceUnsync::eof() {
 }
 
 
+// TXXX holds "description\0value" in the frame's text encoding.  Both come
+// out as plain strings, UTF-16 narrowed to ASCII, which is all the tags read
+// this way (ReplayGain and the like) ever contain.
+static void readUserText(AudioFileSourceUnsync &id3, int framesize, char *desc, int descLen, char *value, int valueLen) {
+    int enc = id3.getByte();
+    bool wide = (enc == 1) || (enc == 2);
+    bool bigEndian = (enc == 2);
+    char *out = desc;
+    int n = 0;
+    desc[0] = value[0] = 0;
+    for (int i = 1; i < framesize; i += wide ? 2 : 1) {
+        int c = id3.getByte();
+        if (wide) {
+            int d = (i + 1 < framesize) ? id3.getByte() : 0;
+            uint16_t unit = (c << 8) | d;
+            if ((unit == 0xfeff) || (unit == 0xfffe)) {
+                bigEndian = (unit == 0xfeff); // Byte order mark
+                continue;
+            }
+            c = bigEndian ? unit : (uint16_t)((d << 8) | c);
+            c = (c < 0x80) ? c : '?';
+        }
+        if (c == 0) {
+            // Past the value the rest of the frame is read and dropped
+            out = (out == desc) ? value : nullptr;
+            n = 0;
+            continue;
+        }
+        if (out && (n < ((out == desc) ? descLen : valueLen) - 1)) {
+            out[n++] = c;
+            out[n] = 0;
+        }
+    }
+}
 
 AudioFileSourceID3::AudioFileSourceID3(AudioFileSource *src) {
     this->src = src;
@@ -226,8 +260,20 @@ uint32_t AudioFileSourceID3::read(void *data, uint32_t len) {
                 }
             }
 
-            // Read the value and send to callback
             char value[64];
+            if ((frameid[0] == 'T' && frameid[1] == 'X' && frameid[2] == 'X' && frameid[3] == 'X') ||
+                    (frameid[0] == 'T' && frameid[1] == 'X' && frameid[2] == 'X' && rev == 2)) {
+                // User defined text, sent with its description as the type.
+                // Both halves of value[], enough for the ReplayGain names
+                // and numbers these frames are read for.
+                readUserText(id3, framesize, value, sizeof(value) / 2, value + sizeof(value) / 2, sizeof(value) / 2);
+                if (value[0]) {
+                    cb.md(value, false, value + sizeof(value) / 2);
+                }
+                continue;
+            }
+
+            // Read the value and send to callback
             uint32_t i;
             bool isUnicode = (id3.getByte() == 1) ? true : false;
             for (i = 0; i < (uint32_t)framesize - 1; i++) {
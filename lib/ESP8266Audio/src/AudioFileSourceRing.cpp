@@ -0,0 +1,229 @@
+/*
+    AudioFileSourceRing
+    Single-producer/single-consumer ring between a file source and a decoder
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#ifndef ARDUINO
+#include <unistd.h>
+#endif
+#include "AudioFileSourceRing.h"
+
+#pragma GCC optimize ("O3")
+
+AudioFileSourceRing::AudioFileSourceRing(AudioFileSource *source, uint32_t bufferBytes, uint32_t chunkBytes) {
+    src = source;
+    chunk = (chunkBytes < 512) ? 512 : (chunkBytes & ~511);
+    uint32_t ringSize = 1;
+    while (ringSize * 2 <= bufferBytes) {
+        ringSize *= 2;
+    }
+    if (ringSize < 2 * chunk) {
+        ringSize = 2 * chunk;
+    }
+    buffer = (uint8_t*)malloc(ringSize);
+    if (!buffer) {
+        audioLogger->printf_P(PSTR("Unable to allocate AudioFileSourceRing::buffer[]\n"));
+    }
+    mask = ringSize - 1;
+    srcOpen = src->isOpen();
+    size = src->getSize();
+    fillPos = readPos = src->getPos();
+    // Keep ring index and file position congruent mod 512, see fill()
+    head = tail = fillPos & 511;
+    eof = false;
+    closeReq = false;
+    seekState = SEEK_IDLE;
+    seekTarget = 0;
+    stalls = 0;
+}
+
+AudioFileSourceRing::~AudioFileSourceRing() {
+    free(buffer);
+    buffer = NULL;
+}
+
+uint32_t AudioFileSourceRing::getFillLevel() {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+}
+
+uint32_t AudioFileSourceRing::copyOut(uint8_t *dst, uint32_t len) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t avail = head.load(std::memory_order_acquire) - t;
+    if (len > avail) {
+        len = avail;
+    }
+    uint32_t idx = t & mask;
+    uint32_t toEnd = mask + 1 - idx;
+    if (len <= toEnd) {
+        memcpy(dst, buffer + idx, len);
+    } else {
+        memcpy(dst, buffer + idx, toEnd);
+        memcpy(dst + toEnd, buffer, len - toEnd);
+    }
+    tail.store(t + len, std::memory_order_release);
+    readPos += len;
+    return len;
+}
+
+void AudioFileSourceRing::waitForData() {
+#ifdef ARDUINO
+    delay(1);
+#else
+    usleep(100);
+#endif
+}
+
+uint32_t AudioFileSourceRing::read(void *data, uint32_t len) {
+    if (!buffer) {
+        return 0;
+    }
+    uint8_t *ptr = reinterpret_cast<uint8_t*>(data);
+    uint32_t bytes = 0;
+    bool stalled = false;
+    while (bytes < len && !closeReq) {
+        uint32_t got = copyOut(ptr + bytes, len - bytes);
+        bytes += got;
+        if (got) {
+            continue;
+        }
+        // eof is set after the last head update, so recheck the ring first
+        if (eof.load(std::memory_order_acquire) && getFillLevel() == 0) {
+            break;
+        }
+        if (!stalled) {
+            stalled = true;
+            stalls++;
+            cb.st(STATUS_UNDERFLOW, PSTR("Ring underflow"));
+        }
+        waitForData();
+    }
+    return bytes;
+}
+
+uint32_t AudioFileSourceRing::readNonBlock(void *data, uint32_t len) {
+    if (!buffer) {
+        return 0;
+    }
+    return copyOut(reinterpret_cast<uint8_t*>(data), len);
+}
+
+bool AudioFileSourceRing::seek(int32_t pos, int dir) {
+    if (!buffer || closeReq) {
+        return false;
+    }
+    uint32_t target;
+    if (dir == SEEK_SET) {
+        target = pos;
+    } else if (dir == SEEK_CUR) {
+        target = readPos + pos;
+    } else if (dir == SEEK_END) {
+        target = size + pos;
+    } else {
+        return false;
+    }
+
+    // Forward within what is already buffered: just drop bytes
+    if (target >= readPos && target - readPos <= getFillLevel()) {
+        tail.store(tail.load(std::memory_order_relaxed) + (target - readPos), std::memory_order_release);
+        readPos = target;
+        return true;
+    }
+
+    seekTarget = target;
+    seekState.store(SEEK_REQUESTED, std::memory_order_release);
+    while (seekState.load(std::memory_order_acquire) == SEEK_REQUESTED) {
+        waitForData();
+    }
+    bool ok = seekState.load(std::memory_order_relaxed) == SEEK_DONE;
+    seekState.store(SEEK_IDLE, std::memory_order_relaxed);
+    readPos = target;
+    return ok;
+}
+
+bool AudioFileSourceRing::close() {
+    // The source itself is closed from fill() or by the owner, never here
+    closeReq = true;
+    return true;
+}
+
+bool AudioFileSourceRing::isOpen() {
+    return srcOpen && !closeReq;
+}
+
+uint32_t AudioFileSourceRing::getSize() {
+    return size;
+}
+
+uint32_t AudioFileSourceRing::getPos() {
+    return readPos;
+}
+
+bool AudioFileSourceRing::fill() {
+    if (!buffer || !srcOpen) {
+        return false;
+    }
+    if (closeReq) {
+        src->close();
+        srcOpen = false;
+        return true;
+    }
+
+    if (seekState.load(std::memory_order_acquire) == SEEK_REQUESTED) {
+        // The decoder is parked in seek() until seekState changes, so the
+        // ring can be reset from this side
+        bool ok = src->seek(seekTarget, SEEK_SET);
+        fillPos = seekTarget;
+        tail.store(fillPos & 511, std::memory_order_relaxed);
+        head.store(fillPos & 511, std::memory_order_relaxed);
+        eof.store(false, std::memory_order_relaxed);
+        seekState.store(ok ? SEEK_DONE : SEEK_FAILED, std::memory_order_release);
+        return true;
+    }
+
+    if (eof.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    // Ring index and file position agree mod 512 and the ring size is a
+    // multiple of 512, so stopping each read on a 512-byte file boundary
+    // also keeps every later read sector aligned on the card
+    uint32_t h = head.load(std::memory_order_relaxed);
+    uint32_t space = mask + 1 - (h - tail.load(std::memory_order_acquire));
+    uint32_t idx = h & mask;
+    uint32_t len = chunk - (fillPos & 511);
+    if (len > mask + 1 - idx) {
+        len = mask + 1 - idx;
+    }
+    if (len > space) {
+        uint32_t end = (fillPos + space) & ~511;
+        if (end <= fillPos) {
+            return false;
+        }
+        len = end - fillPos;
+    }
+
+    uint32_t got = src->read(buffer + idx, len);
+    fillPos += got;
+    head.store(h + got, std::memory_order_release);
+    if (got == 0) {
+        eof.store(true, std::memory_order_release);
+    }
+    return got > 0;
+}
+
@@ -0,0 +1,96 @@
+/*
+    AudioFileSourceRing
+    Single-producer/single-consumer ring between a file source and a decoder
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOFILESOURCERING_H
+#define _AUDIOFILESOURCERING_H
+
+#include <atomic>
+#include "AudioFileSource.h"
+
+// The decoder side (read/seek/getPos/close) and the fill() side may run on
+// different tasks or cores without any lock between them.  Only fill() ever
+// calls into the wrapped source, so a reader task can own the storage bus
+// and the decoder never waits on it while the ring holds data.
+//
+// Seeks outside the buffered data and close() are handed to the fill() side
+// as requests; the decoder waits for a seek to be carried out.
+class AudioFileSourceRing : public AudioFileSource {
+public:
+    // bufferBytes is rounded down to a power of two, chunkBytes to a multiple
+    // of 512 so reads from the source stay sector aligned
+    AudioFileSourceRing(AudioFileSource *in, uint32_t bufferBytes, uint32_t chunkBytes = 4096);
+    virtual ~AudioFileSourceRing() override;
+
+    // Decoder side
+    virtual uint32_t read(void *data, uint32_t len) override;
+    virtual uint32_t readNonBlock(void *data, uint32_t len) override;
+    virtual bool seek(int32_t pos, int dir) override;
+    virtual bool close() override;
+    virtual bool isOpen() override;
+    virtual uint32_t getSize() override;
+    virtual uint32_t getPos() override;
+
+    virtual uint32_t getFillLevel();
+    // The source has been read to the end, what is left sits in the ring
+    bool isBuffered() {
+        return eof.load(std::memory_order_acquire);
+    }
+    // Times read() found the ring empty before the end of the file
+    uint32_t getStallCount() {
+        return stalls;
+    }
+
+    // Reader side: service a pending seek/close or read one chunk.  Returns
+    // false when there was nothing to do (ring full, end of file or closed).
+    bool fill();
+
+    enum { STATUS_UNDERFLOW = 3 };
+
+private:
+    enum { SEEK_IDLE, SEEK_REQUESTED, SEEK_DONE, SEEK_FAILED };
+
+    uint32_t copyOut(uint8_t *dst, uint32_t len);
+    void waitForData();
+
+private:
+    AudioFileSource *src;
+    uint8_t *buffer;
+    uint32_t mask;
+    uint32_t chunk;
+    uint32_t size;
+
+    // head is written only by fill(), tail only by the decoder; both count
+    // bytes and wrap freely, so head - tail is the fill level
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<bool> eof;
+    std::atomic<bool> srcOpen;  // cleared by fill() once it has closed src
+    std::atomic<bool> closeReq;
+    std::atomic<int> seekState;
+    uint32_t seekTarget;
+
+    uint32_t readPos;  // decoder position in the file
+    uint32_t fillPos;  // source position in the file
+    uint32_t stalls;
+};
+
+
+#endif
+
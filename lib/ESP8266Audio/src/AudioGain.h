@@ -0,0 +1,261 @@
+/*
+    AudioGain
+    Block gain, saturation and packing kernels shared by the outputs, and
+    the ramp that moves the gain between settings without clicks
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOGAIN_H
+#define _AUDIOGAIN_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// Gains are Q16: 65536 is unity, 4.0 (262144) the most SetGain() allows.
+// Up to unity a sample times the gain fits 32 bits, so the common case is
+// one multiply, one shift and a saturate per sample, with no branches.  On
+// the ESP32 the saturate is the CLAMPS instruction; elsewhere it is written
+// as min/max so the compiler can vectorize the loop.
+class AudioGain {
+public:
+    static constexpr int32_t unity = 1 << 16;
+    static constexpr int32_t maxGain = 4 << 16;
+
+    static int32_t FromFloat(float f) {
+        if (f > 4.0f) {
+            f = 4.0f;
+        } else if (f < 0.0f) {
+            f = 0.0f;
+        }
+        return (int32_t)(f * unity + 0.5f);
+    }
+
+    static inline int32_t Saturate16(int32_t v) {
+#if defined(ESP32) && defined(__XTENSA__)
+        int32_t r;
+        __asm__("clamps %0, %1, 15" : "=a"(r) : "a"(v));
+        return r;
+#else
+        v = (v < -32768) ? -32768 : v;
+        return (v > 32767) ? 32767 : v;
+#endif
+    }
+
+    static inline int16_t Scale(int16_t s, int32_t gainQ16) {
+        if (gainQ16 <= unity) {
+            return Saturate16(((int32_t)s * gainQ16) >> 16);
+        }
+        return Saturate16((int32_t)(((int64_t)s * gainQ16) >> 16));
+    }
+
+    // 32-bit samples, full scale at INT32_MAX, for outputs with wider slots.
+    // Attenuating here rather than before widening keeps the low bits.
+    static inline int32_t Saturate32(int64_t v) {
+        v = (v < INT32_MIN) ? INT32_MIN : v;
+        return (v > INT32_MAX) ? INT32_MAX : (int32_t)v;
+    }
+
+    static inline int32_t Scale32(int32_t s, int32_t gainQ16) {
+        int64_t v = ((int64_t)s * gainQ16) >> 16;
+        return (gainQ16 <= unity) ? (int32_t)v : Saturate32(v);
+    }
+
+    // Scale count interleaved stereo frames in place
+    static void Apply(int16_t *samples, uint32_t count, int32_t gainQ16) {
+        uint32_t n = 2 * count;
+        if (gainQ16 == unity) {
+            return;
+        }
+        if (gainQ16 < unity) {
+            // Can't overflow 16 bits either, the saturate is only for safety
+            for (uint32_t i = 0; i < n; i++) {
+                samples[i] = Saturate16(((int32_t)samples[i] * gainQ16) >> 16);
+            }
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                samples[i] = Saturate16((int32_t)(((int64_t)samples[i] * gainQ16) >> 16));
+            }
+        }
+    }
+
+    static void Apply32(int32_t *samples, uint32_t count, int32_t gainQ16) {
+        uint32_t n = 2 * count;
+        if (gainQ16 == unity) {
+            return;
+        }
+        if (gainQ16 < unity) {
+            for (uint32_t i = 0; i < n; i++) {
+                samples[i] = (int32_t)(((int64_t)samples[i] * gainQ16) >> 16);
+            }
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                samples[i] = Saturate32(((int64_t)samples[i] * gainQ16) >> 16);
+            }
+        }
+    }
+
+    // Scale and pack into 32-bit I2S slots, left in the low half.  offset is
+    // added after the gain (0x8000 turns signed into the internal DAC's
+    // unsigned format).  Works through a small block of 16-bit lanes that is
+    // copied out whole, which on these little-endian targets is the packed
+    // layout and keeps the inner loop as plain as Apply's.
+    static void Pack(const int16_t *samples, uint32_t *dest, uint32_t count, int32_t gainQ16, uint16_t offset = 0) {
+        uint16_t lanes[2 * 64];
+        while (count) {
+            uint32_t n = (count < 64) ? count : 64;
+            if (gainQ16 <= unity) {
+                for (uint32_t i = 0; i < 2 * n; i++) {
+                    lanes[i] = (uint16_t)Saturate16(((int32_t)samples[i] * gainQ16) >> 16) + offset;
+                }
+            } else {
+                for (uint32_t i = 0; i < 2 * n; i++) {
+                    lanes[i] = (uint16_t)Scale(samples[i], gainQ16) + offset;
+                }
+            }
+            memcpy(dest, lanes, 4 * n);
+            samples += 2 * n;
+            dest += n;
+            count -= n;
+        }
+    }
+};
+
+// Moves a gain to a new setting over a number of frames instead of in one
+// step, which clicks ("zipper" noise) at higher volumes.  The ramp is planned
+// per block of blockFrames: a linear one keeps the same step throughout, an
+// exponential one covers a fixed share of the remaining distance each block,
+// fast at first and easing into the target.  Within a block the gain moves
+// by an integer step every frame, so there is no float work per sample.  The
+// gain is held in Q28 so small steps keep their precision.
+class AudioGainRamp {
+public:
+    enum Shape { LINEAR, EXPONENTIAL };
+    enum { blockFrames = 32 };
+
+    AudioGainRamp() {
+        shape = LINEAR;
+        shareQ16 = 0;
+        Set(AudioGain::unity);
+    }
+
+    // Jump straight to gainQ16, ending any ramp
+    void Set(int32_t gainQ16) {
+        gainQ28 = gainQ16 << 12;
+        targetQ28 = gainQ28;
+        stepQ28 = 0;
+        left = 0;
+        blockLeft = 0;
+    }
+
+    // Head for gainQ16 over the next frames, starting from wherever a ramp
+    // in progress had got to
+    void RampTo(int32_t gainQ16, uint32_t frames, Shape shape = LINEAR) {
+        if (frames == 0) {
+            Set(gainQ16);
+            return;
+        }
+        this->shape = shape;
+        targetQ28 = gainQ16 << 12;
+        left = frames;
+        blockLeft = 0;
+        if (shape == LINEAR) {
+            // The only divide, the per-frame work is an add
+            stepQ28 = (targetQ28 - gainQ28) / (int32_t)frames;
+        } else {
+            // Share per block that leaves 0.1% of the distance for the last one
+            float share = 1.0f - powf(0.001f, (float)blockFrames / frames);
+            shareQ16 = (int32_t)(share * AudioGain::unity + 0.5f);
+        }
+    }
+
+    bool IsRamping() const {
+        return left > 0;
+    }
+    int32_t Gain() const { // Q16
+        return gainQ28 >> 12;
+    }
+    int32_t Target() const { // Q16
+        return targetQ28 >> 12;
+    }
+
+    // Scale count interleaved stereo frames in place, advancing the ramp.
+    // Once it has arrived this is just AudioGain::Apply().
+    void Apply(int16_t *samples, uint32_t count) {
+        samples = Ramp(samples, count);
+        AudioGain::Apply(samples, count, gainQ28 >> 12);
+    }
+    void Apply(int32_t *samples, uint32_t count) {
+        samples = Ramp(samples, count);
+        AudioGain::Apply32(samples, count, gainQ28 >> 12);
+    }
+
+private:
+    static inline int16_t Scale(int16_t s, int32_t g) {
+        return AudioGain::Scale(s, g);
+    }
+    static inline int32_t Scale(int32_t s, int32_t g) {
+        return AudioGain::Scale32(s, g);
+    }
+
+    // Step the ramp over as many of the frames as it still covers, returning
+    // the first frame past it with count reduced to what is left
+    template <class T>
+    T *Ramp(T *samples, uint32_t &count) {
+        while (count && left) {
+            if (!blockLeft) {
+                NextBlock();
+            }
+            uint32_t n = (count < blockLeft) ? count : blockLeft;
+            for (uint32_t i = 0; i < n; i++, samples += 2) {
+                int32_t g = gainQ28 >> 12;
+                samples[0] = Scale(samples[0], g);
+                samples[1] = Scale(samples[1], g);
+                gainQ28 += stepQ28;
+            }
+            count -= n;
+            blockLeft -= n;
+            left -= n;
+            if (!left) {
+                gainQ28 = targetQ28;
+                stepQ28 = 0;
+            }
+        }
+        return samples;
+    }
+
+    void NextBlock() {
+        blockLeft = (left < blockFrames) ? left : blockFrames;
+        if (shape == EXPONENTIAL) {
+            int32_t end = targetQ28;
+            if (left > blockLeft) {
+                end = gainQ28 + (int32_t)(((int64_t)(targetQ28 - gainQ28) * shareQ16) >> 16);
+            }
+            stepQ28 = (end - gainQ28) / (int32_t)blockLeft;
+        }
+    }
+
+    Shape shape;
+    int32_t gainQ28;
+    int32_t targetQ28;
+    int32_t stepQ28;
+    int32_t shareQ16;
+    uint32_t left;      // Frames until the target
+    uint32_t blockLeft; // Frames until the next block is planned
+};
+
+#endif
@@ -31,6 +31,10 @@ public:
     AudioGenerator() {
         lastSample[0] = 0;
         lastSample[1] = 0;
+        block = nullptr;
+        block32 = nullptr;
+        blockPtr = 0;
+        blockLen = 0;
     };
     virtual ~AudioGenerator() {};
     virtual bool begin(AudioFileSource *source, AudioOutput *output) {
@@ -48,6 +52,19 @@ public:
         return false;
     };
     virtual void desync() { };
+    // Time based seeking for generators that support it.  Positions are in
+    // milliseconds of output, not counting anything the generator trims.
+    virtual bool seekToMs(uint32_t ms) {
+        (void)ms;
+        return false;
+    };
+    virtual uint32_t getPositionMs() {
+        return 0;
+    };
+    // Length of the whole track on the same scale, 0 if it isn't known
+    virtual uint32_t getDurationMs() {
+        return 0;
+    };
 
 public:
     virtual bool RegisterMetadataCB(AudioStatus::metadataCBFn fn, void *data) {
@@ -57,12 +74,32 @@ public:
         return cb.RegisterStatusCB(fn, data);
     }
 
+protected:
+    // Push whatever is left of the current PCM block to the output in a
+    // single call.  Returns true once the whole block has been taken.
+    bool SendBlock() {
+        if ((blockPtr < blockLen) && block32) {
+            blockPtr += output->ConsumeSamples32(block32 + 2 * blockPtr, blockLen - blockPtr);
+        } else if (blockPtr < blockLen) {
+            blockPtr += output->ConsumeSamples(block + 2 * blockPtr, blockLen - blockPtr);
+        }
+        return blockPtr >= blockLen;
+    }
+
 protected:
     bool running;
     AudioFileSource *file;
     AudioOutput *output;
     int16_t lastSample[2];
 
+    // Interleaved stereo block being handed to the output, storage is owned
+    // by the generator that uses it.  A generator with more than 16 bits to
+    // give sets block32 instead, and clears it again for 16-bit blocks.
+    int16_t *block;
+    int32_t *block32;
+    uint16_t blockPtr;
+    uint16_t blockLen;
+
 protected:
     AudioStatus cb;
 };
@@ -29,6 +29,9 @@ AudioGeneratorFLAC::AudioGeneratorFLAC() {
     buff[1] = NULL;
     buffPtr = 0;
     buffLen = 0;
+    streamRate = 0;
+    totalSamples = 0;
+    buffSample = 0;
     running = false;
 }
 
@@ -58,6 +61,11 @@ bool AudioGeneratorFLAC::begin(AudioFileSource *source, AudioOutput *output) {
     }
 
     (void)FLAC__stream_decoder_set_md5_checking(flac, false);
+    // libflac keeps the SEEKTABLE for seek_absolute() either way, this only
+    // lets metadata_cb() see it
+    (void)FLAC__stream_decoder_set_metadata_respond(flac, FLAC__METADATA_TYPE_SEEKTABLE);
+    // Tags, ReplayGain among them, go to the metadata callback
+    (void)FLAC__stream_decoder_set_metadata_respond(flac, FLAC__METADATA_TYPE_VORBIS_COMMENT);
 
     FLAC__StreamDecoderInitStatus ret = FLAC__stream_decoder_init_stream(flac, _read_cb, _seek_cb, _tell_cb, _length_cb, _eof_cb, _write_cb, _metadata_cb, _error_cb, reinterpret_cast<void*>(this));
     if (ret != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
@@ -68,12 +76,51 @@ bool AudioGeneratorFLAC::begin(AudioFileSource *source, AudioOutput *output) {
 
     output->begin();
     running = true;
-    lastSample[0] = 0;
-    lastSample[1] = 0;
+    blockPtr = 0;
+    blockLen = 0;
     channels = 0;
+    buffPtr = 0;
+    buffLen = 0;
+    buffSample = 0;
     return true;
 }
 
+void AudioGeneratorFLAC::FillBlock() {
+    uint16_t frames = buffLen - buffPtr;
+    if (frames > blockFrames) {
+        frames = blockFrames;
+    }
+    int room = output->AvailableFrames();
+    if ((room > 0) && (frames > room)) {
+        frames = room; // Only convert what the output can take now
+    }
+    // Mono streams have buff[1] aliased to buff[0] by write_cb()
+    const int *left = buff[0] + buffPtr;
+    const int *right = buff[1] + buffPtr;
+    if ((bitsPerSample > 16) && output->WantsSamples32()) {
+        // Left justified, the output sees every bit of the stream
+        int shift = 32 - bitsPerSample;
+        int32_t *p = pcmBlock32;
+        for (uint16_t i = 0; i < frames; i++) {
+            *(p++) = (int32_t)((uint32_t)left[i] << shift);
+            *(p++) = (int32_t)((uint32_t)right[i] << shift);
+        }
+        block32 = pcmBlock32;
+    } else {
+        int shift = (bitsPerSample > 16) ? bitsPerSample - 16 : 0;
+        int16_t *p = pcmBlock;
+        for (uint16_t i = 0; i < frames; i++) {
+            *(p++) = (int16_t)(left[i] >> shift);
+            *(p++) = (int16_t)(right[i] >> shift);
+        }
+        block32 = nullptr;
+    }
+    buffPtr += frames;
+    block = pcmBlock;
+    blockPtr = 0;
+    blockLen = frames;
+}
+
 bool AudioGeneratorFLAC::loop() {
     FLAC__bool ret;
 
@@ -81,8 +128,8 @@ bool AudioGeneratorFLAC::loop() {
         goto done;
     }
 
-    if (channels && !output->ConsumeSample(lastSample)) {
-        goto done;    // Try and send last buffered sample
+    if (!SendBlock()) {
+        goto done;    // Try and send the rest of the last buffered block
     }
 
     do {
@@ -97,18 +144,7 @@ bool AudioGeneratorFLAC::loop() {
                     running = false;
                     goto done;
                 }
-                unsigned newsr = FLAC__stream_decoder_get_sample_rate(flac);
-                unsigned newch = FLAC__stream_decoder_get_channels(flac);
-                unsigned newbps = FLAC__stream_decoder_get_bits_per_sample(flac);
-                if (newsr != sampleRate) {
-                    output->SetRate(sampleRate = newsr);
-                }
-                if (newch != channels) {
-                    output->SetChannels(channels = newch);
-                }
-                if (newbps != bitsPerSample) {
-                    output->SetBitsPerSample(bitsPerSample = newbps);
-                }
+                UpdateFormat();
             }
         }
 
@@ -116,30 +152,8 @@ bool AudioGeneratorFLAC::loop() {
         if (buffPtr == buffLen) {
             goto done; // At some point the flac better error and we'll return
         }
-        if (bitsPerSample <= 16) {
-            lastSample[AudioOutput::LEFTCHANNEL] = buff[0][buffPtr] & 0xffff;
-            if (channels == 2) {
-                lastSample[AudioOutput::RIGHTCHANNEL] = buff[1][buffPtr] & 0xffff;
-            } else {
-                lastSample[AudioOutput::RIGHTCHANNEL] = lastSample[AudioOutput::LEFTCHANNEL];
-            }
-        } else if (bitsPerSample <= 24) {
-            lastSample[AudioOutput::LEFTCHANNEL] = (buff[0][buffPtr] >> 8) & 0xffff;
-            if (channels == 2) {
-                lastSample[AudioOutput::RIGHTCHANNEL] = (buff[1][buffPtr] >> 8) & 0xffff;
-            } else {
-                lastSample[AudioOutput::RIGHTCHANNEL] = lastSample[AudioOutput::LEFTCHANNEL];
-            }
-        } else {
-            lastSample[AudioOutput::LEFTCHANNEL] = (buff[0][buffPtr] >> 16) & 0xffff;
-            if (channels == 2) {
-                lastSample[AudioOutput::RIGHTCHANNEL] = (buff[1][buffPtr] >> 16) & 0xffff;
-            } else {
-                lastSample[AudioOutput::RIGHTCHANNEL] = lastSample[AudioOutput::LEFTCHANNEL];
-            }
-        }
-        buffPtr++;
-    } while (running && output->ConsumeSample(lastSample));
+        FillBlock();
+    } while (running && SendBlock());
 
 done:
     file->loop();
@@ -148,6 +162,74 @@ done:
     return running;
 }
 
+void AudioGeneratorFLAC::UpdateFormat() {
+    unsigned newsr = FLAC__stream_decoder_get_sample_rate(flac);
+    unsigned newch = FLAC__stream_decoder_get_channels(flac);
+    unsigned newbps = FLAC__stream_decoder_get_bits_per_sample(flac);
+    if (newsr != sampleRate) {
+        output->SetRate(sampleRate = newsr);
+    }
+    if (newch != channels) {
+        output->SetChannels(channels = newch);
+    }
+    if (newbps != bitsPerSample) {
+        output->SetBitsPerSample(bitsPerSample = newbps);
+    }
+}
+
+// libflac does the work: it narrows the search with the SEEKTABLE when the
+// file has one, bisects on frame headers from there, then decodes the frame
+// holding the target and hands write_cb() only the samples from it onwards.
+bool AudioGeneratorFLAC::seekToMs(uint32_t ms) {
+    if (!running) {
+        return false;
+    }
+    FLAC__StreamDecoderState state = FLAC__stream_decoder_get_state(flac);
+    if ((state == FLAC__STREAM_DECODER_SEARCH_FOR_METADATA) || (state == FLAC__STREAM_DECODER_READ_METADATA)) {
+        // Read it here rather than inside the seek, where metadata_cb() isn't called
+        if (!FLAC__stream_decoder_process_until_end_of_metadata(flac)) {
+            return false;
+        }
+    }
+    uint32_t rate = sampleRate ? sampleRate : streamRate;
+    if (!rate) {
+        return false;
+    }
+    uint64_t target = (uint64_t)ms * rate / 1000;
+    if (totalSamples && (target >= totalSamples)) {
+        return false;
+    }
+    if (!FLAC__stream_decoder_seek_absolute(flac, target)) {
+        // A failed seek leaves the decoder in SEEK_ERROR, flush to carry on
+        // from wherever the read position ended up
+        if (FLAC__stream_decoder_get_state(flac) == FLAC__STREAM_DECODER_SEEK_ERROR) {
+            FLAC__stream_decoder_flush(flac);
+        }
+        buffPtr = buffLen = 0;
+        blockPtr = blockLen = 0;
+        return false;
+    }
+    // write_cb() has the target frame now, drop what was waiting for the old position
+    blockPtr = 0;
+    blockLen = 0;
+    UpdateFormat();
+    return true;
+}
+
+uint32_t AudioGeneratorFLAC::getPositionMs() {
+    uint32_t rate = sampleRate ? sampleRate : streamRate;
+    if (!rate) {
+        return 0;
+    }
+    // Samples converted into the block but not yet taken by the output don't count
+    uint64_t played = buffSample + buffPtr - (blockLen - blockPtr);
+    return played * 1000 / rate;
+}
+
+uint32_t AudioGeneratorFLAC::getDurationMs() {
+    return streamRate ? totalSamples * 1000 / streamRate : 0;
+}
+
 bool AudioGeneratorFLAC::stop() {
     if (flac) {
         FLAC__stream_decoder_delete(flac);
@@ -205,6 +287,7 @@ FLAC__StreamDecoderWriteStatus AudioGeneratorFLAC::write_cb(const FLAC__StreamDe
     // Hackish warning here.  FLAC sends the buffer but doesn't free it until the next call to decode_frame, so we stash
     // the pointers here and use it in our loop() instead of memcpy()'ing into yet another buffer.
     buffLen = frame->header.blocksize;
+    buffSample = frame->header.number.sample_number;
     buff[0] = (const int *)buffer[0];
     if (frame->header.channels > 1) {
         buff[1] = (const int *)buffer[1];
@@ -216,8 +299,33 @@ FLAC__StreamDecoderWriteStatus AudioGeneratorFLAC::write_cb(const FLAC__StreamDe
 }
 void AudioGeneratorFLAC::metadata_cb(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata) {
     (void) decoder;
-    (void) metadata;
-    audioLogger->printf_P(PSTR("Metadata\n"));
+    if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+        streamRate = metadata->data.stream_info.sample_rate;
+        totalSamples = metadata->data.stream_info.total_samples;
+    } else if (metadata->type == FLAC__METADATA_TYPE_SEEKTABLE) {
+        audioLogger->printf_P(PSTR("FLAC seektable: %u points\n"), (unsigned)metadata->data.seek_table.num_points);
+    } else if (metadata->type == FLAC__METADATA_TYPE_VORBIS_COMMENT) {
+        // Each NAME=value comment is sent with the name as its type
+        const FLAC__StreamMetadata_VorbisComment &vc = metadata->data.vorbis_comment;
+        for (uint32_t i = 0; i < vc.num_comments; i++) {
+            const char *entry = (const char *)vc.comments[i].entry;
+            uint32_t len = vc.comments[i].length;
+            const char *eq = (const char *)memchr(entry, '=', len);
+            if (!eq || (eq == entry)) {
+                continue;
+            }
+            char name[32], value[64];
+            uint32_t nameLen = eq - entry;
+            uint32_t valueLen = len - nameLen - 1;
+            nameLen = (nameLen < sizeof(name) - 1) ? nameLen : sizeof(name) - 1;
+            valueLen = (valueLen < sizeof(value) - 1) ? valueLen : sizeof(value) - 1;
+            memcpy(name, entry, nameLen);
+            name[nameLen] = 0;
+            memcpy(value, eq + 1, valueLen);
+            value[valueLen] = 0;
+            cb.md(name, false, value);
+        }
+    }
 }
 char AudioGeneratorFLAC::error_cb_str[64];
 void AudioGeneratorFLAC::error_cb(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status) {
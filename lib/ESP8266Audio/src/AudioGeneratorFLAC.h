@@ -34,6 +34,9 @@ public:
     virtual bool loop() override;
     virtual bool stop() override;
     virtual bool isRunning() override;
+    virtual bool seekToMs(uint32_t ms) override;
+    virtual uint32_t getPositionMs() override;
+    virtual uint32_t getDurationMs() override;
 
 protected:
     // FLAC info
@@ -41,12 +44,28 @@ protected:
     uint32_t sampleRate;
     uint16_t bitsPerSample;
 
+    // From STREAMINFO, so a seek can be made before the first frame is decoded
+    uint32_t streamRate;
+    uint64_t totalSamples;
+    // Stream sample number of buff[][0]
+    uint64_t buffSample;
+
     // We need to buffer some data in-RAM to avoid doing 1000s of small reads
     const int *buff[2];
     uint16_t buffPtr;
     uint16_t buffLen;
     FLAC__StreamDecoder *flac;
 
+    // Decoded frames are converted and handed out in blocks of this size,
+    // 32-bit ones for outputs that keep more than 16 bits of a deeper stream
+    static constexpr int blockFrames = 128;
+    union {
+        int16_t pcmBlock[blockFrames * 2];
+        int32_t pcmBlock32[blockFrames * 2];
+    };
+    void FillBlock();
+    void UpdateFormat();
+
     // FLAC callbacks, need static functions to bounce into c++ from c
     static FLAC__StreamDecoderReadStatus _read_cb(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data) {
         return static_cast<AudioGeneratorFLAC*>(client_data)->read_cb(decoder, buffer, bytes);
@@ -0,0 +1,326 @@
+/*
+    AudioGeneratorGapless
+    Plays a queue of generators back to back into one output
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AudioGeneratorGapless.h"
+
+AudioGeneratorGapless::Link::Link() {
+    sink = nullptr;
+    live = false;
+    trackGain = AudioGain::unity;
+    hertz = 44100;
+    bps = 16;
+    channels = 2;
+}
+
+void AudioGeneratorGapless::Link::attach(AudioOutput *out, bool isLive) {
+    sink = out;
+    live = isLive;
+    trackGain = AudioGain::unity;
+}
+
+// Hand the output over, with the format the generator set up while queued.
+// begin() is what starts a mixer input, a running output ignores it.
+void AudioGeneratorGapless::Link::goLive() {
+    live = true;
+    sink->SetRate(hertz);
+    sink->SetBitsPerSample(bps);
+    sink->SetChannels(channels);
+    sink->begin();
+}
+
+bool AudioGeneratorGapless::Link::SetRate(int hz) {
+    hertz = hz;
+    return live ? sink->SetRate(hz) : true;
+}
+
+bool AudioGeneratorGapless::Link::SetBitsPerSample(int bits) {
+    bps = bits;
+    return live ? sink->SetBitsPerSample(bits) : true;
+}
+
+bool AudioGeneratorGapless::Link::SetChannels(int chan) {
+    channels = chan;
+    return live ? sink->SetChannels(chan) : true;
+}
+
+bool AudioGeneratorGapless::Link::begin() {
+    return live ? sink->begin() : true;
+}
+
+bool AudioGeneratorGapless::Link::ConsumeSample(int16_t sample[2]) {
+    return ConsumeSamples(sample, 1) == 1;
+}
+
+// The track gain goes on a copy in scratch[]: frames the sink doesn't take
+// come back to the generator and must not be scaled twice
+uint16_t AudioGeneratorGapless::Link::ConsumeSamples(int16_t *samples, uint16_t count) {
+    if (!live) {
+        return 0;
+    }
+    if (trackGain == AudioGain::unity) {
+        return sink->ConsumeSamples(samples, count);
+    }
+    int16_t *scaled = reinterpret_cast<int16_t*>(scratch);
+    uint16_t taken = 0;
+    while (taken < count) {
+        uint16_t n = (count - taken > scratchFrames) ? scratchFrames : count - taken;
+        memcpy(scaled, samples + 2 * taken, 2 * n * sizeof(int16_t));
+        AudioGain::Apply(scaled, n, trackGain);
+        uint16_t sent = sink->ConsumeSamples(scaled, n);
+        taken += sent;
+        if (sent < n) {
+            break;
+        }
+    }
+    return taken;
+}
+
+uint16_t AudioGeneratorGapless::Link::ConsumeSamples32(int32_t *samples, uint16_t count) {
+    if (!live) {
+        return 0;
+    }
+    if (trackGain == AudioGain::unity) {
+        return sink->ConsumeSamples32(samples, count);
+    }
+    int32_t *scaled = scratch;
+    uint16_t taken = 0;
+    while (taken < count) {
+        uint16_t n = (count - taken > scratchFrames) ? scratchFrames : count - taken;
+        memcpy(scaled, samples + 2 * taken, 2 * n * sizeof(int32_t));
+        AudioGain::Apply32(scaled, n, trackGain);
+        uint16_t sent = sink->ConsumeSamples32(scaled, n);
+        taken += sent;
+        if (sent < n) {
+            break;
+        }
+    }
+    return taken;
+}
+
+// Asked while queued too, so the first blocks are already in the right format
+bool AudioGeneratorGapless::Link::WantsSamples32() {
+    return sink && sink->WantsSamples32();
+}
+
+int AudioGeneratorGapless::Link::AvailableFrames() {
+    return live ? sink->AvailableFrames() : 0;
+}
+
+bool AudioGeneratorGapless::Link::stop() {
+    // The output keeps running across tracks, only the player stops it
+    live = false;
+    return true;
+}
+
+bool AudioGeneratorGapless::Link::loop() {
+    return live ? sink->loop() : true;
+}
+
+AudioGeneratorGapless::AudioGeneratorGapless(AudioOutput *output) {
+    this->output = output;
+    gen[0] = nullptr;
+    gen[1] = nullptr;
+    live = 0;
+    mixer = nullptr;
+    stub[0] = nullptr;
+    stub[1] = nullptr;
+    mixed = false;
+    fading = false;
+    crossfadeMs = 0;
+}
+
+AudioGeneratorGapless::~AudioGeneratorGapless() {
+    drop(0);
+    drop(1);
+    delete stub[0];
+    delete stub[1];
+    delete mixer;
+}
+
+void AudioGeneratorGapless::setCrossfade(uint32_t ms) {
+    crossfadeMs = (ms > maxCrossfadeMs) ? maxCrossfadeMs : ms;
+    if (crossfadeMs && !mixer) {
+        mixer = new AudioOutputMixer(mixFrames, output);
+        stub[0] = mixer->NewInput();
+        stub[1] = mixer->NewInput();
+    }
+}
+
+AudioOutput *AudioGeneratorGapless::sinkFor(int slot) {
+    if (!mixed) {
+        return output;
+    }
+    stub[slot]->SetGain(1.0);
+    return stub[slot];
+}
+
+void AudioGeneratorGapless::drop(int slot) {
+    if (gen[slot]) {
+        gen[slot]->stop();
+        gen[slot] = nullptr;
+    }
+    if (mixed) {
+        stub[slot]->stop(); // Links don't pass stop() on, but the mixer mustn't wait for it
+    }
+}
+
+bool AudioGeneratorGapless::play(AudioGenerator *g, AudioFileSource *source) {
+    drop(0);
+    drop(1);
+    fading = false;
+    mixed = (mixer != nullptr);
+    live = 0;
+    link[live].attach(sinkFor(live), true);
+    if (!g->begin(source, &link[live])) {
+        g->stop();
+        return false;
+    }
+    gen[live] = g;
+    return true;
+}
+
+bool AudioGeneratorGapless::queue(AudioGenerator *g, AudioFileSource *source) {
+    int slot = live ^ 1;
+    drop(slot);
+    link[slot].attach(sinkFor(slot), false);
+    if (!g->begin(source, &link[slot])) {
+        g->stop();
+        return false;
+    }
+    gen[slot] = g;
+    // Parse headers and decode up to the first block now, while the current
+    // track still has time left; the link refuses the samples until it's live
+    g->loop();
+    return true;
+}
+
+bool AudioGeneratorGapless::setTrackGain(AudioGenerator *g, int32_t gainQ16) {
+    for (int slot = 0; slot < 2; slot++) {
+        if (g && (gen[slot] == g)) {
+            link[slot].setTrackGain(gainQ16);
+            return true;
+        }
+    }
+    return false;
+}
+
+void AudioGeneratorGapless::dequeue() {
+    drop(live ^ 1);
+    if (fading) {
+        fading = false;
+        stub[live]->SetGain(1.0);
+    }
+}
+
+bool AudioGeneratorGapless::advance() {
+    if (!gen[live ^ 1]) {
+        return false;
+    }
+    if (fading) {
+        // Already live, skip the rest of the fade
+        endFade();
+        stub[live]->SetGain(1.0);
+        return true;
+    }
+    drop(live);
+    live ^= 1;
+    link[live].goLive();
+    return true;
+}
+
+// Start the crossfade if the current track is close enough to its end.  The
+// ramps cover what is left of it, so the two finish together.
+bool AudioGeneratorGapless::startFade() {
+    int next = live ^ 1;
+    uint32_t duration = gen[live]->getDurationMs();
+    uint32_t pos = gen[live]->getPositionMs();
+    if (!duration || (pos + crossfadeMs < duration)) {
+        return false;
+    }
+    uint32_t ms = (duration > pos) ? duration - pos : 0;
+    uint32_t nextDuration = gen[next]->getDurationMs();
+    if ((link[next].rate() != link[live].rate()) || (nextDuration && (nextDuration <= 2 * ms))) {
+        return false;
+    }
+    uint32_t frames = (uint64_t)ms * link[live].rate() / 1000;
+    if (!frames) {
+        return false;
+    }
+    stub[live]->RampGain(0.0, frames);
+    stub[next]->SetGain(0.0);
+    stub[next]->RampGain(1.0, frames);
+    link[next].goLive();
+    fading = true;
+    return true;
+}
+
+void AudioGeneratorGapless::endFade() {
+    fading = false;
+    drop(live);
+    live ^= 1;
+}
+
+bool AudioGeneratorGapless::loop() {
+    if (!gen[live]) {
+        // The mixer still holds the end of the last track
+        return mixed && mixer->loop() && !mixer->IsEmpty();
+    }
+    if (mixed && crossfadeMs && !fading && gen[live ^ 1] && gen[live]->isRunning()) {
+        startFade();
+    }
+    if (fading) {
+        // Outgoing first, it's the earlier audio.  It's done when it runs
+        // out or its ramp reaches silence, whichever comes first.
+        bool outgoing = gen[live]->isRunning() && gen[live]->loop() && stub[live]->IsRamping();
+        bool incoming = gen[live ^ 1]->isRunning() && gen[live ^ 1]->loop();
+        if (!outgoing) {
+            endFade();
+            return incoming || !mixer->IsEmpty();
+        }
+        if (!incoming) {
+            // Shorter than the fade after all, let the current track play out
+            dequeue();
+        }
+        return true;
+    }
+    if (gen[live]->isRunning() && gen[live]->loop()) {
+        return true;
+    }
+    // Out of data.  Carry on with the queued generator in this same call so
+    // the output sees its first block right after the last one.
+    if (!advance()) {
+        drop(live);
+        return mixed && !mixer->IsEmpty();
+    }
+    return (gen[live]->isRunning() && gen[live]->loop()) || (mixed && !mixer->IsEmpty());
+}
+
+bool AudioGeneratorGapless::isRunning() {
+    return gen[live] && gen[live]->isRunning();
+}
+
+bool AudioGeneratorGapless::stop() {
+    drop(0);
+    drop(1);
+    fading = false;
+    // The output is shared with whatever plays next, stopping it would take
+    // the I2S driver down on every skip.  Whoever ends playback stops it.
+    return true;
+}
@@ -0,0 +1,134 @@
+/*
+    AudioGeneratorGapless
+    Plays a queue of generators back to back into one output
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOGENERATORGAPLESS_H
+#define _AUDIOGENERATORGAPLESS_H
+
+#include "AudioGenerator.h"
+#include "AudioOutputMixer.h"
+
+// Each generator talks to the output through its own link.  Only the live
+// link passes samples on; the queued generator is begun and has its first
+// block decoded ahead of time, then its link goes live in the same loop()
+// call that sees the current generator run dry.  The output is never stopped
+// between tracks, so no DMA underrun or restart falls into the gap.
+//
+// With a crossfade set, the links feed two inputs of a mixer instead.  Once
+// the current generator is within the crossfade of its end, the queued one
+// goes live as well and the two are ramped out and in together.  current()
+// stays on the outgoing generator until it has faded out.  Tracks of unknown
+// length, or at a different rate, still join gaplessly.
+//
+// Generators and sources stay owned by the caller.  A finished generator is
+// stopped here; once current() has moved on it may be deleted.
+class AudioGeneratorGapless {
+public:
+    AudioGeneratorGapless(AudioOutput *output);
+    ~AudioGeneratorGapless();
+
+    // Start gen on source at once, dropping whatever was playing or queued
+    bool play(AudioGenerator *gen, AudioFileSource *source);
+    // Begin gen on source to follow the current generator without a gap
+    bool queue(AudioGenerator *gen, AudioFileSource *source);
+    // Stop and forget the queued generator
+    void dequeue();
+    // Switch to the queued generator now.  Returns false if there is none.
+    bool advance();
+
+    // Returns false once the current generator has finished with nothing
+    // queued behind it (and, with a crossfade, the mixer has drained)
+    bool loop();
+    bool isRunning();
+    // Stop and forget both generators.  The output keeps running.
+    bool stop();
+
+    // Scale g's samples by gainQ16 (AudioGain::unity is 1.0) from its next
+    // block on, for per-track loudness.  Set before it starts, it covers the
+    // whole track.  Returns false if g is neither playing nor queued.
+    bool setTrackGain(AudioGenerator *g, int32_t gainQ16);
+
+    // Overlap consecutive tracks by ms (0 = gapless, at most maxCrossfadeMs).
+    // The mixer is set up on the first non-zero call and used from the next
+    // play() on, so call this before playing.
+    void setCrossfade(uint32_t ms);
+    static constexpr uint32_t maxCrossfadeMs = 10000;
+
+    AudioGenerator *current() {
+        return gen[live];
+    }
+    AudioGenerator *queued() {
+        return gen[live ^ 1];
+    }
+
+private:
+    class Link : public AudioOutput {
+    public:
+        Link();
+        void attach(AudioOutput *out, bool live);
+        void goLive();
+        void setTrackGain(int32_t gainQ16) {
+            trackGain = gainQ16;
+        }
+
+        virtual bool SetRate(int hz) override;
+        virtual bool SetBitsPerSample(int bits) override;
+        virtual bool SetChannels(int chan) override;
+        virtual bool begin() override;
+        virtual bool ConsumeSample(int16_t sample[2]) override;
+        virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+        virtual uint16_t ConsumeSamples32(int32_t *samples, uint16_t count) override;
+        virtual bool WantsSamples32() override;
+        virtual int AvailableFrames() override;
+        virtual bool stop() override;
+        virtual bool loop() override;
+
+        int rate() {
+            return hertz;
+        }
+
+    private:
+        static constexpr uint16_t scratchFrames = 32;
+
+        AudioOutput *sink;
+        bool live;
+        int32_t trackGain; // Q16
+        int32_t scratch[2 * scratchFrames]; // Gain copy, kept off the stack
+    };
+
+    void drop(int slot);
+    AudioOutput *sinkFor(int slot);
+    bool startFade();
+    void endFade();
+
+private:
+    static constexpr int mixFrames = 1024;
+    AudioOutput *output;
+    Link link[2];
+    AudioGenerator *gen[2];
+    int live;
+    AudioOutputMixer *mixer;
+    AudioOutputMixerStub *stub[2];
+    bool mixed;        // The playing generators go through the mixer
+    bool fading;       // Both are live, gen[live] on its way out
+    uint32_t crossfadeMs;
+};
+
+#endif
+
@@ -68,6 +68,7 @@ AudioGeneratorMP3::~AudioGeneratorMP3() {
         free(frame);
         free(stream);
     }
+    free(pcmFrame);
 }
 
 
@@ -90,6 +91,8 @@ bool AudioGeneratorMP3::stop() {
     synth = NULL;
     frame = NULL;
     stream = NULL;
+    free(pcmFrame);
+    pcmFrame = nullptr;
 
     running = false;
     output->stop();
@@ -139,7 +142,14 @@ enum mad_flow AudioGeneratorMP3::Input() {
     lastReadPos = file->getPos() - unused;
     int len = buffLen - unused;
     len = file->read(buff + unused, len);
-    if ((len == 0)  && (unused == 0)) {
+    if ((len == 0) && (unused > 0) && !eofGuard && file->getSize() && (file->getPos() >= file->getSize()) &&
+            (unused + MAD_BUFFER_GUARD <= buffLen)) {
+        // libmad only decodes a frame once it can see past its end, so pad
+        // the end of the file with a guard of zeros to get the last one out
+        memset(buff + unused, 0, MAD_BUFFER_GUARD);
+        len = MAD_BUFFER_GUARD;
+        eofGuard = true;
+    } else if ((len == 0) && (unused == 0)) {
         // Can't read any from the file, and we don't have anything left.  It's done....
         return MAD_FLOW_STOP;
     }
@@ -173,7 +183,23 @@ bool AudioGeneratorMP3::DecodeNextFrame() {
     return true;
 }
 
-bool AudioGeneratorMP3::GetOneSample(int16_t sample[2]) {
+bool AudioGeneratorMP3::SynthBlock() {
+    enum mad_flow flow;
+    if (pcmFrame) {
+        flow = mad_synth_frame_pcm(synth, frame, pcmFrame);
+        nsCount = nsCountMax;
+    } else {
+        flow = mad_synth_frame_onens(synth, frame, nsCount++);
+    }
+    switch (flow) {
+    case MAD_FLOW_STOP:
+    case MAD_FLOW_BREAK: audioLogger->printf_P(PSTR("msf1ns failed\n"));
+        return false; // Either way we're done
+    default:
+        break; // Do nothing
+    }
+    // for IGNORE and CONTINUE, just play what we have now
+
     if (synth->pcm.samplerate != lastRate) {
         output->SetRate(synth->pcm.samplerate);
         lastRate = synth->pcm.samplerate;
@@ -183,77 +209,442 @@ bool AudioGeneratorMP3::GetOneSample(int16_t sample[2]) {
         lastChannels = synth->pcm.channels;
     }
 
-    // If we're here, we have one decoded frame and sent 0 or more samples out
-    if (samplePtr < synth->pcm.length) {
-        sample[AudioOutput::LEFTCHANNEL ] = synth->pcm.samples[0][samplePtr];
-        sample[AudioOutput::RIGHTCHANNEL] = synth->pcm.samples[1][samplePtr];
-        samplePtr++;
+    if (pcmFrame) {
+        block = pcmFrame; // Already interleaved
+    } else {
+        const int16_t *left = synth->pcm.samples[0];
+        const int16_t *right = (lastChannels == 1) ? synth->pcm.samples[0] : synth->pcm.samples[1];
+        int16_t *p = pcmBlock;
+        for (int i = 0; i < synth->pcm.length; i++) {
+            *(p++) = left[i];
+            *(p++) = right[i];
+        }
+        block = pcmBlock;
+    }
+    blockPtr = 0;
+    blockLen = synth->pcm.length;
+
+    // Drop encoder/decoder delay at the start and padding at the end
+    uint32_t first = samplesDecoded;
+    samplesDecoded += blockLen;
+    if (first < outputFrom) {
+        blockPtr = (outputFrom - first < blockLen) ? outputFrom - first : blockLen;
+    }
+    if (trimEnd && samplesDecoded > trimEnd) {
+        uint32_t over = samplesDecoded - trimEnd;
+        blockLen = (over < (uint32_t)(blockLen - blockPtr)) ? blockLen - over : blockPtr;
+    }
+    return true;
+}
+
+static uint32_t readBE32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t readBE(const unsigned char *p, int bytes) {
+    uint32_t v = 0;
+    while (bytes--) {
+        v = (v << 8) | *(p++);
+    }
+    return v;
+}
+
+// Length in bytes of the MPEG audio frame starting with header h, or 0 if h
+// is not a usable header (no sync, reserved fields or free format)
+static uint32_t frameBytes(const unsigned char *h) {
+    static const uint16_t kbps[2][3][16] PROGMEM = {
+        {   // MPEG-1 layer I, II, III
+            { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+            { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+            { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 }
+        },
+        {   // MPEG-2 and 2.5
+            { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+            { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+            { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 }
+        }
+    };
+    static const uint16_t rates[3] = { 44100, 48000, 32000 };
+
+    int version = (h[1] >> 3) & 3; // 3 = MPEG-1, 2 = MPEG-2, 0 = MPEG-2.5
+    int layer = 4 - ((h[1] >> 1) & 3);
+    int rateIdx = (h[2] >> 2) & 3;
+    if (h[0] != 0xff || (h[1] & 0xe0) != 0xe0 || version == 1 || layer == 4 || rateIdx == 3) {
+        return 0;
+    }
+    int lsf = (version == 3) ? 0 : 1;
+    uint32_t rate = rates[rateIdx] >> (version == 3 ? 0 : (version == 2 ? 1 : 2));
+    uint32_t bitrate = pgm_read_word(&kbps[lsf][layer - 1][h[2] >> 4]) * 1000;
+    uint32_t pad = (h[2] >> 1) & 1;
+    if (!bitrate) {
+        return 0;
+    }
+    if (layer == 1) {
+        return (12 * bitrate / rate + pad) * 4;
+    }
+    return ((layer == 3 && lsf) ? 72 : 144) * bitrate / rate + pad;
+}
+
+// File offset of the frame libmad just decoded
+uint32_t AudioGeneratorMP3::FramePos() {
+    return lastReadPos + (stream->this_frame - buff);
+}
+
+// Look for a Xing/Info or VBRI tag in the frame just decoded.  Returns true
+// if it is a tag frame, which carries no audio of its own.  A seek table is
+// kept for seekToMs().  With a LAME (or libavcodec) extension the encoder
+// delay and padding set up trimming.
+bool AudioGeneratorMP3::ParseXingHeader() {
+    const unsigned char *p = stream->this_frame;
+    int len = stream->next_frame - stream->this_frame;
+    bool lsf = frame->header.flags & MAD_FLAG_LSF_EXT;
+    bool mono = frame->header.mode == MAD_MODE_SINGLE_CHANNEL;
+    int off = 4 + ((frame->header.flags & MAD_FLAG_PROTECTION) ? 2 : 0) + (lsf ? (mono ? 9 : 17) : (mono ? 17 : 32));
+    if (len >= 36 + 26 && !memcmp(p + 36, "VBRI", 4)) {
+        // Fraunhofer VBRI: a table of byte counts per framesPerEntry frames
+        // at a fixed offset.  Turn it into a Xing style TOC.
+        const unsigned char *v = p + 36;
+        uint32_t bytes = readBE32(v + 10);
+        uint32_t frames = readBE32(v + 14);
+        int entries = readBE(v + 18, 2);
+        uint32_t scale = readBE(v + 20, 2);
+        int entrySize = readBE(v + 22, 2);
+        uint32_t perEntry = readBE(v + 24, 2);
+        if (bytes && frames && perEntry && entrySize >= 1 && entrySize <= 4 && 36 + 26 + entries * entrySize <= len) {
+            uint64_t pos = 0;
+            int e = 0;
+            for (int i = 0; i < 100; i++) {
+                uint32_t f = (uint64_t)frames * i / 100;
+                while (e < entries && (e + 1) * perEntry <= f) {
+                    pos += readBE(v + 26 + e * entrySize, entrySize) * scale;
+                    e++;
+                }
+                uint64_t t = pos * 256 / bytes;
+                toc[i] = (t > 255) ? 255 : t;
+            }
+            tocFrames = frames;
+            tocBytes = bytes;
+            tocBase = FramePos() + len; // VBRI counts from the first audio frame
+        }
+        return true;
+    }
+    if (off + 8 > len || (memcmp(p + off, "Xing", 4) && memcmp(p + off, "Info", 4))) {
+        return false;
+    }
+
+    uint32_t flags = readBE32(p + off + 4);
+    uint32_t frames = 0;
+    uint32_t bytes = file->getSize() - FramePos();
+    off += 8;
+    if ((flags & 1) && off + 4 <= len) {
+        frames = readBE32(p + off);
+        off += 4;
+    }
+    if ((flags & 2) && off + 4 <= len) {
+        bytes = readBE32(p + off);
+        off += 4;
+    }
+    if ((flags & 4) && off + 100 <= len) {
+        memcpy(toc, p + off, 100);
+        tocFrames = frames;
+        tocBytes = bytes;
+        tocBase = FramePos(); // Xing counts from its own frame
+        off += 100;
+    }
+    off += (flags & 8) ? 4 : 0;
+
+    // LAME extension: 9 byte version string, then two 12 bit fields with
+    // encoder delay and padding 21 bytes in
+    if (frames && off + 24 <= len &&
+            (!memcmp(p + off, "LAME", 4) || !memcmp(p + off, "Lavf", 4) || !memcmp(p + off, "Lavc", 4))) {
+        uint32_t delay = (p[off + 21] << 4) | (p[off + 22] >> 4);
+        uint32_t padding = ((p[off + 22] & 0x0f) << 8) | p[off + 23];
+        uint32_t total = frames * MAD_NSBSAMPLES(&frame->header) * 32;
+        if (delay + padding < total) {
+            trimStart = delay + decoderDelay;
+            trimEnd = trimStart + total - delay - padding;
+            outputFrom = trimStart;
+        }
+    }
+    return true;
+}
+
+
+// Decode the next audio frame, skipping tag frames and keeping the frame
+// count and index up to date.  Returns false at the end of the file or
+// when the stream can't be recovered.
+bool AudioGeneratorMP3::ReadFrame() {
+retry:
+    if (Input() == MAD_FLOW_STOP) {
+        return false;
+    }
+
+    if (!DecodeNextFrame()) {
+        if (stream->error == MAD_ERROR_BUFLEN) {
+            // randomly seeking can lead to endless
+            // and unrecoverable "MAD_ERROR_BUFLEN" loop
+            audioLogger->printf_P(PSTR("MP3:ERROR_BUFLEN %d\n"), unrecoverable);
+            if (++unrecoverable >= 3) {
+                unrecoverable = 0;
+                stop();
+                return false;
+            }
+        } else {
+            unrecoverable = 0;
+            if (sampleRate && (stream->error & 0xff00) == 0x0200) {
+                // Bad frame data after a good header, e.g. the bit reservoir
+                // right after a seek.  It still takes up its share of time.
+                AddIndex(framesDecoded++, FramePos());
+                samplesDecoded += frameSamples;
+            }
+        }
+        goto retry;
+    }
+    if (!headerChecked) {
+        headerChecked = true;
+        if (ParseXingHeader()) {
+            goto retry; // The tag frame is metadata only, don't play it
+        }
+    }
+    if (!sampleRate) {
+        dataStart = FramePos();
+        sampleRate = frame->header.samplerate;
+        bitRate = frame->header.bitrate;
+        frameSamples = 32 * MAD_NSBSAMPLES(&frame->header);
+    }
+    AddIndex(framesDecoded++, FramePos());
+    return true;
+}
+
+// Remember where frame n starts, if it falls on the index stride and the
+// entries before it are all there
+void AudioGeneratorMP3::AddIndex(uint32_t n, uint32_t pos) {
+    if (!framesExact || n != indexCount * indexStride) {
+        return;
+    }
+    if (indexCount == indexSize) {
+        for (int i = 0; i < indexSize / 2; i++) {
+            frameIndex[i] = frameIndex[2 * i];
+        }
+        indexCount = indexSize / 2;
+        indexStride *= 2;
+        if (n != indexCount * indexStride) {
+            return;
+        }
+    }
+    frameIndex[indexCount++] = pos;
+}
+
+// Find where a frame at or close before n starts.  From the nearest index
+// entry the frame headers are walked, which is exact; when that would be
+// too far a read, the position is estimated and n updated to match.
+bool AudioGeneratorMP3::LocateFrame(uint32_t &n, uint32_t &pos, bool &exact) {
+    if (!indexCount) {
+        return false;
+    }
+    uint32_t i = n / indexStride;
+    if (i >= (uint32_t)indexCount) {
+        i = indexCount - 1;
+    }
+    uint32_t f = i * indexStride;
+    pos = frameIndex[i];
+    exact = true;
+
+    if (n - f > maxScanFrames) {
+        uint32_t guess = n;
+        uint32_t guessPos;
+        if (EstimateFrame(guess, guessPos)) {
+            n = guess;
+            pos = guessPos;
+            exact = false;
+            return true;
+        }
+    }
+
+    unsigned char h[4];
+    while (f < n) {
+        uint32_t len;
+        if (!file->seek(pos, SEEK_SET) || file->read(h, 4) != 4 || !(len = frameBytes(h))) {
+            break;
+        }
+        pos += len;
+        f++;
+        AddIndex(f, pos);
+    }
+    n = f;
+    return true;
+}
+
+// Estimate where frame n starts from the seek table, or failing that from
+// the bit rate, then find the real frame start nearby
+bool AudioGeneratorMP3::EstimateFrame(uint32_t &n, uint32_t &pos) {
+    uint32_t guess;
+    if (tocFrames && tocBytes) {
+        uint32_t pct = (uint64_t)n * 10000 / tocFrames; // In 1/100 percent
+        uint32_t i = pct / 100;
+        if (i > 99) {
+            i = 99;
+            pct = 9999;
+        }
+        uint32_t a = toc[i];
+        uint32_t b = (i < 99) ? toc[i + 1] : 256;
+        uint32_t scaled = a * 100 + (b - a) * (pct - i * 100); // In 1/25600 of tocBytes
+        guess = tocBase + (uint64_t)scaled * tocBytes / 25600;
+    } else if (bitRate) {
+        guess = dataStart + (uint64_t)n * frameSamples * bitRate / (8 * sampleRate);
+        // Frames vary by a padding byte, start a little early
+        guess = (guess > dataStart + 2) ? guess - 2 : dataStart;
     } else {
-        samplePtr = 0;
-
-        switch (mad_synth_frame_onens(synth, frame, nsCount++)) {
-        case MAD_FLOW_STOP:
-        case MAD_FLOW_BREAK: audioLogger->printf_P(PSTR("msf1ns failed\n"));
-            return false; // Either way we're done
-        default:
-            break; // Do nothing
+        return false;
+    }
+    if (!SyncFrom(guess)) {
+        return false;
+    }
+    pos = guess;
+    if (!tocFrames && bitRate) {
+        n = ((uint64_t)(pos - dataStart) * 8 * sampleRate + frameSamples * bitRate / 2) / ((uint64_t)frameSamples * bitRate);
+    }
+    return true;
+}
+
+// Move pos forward to the next frame header that is followed by another
+// matching one.  Uses buff, which a seek throws away anyway.
+bool AudioGeneratorMP3::SyncFrom(uint32_t &pos) {
+    for (int tries = 0; tries < 4; tries++) {
+        if (!file->seek(pos, SEEK_SET)) {
+            return false;
+        }
+        uint32_t n = file->read(buff, buffLen);
+        if (n < 4) {
+            return false;
         }
-        // for IGNORE and CONTINUE, just play what we have now
-        sample[AudioOutput::LEFTCHANNEL ] = synth->pcm.samples[0][samplePtr];
-        sample[AudioOutput::RIGHTCHANNEL] = synth->pcm.samples[1][samplePtr];
-        samplePtr++;
+        for (uint32_t i = 0; i + 4 <= n; i++) {
+            uint32_t len = frameBytes(buff + i);
+            if (!len) {
+                continue;
+            }
+            unsigned char next[4];
+            const unsigned char *h2 = buff + i + len;
+            if (i + len + 4 > n) {
+                if (!file->seek(pos + i + len, SEEK_SET) || file->read(next, 4) != 4) {
+                    continue;
+                }
+                h2 = next;
+            }
+            if (frameBytes(h2) && h2[1] == buff[i + 1] && !((h2[2] ^ buff[i + 2]) & 0x0c)) {
+                pos += i;
+                return true;
+            }
+        }
+        pos += n - 3;
+    }
+    return false;
+}
+
+bool AudioGeneratorMP3::seekToMs(uint32_t ms) {
+    // Rate, frame size and the first frame's position come from the first frame
+    if (!running || (!sampleRate && !ReadFrame())) {
+        return false;
+    }
+
+    uint32_t target = trimStart + (uint64_t)ms * sampleRate / 1000;
+    if (trimEnd && target > trimEnd) {
+        target = trimEnd;
     }
+    // Start a few frames early, their output is dropped
+    uint32_t n = target / frameSamples;
+    n = (n > seekPreroll) ? n - seekPreroll : 0;
+    uint32_t lead = target - n * frameSamples;
+    uint32_t pos;
+    bool exact;
+    if (!LocateFrame(n, pos, exact) || !file->seek(pos, SEEK_SET)) {
+        return false;
+    }
+
+    // Restart libmad on the frame boundary, with no stale reservoir or overlap
+    stream->next_frame = NULL;
+    stream->this_frame = NULL;
+    stream->sync = 0;
+    stream->md_len = 0;
+    mad_frame_mute(frame);
+    mad_synth_mute(synth);
+    lastBuffLen = 0;
+    eofGuard = false;
+    unrecoverable = 0;
+    nsCount = 9999;
+    blockPtr = 0;
+    blockLen = 0;
+
+    framesDecoded = n;
+    framesExact = exact;
+    samplesDecoded = n * frameSamples;
+    outputFrom = samplesDecoded + lead;
     return true;
 }
 
+uint32_t AudioGeneratorMP3::getPositionMs() {
+    if (!sampleRate) {
+        return 0;
+    }
+    // Samples handed to the output so far, the held back rest of the block excluded
+    uint32_t sent = samplesDecoded - (blockLen - blockPtr);
+    if (trimEnd && sent > trimEnd) {
+        sent = trimEnd;
+    }
+    if (sent <= trimStart) {
+        return 0;
+    }
+    return (uint64_t)(sent - trimStart) * 1000 / sampleRate;
+}
+
+uint32_t AudioGeneratorMP3::getDurationMs() {
+    if (!sampleRate) {
+        return 0;
+    }
+    uint64_t samples;
+    if (trimEnd) {
+        samples = trimEnd - trimStart;
+    } else if (tocFrames) {
+        samples = (uint64_t)tocFrames * frameSamples;
+    } else if (bitRate && file->getSize() > dataStart) {
+        samples = (uint64_t)(file->getSize() - dataStart) * 8 * sampleRate / bitRate;
+    } else {
+        return 0;
+    }
+    return samples * 1000 / sampleRate;
+}
 
 bool AudioGeneratorMP3::loop() {
     if (!running) {
         goto done;    // Nothing to do here!
     }
 
-    // First, try and push in the stored sample.  If we can't, then punt and try later
-    if (!output->ConsumeSample(lastSample)) {
+    // First, try and push out the rest of the stored block.  If we can't, then punt and try later
+    if (!SendBlock()) {
         goto done;    // Can't send, but no error detected
     }
 
-    // Try and stuff the buffer one sample at a time
+    // Try and stuff the buffer one subband slot at a time
     do {
+        // Everything up to the encoder padding has been sent, we're done
+        if (trimEnd && samplesDecoded >= trimEnd) {
+            return false;
+        }
+
         // Decode next frame if we're beyond the existing generated data
-        if ((samplePtr >= synth->pcm.length) && (nsCount >= nsCountMax)) {
-retry:
-            if (Input() == MAD_FLOW_STOP) {
+        if (nsCount >= nsCountMax) {
+            if (!ReadFrame()) {
                 return false;
             }
-
-            if (!DecodeNextFrame()) {
-                if (stream->error == MAD_ERROR_BUFLEN) {
-                    // randomly seeking can lead to endless
-                    // and unrecoverable "MAD_ERROR_BUFLEN" loop
-                    audioLogger->printf_P(PSTR("MP3:ERROR_BUFLEN %d\n"), unrecoverable);
-                    if (++unrecoverable >= 3) {
-                        unrecoverable = 0;
-                        stop();
-                        return running;
-                    }
-                } else {
-                    unrecoverable = 0;
-                }
-                goto retry;
-            }
-            samplePtr = 9999;
             nsCount = 0;
         }
 
-        if (!GetOneSample(lastSample)) {
-            audioLogger->printf_P(PSTR("G1S failed\n"));
+        if (!SynthBlock()) {
+            audioLogger->printf_P(PSTR("MP3:synth failed\n"));
             running = false;
             goto done;
         }
-        if (lastChannels == 1) {
-            lastSample[1] = lastSample[0];
-        }
-    } while (running && output->ConsumeSample(lastSample));
+    } while (running && SendBlock());
 
 done:
     file->loop();
@@ -288,13 +679,31 @@ bool AudioGeneratorMP3::begin(AudioFileSource *source, AudioOutput *output) {
         return false;
     }
 
-    // Where we are in generating one frame's data, set to invalid so we will run loop on first getsample()
-    samplePtr = 9999;
+    // Where we are in generating one frame's data, set to invalid so we will run loop on first SynthBlock()
     nsCount = 9999;
+    blockPtr = 0;
+    blockLen = 0;
     lastRate = 0;
     lastChannels = 0;
     lastReadPos = 0;
     lastBuffLen = 0;
+    eofGuard = false;
+    headerChecked = false;
+    samplesDecoded = 0;
+    trimStart = 0;
+    trimEnd = 0;
+    outputFrom = 0;
+    indexCount = 0;
+    indexStride = 1;
+    framesDecoded = 0;
+    framesExact = true;
+    dataStart = 0;
+    sampleRate = 0;
+    bitRate = 0;
+    frameSamples = 1152;
+    tocFrames = 0;
+    tocBytes = 0;
+    tocBase = 0;
 
     // Allocate all large memory chunks
     if (preallocateStreamSize + preallocateFrameSize + preallocateSynthSize) {
@@ -350,6 +759,15 @@ bool AudioGeneratorMP3::begin(AudioFileSource *source, AudioOutput *output) {
         }
     }
 
+    free(pcmFrame);
+    pcmFrame = nullptr;
+    if (frameSynth && !preallocateSpace) {
+        pcmFrame = reinterpret_cast<int16_t *>(malloc(1152 * 2 * sizeof(int16_t)));
+        if (!pcmFrame) {
+            audioLogger->printf_P(PSTR("MP3: no room for whole frames, synthesizing by slot\n"));
+        }
+    }
+
     mad_stream_init(stream);
     mad_frame_init(frame);
     mad_synth_init(synth);
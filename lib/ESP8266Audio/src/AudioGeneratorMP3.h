@@ -25,6 +25,20 @@
 #include "libmad/config.h"
 #include "libmad/mad.h"
 
+// Synthesize each MP3 frame whole and send it to the output as one block of
+// up to 1152 frames, instead of one 32-sample subband slot at a time.  Costs
+// a 4.5KB buffer per decoder while it runs (taken from the heap, so not in
+// preallocated mode) and saves the per-slot synth and output calls.  The
+// ESP8266 keeps the slot at a time mode for its RAM.  SetFrameSynth()
+// overrides this per decoder.
+#ifndef MP3_FRAME_SYNTH
+#ifdef ESP8266
+#define MP3_FRAME_SYNTH 0
+#else
+#define MP3_FRAME_SYNTH 1
+#endif
+#endif
+
 class AudioGeneratorMP3 : public AudioGenerator {
 public:
     AudioGeneratorMP3();
@@ -36,6 +50,18 @@ public:
     virtual bool stop() override;
     virtual bool isRunning() override;
     virtual void desync() override;
+    // Seeks land on a frame boundary and then drop samples up to the exact
+    // target.  Exact as far as the frame index reaches; beyond it the
+    // Xing/VBRI table or the bit rate give the starting point.
+    virtual bool seekToMs(uint32_t ms) override;
+    virtual uint32_t getPositionMs() override;
+    // Exact from a LAME tag, from the Xing/VBRI frame count, else estimated
+    // from the bit rate of the first frame
+    virtual uint32_t getDurationMs() override;
+    // Whole-frame (true) or per-slot synthesis, from the next begin() on
+    void SetFrameSynth(bool on) {
+        frameSynth = on;
+    }
 
     static constexpr int preAllocSize() {
         return preAllocBuffSize() + preAllocStreamSize() + preAllocFrameSize() + preAllocSynthSize();
@@ -75,15 +101,65 @@ protected:
     struct mad_stream *stream;
     struct mad_frame *frame;
     struct mad_synth *synth;
-    int samplePtr;
     int nsCount;
     int nsCountMax;
 
+    // One synthesized subband slot, interleaved for ConsumeSamples(), or
+    // with frameSynth a whole frame in pcmFrame
+    int16_t pcmBlock[32 * 2];
+    bool frameSynth = MP3_FRAME_SYNTH;
+    int16_t *pcmFrame = nullptr;
+
+    bool eofGuard; // Zero padding after the last frame has been fed in
+
+    // Gapless trimming from a Xing/Info frame with a LAME tag.  Counted in
+    // samples from the start of the first audio frame: trimStart covers
+    // encoder plus decoder delay, trimEnd is where the padding starts (0 =
+    // unknown).  Nothing before outputFrom is sent, which is trimStart or
+    // the target of the last seek.
+    static constexpr uint32_t decoderDelay = 529;
+    bool headerChecked;
+    uint32_t samplesDecoded;
+    uint32_t trimStart;
+    uint32_t trimEnd;
+    uint32_t outputFrom;
+
+    // Seeking.  frameIndex holds the file offset of every indexStride-th
+    // audio frame, filled in as frames are decoded or walked over.  When it
+    // is full every other entry goes and the stride doubles.  Frame numbers
+    // are only trusted for the index while framesExact is set, which an
+    // estimated seek clears.
+    static constexpr int indexSize = 128;
+    static constexpr uint32_t seekPreroll = 4;     // Frames to refill the bit reservoir and overlap
+    static constexpr uint32_t maxScanFrames = 2000; // Further than this, estimate instead of walking
+    uint32_t frameIndex[indexSize];
+    int indexCount;
+    uint32_t indexStride;
+    uint32_t framesDecoded; // Number of the next audio frame
+    bool framesExact;
+    uint32_t dataStart;     // File offset of the first audio frame
+    uint32_t sampleRate;
+    uint32_t bitRate;
+    uint32_t frameSamples;
+    // Xing TOC, or a VBRI table turned into one: toc[i] is where i% of the
+    // frames start, in 256ths of tocBytes from tocBase.  tocFrames = 0 if none.
+    uint8_t toc[100];
+    uint32_t tocFrames;
+    uint32_t tocBytes;
+    uint32_t tocBase;
+
     // The internal helpers
     enum mad_flow ErrorToFlow();
     enum mad_flow Input();
     bool DecodeNextFrame();
-    bool GetOneSample(int16_t sample[2]);
+    bool SynthBlock();
+    bool ParseXingHeader();
+    bool ReadFrame();
+    uint32_t FramePos();
+    void AddIndex(uint32_t n, uint32_t pos);
+    bool LocateFrame(uint32_t &n, uint32_t &pos, bool &exact);
+    bool EstimateFrame(uint32_t &n, uint32_t &pos);
+    bool SyncFrom(uint32_t &pos);
 
 private:
     int unrecoverable = 0;
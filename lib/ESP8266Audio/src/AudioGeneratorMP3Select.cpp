@@ -0,0 +1,333 @@
+/*
+    AudioGeneratorMP3Select
+    MP3 front end running libmad or Helix, picked per stream
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AudioGeneratorMP3Select.h"
+#include "AudioGeneratorMP3.h"
+#include "AudioGeneratorMP3a.h"
+
+AudioGeneratorMP3Select::Replay::Replay() {
+    src = nullptr;
+    buf = nullptr;
+    len = 0;
+    ptr = 0;
+}
+
+AudioGeneratorMP3Select::Replay::~Replay() {
+    free(buf);
+}
+
+static uint32_t readFully(AudioFileSource *src, uint8_t *p, uint32_t bytes) {
+    uint32_t got = 0;
+    while (got < bytes) {
+        uint32_t n = src->read(p + got, bytes - got);
+        if (!n) {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+// Reads up to bytes from source, past an ID3v2 tag at the start.  The
+// decoders would only sync past the tag anyway.
+bool AudioGeneratorMP3Select::Replay::fill(AudioFileSource *source, uint32_t bytes) {
+    drop();
+    src = source;
+    buf = reinterpret_cast<uint8_t*>(malloc(bytes));
+    if (!buf) {
+        return false;
+    }
+    len = readFully(src, buf, bytes);
+    if (len >= 10 && !memcmp(buf, "ID3", 3)) {
+        uint32_t tag = 10 + ((buf[6] & 0x7f) << 21) + ((buf[7] & 0x7f) << 14) + ((buf[8] & 0x7f) << 7) + (buf[9] & 0x7f);
+        tag += (buf[5] & 0x10) ? 10 : 0; // Footer
+        while (tag > len && len) {
+            tag -= len;
+            len = readFully(src, buf, (tag < bytes) ? tag : bytes);
+        }
+        tag = (tag > len) ? len : tag;
+        memmove(buf, buf + tag, len - tag);
+        len -= tag;
+        len += readFully(src, buf + len, bytes - len);
+    }
+    return len > 0;
+}
+
+void AudioGeneratorMP3Select::Replay::drop() {
+    free(buf);
+    buf = nullptr;
+    len = 0;
+    ptr = 0;
+}
+
+uint32_t AudioGeneratorMP3Select::Replay::take(void *data, uint32_t bytes) {
+    uint32_t n = len - ptr;
+    n = (n > bytes) ? bytes : n;
+    memcpy(data, buf + ptr, n);
+    ptr += n;
+    if (ptr == len) {
+        drop(); // Back to the heap once it has all been read
+    }
+    return n;
+}
+
+uint32_t AudioGeneratorMP3Select::Replay::read(void *data, uint32_t bytes) {
+    uint32_t n = take(data, bytes);
+    return (n < bytes) ? n + src->read(reinterpret_cast<uint8_t*>(data) + n, bytes - n) : n;
+}
+
+uint32_t AudioGeneratorMP3Select::Replay::readNonBlock(void *data, uint32_t bytes) {
+    uint32_t n = take(data, bytes);
+    return (n < bytes) ? n + src->readNonBlock(reinterpret_cast<uint8_t*>(data) + n, bytes - n) : n;
+}
+
+bool AudioGeneratorMP3Select::Replay::seek(int32_t pos, int dir) {
+    if (dir == SEEK_CUR) {
+        pos -= len - ptr;
+    }
+    if (!src->seek(pos, dir)) {
+        return false;
+    }
+    drop();
+    return true;
+}
+
+bool AudioGeneratorMP3Select::Replay::close() {
+    drop();
+    return src->close();
+}
+
+bool AudioGeneratorMP3Select::Replay::isOpen() {
+    return src->isOpen();
+}
+
+uint32_t AudioGeneratorMP3Select::Replay::getSize() {
+    return src->getSize();
+}
+
+uint32_t AudioGeneratorMP3Select::Replay::getPos() {
+    return src->getPos() - (len - ptr);
+}
+
+bool AudioGeneratorMP3Select::Replay::loop() {
+    return src->loop();
+}
+
+
+AudioGeneratorMP3Select::AudioGeneratorMP3Select(Backend which) {
+    running = false;
+    file = NULL;
+    output = NULL;
+    wanted = which;
+    active = AUTO;
+    chooser = DefaultChoice;
+    memset(&profile, 0, sizeof(profile));
+    gen = nullptr;
+}
+
+AudioGeneratorMP3Select::~AudioGeneratorMP3Select() {
+    delete gen;
+}
+
+// The backends report through this object's callbacks
+void AudioGeneratorMP3Select::relayMetadata(void *cbData, const char *type, bool isUnicode, const char *string) {
+    reinterpret_cast<AudioGeneratorMP3Select*>(cbData)->cb.md(type, isUnicode, string);
+}
+
+void AudioGeneratorMP3Select::relayStatus(void *cbData, int code, const char *string) {
+    reinterpret_cast<AudioGeneratorMP3Select*>(cbData)->cb.st(code, string);
+}
+
+bool AudioGeneratorMP3Select::begin(AudioFileSource *source, AudioOutput *output) {
+    delete gen;
+    gen = nullptr;
+    active = AUTO;
+    running = false;
+    if (!source || !output || !source->isOpen()) {
+        return false;
+    }
+    file = source;
+    this->output = output;
+
+    memset(&profile, 0, sizeof(profile));
+    if (replay.fill(source, probeBytes)) {
+        ReadProfile(replay.data(), replay.length(), profile);
+    }
+    Backend which = (wanted == AUTO) ? chooser(profile) : wanted;
+    if (which == AUTO || (which == HELIX && profile.layer != 3)) {
+        which = LIBMAD;
+    }
+    if (which == HELIX) {
+        gen = new AudioGeneratorMP3a();
+    } else {
+        gen = new AudioGeneratorMP3();
+    }
+    active = which;
+    gen->RegisterMetadataCB(relayMetadata, this);
+    gen->RegisterStatusCB(relayStatus, this);
+    running = gen->begin(&replay, output);
+    return running;
+}
+
+bool AudioGeneratorMP3Select::loop() {
+    if (!gen) {
+        return false;
+    }
+    running = gen->loop();
+    return running;
+}
+
+bool AudioGeneratorMP3Select::stop() {
+    running = false;
+    return gen ? gen->stop() : true;
+}
+
+bool AudioGeneratorMP3Select::isRunning() {
+    return gen && gen->isRunning();
+}
+
+void AudioGeneratorMP3Select::desync() {
+    if (gen) {
+        gen->desync();
+    }
+}
+
+bool AudioGeneratorMP3Select::seekToMs(uint32_t ms) {
+    return gen && gen->seekToMs(ms);
+}
+
+uint32_t AudioGeneratorMP3Select::getPositionMs() {
+    return gen ? gen->getPositionMs() : 0;
+}
+
+uint32_t AudioGeneratorMP3Select::getDurationMs() {
+    return gen ? gen->getDurationMs() : 0;
+}
+
+AudioGeneratorMP3Select::Backend AudioGeneratorMP3Select::DefaultChoice(const Profile &p) {
+    if (!MP3_HELIX_MIN_KBPS || p.layer != 3 || p.vbr || p.gapless || p.kbps < MP3_HELIX_MIN_KBPS) {
+        return LIBMAD;
+    }
+    return HELIX;
+}
+
+
+// Frame headers, as far as the profile needs them
+struct FrameHeader {
+    uint8_t version; // 0 MPEG-1, 1 MPEG-2, 2 MPEG-2.5
+    uint8_t layer;
+    bool mono;
+    bool crc;
+    uint16_t kbps;
+    uint32_t rate;
+    uint32_t bytes;
+};
+
+static const uint16_t kbpsTable[2][3][15] = {
+    {   { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 }
+    },
+    {   { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+    }
+};
+static const uint32_t rateTable[3] = { 44100, 48000, 32000 };
+
+static bool parseHeader(const uint8_t *p, FrameHeader &h) {
+    if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0) {
+        return false;
+    }
+    int v = (p[1] >> 3) & 3, l = (p[1] >> 1) & 3, b = p[2] >> 4, r = (p[2] >> 2) & 3;
+    if (v == 1 || l == 0 || b == 0 || b == 15 || r == 3) {
+        return false;
+    }
+    h.version = (v == 3) ? 0 : (v == 2) ? 1 : 2;
+    h.layer = 4 - l;
+    h.mono = (p[3] >> 6) == 3;
+    h.crc = !(p[1] & 1);
+    h.kbps = kbpsTable[h.version ? 1 : 0][h.layer - 1][b];
+    h.rate = rateTable[r] >> h.version;
+    int pad = (p[2] >> 1) & 1;
+    if (h.layer == 1) {
+        h.bytes = (12000 * h.kbps / h.rate + pad) * 4;
+    } else if (h.layer == 3 && h.version) {
+        h.bytes = 72000 * h.kbps / h.rate + pad;
+    } else {
+        h.bytes = 144000 * h.kbps / h.rate + pad;
+    }
+    return true;
+}
+
+static uint32_t readBE32(const uint8_t *p) {
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// The first frame whose successor (if it is in the buffer) agrees with it
+// counts, so a stray sync word in leftover junk doesn't
+bool AudioGeneratorMP3Select::ReadProfile(const uint8_t *p, uint32_t len, Profile &profile) {
+    FrameHeader h, next;
+    bool haveNext = false;
+    uint32_t i;
+    for (i = 0; i + 4 <= len; i++) {
+        if (!parseHeader(p + i, h)) {
+            continue;
+        }
+        haveNext = (i + h.bytes + 4 <= len) && parseHeader(p + i + h.bytes, next);
+        if (i + h.bytes + 4 > len || (haveNext && next.version == h.version && next.layer == h.layer && next.rate == h.rate)) {
+            break;
+        }
+    }
+    if (i + 4 > len) {
+        return false;
+    }
+    profile.layer = h.layer;
+    profile.channels = h.mono ? 1 : 2;
+    profile.sampleRate = h.rate;
+    profile.kbps = h.kbps;
+    profile.vbr = haveNext && next.kbps != h.kbps;
+    profile.gapless = false;
+    if (h.layer != 3) {
+        return true;
+    }
+
+    // A tag frame says more, and the audio starts after it
+    const uint8_t *f = p + i;
+    uint32_t flen = (h.bytes < len - i) ? h.bytes : len - i;
+    uint32_t off = 4 + (h.crc ? 2 : 0) + (h.version ? (h.mono ? 9 : 17) : (h.mono ? 17 : 32));
+    bool xing = off + 8 <= flen && !memcmp(f + off, "Xing", 4);
+    bool info = off + 8 <= flen && !memcmp(f + off, "Info", 4);
+    bool vbri = 40 <= flen && !memcmp(f + 36, "VBRI", 4);
+    if (!xing && !info && !vbri) {
+        return true;
+    }
+    profile.vbr = !info;
+    profile.kbps = haveNext ? next.kbps : profile.kbps;
+    if (xing || info) {
+        uint32_t flags = readBE32(f + off + 4);
+        off += 8 + ((flags & 1) ? 4 : 0) + ((flags & 2) ? 4 : 0) + ((flags & 4) ? 100 : 0) + ((flags & 8) ? 4 : 0);
+        // LAME extension: encoder delay and padding 21 bytes in
+        if (off + 24 <= flen && (!memcmp(f + off, "LAME", 4) || !memcmp(f + off, "Lavf", 4) || !memcmp(f + off, "Lavc", 4))) {
+            profile.gapless = f[off + 21] || f[off + 22] || f[off + 23];
+        }
+    }
+    return true;
+}
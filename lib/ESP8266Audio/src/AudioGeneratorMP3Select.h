@@ -0,0 +1,140 @@
+/*
+    AudioGeneratorMP3Select
+    MP3 front end running libmad or Helix, picked per stream
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOGENERATORMP3SELECT_H
+#define _AUDIOGENERATORMP3SELECT_H
+
+#include "AudioGenerator.h"
+
+// AUTO hands CBR Layer III streams without gapless info to Helix from this
+// bit rate up, 0 for never.  Helix takes 1.7KB less heap and 1KB less stack,
+// but on the host tests/host/mp3bench can't tell the two apart in speed from
+// run to run, and nobody has timed them on the ESP32, so by default
+// everything stays on libmad.  Run it on your own files to set this.
+#ifndef MP3_HELIX_MIN_KBPS
+#define MP3_HELIX_MIN_KBPS 0
+#endif
+
+// begin() reads the first frames of the stream into a small buffer, works
+// out its profile (layer, channels, bit rate, CBR or VBR, LAME gapless info)
+// and starts either AudioGeneratorMP3 (libmad) or AudioGeneratorMP3a (Helix)
+// on it.  The backend then reads those bytes again before the rest, so
+// nothing has to seek back and streams work as well.  Everything else is
+// passed straight through to the backend.
+//
+// AUTO leaves the choice to the chooser, DefaultChoice() unless another one
+// is set.  Helix only decodes Layer III, anything else always gets libmad.
+// DefaultChoice() also keeps VBR and gapless streams on libmad, for its
+// frame index and LAME trimming.
+class AudioGeneratorMP3Select : public AudioGenerator {
+public:
+    enum Backend { AUTO, LIBMAD, HELIX };
+
+    struct Profile {
+        uint8_t layer;       // 0 if no frame was found
+        uint8_t channels;
+        bool vbr;            // Xing or VBRI tag, or the bit rate changes
+        bool gapless;        // LAME tag with encoder delay and padding
+        uint16_t kbps;       // Of the first audio frame
+        uint32_t sampleRate;
+    };
+    typedef Backend (*chooserFn)(const Profile &profile);
+
+    AudioGeneratorMP3Select(Backend which = AUTO);
+    virtual ~AudioGeneratorMP3Select() override;
+    virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
+    virtual bool loop() override;
+    virtual bool stop() override;
+    virtual bool isRunning() override;
+    virtual void desync() override;
+    virtual bool seekToMs(uint32_t ms) override;
+    virtual uint32_t getPositionMs() override;
+    virtual uint32_t getDurationMs() override;
+
+    // Takes effect from the next begin()
+    void SetBackend(Backend which) {
+        wanted = which;
+    }
+    void SetChooser(chooserFn fn) {
+        chooser = fn ? fn : DefaultChoice;
+    }
+    // The backend decoding now, AUTO before begin()
+    Backend GetBackend() {
+        return active;
+    }
+    const Profile &GetProfile() {
+        return profile;
+    }
+
+    // Helix for CBR Layer III without gapless info from MP3_HELIX_MIN_KBPS
+    // up, libmad for the rest
+    static Backend DefaultChoice(const Profile &p);
+
+    // Reads the profile from the start of a stream, false if no frame
+    static bool ReadProfile(const uint8_t *p, uint32_t len, Profile &profile);
+
+private:
+    // Hands out what begin() read before going on with the source
+    class Replay : public AudioFileSource {
+    public:
+        Replay();
+        virtual ~Replay() override;
+        bool fill(AudioFileSource *source, uint32_t bytes);
+        void drop();
+        const uint8_t *data() {
+            return buf;
+        }
+        uint32_t length() {
+            return len;
+        }
+
+        virtual uint32_t read(void *data, uint32_t bytes) override;
+        virtual uint32_t readNonBlock(void *data, uint32_t bytes) override;
+        virtual bool seek(int32_t pos, int dir) override;
+        virtual bool close() override;
+        virtual bool isOpen() override;
+        virtual uint32_t getSize() override;
+        virtual uint32_t getPos() override;
+        virtual bool loop() override;
+
+    private:
+        uint32_t take(void *data, uint32_t bytes);
+
+        AudioFileSource *src;
+        uint8_t *buf;
+        uint32_t len;
+        uint32_t ptr;
+    };
+
+    static void relayMetadata(void *cbData, const char *type, bool isUnicode, const char *string);
+    static void relayStatus(void *cbData, int code, const char *string);
+
+    // Two maximum size Layer III frames and the next header
+    static constexpr uint32_t probeBytes = 2 * 1441 + 4;
+
+    Backend wanted;
+    Backend active;
+    chooserFn chooser;
+    Profile profile;
+    Replay replay;
+    AudioGenerator *gen;
+};
+
+#endif
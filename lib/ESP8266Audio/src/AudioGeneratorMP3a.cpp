@@ -35,12 +35,18 @@ AudioGeneratorMP3a::AudioGeneratorMP3a() {
     // For sanity's sake...
     memset(buff, 0, sizeof(buff));
     memset(outSample, 0, sizeof(outSample));
+    buffStart = 0;
     buffValid = 0;
-    lastFrameEnd = 0;
-    validSamples = 0;
-    curSample = 0;
+    eof = false;
+    block = outSample;
     lastRate = 0;
     lastChannels = 0;
+    dataStart = 0;
+    bitRate = 0;
+    sampleRate = 0;
+    frameSamples = 0;
+    samplesDecoded = 0;
+    outputFrom = 0;
 }
 
 AudioGeneratorMP3a::~AudioGeneratorMP3a() {
@@ -60,39 +66,64 @@ bool AudioGeneratorMP3a::isRunning() {
     return running;
 }
 
-bool AudioGeneratorMP3a::FillBufferWithValidFrame() {
-    buff[0] = 0; // Destroy any existing sync word @ 0
-    int nextSync;
-    do {
-        nextSync = MP3FindSyncWord(buff + lastFrameEnd, buffValid - lastFrameEnd);
-        if (nextSync >= 0) {
-            nextSync += lastFrameEnd;
-        }
-        lastFrameEnd = 0;
-        if (nextSync == -1) {
-            if (buff[buffValid - 1] == 0xff) { // Could be 1st half of syncword, preserve it...
-                buff[0] = 0xff;
-                buffValid = file->read(buff + 1, sizeof(buff) - 1);
-                if (buffValid == 0) {
-                    return false;    // No data available, EOF
-                }
-            } else { // Try a whole new buffer
-                buffValid = file->read(buff, sizeof(buff));
-                if (buffValid == 0) {
-                    return false;    // No data available, EOF
-                }
-            }
+// A Xing/Info or VBRI frame at the start holds only the tag, not silence
+static bool isTagFrame(const uint8_t *p, int len, const MP3FrameInfo &fi) {
+    int side = (fi.version == MPEG1) ? ((fi.nChans == 1) ? 17 : 32) : ((fi.nChans == 1) ? 9 : 17);
+    int off = 4 + ((p[1] & 1) ? 0 : 2) + side;
+    if (len >= 40 && !memcmp(p + 36, "VBRI", 4)) {
+        return true;
+    }
+    return off + 4 <= len && (!memcmp(p + off, "Xing", 4) || !memcmp(p + off, "Info", 4));
+}
+
+// Tops the ring up with whole chunks while there is room for one
+void AudioGeneratorMP3a::Refill() {
+    while (!eof && ringBytes - buffValid >= readBytes) {
+        uint32_t end = buffStart + buffValid;
+        end = (end >= ringBytes) ? end - ringBytes : end;
+        uint32_t len = (ringBytes - end < readBytes) ? ringBytes - end : readBytes;
+        uint32_t got = file->read(buff + end, len);
+        if (!got) {
+            eof = true; // No data available, EOF
         }
-    } while (nextSync == -1);
+        buffValid += got;
+    }
+}
 
-    // Move the frame to start at offset 0 in the buffer
-    buffValid -= nextSync; // Throw out prior to nextSync
-    memmove(buff, buff + nextSync, buffValid);
+uint32_t AudioGeneratorMP3a::Contiguous() {
+    uint32_t toEnd = ringBytes - buffStart;
+    if (buffValid <= toEnd || toEnd >= maxFrameBytes) {
+        return (buffValid < toEnd) ? buffValid : toEnd;
+    }
+    // Not even a frame before the end, so follow it with the start
+    uint32_t wrapped = buffValid - toEnd;
+    wrapped = (wrapped > maxFrameBytes) ? maxFrameBytes : wrapped;
+    memcpy(buff + ringBytes, buff, wrapped);
+    return toEnd + wrapped;
+}
 
-    // We have a sync word at 0 now, try and fill remainder of buffer
-    buffValid += file->read(buff + buffValid, sizeof(buff) - buffValid);
+void AudioGeneratorMP3a::Consume(uint32_t bytes) {
+    buffStart += bytes;
+    buffStart = (buffStart >= ringBytes) ? buffStart - ringBytes : buffStart;
+    buffValid -= bytes;
+}
 
-    return true;
+bool AudioGeneratorMP3a::FindFrame() {
+    while (true) {
+        Refill();
+        uint32_t n = Contiguous();
+        if (!n) {
+            return false; // EOF
+        }
+        int nextSync = MP3FindSyncWord(buff + buffStart, n);
+        if (nextSync >= 0) {
+            Consume(nextSync);
+            Refill();
+            return true;
+        }
+        // The last byte could be the 1st half of a syncword, preserve it...
+        Consume((n > 1) ? n - 1 : n);
+    }
 }
 
 bool AudioGeneratorMP3a::loop() {
@@ -100,46 +131,70 @@ bool AudioGeneratorMP3a::loop() {
         goto done;    // Nothing to do here!
     }
 
-    // If we've got data, try and pump it out...
-    while (validSamples) {
-        lastSample[0] = outSample[curSample * 2];
-        lastSample[1] = outSample[curSample * 2 + 1];
-        if (!output->ConsumeSample(lastSample)) {
-            goto done;    // Can't send, but no error detected
-        }
-        validSamples--;
-        curSample++;
+    // First, try and push out the rest of the stored frame.  If we can't, then punt and try later
+    if (!SendBlock()) {
+        goto done;    // Can't send, but no error detected
     }
 
-    // No samples available, need to decode a new frame
-    if (FillBufferWithValidFrame()) {
-        // buff[0] start of frame, decode it...
-        unsigned char *inBuff = reinterpret_cast<unsigned char *>(buff);
-        int bytesLeft = buffValid;
+    // Decode frames for as long as the output takes them whole
+    do {
+        if (!FindFrame()) {
+            running = false; // No more data, we're done here...
+            goto done;
+        }
+        // buff[buffStart] start of frame, decode it...
+        uint32_t frameBytes = Contiguous();
+        unsigned char *inBuff = buff + buffStart;
+        int bytesLeft = frameBytes;
         int ret = MP3Decode(hMP3Decoder, &inBuff, &bytesLeft, outSample, 0);
-        if (ret) {
+        // A frame reaching back into data before a seek comes out silent,
+        // but it is a frame
+        if (ret && ret != ERR_MP3_MAINDATA_UNDERFLOW) {
             // Error, skip the frame...
+            Consume(1);
             char buff[48];
             sprintf(buff, "MP3 decode error %d", ret);
             cb.st(ret, buff);
-        } else {
-            lastFrameEnd = buffValid - bytesLeft;
-            MP3FrameInfo fi;
-            MP3GetLastFrameInfo(hMP3Decoder, &fi);
-            if ((int)fi.samprate != (int)lastRate) {
-                output->SetRate(fi.samprate);
-                lastRate = fi.samprate;
-            }
-            if (fi.nChans != lastChannels) {
-                output->SetChannels(fi.nChans);
-                lastChannels = fi.nChans;
+            continue;
+        }
+        frameBytes -= bytesLeft;
+        MP3FrameInfo fi;
+        MP3GetLastFrameInfo(hMP3Decoder, &fi);
+        if ((int)fi.samprate != (int)lastRate) {
+            output->SetRate(fi.samprate);
+            lastRate = fi.samprate;
+        }
+        if (fi.nChans != lastChannels) {
+            output->SetChannels(fi.nChans);
+            lastChannels = fi.nChans;
+        }
+        if (!bitRate && isTagFrame(buff + buffStart, frameBytes, fi)) {
+            Consume(frameBytes);
+            continue;
+        }
+        if (!bitRate) {
+            dataStart = file->getPos() - buffValid;
+            bitRate = fi.bitrate;
+            sampleRate = fi.samprate;
+            frameSamples = fi.outputSamps / fi.nChans;
+        }
+        Consume(frameBytes);
+
+        // Mono frames come out packed, spread them over both sides from the back
+        uint16_t samples = fi.outputSamps / lastChannels;
+        if (lastChannels == 1) {
+            for (int i = samples - 1; i >= 0; i--) {
+                outSample[i * 2] = outSample[i * 2 + 1] = outSample[i];
             }
-            curSample = 0;
-            validSamples = fi.outputSamps / lastChannels;
         }
-    } else {
-        running = false; // No more data, we're done here...
-    }
+        block = outSample;
+        blockLen = samples;
+
+        // Drop whatever comes before a seek target
+        uint32_t frameStart = samplesDecoded;
+        samplesDecoded += samples;
+        blockPtr = (outputFrom > frameStart) ? ((outputFrom - frameStart < samples) ? outputFrom - frameStart : samples) : 0;
+    } while (running && SendBlock());
 
 done:
     file->loop();
@@ -166,8 +221,76 @@ bool AudioGeneratorMP3a::begin(AudioFileSource *source, AudioOutput *output) {
     // AAC always comes out at 16 bits
     output->SetBitsPerSample(16);
 
+    buffStart = 0;
+    buffValid = 0;
+    eof = false;
+    blockPtr = 0;
+    blockLen = 0;
+    bitRate = 0;
+    samplesDecoded = 0;
+    outputFrom = 0;
     running = true;
 
     return true;
 }
 
+// Finds the first frame without decoding it, for a seek before loop() has
+// seen one
+bool AudioGeneratorMP3a::ReadHeader() {
+    if (bitRate) {
+        return true;
+    }
+    if (!FindFrame()) {
+        return false;
+    }
+    unsigned char *p = buff + buffStart;
+    MP3FrameInfo fi;
+    if (MP3GetNextFrameInfo(hMP3Decoder, &fi, p) || !fi.bitrate) {
+        return false;
+    }
+    dataStart = file->getPos() - buffValid;
+    if (isTagFrame(p, Contiguous(), fi)) {
+        dataStart += ((fi.version == MPEG1) ? 144 : 72) * fi.bitrate / fi.samprate + ((p[2] >> 1) & 1);
+    }
+    bitRate = fi.bitrate;
+    sampleRate = fi.samprate;
+    frameSamples = fi.outputSamps / fi.nChans;
+    return true;
+}
+
+bool AudioGeneratorMP3a::seekToMs(uint32_t ms) {
+    if (!running || !ReadHeader()) {
+        return false;
+    }
+    uint32_t target = (uint64_t)ms * sampleRate / 1000;
+    uint32_t n = target / frameSamples;
+    n = (n > seekPreroll) ? n - seekPreroll : 0;
+    uint32_t pos = dataStart + (uint64_t)n * frameSamples * bitRate / 8 / sampleRate;
+    if (!file->seek(pos, SEEK_SET)) {
+        return false;
+    }
+    buffStart = 0;
+    buffValid = 0;
+    eof = false;
+    blockPtr = 0;
+    blockLen = 0;
+    samplesDecoded = n * frameSamples;
+    outputFrom = target;
+    return true;
+}
+
+uint32_t AudioGeneratorMP3a::getPositionMs() {
+    if (!sampleRate) {
+        return 0;
+    }
+    return (uint64_t)(samplesDecoded - (blockLen - blockPtr)) * 1000 / sampleRate;
+}
+
+uint32_t AudioGeneratorMP3a::getDurationMs() {
+    uint32_t size = file ? file->getSize() : 0;
+    if (!bitRate || size <= dataStart) {
+        return 0;
+    }
+    return (uint64_t)(size - dataStart) * 8000 / bitRate;
+}
+
@@ -32,25 +32,51 @@ public:
     virtual bool loop() override;
     virtual bool stop() override;
     virtual bool isRunning() override;
+    // Positions come from the bit rate of the first frame, so they are exact
+    // for CBR and estimates for VBR.  Seeks land a few frames early and drop
+    // samples up to the target.
+    virtual bool seekToMs(uint32_t ms) override;
+    virtual uint32_t getPositionMs() override;
+    virtual uint32_t getDurationMs() override;
 
 protected:
     // Helix MP3 decoder
     HMP3Decoder hMP3Decoder;
 
-    // Input buffering
-    uint8_t buff[1600]; // File buffer required to store at least a whole compressed frame
-    int16_t buffValid;
-    int16_t lastFrameEnd;
-    bool FillBufferWithValidFrame(); // Read until we get a valid syncword and min(feof, 2048) butes in the buffer
+    // Input ring.  The source is read in whole readBytes chunks, which land
+    // chunk aligned unless a short read came before.  A frame running past
+    // the end of the ring has its tail copied from the start into the spare
+    // bytes after it, so the decoder always gets it in one piece.
+    static constexpr uint32_t readBytes = 1024;
+    static constexpr uint32_t ringBytes = 3 * readBytes;
+    static constexpr uint32_t maxFrameBytes = 1441; // Layer III, 320kbps at 32kHz with padding
+    static_assert(ringBytes - readBytes >= maxFrameBytes, "a full ring must hold a whole frame");
+    uint8_t buff[ringBytes + maxFrameBytes];
+    uint32_t buffStart; // Ring offset of the first unused byte
+    uint32_t buffValid; // Bytes in the ring from there on
+    bool eof;
+    void Refill();
+    uint32_t Contiguous(); // Bytes from buffStart on that can be read in one piece
+    void Consume(uint32_t bytes);
+    bool FindFrame(); // Moves buffStart to the next sync word, with a frame's worth read in after it
 
-    // Output buffering
+    // Output buffering, whole frames go out through SendBlock()
     int16_t outSample[1152 * 2]; // Interleaved L/R
-    int16_t validSamples;
-    int16_t curSample;
 
     // Each frame may change this if they're very strange, I guess
     unsigned int lastRate;
     int lastChannels;
+
+    // Seeking.  Samples are counted from the first frame, nothing before
+    // outputFrom is sent.
+    static constexpr uint32_t seekPreroll = 4; // Frames to refill the bit reservoir and overlap
+    uint32_t dataStart; // File offset of the first frame
+    uint32_t bitRate;   // Of the first frame, 0 until one has been seen
+    uint32_t sampleRate;
+    uint32_t frameSamples;
+    uint32_t samplesDecoded;
+    uint32_t outputFrom;
+    bool ReadHeader();
 };
 
 #endif
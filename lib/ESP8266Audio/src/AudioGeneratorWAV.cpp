@@ -29,6 +29,12 @@ AudioGeneratorWAV::AudioGeneratorWAV() {
     buff = NULL;
     buffPtr = 0;
     buffLen = 0;
+    channels = 0;
+    sampleRate = 0;
+    bitsPerSample = 0;
+    availBytes = 0;
+    dataBytes = 0;
+    dataStart = 0;
 }
 
 AudioGeneratorWAV::~AudioGeneratorWAV() {
@@ -51,6 +57,43 @@ bool AudioGeneratorWAV::isRunning() {
     return running;
 }
 
+// Every frame is the same size, so the target is a straight file offset
+bool AudioGeneratorWAV::seekToMs(uint32_t ms) {
+    uint32_t frameBytes = channels * bitsPerSample / 8;
+    if (!running || !sampleRate || !frameBytes) {
+        return false;
+    }
+    uint64_t off = (uint64_t)ms * sampleRate / 1000 * frameBytes;
+    if (off >= dataBytes || !file->seek(dataStart + off, SEEK_SET)) {
+        return false;
+    }
+    availBytes = dataBytes - off;
+    buffPtr = 0;
+    buffLen = 0;
+    blockPtr = 0;
+    blockLen = 0;
+    return true;
+}
+
+uint32_t AudioGeneratorWAV::getPositionMs() {
+    uint32_t frameBytes = channels * bitsPerSample / 8;
+    if (!sampleRate || !frameBytes) {
+        return 0;
+    }
+    // Bytes read in, less those still in buff and the frames still in the block
+    uint32_t used = dataBytes - availBytes - (buffLen - buffPtr);
+    uint32_t frames = used / frameBytes - (blockLen - blockPtr);
+    return (uint64_t)frames * 1000 / sampleRate;
+}
+
+uint32_t AudioGeneratorWAV::getDurationMs() {
+    uint32_t frameBytes = channels * bitsPerSample / 8;
+    if (!sampleRate || !frameBytes) {
+        return 0;
+    }
+    return (uint64_t)(dataBytes / frameBytes) * 1000 / sampleRate;
+}
+
 
 // Handle buffered reading, reload each time we run out of data
 bool AudioGeneratorWAV::GetBufferedData(int bytes, void *dest) {
@@ -74,45 +117,65 @@ bool AudioGeneratorWAV::GetBufferedData(int bytes, void *dest) {
     return true;
 }
 
-bool AudioGeneratorWAV::loop() {
-    if (!running) {
-        goto done;    // Nothing to do here!
+// Read as many whole frames as are available (up to one block), returns the count
+uint16_t AudioGeneratorWAV::FillBlock() {
+    int16_t *p = pcmBlock;
+    uint16_t frames;
+    uint16_t want = blockFrames;
+    int room = output->AvailableFrames();
+    if ((room > 0) && (want > room)) {
+        want = room; // Only read what the output can take now
     }
-
-    // First, try and push in the stored sample.  If we can't, then punt and try later
-    if (!output->ConsumeSample(lastSample)) {
-        goto done;    // Can't send, but no error detected
-    }
-
-    // Try and stuff the buffer one sample at a time
-    do {
+    for (frames = 0; frames < want; frames++, p += 2) {
         if (bitsPerSample == 8) {
             uint8_t l, r;
             if (!GetBufferedData(1, &l)) {
-                stop();
+                break;
             }
             if (channels == 2) {
                 if (!GetBufferedData(1, &r)) {
-                    stop();
+                    break;
                 }
             } else {
                 r = 0;
             }
-            lastSample[AudioOutput::LEFTCHANNEL] = l;
-            lastSample[AudioOutput::RIGHTCHANNEL] = r;
+            p[AudioOutput::LEFTCHANNEL] = l;
+            p[AudioOutput::RIGHTCHANNEL] = r;
         } else if (bitsPerSample == 16) {
-            if (!GetBufferedData(2, &lastSample[AudioOutput::LEFTCHANNEL])) {
-                stop();
+            if (!GetBufferedData(2, &p[AudioOutput::LEFTCHANNEL])) {
+                break;
             }
             if (channels == 2) {
-                if (!GetBufferedData(2, &lastSample[AudioOutput::RIGHTCHANNEL])) {
-                    stop();
+                if (!GetBufferedData(2, &p[AudioOutput::RIGHTCHANNEL])) {
+                    break;
                 }
             } else {
-                lastSample[AudioOutput::RIGHTCHANNEL] = 0;
+                p[AudioOutput::RIGHTCHANNEL] = 0;
             }
         }
-    } while (running && output->ConsumeSample(lastSample));
+    }
+    block = pcmBlock;
+    blockPtr = 0;
+    blockLen = frames;
+    return frames;
+}
+
+bool AudioGeneratorWAV::loop() {
+    if (!running) {
+        goto done;    // Nothing to do here!
+    }
+
+    // First, try and push out the rest of the stored block.  If we can't, then punt and try later
+    if (!SendBlock()) {
+        goto done;    // Can't send, but no error detected
+    }
+
+    // Try and stuff the buffer one block at a time
+    do {
+        if (!FillBlock()) {
+            stop();
+        }
+    } while (running && SendBlock());
 
 done:
     file->loop();
@@ -273,7 +336,13 @@ bool AudioGeneratorWAV::ReadWAVInfo() {
         Serial.printf_P(PSTR("AudioGeneratorWAV::ReadWAVInfo: failed to read WAV data\n"));
         return false;
     };
+    // Streamed WAVs leave the size at 0xffffffff, believe the file instead
+    if (u32 > file->getSize() - file->getPos()) {
+        u32 = file->getSize() - file->getPos();
+    }
     availBytes = u32;
+    dataBytes = u32;
+    dataStart = file->getPos();
 
     // Now set up the buffer or fail
     buff = reinterpret_cast<uint8_t *>(malloc(buffSize));
@@ -326,6 +395,8 @@ bool AudioGeneratorWAV::begin(AudioFileSource *source, AudioOutput *output) {
     }
 
     running = true;
+    blockPtr = 0;
+    blockLen = 0;
 
     return true;
 }
@@ -31,6 +31,9 @@ public:
     virtual bool loop() override;
     virtual bool stop() override;
     virtual bool isRunning() override;
+    virtual bool seekToMs(uint32_t ms) override;
+    virtual uint32_t getPositionMs() override;
+    virtual uint32_t getDurationMs() override;
     void SetBufferSize(int sz) {
         buffSize = sz;
     }
@@ -47,6 +50,7 @@ private:
     }
     bool GetBufferedData(int bytes, void *dest);
     bool ReadWAVInfo();
+    uint16_t FillBlock();
 
 
 protected:
@@ -56,12 +60,18 @@ protected:
     uint16_t bitsPerSample;
 
     uint32_t availBytes;
+    uint32_t dataBytes; // Size of the data chunk, cut to what the file holds
+    uint32_t dataStart; // File offset of the first sample
 
     // We need to buffer some data in-RAM to avoid doing 1000s of small reads
     uint32_t buffSize;
     uint8_t *buff;
     uint16_t buffPtr;
     uint16_t buffLen;
+
+    // Frames are handed to the output in blocks of this size
+    static constexpr int blockFrames = 64;
+    int16_t pcmBlock[blockFrames * 2];
 };
 
 #endif
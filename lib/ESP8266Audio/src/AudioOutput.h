@@ -23,10 +23,15 @@
 
 #include <Arduino.h>
 #include "AudioStatus.h"
+#include "AudioGain.h"
 
 class AudioOutput {
 public:
-    AudioOutput() { };
+    AudioOutput() {
+        hertz = 0;
+        gainRampMs = 0;
+        gainRampShape = AudioGainRamp::LINEAR;
+    };
     virtual ~AudioOutput() {};
     virtual bool SetRate(int hz) {
         hertz = hz;
@@ -40,22 +45,40 @@ public:
         channels = chan;
         return true;
     }
+    // Ramps over the time set by SetGainRamp(), at once if that is 0
     virtual bool SetGain(float f) {
-        if (f > 4.0) {
-            f = 4.0;
-        } if (f < 0.0) {
-            f = 0.0;
-        } gainF2P6 = (uint8_t)(f * (1 << 6));
+        return FadeGain(f, gainRampMs);
+    }
+    // Slide the gain to f over ms of audio instead of jumping, e.g. to fade
+    // a track in or out.  0 ms, or a rate not known yet, jumps at once.
+    virtual bool FadeGain(float f, uint32_t ms) {
+        uint32_t frames = (uint32_t)(((uint64_t)ms * hertz) / 1000);
+        gain.RampTo(AudioGain::FromFloat(f), frames, gainRampShape);
         return true;
     }
+    // How long SetGain() takes to reach a new gain, and along which curve
+    void SetGainRamp(uint32_t ms, AudioGainRamp::Shape shape = AudioGainRamp::LINEAR) {
+        gainRampMs = ms;
+        gainRampShape = shape;
+    }
+    // A fade is still under way, it moves as frames are consumed
+    virtual bool IsRamping() {
+        return gain.IsRamping();
+    }
     virtual bool begin() {
         return false;
     };
     typedef enum { LEFTCHANNEL = 0, RIGHTCHANNEL = 1 } SampleIndex;
+    // Single stereo frame.  Kept for compatibility, outputs which can take
+    // whole blocks should implement ConsumeSamples() and forward this to it.
     virtual bool ConsumeSample(int16_t sample[2]) {
         (void)sample;
         return false;
     }
+    // Block of "count" interleaved L/R frames, the preferred path for
+    // generators.  Returns how many frames were taken, the caller holds on to
+    // the rest and resends them later.  The output may modify the frames it
+    // takes in place, but must not keep a pointer to them.
     virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) {
         for (uint16_t i = 0; i < count; i++) {
             if (!ConsumeSample(samples)) {
@@ -65,6 +88,46 @@ public:
         }
         return count;
     }
+    // The same for 32-bit samples, full scale at INT32_MAX (a 16-bit sample s
+    // is s << 16), from sources with more than 16 bits.  Outputs that carry
+    // only 16 bits get the top 16 bits of each sample through
+    // ConsumeSamples(), so a generator can always use this path.
+    virtual uint16_t ConsumeSamples32(int32_t *samples, uint16_t count) {
+        int16_t narrow[2 * 32];
+        uint16_t taken = 0;
+        while (taken < count) {
+            uint16_t n = count - taken;
+            if (n > 32) {
+                n = 32;
+            }
+            for (uint16_t i = 0; i < 2 * n; i++) {
+                narrow[i] = samples[2 * taken + i] >> 16;
+            }
+            uint16_t sent = ConsumeSamples(narrow, n);
+            taken += sent;
+            if (sent < n) {
+                break;
+            }
+        }
+        return taken;
+    }
+    // Whether ConsumeSamples32() keeps more than 16 bits, i.e. whether it is
+    // worth a generator producing them
+    virtual bool WantsSamples32() {
+        return false;
+    }
+    // Frames the output can take right now without refusing any, or -1 if
+    // it can't tell.  Lets generators decode only as much as will fit.
+    virtual int AvailableFrames() {
+        return -1;
+    }
+    // Block until the output can take more frames or ms have passed, so a
+    // playback task can sleep instead of polling.  Returns false on timeout.
+    // Outputs that can't wait return at once.
+    virtual bool WaitForSpace(uint32_t ms) {
+        (void)ms;
+        return true;
+    }
     virtual bool stop() {
         return false;
     }
@@ -96,22 +159,23 @@ protected:
         }
     };
 
+    // Gain for count stereo frames in place, stepping any ramp.  Outputs
+    // which handle a frame at a time call this once per frame, not Amplify().
+    void ApplyGain(int16_t *samples, uint16_t count) {
+        gain.Apply(samples, count);
+    }
+
     inline int16_t Amplify(int16_t s) {
-        int32_t v = (s * gainF2P6) >> 6;
-        if (v < -32767) {
-            return -32767;
-        } else if (v > 32767) {
-            return 32767;
-        } else {
-            return (int16_t)(v & 0xffff);
-        }
+        return AudioGain::Scale(s, gain.Gain());
     }
 
 protected:
     uint16_t hertz;
     uint8_t bps;
     uint8_t channels;
-    uint8_t gainF2P6; // Fixed point 2.6
+    AudioGainRamp gain;
+    uint32_t gainRampMs;
+    AudioGainRamp::Shape gainRampShape;
 
 protected:
     AudioStatus cb;
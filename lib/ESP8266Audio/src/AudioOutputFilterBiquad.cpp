@@ -59,6 +59,14 @@ bool AudioOutputFilterBiquad::SetGain(float gain) {
     return sink->SetGain(gain);
 }
 
+bool AudioOutputFilterBiquad::FadeGain(float gain, uint32_t ms) {
+    return sink->FadeGain(gain, ms);
+}
+
+bool AudioOutputFilterBiquad::IsRamping() {
+    return sink->IsRamping();
+}
+
 void AudioOutputFilterBiquad::SetType(int type) {
     this->type = type;
     CalcBiquad();
@@ -87,12 +95,12 @@ void AudioOutputFilterBiquad::SetBiquad(int type, float Fc, float Q, float peakG
     CalcBiquad();
 }
 
-void AudioOutputFilterBiquad::CalcBiquad() {
+void AudioOutputFilterBiquad::Design(int type, float Fc, float Q, float peakGain, float &a0, float &a1, float &a2, float &b1, float &b2) {
     float norm;
     float V = pow(10, fabs(peakGain) / 20.0);
     float K = tan(M_PI * Fc);
 
-    switch (this->type) {
+    switch (type) {
     case bq_type_lowpass:
         norm = 1 / (1 + K / Q + K * K);
         a0 = K * K * norm;
@@ -183,6 +191,10 @@ void AudioOutputFilterBiquad::CalcBiquad() {
         }
         break;
     }
+}
+
+void AudioOutputFilterBiquad::CalcBiquad() {
+    Design(type, Fc, Q, peakGain, a0, a1, a2, b1, b2);
 
     i_a0 = a0 * BQ_DECAL;
     i_a1 = a1 * BQ_DECAL;
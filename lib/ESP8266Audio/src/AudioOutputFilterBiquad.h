@@ -46,10 +46,16 @@ public:
     virtual bool SetBitsPerSample(int bits) override;
     virtual bool SetChannels(int chan) override;
     virtual bool SetGain(float f) override;
+    virtual bool FadeGain(float f, uint32_t ms) override;
+    virtual bool IsRamping() override;
     virtual bool begin() override;
     virtual bool ConsumeSample(int16_t sample[2]) override;
     virtual bool stop() override;
 
+    // Coefficients for a filter of type at Fc (a fraction of the sample
+    // rate), shared with AudioOutputFilterEQ
+    static void Design(int type, float Fc, float Q, float peakGain, float &a0, float &a1, float &a2, float &b1, float &b2);
+
 private:
     void SetType(int type);
     void SetFc(float Fc);
@@ -65,6 +65,14 @@ bool AudioOutputFilterDecimate::SetGain(float gain) {
     return sink->SetGain(gain);
 }
 
+bool AudioOutputFilterDecimate::FadeGain(float gain, uint32_t ms) {
+    return sink->FadeGain(gain, ms);
+}
+
+bool AudioOutputFilterDecimate::IsRamping() {
+    return sink->IsRamping();
+}
+
 bool AudioOutputFilterDecimate::begin() {
     return sink->begin();
 }
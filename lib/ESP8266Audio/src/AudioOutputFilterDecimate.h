@@ -31,6 +31,8 @@ public:
     virtual bool SetBitsPerSample(int bits) override;
     virtual bool SetChannels(int chan) override;
     virtual bool SetGain(float f) override;
+    virtual bool FadeGain(float f, uint32_t ms) override;
+    virtual bool IsRamping() override;
     virtual bool begin() override;
     virtual bool ConsumeSample(int16_t sample[2]) override;
     virtual bool stop() override;
@@ -0,0 +1,392 @@
+/*
+    AudioOutputFilterEQ
+    Parametric EQ as a cascade of biquads run over blocks
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include <math.h>
+#include "AudioOutputFilterEQ.h"
+
+#define EQ_SHIFT 28
+#define EQ_ONE (1 << EQ_SHIFT)
+// Bits kept below the 16-bit LSB while samples go through the cascade
+#define EQ_GUARD 12
+// Sections below this (and every low shelf) feed back their rounding error
+#ifndef EQ_FEEDBACK_HZ
+#define EQ_FEEDBACK_HZ 400
+#endif
+
+AudioOutputFilterEQ::AudioOutputFilterEQ(AudioOutput *sink, int sections) : AudioOutput() {
+    this->sink = sink;
+    numSections = (sections > 0) ? sections : 1;
+    section = (Section *)calloc(numSections, sizeof(Section));
+    setting = (Setting *)calloc(numSections, sizeof(Setting));
+    hertz = 44100;
+    bps = 16;
+    channels = 2;
+    rampMs = 20;
+    pendingWide = false;
+    pendingLen = 0;
+    pendingPtr = 0;
+    for (int i = 0; section && setting && i < numSections; i++) {
+        ClearSection(i);
+        section[i].a0 = EQ_ONE;
+    }
+}
+
+AudioOutputFilterEQ::~AudioOutputFilterEQ() {
+    free(section);
+    free(setting);
+}
+
+// Target coefficients of section n for the current rate.  Peaks and shelves
+// at 0 dB are no filter at all and are left out of the cascade.
+void AudioOutputFilterEQ::Design(int n) {
+    Setting &t = setting[n];
+    if (t.on && (t.gainDb == 0.0f) && ((t.type == bq_type_peak) || (t.type == bq_type_lowshelf) || (t.type == bq_type_highshelf))) {
+        t.on = false;
+    }
+    if (!t.on) {
+        t.target[0] = EQ_ONE;
+        t.target[1] = t.target[2] = t.target[3] = t.target[4] = 0;
+        t.feedback = false;
+        return;
+    }
+    t.feedback = (t.type == bq_type_lowshelf) || (t.hz < EQ_FEEDBACK_HZ);
+    float c[5];
+    AudioOutputFilterBiquad::Design(t.type, t.hz / hertz, t.Q, t.gainDb, c[0], c[1], c[2], c[3], c[4]);
+    for (int i = 0; i < 5; i++) {
+        t.target[i] = (int32_t)lrintf(c[i] * EQ_ONE);
+    }
+}
+
+bool AudioOutputFilterEQ::SetSection(int n, int type, float hz, float Q, float gainDb) {
+    if (!section || !setting || (n < 0) || (n >= numSections) || (type < bq_type_lowpass) || (type > bq_type_highshelf)) {
+        return false;
+    }
+    if ((hz <= 0.0f) || (hz >= hertz / 2) || (Q <= 0.0f)) {
+        return false;
+    }
+    Setting &t = setting[n];
+    t.type = type;
+    t.hz = hz;
+    t.Q = Q;
+    t.gainDb = gainDb;
+    t.on = true;
+    Design(n);
+
+    Section &s = section[n];
+    if (!s.active && !t.on) {
+        return true;
+    }
+    uint32_t chunks = ((uint64_t)rampMs * hertz / 1000) / chunkFrames;
+    if (!chunks) {
+        // Switched at once: a section coming in starts from silence
+        if (!s.active) {
+            memset(s.z, 0, sizeof(s.z));
+        }
+        memcpy(&s.a0, t.target, sizeof(t.target));
+        s.ramp = 0;
+        s.active = t.on;
+        s.feedback = t.feedback;
+        return true;
+    }
+    // A section coming in runs its first chunk as it is, flat, which fills
+    // its history before the coefficients start to move.  Feedback is kept
+    // for the whole slide if either end needs it.
+    s.ramp = (chunks > 65535) ? 65535 : chunks;
+    s.feedback = (s.active && s.feedback) || t.feedback;
+    s.active = true;
+    return true;
+}
+
+bool AudioOutputFilterEQ::ClearSection(int n) {
+    if (!section || !setting || (n < 0) || (n >= numSections)) {
+        return false;
+    }
+    Setting &t = setting[n];
+    t.on = false;
+    Design(n);
+    Section &s = section[n];
+    if (s.active) {
+        uint32_t chunks = ((uint64_t)rampMs * hertz / 1000) / chunkFrames;
+        s.ramp = (chunks > 65535) ? 65535 : chunks;
+        if (!chunks) {
+            memcpy(&s.a0, t.target, sizeof(t.target));
+            s.active = false;
+            s.feedback = false;
+        }
+    }
+    return true;
+}
+
+bool AudioOutputFilterEQ::IsFlat() {
+    for (int i = 0; section && i < numSections; i++) {
+        if (section[i].active) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A new rate is a new track, the filters switch straight to it
+bool AudioOutputFilterEQ::SetRate(int hz) {
+    if (hz <= 0) {
+        return false;
+    }
+    hertz = hz;
+    for (int i = 0; section && setting && i < numSections; i++) {
+        Setting &t = setting[i];
+        Section &s = section[i];
+        if (t.on && (t.hz >= hertz / 2)) {
+            t.on = false;
+        }
+        Design(i);
+        memcpy(&s.a0, t.target, sizeof(t.target));
+        s.ramp = 0;
+        s.active = t.on;
+        s.feedback = t.feedback;
+    }
+    return sink->SetRate(hz);
+}
+
+bool AudioOutputFilterEQ::SetBitsPerSample(int bits) {
+    bps = bits;
+    return sink->SetBitsPerSample(16);
+}
+
+bool AudioOutputFilterEQ::SetChannels(int chan) {
+    channels = chan;
+    return sink->SetChannels(2);
+}
+
+bool AudioOutputFilterEQ::SetGain(float f) {
+    return sink->SetGain(f);
+}
+
+bool AudioOutputFilterEQ::FadeGain(float f, uint32_t ms) {
+    return sink->FadeGain(f, ms);
+}
+
+bool AudioOutputFilterEQ::IsRamping() {
+    return sink->IsRamping();
+}
+
+bool AudioOutputFilterEQ::begin() {
+    sink->SetBitsPerSample(16);
+    sink->SetChannels(2);
+    return sink->begin();
+}
+
+// One step of a ramp, landing exactly on the target with the last one
+void AudioOutputFilterEQ::Step(Section &s, const Setting &t) {
+    if (!s.ramp) {
+        return;
+    }
+    int32_t *c = &s.a0;
+    for (int i = 0; i < 5; i++) {
+        c[i] += (t.target[i] - c[i]) / (int32_t)s.ramp;
+    }
+    if (!--s.ramp) {
+        s.active = t.on;
+        s.feedback = t.feedback;
+    }
+}
+
+// One section over the block, Direct Form I, both channels in the same pass
+// so the two feedback chains overlap.  With feedback, what the shift drops
+// is added back into the next sample, so low bass filters with their poles
+// close to 1.0 don't build up rounding noise.
+template <bool feedback>
+void AudioOutputFilterEQ::Run(Section &s, int32_t *w, uint16_t frames) {
+    const int32_t a0 = s.a0, a1 = s.a1, a2 = s.a2, b1 = s.b1, b2 = s.b2;
+    int32_t lx1 = s.z[0][0], lx2 = s.z[0][1], ly1 = s.z[0][2], ly2 = s.z[0][3];
+    int32_t rx1 = s.z[1][0], rx2 = s.z[1][1], ry1 = s.z[1][2], ry2 = s.z[1][3];
+    int64_t lerr = feedback ? s.z[0][4] : 0, rerr = feedback ? s.z[1][4] : 0;
+    for (uint16_t i = 0; i < frames; i++, w += 2) {
+        int32_t lx = w[0], rx = w[1];
+        int64_t lacc = lerr + (int64_t)a0 * lx + (int64_t)a1 * lx1 + (int64_t)a2 * lx2 - (int64_t)b1 * ly1 - (int64_t)b2 * ly2;
+        int64_t racc = rerr + (int64_t)a0 * rx + (int64_t)a1 * rx1 + (int64_t)a2 * rx2 - (int64_t)b1 * ry1 - (int64_t)b2 * ry2;
+        int32_t ly = (int32_t)(lacc >> EQ_SHIFT);
+        int32_t ry = (int32_t)(racc >> EQ_SHIFT);
+        if (feedback) {
+            lerr = lacc - ((int64_t)ly << EQ_SHIFT);
+            rerr = racc - ((int64_t)ry << EQ_SHIFT);
+        }
+        lx2 = lx1;
+        lx1 = lx;
+        ly2 = ly1;
+        ly1 = ly;
+        rx2 = rx1;
+        rx1 = rx;
+        ry2 = ry1;
+        ry1 = ry;
+        w[0] = ly;
+        w[1] = ry;
+    }
+    s.z[0][0] = lx1;
+    s.z[0][1] = lx2;
+    s.z[0][2] = ly1;
+    s.z[0][3] = ly2;
+    s.z[0][4] = (int32_t)lerr;
+    s.z[1][0] = rx1;
+    s.z[1][1] = rx2;
+    s.z[1][2] = ry1;
+    s.z[1][3] = ry2;
+    s.z[1][4] = (int32_t)rerr;
+}
+
+void AudioOutputFilterEQ::Process(int32_t *w, uint16_t frames) {
+    for (int i = 0; i < numSections; i++) {
+        Section &s = section[i];
+        if (s.active && s.feedback) {
+            Run<true>(s, w, frames);
+            Step(s, setting[i]);
+        } else if (s.active) {
+            Run<false>(s, w, frames);
+            Step(s, setting[i]);
+        }
+    }
+}
+
+// Hand the pending block to the sink.  True once all of it is gone.
+bool AudioOutputFilterEQ::Drain() {
+    while (pendingPtr < pendingLen) {
+        uint16_t sent = pendingWide ? sink->ConsumeSamples32(work + 2 * pendingPtr, pendingLen - pendingPtr)
+                        : sink->ConsumeSamples(pending + 2 * pendingPtr, pendingLen - pendingPtr);
+        if (!sent) {
+            return false;
+        }
+        pendingPtr += sent;
+    }
+    pendingPtr = 0;
+    pendingLen = 0;
+    return true;
+}
+
+bool AudioOutputFilterEQ::ConsumeSample(int16_t sample[2]) {
+    return ConsumeSamples(sample, 1) == 1;
+}
+
+uint16_t AudioOutputFilterEQ::ConsumeSamples(int16_t *samples, uint16_t count) {
+    if (!Drain()) {
+        return 0;
+    }
+    bool plain = (bps == 16) && (channels == 2);
+    if (plain && IsFlat()) {
+        return sink->ConsumeSamples(samples, count);
+    }
+    uint16_t taken = 0;
+    while ((taken < count) && Drain()) {
+        uint16_t n = count - taken;
+        if (n > chunkFrames) {
+            n = chunkFrames;
+        }
+        const int16_t *src = samples + 2 * taken;
+        for (uint16_t i = 0; i < 2 * n; i += 2) {
+            int16_t ms[2] = { src[i], src[i + 1] };
+            if (!plain) {
+                MakeSampleStereo16(ms);
+            }
+            work[i] = (int32_t)ms[0] << EQ_GUARD;
+            work[i + 1] = (int32_t)ms[1] << EQ_GUARD;
+        }
+        Process(work, n);
+        for (uint16_t i = 0; i < 2 * n; i++) {
+            pending[i] = AudioGain::Saturate16((work[i] + (1 << (EQ_GUARD - 1))) >> EQ_GUARD);
+        }
+        pendingWide = false;
+        pendingLen = n;
+        taken += n;
+    }
+    Drain();
+    return taken;
+}
+
+uint16_t AudioOutputFilterEQ::ConsumeSamples32(int32_t *samples, uint16_t count) {
+    if (!Drain()) {
+        return 0;
+    }
+    if (IsFlat()) {
+        return sink->ConsumeSamples32(samples, count);
+    }
+    bool wide = sink->WantsSamples32();
+    uint16_t taken = 0;
+    while ((taken < count) && Drain()) {
+        uint16_t n = count - taken;
+        if (n > chunkFrames) {
+            n = chunkFrames;
+        }
+        const int32_t *src = samples + 2 * taken;
+        for (uint16_t i = 0; i < 2 * n; i++) {
+            work[i] = src[i] >> (16 - EQ_GUARD);
+        }
+        Process(work, n);
+        if (wide) {
+            for (uint16_t i = 0; i < 2 * n; i++) {
+                work[i] = AudioGain::Saturate32((int64_t)work[i] << (16 - EQ_GUARD));
+            }
+        } else {
+            for (uint16_t i = 0; i < 2 * n; i++) {
+                pending[i] = AudioGain::Saturate16((work[i] + (1 << (EQ_GUARD - 1))) >> EQ_GUARD);
+            }
+        }
+        pendingWide = wide;
+        pendingLen = n;
+        taken += n;
+    }
+    Drain();
+    return taken;
+}
+
+bool AudioOutputFilterEQ::WantsSamples32() {
+    return sink->WantsSamples32();
+}
+
+// What the sink can take now, less the pending block
+int AudioOutputFilterEQ::AvailableFrames() {
+    int room = sink->AvailableFrames();
+    if (room < 0) {
+        return room;
+    }
+    room -= pendingLen - pendingPtr;
+    return (room > 0) ? room : 0;
+}
+
+bool AudioOutputFilterEQ::WaitForSpace(uint32_t ms) {
+    return sink->WaitForSpace(ms);
+}
+
+void AudioOutputFilterEQ::flush() {
+    Drain();
+    sink->flush();
+}
+
+bool AudioOutputFilterEQ::stop() {
+    for (int i = 0; section && i < numSections; i++) {
+        memset(section[i].z, 0, sizeof(section[i].z));
+    }
+    pendingLen = 0;
+    pendingPtr = 0;
+    return sink->stop();
+}
+
+bool AudioOutputFilterEQ::loop() {
+    Drain();
+    return sink->loop();
+}
@@ -0,0 +1,113 @@
+/*
+    AudioOutputFilterEQ
+    Parametric EQ as a cascade of biquads run over blocks
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOOUTPUTFILTEREQ_H
+#define _AUDIOOUTPUTFILTEREQ_H
+
+#include "AudioOutput.h"
+#include "AudioOutputFilterBiquad.h"
+
+// N biquad sections (the bq_type_* filters of AudioOutputFilterBiquad) run
+// one after the other over each block, a section at a time, so its
+// coefficients and state sit in registers for the whole block instead of
+// being reloaded for every sample.  Samples go through the cascade as 32-bit
+// values with 12 bits below the 16-bit LSB (24 dB of headroom above full
+// scale), coefficients are Q28, and each section is a Direct Form I with a
+// 64-bit accumulator.  32-bit blocks keep their low bits the same way.
+// Only low shelves and sections below EQ_FEEDBACK_HZ, whose poles sit close
+// to 1.0, carry their rounding error on to the next sample; the rest skip
+// that work.
+//
+// Sections at 0 dB (or never set) are skipped, and with every section flat
+// the audio passes through untouched.  A new setting slides the
+// coefficients to their new values over a few ms instead of switching, which
+// would click; any point between two stable biquads is stable too, so the
+// slide is safe.  The sink is always fed 16-bit stereo.
+class AudioOutputFilterEQ : public AudioOutput {
+public:
+    AudioOutputFilterEQ(AudioOutput *sink, int sections = 5);
+    virtual ~AudioOutputFilterEQ() override;
+    virtual bool SetRate(int hz) override;
+    virtual bool SetBitsPerSample(int bits) override;
+    virtual bool SetChannels(int chan) override;
+    virtual bool SetGain(float f) override;
+    virtual bool FadeGain(float f, uint32_t ms) override;
+    virtual bool IsRamping() override;
+    virtual bool begin() override;
+    virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+    virtual uint16_t ConsumeSamples32(int32_t *samples, uint16_t count) override;
+    virtual bool WantsSamples32() override;
+    virtual int AvailableFrames() override;
+    virtual bool WaitForSpace(uint32_t ms) override;
+    virtual void flush() override;
+    virtual bool stop() override;
+    virtual bool loop() override;
+
+    // Section n becomes a bq_type_* filter at hz, with gainDb for the peak
+    // and shelf types.  Takes effect over the ramp time set below.
+    bool SetSection(int n, int type, float hz, float Q, float gainDb);
+    // Back to a flat section
+    bool ClearSection(int n);
+    void SetRampMs(uint32_t ms) {
+        rampMs = ms;
+    }
+    int Sections() {
+        return numSections;
+    }
+    // True when every section is skipped
+    bool IsFlat();
+
+protected:
+    struct Section {
+        int32_t a0, a1, a2, b1, b2;  // Q28, live
+        int32_t z[2][5];             // Per channel x1, x2, y1, y2, rounding error
+        uint16_t ramp;               // Chunks left to reach the target
+        bool active;
+        bool feedback;               // Rounding error goes into the next sample
+    };
+    struct Setting {
+        int type;
+        float hz, Q, gainDb;
+        bool on;
+        bool feedback;
+        int32_t target[5];
+    };
+    void Design(int n);
+    void Step(Section &s, const Setting &t);
+    template <bool feedback> void Run(Section &s, int32_t *w, uint16_t frames);
+    void Process(int32_t *w, uint16_t frames);
+    bool Drain();
+
+protected:
+    enum { chunkFrames = 32 }; // Frames per pass, and per coefficient step
+    AudioOutput *sink;
+    int numSections;
+    Section *section;
+    Setting *setting;
+    uint32_t rampMs;
+    int32_t work[2 * chunkFrames];
+    int16_t pending[2 * chunkFrames];
+    bool pendingWide;            // The pending frames are the 32-bit ones in work
+    uint16_t pendingLen;
+    uint16_t pendingPtr;
+};
+
+#endif
@@ -0,0 +1,413 @@
+/*
+    AudioOutputFilterResample
+    Polyphase fixed-point sample rate converter to one fixed output rate
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include <math.h>
+#include "AudioOutputFilterResample.h"
+
+AudioOutputFilterResample::AudioOutputFilterResample(AudioOutput *sink, int outRate, Quality quality) : AudioOutput() {
+    this->sink = sink;
+    this->outRate = outRate;
+    hertz = outRate;
+    bps = 16;
+    channels = 2;
+    table = nullptr;
+    table32 = nullptr;
+    hist = nullptr;
+    histWide = false;
+    outWide = false;
+    tableRate = 0;
+    sinkRunning = false;
+    step = 1ULL << 32;
+    SetQuality(quality);
+}
+
+AudioOutputFilterResample::~AudioOutputFilterResample() {
+    free(table);
+    free(table32);
+    free(hist);
+}
+
+bool AudioOutputFilterResample::SetQuality(Quality quality) {
+    static const uint8_t tierTaps[] = { 2, 32, 64 };
+    static const uint8_t tierPhaseBits[] = { 0, 5, 6 };
+    this->quality = quality;
+    taps = tierTaps[quality];
+    phaseBits = tierPhaseBits[quality];
+    free(table);
+    free(table32);
+    free(hist);
+    table32 = nullptr;
+    // One more phase than the fraction selects, the output interpolates
+    // between a phase and the next
+    table = (int16_t *)malloc(taps * ((1 << phaseBits) + 1) * sizeof(int16_t));
+    histSize = taps + histExtra;
+    hist = (int32_t *)malloc(2 * histSize * sizeof(int32_t));
+    tableRate = 0;
+    Reset();
+    return table && hist && (passthrough() || MakeTable());
+}
+
+// Start over with silence before the first input frame, so the first
+// output lands on it and the delay is the same for every rate
+void AudioOutputFilterResample::Reset() {
+    histLen = taps / 2 - 1;
+    if (hist) {
+        memset(hist, 0, 2 * histLen * sizeof(int32_t));
+    }
+    pos = 0;
+    outLen = 0;
+    outPtr = 0;
+}
+
+// Zeroth order modified Bessel function, for the Kaiser window
+static float besselI0(float x) {
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 32 && term > 1e-9f * sum; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Kaiser windowed sinc for the current ratio, with the stopband starting at
+// the lower of the two Nyquist rates, so nothing above the output's Nyquist
+// folds back and nothing above the input's is imaged.  The transition band
+// is as wide as the taps need for the tier's stopband, below that edge.
+// Floats here are fine, this runs once per rate change.
+bool AudioOutputFilterResample::MakeTable() {
+    if (!table) {
+        return false;
+    }
+    static const float tierStopDb[] = { 0, 70, 80 };
+    float stopDb = tierStopDb[quality];
+    float beta = (stopDb > 50) ? 0.1102f * (stopDb - 8.7f) : 0.5842f * powf(stopDb - 21, 0.4f) + 0.07886f * (stopDb - 21);
+    float transition = (stopDb - 8) / (2.285f * M_PI * taps); // Of the input Nyquist
+    float edge = (hertz > outRate) ? (float)outRate / hertz : 1.0f;
+    float fc = edge - transition / 2;
+    float norm = besselI0(beta);
+    int phases = 1 << phaseBits;
+    int center = taps / 2 - 1;
+    for (int p = 0; p <= phases; p++) {
+        // Designed straight into the row, then scaled so each phase sums to
+        // exactly 1.0 and DC goes through unchanged
+        int16_t *row = table + p * taps;
+        int32_t *row32 = table32 ? table32 + p * taps : nullptr;
+        float sum = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            int32_t total = 0, total32 = 0;
+            int peak = 0;
+            for (int k = 0; k < taps; k++) {
+                float x = k - center - (float)p / phases;
+                float h;
+                if (quality == FAST) {
+                    h = (fabsf(x) < 1.0f) ? 1.0f - fabsf(x) : 0.0f;
+                } else {
+                    float r = x / (taps / 2);
+                    float w = (fabsf(r) < 1.0f) ? besselI0(beta * sqrtf(1.0f - r * r)) / norm : 0.0f;
+                    h = fc * w * ((x == 0.0f) ? 1.0f : sinf(M_PI * fc * x) / (M_PI * fc * x));
+                }
+                if (!pass) {
+                    sum += h;
+                } else {
+                    row[k] = (int16_t)lrintf(h * 32767.0f / sum);
+                    total += row[k];
+                    peak = (row[k] > row[peak]) ? k : peak;
+                    if (row32) {
+                        row32[k] = (int32_t)lrint((double)h * (1 << 30) / sum);
+                        total32 += row32[k];
+                    }
+                }
+            }
+            if (pass) {
+                row[peak] += 32767 - total;
+            }
+            if (pass && row32) {
+                row32[peak] += (1 << 30) - total32;
+            }
+        }
+    }
+    tableRate = hertz;
+    return true;
+}
+
+void AudioOutputFilterResample::Configure() {
+    step = ((uint64_t)hertz << 32) / outRate;
+    if (passthrough()) {
+        sink->SetBitsPerSample(bps);
+        sink->SetChannels(channels);
+        return;
+    }
+    // Resampled audio is always stereo, 32-bit blocks go to the sink as such
+    sink->SetBitsPerSample(16);
+    sink->SetChannels(2);
+    if (tableRate != hertz) {
+        MakeTable();
+    }
+}
+
+bool AudioOutputFilterResample::SetRate(int hz) {
+    if (hz <= 0) {
+        return false;
+    }
+    hertz = hz;
+    Configure();
+    return true;
+}
+
+bool AudioOutputFilterResample::SetBitsPerSample(int bits) {
+    bps = bits;
+    Configure();
+    return true;
+}
+
+bool AudioOutputFilterResample::SetChannels(int chan) {
+    channels = chan;
+    Configure();
+    return true;
+}
+
+bool AudioOutputFilterResample::SetGain(float f) {
+    return sink->SetGain(f);
+}
+
+bool AudioOutputFilterResample::FadeGain(float f, uint32_t ms) {
+    return sink->FadeGain(f, ms);
+}
+
+bool AudioOutputFilterResample::IsRamping() {
+    return sink->IsRamping();
+}
+
+// The sink's rate is set once, generators begin() again for every track
+bool AudioOutputFilterResample::begin() {
+    if (!sinkRunning) {
+        sink->SetRate(outRate);
+    }
+    Configure();
+    sinkRunning = sink->begin();
+    return sinkRunning;
+}
+
+// Hand the pending output block to the sink.  True once all of it is gone.
+bool AudioOutputFilterResample::Drain() {
+    while (outPtr < outLen) {
+        uint16_t sent = outWide ? sink->ConsumeSamples32(outBlock + 2 * outPtr, outLen - outPtr)
+                        : sink->ConsumeSamples(reinterpret_cast<int16_t*>(outBlock) + 2 * outPtr, outLen - outPtr);
+        if (!sent) {
+            return false;
+        }
+        outPtr += sent;
+    }
+    outPtr = 0;
+    outLen = 0;
+    return true;
+}
+
+// Filter every output frame the history covers, then drop the input no
+// output needs any more.  False if the sink is backed up.
+bool AudioOutputFilterResample::Produce() {
+    if (!Drain()) {
+        return false;
+    }
+    int phaseShift = 32 - phaseBits;
+    while (((pos >> 32) + taps) <= histLen) {
+        if ((outLen == outFrames) && !Drain()) {
+            break;
+        }
+        uint32_t frac = (uint32_t)pos;
+        uint32_t phase = (phaseBits ? (frac >> phaseShift) : 0) * taps;
+        const int32_t *x = hist + 2 * (uint32_t)(pos >> 32);
+        // Between the two phases by the rest of the fraction
+        int32_t mix = (int32_t)((frac << phaseBits) >> 17); // Q15
+        outWide = histWide;
+        if (histWide) {
+            const int32_t *h0 = table32 + phase;
+            const int32_t *h1 = h0 + taps;
+            int64_t l0 = 0, r0 = 0, l1 = 0, r1 = 0;
+            for (int k = 0; k < taps; k++) {
+                l0 += (int64_t)x[2 * k] * h0[k];
+                r0 += (int64_t)x[2 * k + 1] * h0[k];
+                l1 += (int64_t)x[2 * k] * h1[k];
+                r1 += (int64_t)x[2 * k + 1] * h1[k];
+            }
+            // Down to Q15 first, so the blend can't overflow
+            l0 >>= 15;
+            r0 >>= 15;
+            l1 >>= 15;
+            r1 >>= 15;
+            outBlock[2 * outLen] = AudioGain::Saturate32((l0 + (((l1 - l0) * mix) >> 15) + (1 << 14)) >> 15);
+            outBlock[2 * outLen + 1] = AudioGain::Saturate32((r0 + (((r1 - r0) * mix) >> 15) + (1 << 14)) >> 15);
+        } else {
+            const int16_t *h0 = table + phase;
+            const int16_t *h1 = h0 + taps;
+            int32_t l0 = 0, r0 = 0, l1 = 0, r1 = 0;
+            for (int k = 0; k < taps; k++) {
+                l0 += x[2 * k] * h0[k];
+                r0 += x[2 * k + 1] * h0[k];
+                l1 += x[2 * k] * h1[k];
+                r1 += x[2 * k + 1] * h1[k];
+            }
+            int32_t l = (l0 + (int32_t)(((int64_t)(l1 - l0) * mix) >> 15) + (1 << 14)) >> 15;
+            int32_t r = (r0 + (int32_t)(((int64_t)(r1 - r0) * mix) >> 15) + (1 << 14)) >> 15;
+            int16_t *o = reinterpret_cast<int16_t*>(outBlock);
+            o[2 * outLen] = AudioGain::Saturate16(l);
+            o[2 * outLen + 1] = AudioGain::Saturate16(r);
+        }
+        outLen++;
+        pos += step;
+    }
+    uint32_t drop = pos >> 32;
+    if (drop > histLen) {
+        drop = histLen;
+    }
+    if (drop) {
+        memmove(hist, hist + 2 * drop, 2 * (histLen - drop) * sizeof(int32_t));
+        histLen -= drop;
+        pos -= (uint64_t)drop << 32;
+    }
+    return Drain();
+}
+
+bool AudioOutputFilterResample::ConsumeSample(int16_t sample[2]) {
+    return ConsumeSamples(sample, 1) == 1;
+}
+
+uint16_t AudioOutputFilterResample::ConsumeSamples(int16_t *samples, uint16_t count) {
+    if (passthrough()) {
+        return Drain() ? sink->ConsumeSamples(samples, count) : 0;
+    }
+    if (!Produce()) {
+        return 0;
+    }
+    Widen(false);
+    bool plain = (channels == 2) && (bps == 16);
+    uint16_t taken = 0;
+    while (taken < count) {
+        uint16_t n = count - taken;
+        if (n > histSize - histLen) {
+            n = histSize - histLen;
+        }
+        int32_t *dst = hist + 2 * histLen;
+        for (uint16_t i = 0; i < n; i++, dst += 2) {
+            int16_t ms[2] = { samples[2 * (taken + i)], samples[2 * (taken + i) + 1] };
+            if (!plain) {
+                MakeSampleStereo16(ms);
+            }
+            dst[0] = ms[0];
+            dst[1] = ms[1];
+        }
+        histLen += n;
+        taken += n;
+        if (!Produce()) {
+            break;
+        }
+    }
+    return taken;
+}
+
+// 32-bit blocks are always stereo
+uint16_t AudioOutputFilterResample::ConsumeSamples32(int32_t *samples, uint16_t count) {
+    if (passthrough()) {
+        return Drain() ? sink->ConsumeSamples32(samples, count) : 0;
+    }
+    if (!sink->WantsSamples32()) {
+        return AudioOutput::ConsumeSamples32(samples, count);
+    }
+    if (!Produce()) {
+        return 0;
+    }
+    Widen(true);
+    if (!table32) {
+        return AudioOutput::ConsumeSamples32(samples, count);
+    }
+    uint16_t taken = 0;
+    while (taken < count) {
+        uint16_t n = count - taken;
+        if (n > histSize - histLen) {
+            n = histSize - histLen;
+        }
+        memcpy(hist + 2 * histLen, samples + 2 * taken, 2 * n * sizeof(int32_t));
+        histLen += n;
+        taken += n;
+        if (!Produce()) {
+            break;
+        }
+    }
+    return taken;
+}
+
+// Moves what is left of the history to the width of the blocks coming in,
+// which only changes between tracks.  The Q30 table is made the first time
+// it is needed; without the memory for it 32-bit blocks are narrowed.
+void AudioOutputFilterResample::Widen(bool wide) {
+    if (wide && !table32) {
+        table32 = (int32_t *)malloc(taps * ((1 << phaseBits) + 1) * sizeof(int32_t));
+        if (!table32) {
+            wide = false;
+        } else {
+            MakeTable();
+        }
+    }
+    if (wide == histWide) {
+        return;
+    }
+    for (uint16_t i = 0; i < 2 * histLen; i++) {
+        hist[i] = wide ? (int32_t)((uint32_t)hist[i] << 16) : (hist[i] >> 16);
+    }
+    histWide = wide;
+}
+
+bool AudioOutputFilterResample::WantsSamples32() {
+    return sink->WantsSamples32();
+}
+
+// What the sink can take now, less the pending block, in input frames
+int AudioOutputFilterResample::AvailableFrames() {
+    int room = sink->AvailableFrames();
+    if (room < 0) {
+        return room;
+    }
+    room -= outLen - outPtr;
+    if (room <= 0) {
+        return 0;
+    }
+    return (int)(((uint64_t)room * step) >> 32);
+}
+
+bool AudioOutputFilterResample::WaitForSpace(uint32_t ms) {
+    return sink->WaitForSpace(ms);
+}
+
+void AudioOutputFilterResample::flush() {
+    Drain();
+    sink->flush();
+}
+
+bool AudioOutputFilterResample::stop() {
+    Reset();
+    sinkRunning = false;
+    return sink->stop();
+}
+
+bool AudioOutputFilterResample::loop() {
+    Produce();
+    return sink->loop();
+}
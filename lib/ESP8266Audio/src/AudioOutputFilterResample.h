@@ -0,0 +1,112 @@
+/*
+    AudioOutputFilterResample
+    Polyphase fixed-point sample rate converter to one fixed output rate
+
+    Copyright (C) 2017  Earle F. Philhower, III
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOOUTPUTFILTERRESAMPLE_H
+#define _AUDIOOUTPUTFILTERRESAMPLE_H
+
+#include "AudioOutput.h"
+
+// Converts whatever rate the generator sets to the sink's fixed rate, so the
+// sink is programmed once and never has to retune (and glitch) between
+// tracks.  Input at the output rate passes straight through, bit exact, and
+// 32-bit blocks with it.  When the sink keeps 32 bits, 32-bit blocks are
+// resampled in 32 bits as well, with a Q30 copy of the table made on the
+// first one and 64-bit accumulators; 16-bit input keeps the Q15 table and
+// 32-bit sums.
+//
+// Each output frame comes from the two phases of a Kaiser windowed sinc
+// either side of the fractional input position, taken from a Q15 table and
+// blended by the rest of the fraction.  Its stopband starts at the lower of
+// the two Nyquist rates.  The table is built on a rate change, the
+// per-sample work is integer multiply-accumulates only.  Quality tiers trade
+// taps for CPU and treble (the passband ends where the transition band
+// starts, about 15.5 kHz for GOOD and 18 kHz for BEST from 48 kHz):
+//
+//   FAST   2 taps, linear interpolation, audible aliasing on bright material
+//   GOOD  32 taps x 32 phases, 70 dB stopband, 2 KB table
+//   BEST  64 taps x 64 phases, 80 dB stopband, 8 KB table
+//
+// MacsPerFrame() gives the cost of the current setting; tests/host/resample
+// measures each tier.
+class AudioOutputFilterResample : public AudioOutput {
+public:
+    enum Quality { FAST, GOOD, BEST };
+
+    AudioOutputFilterResample(AudioOutput *sink, int outRate = 44100, Quality quality = GOOD);
+    virtual ~AudioOutputFilterResample() override;
+    virtual bool SetRate(int hz) override;
+    virtual bool SetBitsPerSample(int bits) override;
+    virtual bool SetChannels(int chan) override;
+    virtual bool SetGain(float f) override;
+    virtual bool FadeGain(float f, uint32_t ms) override;
+    virtual bool IsRamping() override;
+    virtual bool begin() override;
+    virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+    virtual uint16_t ConsumeSamples32(int32_t *samples, uint16_t count) override;
+    virtual bool WantsSamples32() override;
+    virtual int AvailableFrames() override;
+    virtual bool WaitForSpace(uint32_t ms) override;
+    virtual void flush() override;
+    virtual bool stop() override;
+    virtual bool loop() override;
+
+    bool SetQuality(Quality quality);
+    // Multiply-accumulates per output frame, 0 while passing through
+    int MacsPerFrame() {
+        return passthrough() ? 0 : 4 * taps;
+    }
+
+protected:
+    bool passthrough() {
+        return hertz == outRate;
+    }
+    void Reset();
+    void Configure();
+    bool MakeTable();
+    void Widen(bool wide);
+    bool Produce();
+    bool Drain();
+
+protected:
+    enum { outFrames = 64 }; // Frames handed to the sink at a time
+    enum { histExtra = 128 }; // Input frames buffered beyond the filter length
+    AudioOutput *sink;
+    int outRate;
+    Quality quality;
+    int taps;
+    int phaseBits;
+    int16_t *table;      // [phase][tap], Q15, each phase sums to 1.0
+    int32_t *table32;    // The same in Q30, once a 32-bit block comes in
+    int tableRate;       // Input rate the table was made for
+    bool sinkRunning;
+    int32_t *hist;       // Interleaved stereo input
+    bool histWide;       // hist holds 32-bit samples, not 16-bit ones
+    uint16_t histLen;
+    uint16_t histSize;
+    uint64_t pos;        // Q32.32 input frame of the next output's first tap
+    uint64_t step;       // Q32.32 input frames per output frame
+    int32_t outBlock[2 * outFrames]; // 16-bit frames in its first half unless outWide
+    bool outWide;
+    uint16_t outLen;
+    uint16_t outPtr;
+};
+
+#endif
@@ -33,6 +33,14 @@ AudioOutputI2S::AudioOutputI2S(int port, int output_mode, int dma_buf_count, int
     this->portNo = port;
     this->i2sOn = false;
     this->dma_buf_count = dma_buf_count;
+    this->dma_buf_len = 128;
+#ifdef ESP32
+    stage = nullptr;
+    stageLen = 0;
+    frameWords = 1;
+    i2sEvents = NULL;
+    dmaFreeBytes = 0;
+#endif
     if (output_mode != EXTERNAL_I2S && output_mode != INTERNAL_DAC && output_mode != INTERNAL_PDM) {
         output_mode = EXTERNAL_I2S;
     }
@@ -42,6 +50,7 @@ AudioOutputI2S::AudioOutputI2S(int port, int output_mode, int dma_buf_count, int
     //set defaults
     mono = false;
     lsb_justified = false;
+    slotBits = 16;
     bps = 16;
     channels = 2;
     hertz = 44100;
@@ -55,7 +64,9 @@ AudioOutputI2S::AudioOutputI2S(int port, int output_mode, int dma_buf_count, int
 #elif defined(ARDUINO_ARCH_RP2040)
 AudioOutputI2S::AudioOutputI2S(long sampleRate, pin_size_t sck, pin_size_t data) {
     i2sOn = false;
+    dma_buf_len = 128;
     mono = false;
+    slotBits = 16;
     bps = 16;
     channels = 2;
     hertz = sampleRate;
@@ -188,6 +199,26 @@ bool AudioOutputI2S::SetMclk(bool enabled) {
     return true;
 }
 
+// Wider slots carry 32-bit samples from the generators, with the gain
+// applied before they are cut to what the DAC takes.  A 24-bit DAC is
+// sent 32-bit slots too, that is what such DACs expect and it spares the
+// driver's 24-bit packing.
+bool AudioOutputI2S::SetSlotBits(int bits) {
+    if (i2sOn || ((bits != 16) && (bits != 24) && (bits != 32))) {
+        return false;
+    }
+#ifdef ESP32
+    if ((bits > 16) && (output_mode == INTERNAL_DAC || output_mode == INTERNAL_PDM)) {
+        return false;    // The internal DAC only takes 16-bit slots
+    }
+    slotBits = bits;
+    frameWords = (bits > 16) ? 2 : 1;
+    return true;
+#else
+    return bits == 16;
+#endif
+}
+
 bool AudioOutputI2S::begin(bool txDAC) {
 #ifdef ESP32
     if (!i2sOn) {
@@ -241,12 +272,12 @@ bool AudioOutputI2S::begin(bool txDAC) {
         i2s_config_t i2s_config_dac = {
             .mode = mode,
             .sample_rate = 44100,
-            .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+            .bits_per_sample = (frameWords == 2) ? I2S_BITS_PER_SAMPLE_32BIT : I2S_BITS_PER_SAMPLE_16BIT,
             .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
             .communication_format = comm_fmt,
             .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1, // lowest interrupt priority
             .dma_buf_count = dma_buf_count,
-            .dma_buf_len = 128,
+            .dma_buf_len = dma_buf_len,
             .use_apll = use_apll, // Use audio PLL
             .tx_desc_auto_clear = true, // Silence on underflow
             .fixed_mclk = use_mclk, // Unused
@@ -255,10 +286,18 @@ bool AudioOutputI2S::begin(bool txDAC) {
             .bits_per_chan = I2S_BITS_PER_CHAN_DEFAULT // Use bits per sample
 #endif
         };
+        stage = (uint32_t *)malloc(dma_buf_len * frameBytes());
+        if (!stage) {
+            audioLogger->println("ERROR: Unable to allocate I2S staging buffer\n");
+            return false;
+        }
+        stageLen = 0;
         audioLogger->printf("+%d %p\n", portNo, &i2s_config_dac);
-        if (i2s_driver_install((i2s_port_t)portNo, &i2s_config_dac, 0, NULL) != ESP_OK) {
+        // The event queue is only used to track how much DMA space has drained
+        if (i2s_driver_install((i2s_port_t)portNo, &i2s_config_dac, dma_buf_count, &i2sEvents) != ESP_OK) {
             audioLogger->println("ERROR: Unable to install I2S drives\n");
         }
+        dmaFreeBytes = dma_buf_count * dma_buf_len * frameBytes();
         if (output_mode == INTERNAL_DAC || output_mode == INTERNAL_PDM) {
 #if CONFIG_IDF_TARGET_ESP32
             i2s_set_pin((i2s_port_t)portNo, NULL);
@@ -311,6 +350,9 @@ bool AudioOutputI2S::begin(bool txDAC) {
 }
 
 bool AudioOutputI2S::ConsumeSample(int16_t sample[2]) {
+#ifdef ESP32
+    return ConsumeSamples(sample, 1) == 1;
+#else
 
     //return if we haven't called ::begin yet
     if (!i2sOn) {
@@ -328,34 +370,180 @@ bool AudioOutputI2S::ConsumeSample(int16_t sample[2]) {
         int32_t ttl = ms[LEFTCHANNEL] + ms[RIGHTCHANNEL];
         ms[LEFTCHANNEL] = ms[RIGHTCHANNEL] = (ttl >> 1) & 0xffff;
     }
-#ifdef ESP32
-    uint32_t s32;
-    if (output_mode == INTERNAL_DAC) {
-        int16_t l = Amplify(ms[LEFTCHANNEL]) + 0x8000;
-        int16_t r = Amplify(ms[RIGHTCHANNEL]) + 0x8000;
-        s32 = ((r & 0xffff) << 16) | (l & 0xffff);
-    } else {
-        s32 = ((Amplify(ms[RIGHTCHANNEL])) << 16) | (Amplify(ms[LEFTCHANNEL]) & 0xffff);
-    }
-    //"i2s_write_bytes" has been removed in the ESP32 Arduino 2.0.0,  use "i2s_write" instead.
-    //    return i2s_write_bytes((i2s_port_t)portNo, (const char *)&s32, sizeof(uint32_t), 0);
-
-    size_t i2s_bytes_written;
-    i2s_write((i2s_port_t)portNo, (const char*)&s32, sizeof(uint32_t), &i2s_bytes_written, 0);
-    return i2s_bytes_written;
-#elif defined(ESP8266)
-    uint32_t s32 = ((Amplify(ms[RIGHTCHANNEL])) << 16) | (Amplify(ms[LEFTCHANNEL]) & 0xffff);
+    ApplyGain(ms, 1);
+#if defined(ESP8266)
+    uint32_t s32 = ((ms[RIGHTCHANNEL]) << 16) | (ms[LEFTCHANNEL] & 0xffff);
     return i2s_write_sample_nb(s32); // If we can't store it, return false.  OTW true
 #elif defined(ARDUINO_ARCH_RP2040)
-    uint32_t s32 = ((Amplify(ms[RIGHTCHANNEL])) << 16) | (Amplify(ms[LEFTCHANNEL]) & 0xffff);
+    uint32_t s32 = ((ms[RIGHTCHANNEL]) << 16) | (ms[LEFTCHANNEL] & 0xffff);
     return !!i2s.write((int32_t)s32, false);
 #endif
+#endif
+}
+
+#ifdef ESP32
+// Convert a run of frames to the 32-bit I2S slot format, with mono mixing and
+// gain.  Every frame passed in is taken, so a gain ramp may scale them in place.
+void AudioOutputI2S::PackBlock(int16_t *samples, uint32_t *dest, uint16_t count) {
+    uint16_t offset = (output_mode == INTERNAL_DAC) ? 0x8000 : 0;
+    if (frameWords == 2) {
+        // Widen first so the gain works on 32 bits and quiet volumes keep
+        // the detail of the source
+        int32_t wide[2 * 32];
+        while (count) {
+            uint16_t n = (count < 32) ? count : 32;
+            for (uint16_t i = 0; i < n; i++, samples += 2) {
+                int16_t ms[2] = { samples[0], samples[1] };
+                MakeSampleStereo16(ms);
+                wide[2 * i] = (int32_t)ms[LEFTCHANNEL] << 16;
+                wide[2 * i + 1] = (int32_t)ms[RIGHTCHANNEL] << 16;
+            }
+            PackBlock(wide, dest, n);
+            dest += 2 * n;
+            count -= n;
+        }
+        return;
+    }
+    if ((channels == 2) && (bps == 16) && !this->mono) {
+        // The usual case, straight through the block kernel
+        if (gain.IsRamping()) {
+            gain.Apply(samples, count);
+            AudioGain::Pack(samples, dest, count, AudioGain::unity, offset);
+        } else {
+            AudioGain::Pack(samples, dest, count, gain.Gain(), offset);
+        }
+        return;
+    }
+    for (uint16_t i = 0; i < count; i++, samples += 2) {
+        int16_t ms[2];
+
+        ms[0] = samples[0];
+        ms[1] = samples[1];
+        MakeSampleStereo16(ms);
+
+        if (this->mono) {
+            // Average the two samples and overwrite
+            int32_t ttl = ms[LEFTCHANNEL] + ms[RIGHTCHANNEL];
+            ms[LEFTCHANNEL] = ms[RIGHTCHANNEL] = (ttl >> 1) & 0xffff;
+        }
+        ApplyGain(ms, 1);
+        AudioGain::Pack(ms, dest + i, 1, AudioGain::unity, offset);
+    }
+}
+
+// 32-bit slots, left then right, with mono mixing and gain.  Like the 16-bit
+// version every frame passed in is taken and may be scaled in place.
+void AudioOutputI2S::PackBlock(int32_t *samples, uint32_t *dest, uint16_t count) {
+    if (this->mono) {
+        for (uint16_t i = 0; i < count; i++) {
+            int32_t avg = (int32_t)(((int64_t)samples[2 * i] + samples[2 * i + 1]) >> 1);
+            samples[2 * i] = samples[2 * i + 1] = avg;
+        }
+    }
+    gain.Apply(samples, count);
+    memcpy(dest, samples, count * 2 * sizeof(uint32_t));
 }
 
+// Hand the staging block to the driver, keeping whatever it couldn't take
+bool AudioOutputI2S::FlushStage(TickType_t wait) {
+    if (!stageLen) {
+        return true;
+    }
+    //"i2s_write_bytes" has been removed in the ESP32 Arduino 2.0.0,  use "i2s_write" instead.
+    size_t i2s_bytes_written = 0;
+    i2s_write((i2s_port_t)portNo, (const char*)stage, stageLen * frameBytes(), &i2s_bytes_written, wait);
+    uint16_t frames = i2s_bytes_written / frameBytes();
+    dmaFreeBytes -= i2s_bytes_written;
+    if (dmaFreeBytes < 0) {
+        dmaFreeBytes = 0;
+    }
+    if (frames < stageLen) {
+        memmove(stage, stage + frames * frameWords, (stageLen - frames) * frameBytes());
+    }
+    stageLen -= frames;
+    return stageLen == 0;
+}
+
+uint16_t AudioOutputI2S::ConsumeSamples(int16_t *samples, uint16_t count) {
+    return StageSamples(samples, count);
+}
+
+uint16_t AudioOutputI2S::ConsumeSamples32(int32_t *samples, uint16_t count) {
+    if (frameWords == 1) {
+        return AudioOutput::ConsumeSamples32(samples, count);
+    }
+    return StageSamples(samples, count);
+}
+
+bool AudioOutputI2S::WantsSamples32() {
+    return frameWords == 2;
+}
+
+template <class T>
+uint16_t AudioOutputI2S::StageSamples(T *samples, uint16_t count) {
+    //return if we haven't called ::begin yet
+    if (!i2sOn) {
+        return 0;
+    }
+
+    uint16_t taken = 0;
+    while (taken < count) {
+        if ((stageLen == dma_buf_len) && !FlushStage(0)) {
+            break; // DMA is full, the generator will resend the rest
+        }
+        uint16_t n = count - taken;
+        if (n > dma_buf_len - stageLen) {
+            n = dma_buf_len - stageLen;
+        }
+        PackBlock(samples + 2 * taken, stage + stageLen * frameWords, n);
+        stageLen += n;
+        taken += n;
+    }
+    if (stageLen == dma_buf_len) {
+        FlushStage(0);
+    }
+    return taken;
+}
+
+int AudioOutputI2S::AvailableFrames() {
+    if (!i2sOn) {
+        return 0;
+    }
+    i2s_event_t evt;
+    while (xQueueReceive(i2sEvents, &evt, 0) == pdTRUE) {
+        if (evt.type == I2S_EVENT_TX_DONE) {
+            dmaFreeBytes += dma_buf_len * frameBytes();
+        }
+    }
+    int dmaBytes = dma_buf_count * dma_buf_len * frameBytes();
+    if (dmaFreeBytes > dmaBytes) {
+        dmaFreeBytes = dmaBytes;
+    }
+    // A full stage means nobody has pushed it out yet, try now so we never report 0 forever
+    if (stageLen == dma_buf_len) {
+        FlushStage(0);
+    }
+    return (dma_buf_len - stageLen) + dmaFreeBytes / frameBytes();
+}
+
+bool AudioOutputI2S::WaitForSpace(uint32_t ms) {
+    if (!i2sOn) {
+        return false;
+    }
+    if (stageLen < dma_buf_len) {
+        return true;
+    }
+    // i2s_write sleeps until a DMA buffer is released, then takes what fits
+    FlushStage(pdMS_TO_TICKS(ms));
+    return stageLen < dma_buf_len;
+}
+#endif
+
 void AudioOutputI2S::flush() {
 #ifdef ESP32
     // makes sure that all stored DMA samples are consumed / played
-    int buffersize = 128 * this->dma_buf_count;
+    FlushStage(portMAX_DELAY);
+    int buffersize = dma_buf_len * this->dma_buf_count;
     int16_t samples[2] = {0x0, 0x0};
     for (int i = 0; i < buffersize; i++) {
         while (!ConsumeSample(samples)) {
@@ -376,6 +564,10 @@ bool AudioOutputI2S::stop() {
     i2s_zero_dma_buffer((i2s_port_t)portNo);
     audioLogger->printf("UNINSTALL I2S\n");
     i2s_driver_uninstall((i2s_port_t)portNo); //stop & destroy i2s driver
+    i2sEvents = NULL;
+    free(stage);
+    stage = nullptr;
+    stageLen = 0;
 #elif defined(ESP8266)
     i2s_end();
 #elif defined(ARDUINO_ARCH_RP2040)
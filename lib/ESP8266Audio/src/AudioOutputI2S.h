@@ -46,6 +46,13 @@ public:
         return begin(true);
     }
     virtual bool ConsumeSample(int16_t sample[2]) override;
+#ifdef ESP32
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+    virtual uint16_t ConsumeSamples32(int32_t *samples, uint16_t count) override;
+    virtual bool WantsSamples32() override;
+    virtual int AvailableFrames() override;
+    virtual bool WaitForSpace(uint32_t ms) override;
+#endif
     virtual void flush() override;
     virtual bool stop() override;
 
@@ -54,6 +61,7 @@ public:
     bool SetLsbJustified(bool lsbJustified);  // Allow supporting non-I2S chips, e.g. PT8211
     bool SetMclk(bool enabled);  // Enable MCLK output (if supported)
     bool SwapClocks(bool swap_clocks);  // Swap BCLK and WCLK
+    bool SetSlotBits(int bits);  // 16, or 24/32 for DACs taking 32-bit slots (ESP32 only, before begin())
 
 protected:
     bool SetPinout();
@@ -62,6 +70,7 @@ protected:
     }
     uint8_t portNo;
     int output_mode;
+    int dma_buf_len;
     bool mono;
     int lsb_justified;
     bool i2sOn;
@@ -69,6 +78,7 @@ protected:
     int use_apll;
     bool use_mclk;
     bool swap_clocks;
+    int slotBits;
     // We can restore the old values and free up these pins when in NoDAC mode
     uint32_t orig_bck;
     uint32_t orig_ws;
@@ -78,6 +88,24 @@ protected:
     uint8_t doutPin;
     uint8_t mclkPin;
 
+#ifdef ESP32
+    // Frames are packed into a staging block one DMA buffer long and handed
+    // to the driver with a single i2s_write() once it fills.  A frame is one
+    // word with 16-bit slots, two (left, right) with 32-bit ones.
+    uint32_t *stage;
+    uint16_t stageLen;
+    uint8_t frameWords;
+    QueueHandle_t i2sEvents;
+    int dmaFreeBytes; // Estimate from TX_DONE events, never above the DMA total
+    int frameBytes() {
+        return frameWords * sizeof(uint32_t);
+    }
+    void PackBlock(int16_t *samples, uint32_t *dest, uint16_t count);
+    void PackBlock(int32_t *samples, uint32_t *dest, uint16_t count);
+    template <class T> uint16_t StageSamples(T *samples, uint16_t count);
+    bool FlushStage(TickType_t wait);
+#endif
+
 #if defined(ARDUINO_ARCH_RP2040)
     I2S i2s;
 #endif
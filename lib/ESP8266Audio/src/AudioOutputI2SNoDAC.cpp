@@ -81,7 +81,9 @@ bool AudioOutputI2SNoDAC::SetOversampling(int os) {
 void AudioOutputI2SNoDAC::DeltaSigma(int16_t sample[2], uint32_t dsBuff[8]) {
     // Not shift 8 because addition takes care of one mult x 2
     int32_t sum = (((int32_t)sample[0]) + ((int32_t)sample[1])) >> 1;
-    fixed24p8_t newSamp = ((int32_t)Amplify(sum)) << 8;
+    int16_t ms[2] = { (int16_t)sum, (int16_t)sum };
+    ApplyGain(ms, 1);
+    fixed24p8_t newSamp = ((int32_t)ms[0]) << 8;
 
     int oversample32 = oversample / 32;
     // How much the comparison signal changes each oversample step
@@ -91,16 +91,20 @@ public:
             dac_init();
         }
         auto u8_samples = (uint8_t*)samples;
+        uint16_t n = 0;
 
+        // count is in stereo frames, pack down to "channels" bytes per frame
         for (int i = 0 ; i < count ; ++i) {
-            if (bps == 16) { // int16 to uint8
-                u8_samples[i] = (samples[i] + 32768) / 257;
-            } else {
-                u8_samples[i] = samples[i];
+            for (int c = 0 ; c < channels ; ++c) {
+                if (bps == 16) { // int16 to uint8
+                    u8_samples[n++] = (samples[2 * i + c] + 32768) / 257;
+                } else {
+                    u8_samples[n++] = samples[2 * i + c];
+                }
             }
         }
 
-        dac_write(u8_samples, count);
+        dac_write(u8_samples, n);
         return count;
     }
 
@@ -43,40 +43,62 @@ bool AudioOutputMixerStub::SetChannels(int channels) {
     return parent->SetChannels(channels, id);
 }
 
+void AudioOutputMixerStub::RampGain(float f, uint32_t frames) {
+    gain.RampTo(AudioGain::FromFloat(f), frames);
+}
+
 bool AudioOutputMixerStub::begin() {
     return parent->begin(id);
 }
 
 bool AudioOutputMixerStub::ConsumeSample(int16_t sample[2]) {
-    int16_t amp[2];
-    amp[LEFTCHANNEL] = Amplify(sample[LEFTCHANNEL]);
-    amp[RIGHTCHANNEL] = Amplify(sample[RIGHTCHANNEL]);
-    return parent->ConsumeSample(amp, id);
+    int16_t amp[2] = { sample[LEFTCHANNEL], sample[RIGHTCHANNEL] };
+    return ConsumeSamples(amp, 1) == 1;
+}
+
+uint16_t AudioOutputMixerStub::ConsumeSamples(int16_t *samples, uint16_t count) {
+    // Only scale what the mixer will take, the caller resends the rest as is
+    int room = parent->AvailableFrames(id);
+    if (count > room) {
+        count = room;
+    }
+    ApplyGain(samples, count);
+    return parent->ConsumeSamples(samples, count, id);
+}
+
+int AudioOutputMixerStub::AvailableFrames() {
+    return parent->AvailableFrames(id);
 }
 
 bool AudioOutputMixerStub::stop() {
     return parent->stop(id);
 }
 
+bool AudioOutputMixerStub::loop() {
+    return parent->loop();
+}
+
 
 
 AudioOutputMixer::AudioOutputMixer(int buffSizeSamples, AudioOutput *dest) : AudioOutput() {
     buffSize = buffSizeSamples;
     leftAccum = (int32_t*)calloc(buffSize, sizeof(int32_t));
     rightAccum = (int32_t*)calloc(buffSize, sizeof(int32_t));
+    outBlock = (int16_t*)malloc(outFrames * 2 * sizeof(int16_t));
+    readPos = 0;
+    frontier = 0;
     for (int i = 0; i < maxStubs; i++) {
         stubAllocated[i] = false;
         stubRunning[i] = false;
-        writePtr[i] = 0;
+        writePos[i] = 0;
     }
-    readPtr = 0;
     sink = dest;
-    sinkStarted = false;
 }
 
 AudioOutputMixer::~AudioOutputMixer() {
     free(leftAccum);
     free(rightAccum);
+    free(outBlock);
 }
 
 
@@ -127,14 +149,18 @@ bool AudioOutputMixer::SetChannels(int channels, int id) {
 }
 
 bool AudioOutputMixer::begin(int id) {
+    bool idle = true;
+    for (int i = 0; i < maxStubs; i++) {
+        idle = idle && !stubRunning[i];
+    }
+    if (!stubRunning[id]) {
+        writePos[id] = frontier;
+    }
     stubRunning[id] = true;
 
-    if (!sinkStarted) {
-        sinkStarted = true;
-        return sink->begin();
-    } else {
-        return true;
-    }
+    // The sink is started when the first input comes in, and again after
+    // everything had stopped
+    return idle ? sink->begin() : true;
 }
 
 AudioOutputMixerStub *AudioOutputMixer::NewInput() {
@@ -142,7 +168,7 @@ AudioOutputMixerStub *AudioOutputMixer::NewInput() {
         if (!stubAllocated[i]) {
             stubAllocated[i] = true;
             stubRunning[i] = false;
-            writePtr[i] = readPtr; // TODO - should it be 1 before readPtr?
+            writePos[i] = frontier;
             AudioOutputMixerStub *stub = new AudioOutputMixerStub(this, i);
             return stub;
         }
@@ -156,64 +182,91 @@ void AudioOutputMixer::RemoveInput(int id) {
 }
 
 bool AudioOutputMixer::loop() {
-    // First, try and fill I2S...
-    // This is not optimal, but algorithmically should work fine
-    bool avail;
-    do {
-        avail = true;
-        for (int i = 0; i < maxStubs && avail; i++) {
-            if (stubRunning[i] && writePtr[i] == readPtr) {
-                avail = false;  // The read pointer is touching an active writer, can't advance
-            }
+    // Everything up to the slowest running input is complete.  With none
+    // running, what's left in the buffer is flushed.
+    uint32_t ready = frontier - readPos;
+    for (int i = 0; i < maxStubs; i++) {
+        if (stubRunning[i] && (writePos[i] - readPos < ready)) {
+            ready = writePos[i] - readPos;
+        }
+    }
+
+    while (ready) {
+        // One contiguous run of the ring, clipped into outBlock
+        int idx = readPos % buffSize;
+        uint32_t run = buffSize - idx;
+        if (run > ready) {
+            run = ready;
         }
-        if (avail) {
-            int16_t s[2];
-            if (leftAccum[readPtr] > 32767) {
-                s[LEFTCHANNEL] = 32767;
-            } else if (leftAccum[readPtr] < -32767) {
-                s[LEFTCHANNEL] = -32767;
-            } else {
-                s[LEFTCHANNEL] = leftAccum[readPtr];
-            }
-            if (rightAccum[readPtr] > 32767) {
-                s[RIGHTCHANNEL] = 32767;
-            } else if (rightAccum[readPtr] < -32767) {
-                s[RIGHTCHANNEL] = -32767;
-            } else {
-                s[RIGHTCHANNEL] = rightAccum[readPtr];
-            }
-            //      s[LEFTCHANNEL] = Amplify(s[LEFTCHANNEL]);
-            //      s[RIGHTCHANNEL] = Amplify(s[RIGHTCHANNEL]);
-            if (!sink->ConsumeSample(s)) {
-                break; // Can't stuff any more in I2S...
-            }
-            // Clear the accums and advance the pointer to next potential sample
-            leftAccum[readPtr] = 0;
-            rightAccum[readPtr] = 0;
-            readPtr = (readPtr + 1) % buffSize;
+        if (run > outFrames) {
+            run = outFrames;
         }
-    } while (avail);
+        const int32_t *l = leftAccum + idx;
+        const int32_t *r = rightAccum + idx;
+        int16_t *o = outBlock;
+        for (uint32_t i = 0; i < run; i++) {
+            *(o++) = (l[i] > 32767) ? 32767 : (l[i] < -32767) ? -32767 : l[i];
+            *(o++) = (r[i] > 32767) ? 32767 : (r[i] < -32767) ? -32767 : r[i];
+        }
+        uint16_t sent = sink->ConsumeSamples(outBlock, run);
+        // Clear the accums behind the read position for the next pass round
+        memset(leftAccum + idx, 0, sent * sizeof(int32_t));
+        memset(rightAccum + idx, 0, sent * sizeof(int32_t));
+        readPos += sent;
+        ready -= sent;
+        if (sent < run) {
+            break; // Can't stuff any more in I2S...
+        }
+    }
     return true;
 }
 
 bool AudioOutputMixer::ConsumeSample(int16_t sample[2], int id) {
-    loop(); // Send any pre-existing, completed I2S data we can fit
+    return ConsumeSamples(sample, 1, id) == 1;
+}
 
-    // Now, do we have space for a new sample?
-    int nextWritePtr = (writePtr[id] + 1) % buffSize;
-    if (nextWritePtr == readPtr) {
-        return false;
+int AudioOutputMixer::AvailableFrames(int id) {
+    loop(); // Send any pre-existing, completed I2S data we can fit
+    if (!stubRunning[id]) {
+        return 0;
     }
+    return buffSize - (writePos[id] - readPos);
+}
 
-    leftAccum[writePtr[id]] += sample[LEFTCHANNEL];
-    rightAccum[writePtr[id]] += sample[RIGHTCHANNEL];
-    writePtr[id] = nextWritePtr;
-    return true;
+uint16_t AudioOutputMixer::ConsumeSamples(int16_t *samples, uint16_t count, int id) {
+    if (!stubRunning[id]) {
+        return 0;
+    }
+    uint32_t room = buffSize - (writePos[id] - readPos);
+    if (count > room) {
+        count = room;
+    }
+    // At most two runs, one up to the end of the ring and one from its start
+    uint16_t done = 0;
+    while (done < count) {
+        int idx = writePos[id] % buffSize;
+        uint16_t run = buffSize - idx;
+        if (run > count - done) {
+            run = count - done;
+        }
+        int32_t *l = leftAccum + idx;
+        int32_t *r = rightAccum + idx;
+        const int16_t *s = samples + 2 * done;
+        for (uint16_t i = 0; i < run; i++) {
+            l[i] += s[2 * i + LEFTCHANNEL];
+            r[i] += s[2 * i + RIGHTCHANNEL];
+        }
+        writePos[id] += run;
+        done += run;
+    }
+    if (writePos[id] - readPos > frontier - readPos) {
+        frontier = writePos[id];
+    }
+    return count;
 }
 
 bool AudioOutputMixer::stop(int id) {
     stubRunning[id] = false;
+    loop(); // Nothing waits on this input any more, send what it left
     return true;
 }
-
-
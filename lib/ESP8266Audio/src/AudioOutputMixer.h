@@ -36,7 +36,14 @@ public:
     virtual bool SetChannels(int channels) override;
     virtual bool begin() override;
     virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+    virtual int AvailableFrames() override;
     virtual bool stop() override;
+    virtual bool loop() override;
+
+    // Slide the gain linearly to f over the next frames written, e.g. to fade
+    // one input out while another comes in.  Replaces any ramp in progress.
+    void RampGain(float f, uint32_t frames);
 
 protected:
     AudioOutputMixer *parent;
@@ -57,6 +64,9 @@ public:
     virtual bool loop() override; // Send all existing samples we can to I2S
 
     AudioOutputMixerStub *NewInput(); // Get a new stub to pass to a generator
+    bool IsEmpty() { // Everything written has gone to the sink
+        return readPos == frontier;
+    }
 
     // Stub called functions
     friend class AudioOutputMixerStub;
@@ -67,19 +77,26 @@ private:
     bool SetChannels(int channels, int id);
     bool begin(int id);
     bool ConsumeSample(int16_t sample[2], int id);
+    uint16_t ConsumeSamples(int16_t *samples, uint16_t count, int id);
+    int AvailableFrames(int id);
     bool stop(int id);
 
 protected:
     enum { maxStubs = 8 };
+    enum { outFrames = 64 }; // Frames clipped and handed to the sink at a time
     AudioOutput *sink;
-    bool sinkStarted;
     int16_t buffSize;
     int32_t *leftAccum;
     int32_t *rightAccum;
+    int16_t *outBlock;
     bool stubAllocated[maxStubs];
     bool stubRunning[maxStubs];
-    int16_t writePtr[maxStubs]; // Array of pointers for allocated stubs
-    int16_t readPtr;
+    // Positions are running frame counts, the ring index is pos % buffSize.
+    // frontier is the furthest any input has written, where a newly begun
+    // input starts, so it never lands on audio already queued for the sink.
+    uint32_t writePos[maxStubs];
+    uint32_t readPos;
+    uint32_t frontier;
 };
 
 #endif
@@ -33,9 +33,12 @@ public:
         return true;
     }
     virtual bool ConsumeSample(int16_t sample[2]) {
-        (void)sample;
-        samples++;
-        return true;
+        return ConsumeSamples(sample, 1) == 1;
+    }
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) {
+        (void)samples;
+        this->samples += count;
+        return count;
     }
     virtual bool stop() {
         endms = millis();
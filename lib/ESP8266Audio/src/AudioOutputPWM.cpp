@@ -94,8 +94,7 @@ bool AudioOutputPWM::ConsumeSample(int16_t sample[2]) {
         ms[LEFTCHANNEL] = ms[RIGHTCHANNEL] = (ttl >> 1) & 0xffff;
     }
 
-    ms[LEFTCHANNEL] = Amplify(ms[LEFTCHANNEL]);
-    ms[RIGHTCHANNEL] = Amplify(ms[RIGHTCHANNEL]);
+    ApplyGain(ms, 1);
 
     if (pwm.available()) {
         pwm.write((int16_t) ms[0]);
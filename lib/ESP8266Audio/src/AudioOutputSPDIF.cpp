@@ -262,7 +262,8 @@ bool AudioOutputSPDIF::ConsumeSample(int16_t sample[2]) {
     // BMC encoded with two table lookups (and at the same time flipped to LSB first).
     // There is no separate word-clock, so hopefully the receiver won't notice.
 
-    uint16_t sample_left = Amplify(ms[LEFTCHANNEL]);
+    ApplyGain(ms, 1);
+    uint16_t sample_left = ms[LEFTCHANNEL];
     // BMC encode and flip left channel bits
     hi = pgm_read_word(&spdif_bmclookup[(uint8_t)(sample_left >> 8)]);
     lo = pgm_read_word(&spdif_bmclookup[(uint8_t)sample_left]);
@@ -279,7 +280,7 @@ bool AudioOutputSPDIF::ConsumeSample(int16_t sample[2]) {
         buf[1] = VUCP_PREAMBLE_M | aux;
     }
 
-    uint16_t sample_right = Amplify(ms[RIGHTCHANNEL]);
+    uint16_t sample_right = ms[RIGHTCHANNEL];
     // BMC encode right channel, similar as above
     hi = pgm_read_word(&spdif_bmclookup[(uint8_t)(sample_right >> 8)]);
     lo = pgm_read_word(&spdif_bmclookup[(uint8_t)sample_right]);
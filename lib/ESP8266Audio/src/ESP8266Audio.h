@@ -25,6 +25,7 @@
 // Actual decode/audio generation logic
 #include "AudioGeneratorAAC.h"
 #include "AudioGeneratorFLAC.h"
+#include "AudioGeneratorGapless.h"
 #include "AudioGenerator.h"
 #include "AudioGeneratorMIDI.h"
 #include "AudioGeneratorMOD.h"
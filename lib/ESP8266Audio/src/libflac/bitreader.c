@@ -116,7 +116,8 @@ struct FLAC__BitReader {
     uint32_t consumed_words; /* #words ... */
     uint32_t consumed_bits; /* ... + (#bits of head word) already consumed from the front of buffer */
     uint32_t read_crc16; /* the running frame CRC */
-    uint32_t crc16_align; /* the number of bits in the current consumed word that should not be CRC'd */
+    uint32_t crc16_offset; /* the first consumed word not yet CRC'd */
+    uint32_t crc16_align; /* the number of bits in the word at crc16_offset that should not be CRC'd */
     FLAC__BitReaderReadCallback read_callback;
     void *client_data;
 };
@@ -151,6 +152,25 @@ static inline void crc16_update_word_(FLAC__BitReader *br, brword word) {
 #endif
     br->crc16_align = 0;
 }
+
+/*  Words are CRC'd in bulk once consumed, when the buffer is refilled or the
+    frame CRC is asked for, rather than one at a time in the readers */
+static inline void crc16_update_block_(FLAC__BitReader *br) {
+    if (br->consumed_words > br->crc16_offset && br->crc16_align) {
+        crc16_update_word_(br, br->buffer[br->crc16_offset++]);
+    }
+    if (br->consumed_words > br->crc16_offset) {
+#if FLAC__BYTES_PER_WORD == 4
+        br->read_crc16 = FLAC__crc16_update_words32(br->buffer + br->crc16_offset, br->consumed_words - br->crc16_offset, br->read_crc16);
+#else
+        uint32_t i;
+        for (i = br->crc16_offset; i < br->consumed_words; i++) {
+            crc16_update_word_(br, br->buffer[i]);
+        }
+#endif
+    }
+    br->crc16_offset = br->consumed_words;
+}
 #pragma GCC diagnostic pop
 
 static FLAC__bool bitreader_read_from_client_(FLAC__BitReader *br) {
@@ -160,6 +180,8 @@ static FLAC__bool bitreader_read_from_client_(FLAC__BitReader *br) {
 
     /* first shift the unconsumed buffer data toward the front as much as possible */
     if (br->consumed_words > 0) {
+        crc16_update_block_(br);
+        br->crc16_offset = 0;
         start = br->consumed_words;
         end = br->words + (br->bytes ? 1 : 0);
         memmove(br->buffer, br->buffer + start, FLAC__BYTES_PER_WORD * (end - start));
@@ -270,6 +292,7 @@ FLAC__bool FLAC__bitreader_init(FLAC__BitReader *br, FLAC__BitReaderReadCallback
 
     br->words = br->bytes = 0;
     br->consumed_words = br->consumed_bits = 0;
+    br->crc16_offset = 0;
     br->capacity = FLAC__BITREADER_DEFAULT_CAPACITY;
     br->buffer = (brword*)malloc(sizeof(brword) * br->capacity);
     if (br->buffer == 0) {
@@ -291,6 +314,7 @@ void FLAC__bitreader_free(FLAC__BitReader *br) {
     br->capacity = 0;
     br->words = br->bytes = 0;
     br->consumed_words = br->consumed_bits = 0;
+    br->crc16_offset = 0;
     br->read_callback = 0;
     br->client_data = 0;
 }
@@ -298,6 +322,7 @@ void FLAC__bitreader_free(FLAC__BitReader *br) {
 FLAC__bool FLAC__bitreader_clear(FLAC__BitReader *br) {
     br->words = br->bytes = 0;
     br->consumed_words = br->consumed_bits = 0;
+    br->crc16_offset = 0;
     return true;
 }
 #if 0
@@ -337,6 +362,7 @@ void FLAC__bitreader_reset_read_crc16(FLAC__BitReader *br, FLAC__uint16 seed) {
     FLAC__ASSERT((br->consumed_bits & 7) == 0);
 
     br->read_crc16 = (uint32_t)seed;
+    br->crc16_offset = br->consumed_words;
     br->crc16_align = br->consumed_bits;
 }
 
@@ -346,6 +372,9 @@ FLAC__uint16 FLAC__bitreader_get_read_crc16(FLAC__BitReader *br) {
     FLAC__ASSERT(0 != br);
     FLAC__ASSERT(0 != br->buffer);
     FLAC__ASSERT((br->consumed_bits & 7) == 0);
+
+    /* CRC consumed words up to here */
+    crc16_update_block_(br);
     FLAC__ASSERT(br->crc16_align <= br->consumed_bits);
 
     /* CRC any tail bytes in a partially-consumed word */
@@ -406,7 +435,6 @@ FLAC__bool FLAC__bitreader_read_raw_uint32(FLAC__BitReader *br, FLAC__uint32 *va
             /* (FLAC__BITS_PER_WORD - br->consumed_bits <= bits) ==> (FLAC__WORD_ALL_ONES >> br->consumed_bits) has no more than 'bits' non-zero bits */
             *val = (FLAC__uint32)(word & (FLAC__WORD_ALL_ONES >> br->consumed_bits));
             bits -= n;
-            crc16_update_word_(br, word);
             br->consumed_words++;
             br->consumed_bits = 0;
             if (bits) { /* if there are still bits left to read, there have to be less than 32 so they will all be in the next word */
@@ -424,7 +452,6 @@ FLAC__bool FLAC__bitreader_read_raw_uint32(FLAC__BitReader *br, FLAC__uint32 *va
             }
             /* at this point bits == FLAC__BITS_PER_WORD == 32; because of previous assertions, it can't be larger */
             *val = (FLAC__uint32)word;
-            crc16_update_word_(br, word);
             br->consumed_words++;
             return true;
         }
@@ -682,14 +709,12 @@ FLAC__bool FLAC__bitreader_read_unary_unsigned(FLAC__BitReader *br, uint32_t *va
                 i++;
                 br->consumed_bits += i;
                 if (br->consumed_bits >= FLAC__BITS_PER_WORD) { /* faster way of testing if(br->consumed_bits == FLAC__BITS_PER_WORD) */
-                    crc16_update_word_(br, br->buffer[br->consumed_words]);
                     br->consumed_words++;
                     br->consumed_bits = 0;
                 }
                 return true;
             } else {
                 *val += FLAC__BITS_PER_WORD - br->consumed_bits;
-                crc16_update_word_(br, br->buffer[br->consumed_words]);
                 br->consumed_words++;
                 br->consumed_bits = 0;
                 /* didn't find stop bit yet, have to keep going... */
@@ -809,7 +834,7 @@ FLAC__bool FLAC__bitreader_read_rice_signed_block(FLAC__BitReader *br, int vals[
             x = ucbits;
             do {
                 /* didn't find stop bit yet, have to keep going... */
-                crc16_update_word_(br, br->buffer[cwords++]);
+                cwords++;
                 if (cwords >= words) {
                     goto incomplete_msbs;
                 }
@@ -830,7 +855,7 @@ FLAC__bool FLAC__bitreader_read_rice_signed_block(FLAC__BitReader *br, int vals[
             b <<= parameter;
         } else {
             /* there are still bits left to read, they will all be in the next word */
-            crc16_update_word_(br, br->buffer[cwords++]);
+            cwords++;
             if (cwords >= words) {
                 goto incomplete_lsbs;
             }
@@ -889,7 +914,7 @@ incomplete_lsbs:
 
     if (ucbits == 0 && cwords < words) {
         /* don't leave the head word with no unconsumed bits */
-        crc16_update_word_(br, br->buffer[cwords++]);
+        cwords++;
         ucbits = FLAC__BITS_PER_WORD;
     }
 
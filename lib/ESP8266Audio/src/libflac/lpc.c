@@ -1271,6 +1271,25 @@ void FLAC__lpc_restore_signal_wide(const FLAC__int32 * flac_restrict residual, u
 }
 #endif
 
+/*
+    The prediction sum can't leave 32 bits when the coefficients' absolute
+    sum times the largest sample does not.  This only widens which 16-bit
+    subframes may take the existing 32-bit datapath; the restore loops
+    themselves are unchanged.  24-bit subframes almost never pass and stay
+    on the 64-bit one.
+*/
+FLAC__bool FLAC__lpc_prediction_fits_32bit(uint32_t subframe_bps, const FLAC__int32 qlp_coeff[], uint32_t order) {
+    FLAC__uint64 abs_sum = 0;
+    uint32_t i;
+
+    FLAC__ASSERT(subframe_bps > 0 && subframe_bps <= 32);
+
+    for (i = 0; i < order; i++) {
+        abs_sum += (qlp_coeff[i] < 0) ? -(FLAC__int64)qlp_coeff[i] : qlp_coeff[i];
+    }
+    return (abs_sum << (subframe_bps - 1)) <= 0x7fffffff;
+}
+
 #if defined(_MSC_VER)
 #pragma warning ( default : 4028 )
 #endif
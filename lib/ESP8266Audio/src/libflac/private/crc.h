@@ -54,6 +54,7 @@ FLAC__uint8 FLAC__crc8(const FLAC__byte *data, unsigned len);
 ** init = 0
 */
 extern unsigned const FLAC__crc16_table[256];
+extern FLAC__uint16 const FLAC__crc16_table_word[3][256];
 
 #define FLAC__CRC16_UPDATE(data, crc) ((((crc)<<8) & 0xffff) ^ pgm_read_word(&FLAC__crc16_table[((crc)>>8) ^ (data)]))
 /* this alternate may be faster on some systems/compilers */
@@ -62,5 +63,7 @@ extern unsigned const FLAC__crc16_table[256];
 #endif
 
 unsigned FLAC__crc16(const FLAC__byte *data, unsigned len);
+/* continues crc over len words, each holding 4 stream bytes MSB first */
+unsigned FLAC__crc16_update_words32(const FLAC__uint32 *words, unsigned len, unsigned crc);
 
 #endif
@@ -211,6 +211,15 @@ void FLAC__lpc_compute_residual_from_qlp_coefficients_wide_intrin_avx2(const FLA
 */
 void FLAC__lpc_restore_signal(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[]);
 void FLAC__lpc_restore_signal_wide(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[]);
+
+/*
+ 	FLAC__lpc_prediction_fits_32bit()
+ 	--------------------------------------------------------------------
+ 	True if no prediction sum of samples of subframe_bps bits with
+ 	these coefficients can leave 32 bits, so the 32-bit datapath
+ 	restores exactly what the 64-bit one does.
+*/
+FLAC__bool FLAC__lpc_prediction_fits_32bit(uint32_t subframe_bps, const FLAC__int32 qlp_coeff[], uint32_t order);
 #ifndef FLAC__NO_ASM
 #  ifdef FLAC__CPU_IA32
 #    ifdef FLAC__HAS_NASM
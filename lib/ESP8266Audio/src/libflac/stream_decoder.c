@@ -2839,7 +2839,7 @@ FLAC__bool read_subframe_lpc_(FLAC__StreamDecoder *decoder, uint32_t channel, ui
     /* decode the subframe */
     if (do_full_decode) {
         memcpy(decoder->private_->output[channel], subframe->warmup, sizeof(FLAC__int32) * order);
-        if (bps + subframe->qlp_coeff_precision + FLAC__bitmath_ilog2(order) <= 32)
+        if (bps + subframe->qlp_coeff_precision + FLAC__bitmath_ilog2(order) <= 32 || FLAC__lpc_prediction_fits_32bit(bps, subframe->qlp_coeff, order))
             if (bps <= 16 && subframe->qlp_coeff_precision <= 16) {
                 decoder->private_->local_lpc_restore_signal_16bit(decoder->private_->residual[channel], decoder->private_->frame.header.blocksize - order, subframe->qlp_coeff, order, subframe->quantization_level, decoder->private_->output[channel] + order);
             } else {
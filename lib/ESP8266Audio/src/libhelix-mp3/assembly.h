@@ -302,7 +302,7 @@ static __inline Word64 xSAR64(Word64 x, int n) {
 }
 //mw
 
-#elif defined(ARDUINO)
+#elif defined(ARDUINO) || defined(__GNUC__)	/* plain C, also for host builds */
 
 static __inline int FASTABS(int x) {
     int sign;
@@ -63,6 +63,8 @@
 #
 #elif defined (ARDUINO)
 #
+#elif defined(__GNUC__)	/* Host builds, e.g. tests/host */
+#
 #else
 #error No platform defined. See valid options in mp3dec.h
 #endif
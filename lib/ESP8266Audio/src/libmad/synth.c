@@ -575,9 +575,11 @@ void synth_full(struct mad_synth *, struct mad_frame const *,
 static
 enum mad_flow synth_full(struct mad_synth *synth, struct mad_frame const *frame,
                          unsigned int nch, unsigned int startns, unsigned int endns,
-                         enum mad_flow(*output_func)(void *s, struct mad_header const *, struct mad_pcm *), void *cbdata) {
+                         enum mad_flow(*output_func)(void *s, struct mad_header const *, struct mad_pcm *), void *cbdata,
+                         int16_t *out) {
     unsigned int phase, ch, s, sb, pe, po;
     int16_t *pcm1, *pcm2;
+    int const stride = out ? 2 : 1;
     mad_fixed_t (*filter)[2][2][16][8];
     mad_fixed_t const(*sbsample)[36][32];
     register mad_fixed_t (*fe)[8], (*fx)[8], (*fo)[8];
@@ -591,7 +593,8 @@ enum mad_flow synth_full(struct mad_synth *synth, struct mad_frame const *frame,
             sbsample = &frame->sbsample[ch];
             filter   = &synth->filter[ch];
             phase    = (synth->phase + start) % 16;
-            pcm1     = synth->pcm.samples[ch];// + start * 32;
+            /* one ns into pcm.samples, or the whole frame interleaved into out */
+            pcm1     = out ? out + start * 32 * 2 + ch : synth->pcm.samples[ch];
 
             for (s = start; s <= start; ++s) {
                 dct32((*sbsample)[s], phase >> 1,
@@ -629,9 +632,10 @@ enum mad_flow synth_full(struct mad_synth *synth, struct mad_frame const *frame,
                 MLA(hi, lo, (*fe)[6], ptr[ 4]);
                 MLA(hi, lo, (*fe)[7], ptr[ 2]);
 
-                *pcm1++ = scale(SHIFT(MLZ(hi, lo)));
+                *pcm1 = scale(SHIFT(MLZ(hi, lo)));
+                pcm1 += stride;
 
-                pcm2 = pcm1 + 30;
+                pcm2 = pcm1 + 30 * stride;
 
                 for (sb = 1; sb < 16; ++sb) {
                     ++fe;
@@ -660,7 +664,8 @@ enum mad_flow synth_full(struct mad_synth *synth, struct mad_frame const *frame,
                     MLA(hi, lo, (*fe)[1], ptr[14]);
                     MLA(hi, lo, (*fe)[0], ptr[ 0]);
 
-                    *pcm1++ = scale(SHIFT(MLZ(hi, lo)));
+                    *pcm1 = scale(SHIFT(MLZ(hi, lo)));
+                    pcm1 += stride;
 
                     ptr = *Dptr - pe;
                     ML0(hi, lo, (*fe)[0], ptr[31 - 16]);
@@ -682,7 +687,8 @@ enum mad_flow synth_full(struct mad_synth *synth, struct mad_frame const *frame,
                     MLA(hi, lo, (*fo)[1], ptr[31 - 14]);
                     MLA(hi, lo, (*fo)[0], ptr[31 - 16]);
 
-                    *pcm2-- = scale(SHIFT(MLZ(hi, lo)));
+                    *pcm2 = scale(SHIFT(MLZ(hi, lo)));
+                    pcm2 -= stride;
 
                     ++fo;
                 }
@@ -700,7 +706,7 @@ enum mad_flow synth_full(struct mad_synth *synth, struct mad_frame const *frame,
                 MLA(hi, lo, (*fo)[7], ptr[ 2]);
 
                 *pcm1 = scale(SHIFT(-MLZ(hi, lo)));
-                pcm1 += 16;
+                pcm1 += 16 * stride;
 
                 phase = (phase + 1) % 16;
             }
@@ -723,9 +729,11 @@ enum mad_flow synth_full(struct mad_synth *synth, struct mad_frame const *frame,
 static
 enum mad_flow synth_half(struct mad_synth *synth, struct mad_frame const *frame,
                          unsigned int nch, unsigned int startns, unsigned int endns,
-                         enum mad_flow(*output_func)(void *s, struct mad_header const *, struct mad_pcm *), void *cbdata) {
+                         enum mad_flow(*output_func)(void *s, struct mad_header const *, struct mad_pcm *), void *cbdata,
+                         int16_t *out) {
     unsigned int phase, ch, s, sb, pe, po;
     int16_t *pcm1, *pcm2;
+    int const stride = out ? 2 : 1;
     mad_fixed_t (*filter)[2][2][16][8];
     mad_fixed_t const(*sbsample)[36][32];
     register mad_fixed_t (*fe)[8], (*fx)[8], (*fo)[8];
@@ -738,7 +746,7 @@ enum mad_flow synth_half(struct mad_synth *synth, struct mad_frame const *frame,
             sbsample = &frame->sbsample[ch];
             filter   = &synth->filter[ch];
             phase    = (synth->phase + start) % 16;
-            pcm1     = synth->pcm.samples[ch];// + start * 32;
+            pcm1     = out ? out + start * 16 * 2 + ch : synth->pcm.samples[ch];
 
             for (s = start; s <= start; ++s) {
                 dct32((*sbsample)[s], phase >> 1,
@@ -776,9 +784,10 @@ enum mad_flow synth_half(struct mad_synth *synth, struct mad_frame const *frame,
                 MLA(hi, lo, (*fe)[6], ptr[ 4]);
                 MLA(hi, lo, (*fe)[7], ptr[ 2]);
 
-                *pcm1++ = scale(SHIFT(MLZ(hi, lo)));
+                *pcm1 = scale(SHIFT(MLZ(hi, lo)));
+                pcm1 += stride;
 
-                pcm2 = pcm1 + 14;
+                pcm2 = pcm1 + 14 * stride;
 
                 for (sb = 1; sb < 16; ++sb) {
                     ++fe;
@@ -808,7 +817,8 @@ enum mad_flow synth_half(struct mad_synth *synth, struct mad_frame const *frame,
                         MLA(hi, lo, (*fe)[1], ptr[14]);
                         MLA(hi, lo, (*fe)[0], ptr[ 0]);
 
-                        *pcm1++ = scale(SHIFT(MLZ(hi, lo)));
+                        *pcm1 = scale(SHIFT(MLZ(hi, lo)));
+                        pcm1 += stride;
 
                         ptr = *Dptr - po;
                         ML0(hi, lo, (*fo)[7], ptr[31 -  2]);
@@ -830,7 +840,8 @@ enum mad_flow synth_half(struct mad_synth *synth, struct mad_frame const *frame,
                         MLA(hi, lo, (*fe)[6], ptr[31 -  4]);
                         MLA(hi, lo, (*fe)[7], ptr[31 -  2]);
 
-                        *pcm2-- = scale(SHIFT(MLZ(hi, lo)));
+                        *pcm2 = scale(SHIFT(MLZ(hi, lo)));
+                        pcm2 -= stride;
                     }
 
                     ++fo;
@@ -849,7 +860,7 @@ enum mad_flow synth_half(struct mad_synth *synth, struct mad_frame const *frame,
                 MLA(hi, lo, (*fo)[7], ptr[ 2]);
 
                 *pcm1 = scale(SHIFT(-MLZ(hi, lo)));
-                pcm1 += 8;
+                pcm1 += 8 * stride;
 
                 phase = (phase + 1) % 16;
 
@@ -873,7 +884,7 @@ enum mad_flow mad_synth_frame(struct mad_synth *synth, struct mad_frame const *f
 //void mad_synth_frame(struct mad_synth *synth, struct mad_frame const *frame)
 {
     unsigned int nch, ns;
-    enum mad_flow(*synth_frame)(struct mad_synth *, struct mad_frame const *, unsigned int, unsigned int, unsigned int, enum mad_flow(*output_func)(), void *);
+    enum mad_flow(*synth_frame)(struct mad_synth *, struct mad_frame const *, unsigned int, unsigned int, unsigned int, enum mad_flow(*output_func)(), void *, int16_t *);
 
     nch = MAD_NCHANNELS(&frame->header);
     ns  = MAD_NSBSAMPLES(&frame->header);
@@ -891,7 +902,7 @@ enum mad_flow mad_synth_frame(struct mad_synth *synth, struct mad_frame const *f
         synth_frame = synth_half;
     }
 
-    enum mad_flow ret = synth_frame(synth, frame, nch, 0, ns, output_func, cbdata);
+    enum mad_flow ret = synth_frame(synth, frame, nch, 0, ns, output_func, cbdata, NULL);
 
     synth->phase = (synth->phase + ns) % 16;
 
@@ -902,7 +913,7 @@ enum mad_flow mad_synth_frame(struct mad_synth *synth, struct mad_frame const *f
 // Up to caller to increment synth->phase, only call proper # of ns
 enum mad_flow mad_synth_frame_onens(struct mad_synth *synth, struct mad_frame const *frame, unsigned int ns) {
     unsigned int nch; //, ns;
-    enum mad_flow(*synth_frame)(struct mad_synth *, struct mad_frame const *, unsigned int, unsigned int, unsigned int, enum mad_flow(*output_func)(), void *);
+    enum mad_flow(*synth_frame)(struct mad_synth *, struct mad_frame const *, unsigned int, unsigned int, unsigned int, enum mad_flow(*output_func)(), void *, int16_t *);
 
     nch = MAD_NCHANNELS(&frame->header);
     //  ns  = MAD_NSBSAMPLES(&frame->header);
@@ -919,7 +930,7 @@ enum mad_flow mad_synth_frame_onens(struct mad_synth *synth, struct mad_frame co
 
         synth_frame = synth_half;
     }
-    enum mad_flow ret = synth_frame(synth, frame, nch, ns, ns + 1, NULL, NULL);
+    enum mad_flow ret = synth_frame(synth, frame, nch, ns, ns + 1, NULL, NULL, NULL);
 
     if (ns == MAD_NSBSAMPLES(&frame->header) - 1) {
         synth->phase = (synth->phase + MAD_NSBSAMPLES(&frame->header)) % 16;
@@ -927,3 +938,38 @@ enum mad_flow mad_synth_frame_onens(struct mad_synth *synth, struct mad_frame co
 
     return ret;
 }
+
+// Synthesize every ns of the frame in one go, into out as interleaved
+// stereo (a mono frame is copied to both sides).  out holds 2 * 32 * ns
+// samples, pcm.length is set to the frames written and phase is advanced.
+enum mad_flow mad_synth_frame_pcm(struct mad_synth *synth, struct mad_frame const *frame, int16_t *out) {
+    unsigned int nch, ns, i;
+    enum mad_flow(*synth_frame)(struct mad_synth *, struct mad_frame const *, unsigned int, unsigned int, unsigned int, enum mad_flow(*output_func)(), void *, int16_t *);
+
+    nch = MAD_NCHANNELS(&frame->header);
+    ns  = MAD_NSBSAMPLES(&frame->header);
+
+    synth->pcm.samplerate = frame->header.samplerate;
+    synth->pcm.channels   = nch;
+    synth->pcm.length     = 32 * ns;
+
+    synth_frame = synth_full;
+
+    if (frame->options & MAD_OPTION_HALFSAMPLERATE) {
+        synth->pcm.samplerate /= 2;
+        synth->pcm.length     /= 2;
+
+        synth_frame = synth_half;
+    }
+    enum mad_flow ret = synth_frame(synth, frame, nch, 0, ns, NULL, NULL, out);
+
+    if (nch == 1) {
+        for (i = 0; i < synth->pcm.length; i++) {
+            out[2 * i + 1] = out[2 * i];
+        }
+    }
+
+    synth->phase = (synth->phase + ns) % 16;
+
+    return ret;
+}
@@ -0,0 +1,230 @@
+#include <Arduino.h>
+#include <vector>
+#include <chrono>
+#include <math.h>
+#include "AudioOutputFilterEQ.h"
+#include "hosttest.h"
+
+struct Band {
+    int type;
+    float hz, Q, gainDb;
+};
+
+// A loudness-ish five band setting
+static const Band bands[] = {
+    { bq_type_lowshelf, 80, 0.707f, 6 },
+    { bq_type_peak, 250, 1.0f, -3 },
+    { bq_type_peak, 1000, 0.7f, 2 },
+    { bq_type_peak, 4000, 2.0f, -4 },
+    { bq_type_highshelf, 10000, 0.707f, 5 },
+};
+
+static Pcm noise(uint32_t frames, int amp) {
+    Pcm p(2 * frames);
+    uint32_t seed = 1;
+    for (auto &s : p) {
+        seed = seed * 1664525 + 1013904223;
+        s = (int16_t)(((int32_t)(seed >> 16) - 32768) * amp / 32768);
+    }
+    return p;
+}
+
+static Pcm tone(float hz, uint32_t frames, float amp) {
+    Pcm p(2 * frames);
+    for (uint32_t i = 0; i < frames; i++) {
+        p[2 * i] = p[2 * i + 1] = (int16_t)lrintf(amp * sinf(2 * M_PI * hz * i / 44100));
+    }
+    return p;
+}
+
+// The cascade in doubles, straight from the same designs
+static std::vector<double> reference(const Pcm &in, const Band *b, int n) {
+    std::vector<double> x(in.begin(), in.end());
+    for (int s = 0; s < n; s++) {
+        float a0, a1, a2, b1, b2;
+        AudioOutputFilterBiquad::Design(b[s].type, b[s].hz / 44100, b[s].Q, b[s].gainDb, a0, a1, a2, b1, b2);
+        for (int c = 0; c < 2; c++) {
+            double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+            for (size_t i = c; i < x.size(); i += 2) {
+                double y = a0 * x[i] + a1 * x1 + a2 * x2 - b1 * y1 - b2 * y2;
+                x2 = x1;
+                x1 = x[i];
+                y2 = y1;
+                y1 = y;
+                x[i] = y;
+            }
+        }
+    }
+    return x;
+}
+
+static void setBands(AudioOutputFilterEQ &eq, const Band *b, int n) {
+    for (int i = 0; i < n; i++) {
+        eq.SetSection(i, b[i].type, b[i].hz, b[i].Q, b[i].gainDb);
+    }
+}
+
+// Feed pcm in uneven blocks, resending whatever isn't taken
+static void feed(AudioOutput &out, Pcm pcm) {
+    uint32_t frames = pcm.size() / 2, at = 0, n = 1;
+    while (at < frames) {
+        uint16_t want = (frames - at < n) ? frames - at : n;
+        at += out.ConsumeSamples(&pcm[2 * at], want);
+        out.loop();
+        n = (n * 7 + 3) % 100 + 1;
+    }
+    out.flush();
+}
+
+// Error against the reference, in dB below the reference
+static double snr(const std::vector<double> &ref, const std::vector<double> &got) {
+    double sig = 0, err = 0;
+    for (size_t i = 0; i < ref.size() && i < got.size(); i++) {
+        sig += ref[i] * ref[i];
+        err += (got[i] - ref[i]) * (got[i] - ref[i]);
+    }
+    return (got.size() == ref.size()) ? 10 * log10(sig / (err + 1e-9)) : -999;
+}
+
+// Largest second difference of the left channel from frame from on, which
+// jumps when the signal's level steps
+static int maxBend(const Pcm &p, size_t from) {
+    int m = 0;
+    for (size_t i = from + 2; i < p.size() / 2; i++) {
+        int d = abs(p[2 * i] - 2 * p[2 * i - 2] + p[2 * i - 4]);
+        m = (d > m) ? d : m;
+    }
+    return m;
+}
+
+// A 1 kHz tone with a treble shelf turned up 12 dB part way through
+static Pcm bendRun(uint32_t rampMs) {
+    CaptureOutput out;
+    AudioOutputFilterEQ eq(&out, 1);
+    eq.SetRampMs(rampMs);
+    eq.begin();
+    Pcm t = tone(1000, 8820, 6000);
+    eq.ConsumeSamples(t.data(), 4417);
+    eq.SetSection(0, bq_type_highshelf, 4000, 0.707f, 12);
+    for (uint32_t at = 4417; at < 8820; at += 30) {
+        eq.ConsumeSamples(&t[2 * at], (8820 - at < 30) ? 8820 - at : 30);
+    }
+    return out.pcm;
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+    const int nb = sizeof(bands) / sizeof(bands[0]);
+
+    Pcm in = noise(44100, 8000);
+    CaptureOutput flatOut;
+    AudioOutputFilterEQ flat(&flatOut);
+    flat.begin();
+    feed(flat, in);
+    check(flat.IsFlat() && flatOut.pcm == in, "a flat EQ passes audio through untouched");
+    flat.SetSection(2, bq_type_peak, 1000, 1.0f, 0);
+    check(flat.IsFlat(), "a 0 dB band is left out");
+
+    std::vector<double> ref = reference(in, bands, nb);
+    CaptureOutput out;
+    AudioOutputFilterEQ eq(&out);
+    eq.SetRampMs(0);
+    eq.begin();
+    setBands(eq, bands, nb);
+    feed(eq, in);
+    double s16 = snr(ref, std::vector<double>(out.pcm.begin(), out.pcm.end()));
+    printf("5 bands, 16-bit out: %.1f dB\n", s16);
+    check(s16 > 75, "five bands match the double precision cascade");
+
+    CaptureOutput choppy;
+    choppy.chop(3, 21);
+    AudioOutputFilterEQ eq2(&choppy);
+    eq2.SetRampMs(0);
+    eq2.begin();
+    setBands(eq2, bands, nb);
+    feed(eq2, in);
+    check(choppy.pcm == out.pcm, "a sink that refuses and takes odd amounts gets the same audio");
+
+    // 32 bits in and out keep what a 16-bit output would round off
+    Pcm32 in32(in.size());
+    for (size_t i = 0; i < in.size(); i++) {
+        in32[i] = (int32_t)in[i] << 16;
+    }
+    CaptureOutput wideOut;
+    wideOut.wide = true;
+    AudioOutputFilterEQ eq3(&wideOut);
+    eq3.SetRampMs(0);
+    eq3.begin();
+    setBands(eq3, bands, nb);
+    for (uint32_t at = 0; at < in32.size() / 2;) {
+        uint32_t n = (in32.size() / 2 - at < 77) ? in32.size() / 2 - at : 77;
+        at += eq3.ConsumeSamples32(&in32[2 * at], n);
+    }
+    eq3.flush();
+    std::vector<double> got32(wideOut.pcm32.size());
+    for (size_t i = 0; i < got32.size(); i++) {
+        got32[i] = wideOut.pcm32[i] / 65536.0;
+    }
+    double s32 = snr(ref, got32);
+    printf("5 bands, 32-bit out: %.1f dB\n", s32);
+    check(s32 > s16 + 15, "32-bit blocks keep the bits below 16");
+
+    // A quiet low tone through a deep bass shelf, where rounding noise in a
+    // pole close to 1.0 would show
+    Band bass[] = { { bq_type_lowshelf, 40, 0.707f, 12 } };
+    Pcm quiet = tone(30, 44100, 100);
+    CaptureOutput bassOut;
+    AudioOutputFilterEQ eq4(&bassOut, 1);
+    eq4.SetRampMs(0);
+    eq4.begin();
+    setBands(eq4, bass, 1);
+    feed(eq4, quiet);
+    double sBass = snr(reference(quiet, bass, 1), std::vector<double>(bassOut.pcm.begin(), bassOut.pcm.end()));
+    printf("quiet 30 Hz through a 40 Hz shelf: %.1f dB\n", sBass);
+    check(sBass > 40, "low shelves stay clean on quiet signals");
+
+    // Turning a band up while a tone plays
+    int bendRamp = maxBend(bendRun(20), 4400);
+    int bendJump = maxBend(bendRun(0), 4400);
+    printf("largest second difference: ramped %d, switched %d\n", bendRamp, bendJump);
+    check(bendJump > 10 * bendRamp, "a new setting slides in without a click");
+
+    // Cost against what it replaces, the same five bands as a chain of
+    // per-sample Biquads, and against one of them.  Best of 20, taking turns.
+    Pcm bench = noise(4096, 8000);
+    CaptureOutput sink;
+    sink.keep = false;
+    AudioOutputFilterBiquad single(bq_type_peak, 1000.0f / 44100, 1.0f, 3, &sink);
+    AudioOutput *next = &sink;
+    std::vector<AudioOutputFilterBiquad *> chain;
+    for (int i = nb - 1; i >= 0; i--) {
+        chain.push_back(new AudioOutputFilterBiquad(bands[i].type, bands[i].hz / 44100, bands[i].Q, bands[i].gainDb, next));
+        next = chain.back();
+    }
+    AudioOutputFilterEQ five(&sink);
+    five.begin();
+    setBands(five, bands, nb);
+    AudioOutput *run[3] = { &single, next, &five };
+    double best[3] = { 1e30, 1e30, 1e30 };
+    for (int r = 0; r < 20; r++) {
+        for (int w = 0; w < 3; w++) {
+            Pcm b = bench;
+            auto t0 = std::chrono::steady_clock::now();
+            for (int k = 0; k < 10; k++) {
+                run[w]->ConsumeSamples(b.data(), 4096);
+            }
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / (10 * 4096.0);
+            best[w] = (ns < best[w]) ? ns : best[w];
+        }
+    }
+    for (AudioOutputFilterBiquad *b : chain) {
+        delete b;
+    }
+    printf("ns/frame: one Biquad %.1f, five chained Biquads %.1f, five band EQ %.1f\n", best[0], best[1], best[2]);
+    printf("five band EQ: %.0f%% of the chain, %.1fx one Biquad%s\n", 100.0 * best[2] / best[1], best[2] / best[0],
+           (best[2] > 1.5 * best[0]) ? " (not the cost of one)" : "");
+
+    return failures ? 1 : 0;
+}
@@ -1,10 +1,112 @@
 #include <Arduino.h>
+#include <vector>
+#include <random>
 #include "AudioFileSourceSTDIO.h"
 #include "AudioOutputSTDIO.h"
 #include "AudioGeneratorFLAC.h"
+extern "C" {
+#include "libflac/private/lpc.h"
+#include "libflac/private/crc.h"
+#include "libflac/private/md5.h"
+}
+#include "hosttest.h"
 
 #define AAC "gs-16b-2c-44100hz.flac"
 
+typedef std::vector<int32_t> Samples;
+
+// The decoded WAV against the MD5 the encoder put in STREAMINFO
+static bool matchesStreamInfo(const Bytes &flac, const Bytes &wav) {
+    if (flac.size() < 42 || wav.size() < 44) {
+        return false;
+    }
+    uint32_t frames = (wav.size() - 44) / 4;
+    Samples left(frames), right(frames);
+    const int16_t *pcm = reinterpret_cast<const int16_t *>(wav.data() + 44);
+    for (uint32_t i = 0; i < frames; i++) {
+        left[i] = pcm[2 * i];
+        right[i] = pcm[2 * i + 1];
+    }
+    const FLAC__int32 *signal[2] = { left.data(), right.data() };
+    FLAC__MD5Context ctx;
+    FLAC__byte digest[16];
+    FLAC__MD5Init(&ctx);
+    FLAC__MD5Accumulate(&ctx, signal, 2, frames, 2);
+    FLAC__MD5Final(digest, &ctx);
+    // "fLaC", the block header, then 18 bytes of STREAMINFO before the MD5
+    return !memcmp(digest, flac.data() + 26, 16);
+}
+
+// Random subframe: warmup of bps bits and coefficients of precision bits,
+// kept small enough for the 32-bit sum.  makeResiduals() fills the rest.
+struct Subframe {
+    Samples residual;
+    Samples warmup;
+    FLAC__int32 coeff[32];
+    uint32_t order;
+    int shift;
+};
+
+static Subframe randomSubframe(std::mt19937 &rng, uint32_t order, uint32_t bps, uint32_t precision, uint32_t len) {
+    Subframe s;
+    std::uniform_int_distribution<int32_t> sample(-(1 << (bps - 1)), (1 << (bps - 1)) - 1);
+    std::uniform_int_distribution<int32_t> coeff(-(1 << (precision - 1)), (1 << (precision - 1)) - 1);
+    s.order = order;
+    s.shift = precision - 1 - (rng() % 4);
+    for (uint32_t j = 0; j < order; j++) {
+        s.coeff[j] = coeff(rng) >> (rng() % 4);
+    }
+    while (!FLAC__lpc_prediction_fits_32bit(bps, s.coeff, order)) {
+        for (uint32_t j = 0; j < order; j++) {
+            s.coeff[j] /= 2;
+        }
+    }
+    s.warmup.resize(order);
+    for (int32_t &w : s.warmup) {
+        w = sample(rng);
+    }
+    s.residual.resize(len);
+    return s;
+}
+
+typedef void (*Restore)(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[]);
+
+// Plain loops in 64 bits, the slower but clearer version from lpc.c
+static void reference(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[]) {
+    for (uint32_t i = 0; i < data_len; i++) {
+        int64_t sum = 0;
+        for (uint32_t j = 0; j < order; j++) {
+            sum += (int64_t)qlp_coeff[j] * data[(int)i - (int)j - 1];
+        }
+        data[i] = residual[i] + (FLAC__int32)(sum >> lp_quantization);
+    }
+}
+
+static Samples restore(const Subframe &s, Restore fn) {
+    Samples out(s.warmup);
+    out.resize(s.order + s.residual.size());
+    fn(s.residual.data(), s.residual.size(), s.coeff, s.order, s.shift, out.data() + s.order);
+    return out;
+}
+
+// Fills in residuals so the restored signal is a clipped random walk
+static void makeResiduals(std::mt19937 &rng, Subframe &s, uint32_t bps) {
+    Samples out(s.warmup);
+    out.resize(s.order + s.residual.size());
+    int32_t top = (1 << (bps - 1)) - 1, bottom = -(1 << (bps - 1));
+    for (uint32_t i = 0; i < s.residual.size(); i++) {
+        int64_t sum = 0;
+        for (uint32_t j = 0; j < s.order; j++) {
+            sum += (int64_t)s.coeff[j] * out[s.order + i - j - 1];
+        }
+        int32_t predicted = (int32_t)(sum >> s.shift);
+        int32_t want = out[s.order + i - 1] + (int32_t)(rng() % 2001) - 1000;
+        want = (want > top) ? top : (want < bottom) ? bottom : want;
+        s.residual[i] = want - predicted;
+        out[s.order + i] = want;
+    }
+}
+
 int main(int argc, char **argv)
 {
     (void) argc;
@@ -21,4 +123,46 @@ int main(int argc, char **argv)
     delete flac;
     delete out;
     delete in;
+
+    check(matchesStreamInfo(loadFile(AAC), loadFile("out.flac.wav")), "decoded PCM matches the STREAMINFO MD5");
+
+    // The 32-bit restore against the plain loops, for subframes only the sum
+    // bound lets onto it.  The old bps + precision + log2(order) <= 32 rule
+    // sent all of them to the 64-bit one.
+    std::mt19937 rng(1234);
+    std::vector<Subframe> all;
+    bool same = true;
+    for (uint32_t order = 1; order <= 32; order++) {
+        uint32_t log2 = 0;
+        while ((2u << log2) <= order) {
+            log2++;
+        }
+        for (uint32_t precision = 12; precision <= 15; precision++) {
+            if (16 + precision + log2 <= 32) {
+                continue;
+            }
+            Subframe s = randomSubframe(rng, order, 16, precision, 4096);
+            makeResiduals(rng, s, 16);
+            same = same && restore(s, FLAC__lpc_restore_signal) == restore(s, reference);
+            all.push_back(s);
+        }
+    }
+    check(!all.empty() && same, "32-bit restore gives the same samples as the plain loops wherever the sum bound lets it run");
+
+    FLAC__int32 loud[2] = { 32767, 32767 };
+    check(FLAC__lpc_prediction_fits_32bit(16, loud, 2) && !FLAC__lpc_prediction_fits_32bit(17, loud, 2) && !FLAC__lpc_prediction_fits_32bit(24, loud, 1),
+          "the sum bound is where 32 bits run out");
+
+    // Word CRC against the bytewise one
+    Bytes noise(4096);
+    for (uint8_t &b : noise) {
+        b = rng();
+    }
+    std::vector<FLAC__uint32> words(noise.size() / 4);
+    for (size_t i = 0; i < words.size(); i++) {
+        words[i] = (noise[4 * i] << 24) | (noise[4 * i + 1] << 16) | (noise[4 * i + 2] << 8) | noise[4 * i + 3];
+    }
+    check(FLAC__crc16_update_words32(words.data(), words.size(), 0) == FLAC__crc16(noise.data(), noise.size()), "CRC-16 a word at a time matches the bytewise one");
+
+    return failures ? 1 : 0;
 }
@@ -0,0 +1,221 @@
+#include <Arduino.h>
+#include <vector>
+#include <chrono>
+#include <math.h>
+#include "AudioGain.h"
+#include "AudioOutput.h"
+#include "hosttest.h"
+
+static int16_t reference(int16_t s, int32_t gainQ16) {
+    int64_t v = ((int64_t)s * gainQ16) >> 16;
+    return (v < -32768) ? -32768 : (v > 32767) ? 32767 : v;
+}
+
+// The per-sample 2.6 gain the outputs used before
+static void oldAmplify(int16_t *samples, uint32_t n, uint8_t gainF2P6) {
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t v = (samples[i] * gainF2P6) >> 6;
+        if (v < -32767) {
+            samples[i] = -32767;
+        } else if (v > 32767) {
+            samples[i] = 32767;
+        } else {
+            samples[i] = (int16_t)(v & 0xffff);
+        }
+    }
+}
+
+// Run a constant full-scale signal through a ramp, returning the left channel
+static std::vector<int16_t> rampOf(AudioGainRamp &r, uint32_t frames, uint32_t chunk) {
+    std::vector<int16_t> left;
+    std::vector<int16_t> buf(2 * chunk);
+    for (uint32_t done = 0; done < frames; done += chunk) {
+        uint32_t n = (frames - done < chunk) ? frames - done : chunk;
+        for (uint32_t i = 0; i < 2 * n; i++) {
+            buf[i] = 32767;
+        }
+        r.Apply(buf.data(), n);
+        for (uint32_t i = 0; i < n; i++) {
+            left.push_back(buf[2 * i]);
+        }
+    }
+    return left;
+}
+
+// Largest change between neighbouring samples
+static int maxStep(const std::vector<int16_t> &v) {
+    int m = 0;
+    for (size_t i = 1; i < v.size(); i++) {
+        int d = abs(v[i] - v[i - 1]);
+        m = (d > m) ? d : m;
+    }
+    return m;
+}
+
+// Records the gained samples of whatever goes through the base gain path
+class GainOutput : public AudioOutput {
+public:
+    virtual bool begin() override {
+        return true;
+    }
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override {
+        ApplyGain(samples, count);
+        for (uint16_t i = 0; i < count; i++) {
+            left.push_back(samples[2 * i]);
+        }
+        return count;
+    }
+    std::vector<int16_t> left;
+};
+
+template <class F>
+static double nsPerSample(F fn, uint32_t samples, int reps) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        fn();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / ((double)samples * reps);
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    // Every sample value through a spread of gains, saturating ones included
+    static const float gains[] = { 0.0f, 0.02f, 0.05f, 0.3f, 0.999f, 1.0f, 1.001f, 1.5f, 4.0f };
+    std::vector<int16_t> all(65536);
+    for (int i = 0; i < 65536; i++) {
+        all[i] = (int16_t)(i - 32768);
+    }
+    bool applyOk = true, packOk = true;
+    for (float f : gains) {
+        int32_t g = AudioGain::FromFloat(f);
+        std::vector<int16_t> s = all;
+        AudioGain::Apply(s.data(), s.size() / 2, g);
+        std::vector<uint32_t> packed(all.size() / 2);
+        AudioGain::Pack(all.data(), packed.data(), packed.size(), g);
+        for (size_t i = 0; i < all.size(); i++) {
+            applyOk = applyOk && s[i] == reference(all[i], g);
+            uint16_t half = (i & 1) ? packed[i / 2] >> 16 : packed[i / 2] & 0xffff;
+            packOk = packOk && half == (uint16_t)reference(all[i], g);
+        }
+    }
+    check(applyOk, "Apply matches the 64-bit reference for every sample and gain");
+    check(packOk, "Pack matches the reference, left in the low half");
+    check(AudioGain::Scale(-32768, AudioGain::maxGain) == -32768 && AudioGain::Scale(32767, AudioGain::maxGain) == 32767, "4x gain saturates");
+    check(AudioGain::FromFloat(5.0f) == AudioGain::maxGain && AudioGain::FromFloat(-1.0f) == 0, "gain is clamped to 0..4");
+
+    // 32-bit samples for wide I2S slots
+    bool ok32 = true;
+    uint32_t seed = 1;
+    for (float f : gains) {
+        int32_t g = AudioGain::FromFloat(f);
+        std::vector<int32_t> w(2 * 4096), ref(2 * 4096);
+        for (size_t i = 0; i < w.size(); i++) {
+            seed = seed * 1664525 + 1013904223;
+            w[i] = (i < 4) ? ((i & 1) ? INT32_MAX : INT32_MIN) : (int32_t)seed;
+            int64_t v = ((int64_t)w[i] * g) >> 16;
+            ref[i] = (v < INT32_MIN) ? INT32_MIN : (v > INT32_MAX) ? INT32_MAX : (int32_t)v;
+        }
+        AudioGain::Apply32(w.data(), w.size() / 2, g);
+        ok32 = ok32 && w == ref;
+    }
+    check(ok32, "Apply32 matches the 64-bit reference, saturating above unity");
+    int32_t quiet = AudioGain::Scale32((int32_t)1001 << 16, AudioGain::FromFloat(0.02f));
+    check((quiet >> 16) == AudioGain::Scale(1001, AudioGain::FromFloat(0.02f)) && (quiet & 0xffff), "32-bit gain keeps the bits a 16-bit one drops");
+    AudioGainRamp ramp32;
+    ramp32.RampTo(0, 100);
+    std::vector<int32_t> hi(2 * 200, INT32_MAX);
+    ramp32.Apply(hi.data(), 200);
+    bool down32 = hi[0] == INT32_MAX && hi[2 * 100] == 0 && hi[2 * 199] == 0;
+    for (size_t i = 2; i < hi.size(); i += 2) {
+        down32 = down32 && hi[i] <= hi[i - 2] && hi[i] == hi[i + 1];
+    }
+    check(down32, "ramps work on 32-bit samples too");
+
+    // Volume resolution: the old 2.6 format turned 0.02 into 1/64
+    float errOld = fabsf((uint8_t)(0.02f * 64) / 64.0f - 0.02f) / 0.02f;
+    float errNew = fabsf(AudioGain::FromFloat(0.02f) / 65536.0f - 0.02f) / 0.02f;
+    printf("0.02 gain error: 2.6 %.2f%%, Q16 %.4f%%\n", 100 * errOld, 100 * errNew);
+    check(errNew < 0.001f, "Q16 keeps quiet volume steps");
+
+    // Ramps move without a step and land exactly on the target
+    AudioGainRamp lin;
+    lin.RampTo(0, 1000);
+    std::vector<int16_t> down = rampOf(lin, 1500, 37);
+    bool mono = true;
+    for (size_t i = 1; i < down.size(); i++) {
+        mono = mono && down[i] <= down[i - 1];
+    }
+    check(mono && down[0] == 32767 && down[999] < 64 && down[1000] == 0 && !lin.IsRamping(), "linear ramp falls to the target in its frames");
+    check(maxStep(down) <= 34, "linear ramp has no zipper steps");
+
+    AudioGainRamp ex;
+    ex.Set(0);
+    ex.RampTo(AudioGain::unity, 1000, AudioGainRamp::EXPONENTIAL);
+    std::vector<int16_t> up = rampOf(ex, 1500, 100);
+    mono = true;
+    for (size_t i = 1; i < up.size(); i++) {
+        mono = mono && up[i] >= up[i - 1];
+    }
+    check(mono && up[0] == 0 && up[999] < 32767 && up[1000] == 32767 && !ex.IsRamping(), "exponential ramp rises to the target in its frames");
+    check(up[200] > 24000 && maxStep(up) < 700, "exponential ramp starts fast without a jump");
+
+    AudioGainRamp turn;
+    turn.RampTo(0, 1000);
+    rampOf(turn, 500, 64);
+    turn.RampTo(AudioGain::unity, 100);
+    std::vector<int16_t> back = rampOf(turn, 200, 64);
+    check(back[0] >= 16300 && back[0] <= 16400 && back[100] == 32767, "a new target carries on from where the ramp had got");
+
+    GainOutput go;
+    go.SetRate(1000);
+    go.SetGainRamp(50);
+    go.SetGain(0.5f);
+    std::vector<int16_t> full(2 * 100, 32767);
+    go.ConsumeSamples(full.data(), 100);
+    check(go.left[0] == 32767 && go.left[49] > 16383 && go.left[50] == 16383 && !go.IsRamping(), "SetGain ramps over the configured ms");
+    go.FadeGain(0.0f, 0);
+    check(!go.IsRamping(), "a 0 ms fade jumps at once");
+
+    // Micro-benchmark against the old per-sample path
+    const uint32_t n = 2 * 4096;
+    const int reps = 2000;
+    std::vector<int16_t> buf(n), work(n);
+    for (uint32_t i = 0; i < n; i++) {
+        buf[i] = (int16_t)(i * 7919);
+    }
+    std::vector<uint32_t> out(n / 2);
+    double tOld = nsPerSample([&]() {
+        work = buf;
+        oldAmplify(work.data(), n, 19);
+    }, n, reps);
+    double tNew = nsPerSample([&]() {
+        work = buf;
+        AudioGain::Apply(work.data(), n / 2, AudioGain::FromFloat(0.3f));
+    }, n, reps);
+    double tOldPack = nsPerSample([&]() {
+        for (uint32_t i = 0; i < n / 2; i++) {
+            int16_t ms[2] = { buf[2 * i], buf[2 * i + 1] };
+            oldAmplify(ms, 2, 19);
+            out[i] = ((uint32_t)(uint16_t)ms[1] << 16) | (uint16_t)ms[0];
+        }
+    }, n, reps);
+    double tPack = nsPerSample([&]() {
+        AudioGain::Pack(buf.data(), out.data(), n / 2, AudioGain::FromFloat(0.3f));
+    }, n, reps);
+    printf("ns/sample gain: 2.6 per sample %.3f, Q16 block %.3f\n", tOld, tNew);
+    AudioGainRamp bench;
+    double tRamp = nsPerSample([&]() {
+        work = buf;
+        bench.Set(AudioGain::unity);
+        bench.RampTo(0, n / 2);
+        bench.Apply(work.data(), n / 2);
+    }, n, reps);
+    printf("ns/sample ramp: %.3f\n", tRamp);
+    printf("ns/sample gain+pack: 2.6 per frame %.3f, Q16 block %.3f\n", tOldPack, tPack);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+#include <Arduino.h>
+#include <vector>
+#include "AudioFileSourcePROGMEM.h"
+#include "AudioGeneratorMP3.h"
+#include "AudioGeneratorWAV.h"
+#include "AudioGeneratorGapless.h"
+#include "hosttest.h"
+
+#define MP3 "../../examples/PlayMP3FromSPIFFS/data/pno-cs.mp3"
+
+// Refuses every fifth call and takes at most 37 frames of the rest, so the
+// generators have to hold blocks back and resend them like a full DMA queue
+class ChoppyOutput : public CaptureOutput {
+public:
+    ChoppyOutput() {
+        chop(5, 37);
+    }
+};
+
+// The bare frames of the test MP3: ID3 tag cut off, nothing after the last frame
+static Bytes rawFrames(uint32_t &frames) {
+    Bytes in = loadFile(MP3);
+    uint32_t pos = 0;
+    if (in.size() > 10 && !memcmp(in.data(), "ID3", 3)) {
+        pos = 10 + ((in[6] << 21) | (in[7] << 14) | (in[8] << 7) | in[9]);
+    }
+    Bytes out;
+    frames = 0;
+    uint32_t len;
+    while (pos + 4 <= in.size() && (len = frameLen(&in[pos])) && pos + len <= in.size()) {
+        out.insert(out.end(), in.begin() + pos, in.begin() + pos + len);
+        pos += len;
+        frames++;
+    }
+    return out;
+}
+
+// Prepend an Info frame with a LAME tag, as LAME writes for CBR files
+static Bytes withLameTag(const Bytes &raw, uint32_t frames, uint32_t delay, uint32_t padding) {
+    uint32_t len = frameLen(raw.data());
+    Bytes tag(len, 0);
+    memcpy(tag.data(), raw.data(), 4);
+    tag[1] |= 1; // no CRC
+    bool mono = (tag[3] >> 6) == 3;
+    uint32_t off = 4 + (mono ? 17 : 32);
+    memcpy(&tag[off], "Info", 4);
+    tag[off + 7] = 0x0f; // frames, bytes, TOC and quality present
+    tag[off + 8] = frames >> 24;
+    tag[off + 9] = frames >> 16;
+    tag[off + 10] = frames >> 8;
+    tag[off + 11] = frames;
+    off += 8 + 4 + 4 + 100 + 4;
+    memcpy(&tag[off], "LAME3.100", 9);
+    tag[off + 21] = delay >> 4;
+    tag[off + 22] = ((delay & 0x0f) << 4) | (padding >> 8);
+    tag[off + 23] = padding;
+    tag.insert(tag.end(), raw.begin(), raw.end());
+    return tag;
+}
+
+static Bytes makeWav(const Pcm &pcm, uint32_t rate = 44100) {
+    uint32_t data = pcm.size() * 2;
+    Bytes w(44);
+    memcpy(&w[0], "RIFF", 4);
+    uint32_t riff = 36 + data;
+    memcpy(&w[4], &riff, 4);
+    memcpy(&w[8], "WAVEfmt ", 8);
+    uint32_t fmtLen = 16, byteRate = rate * 4;
+    uint16_t fmt = 1, chans = 2, align = 4, bits = 16;
+    memcpy(&w[16], &fmtLen, 4);
+    memcpy(&w[20], &fmt, 2);
+    memcpy(&w[22], &chans, 2);
+    memcpy(&w[24], &rate, 4);
+    memcpy(&w[28], &byteRate, 4);
+    memcpy(&w[32], &align, 2);
+    memcpy(&w[34], &bits, 2);
+    memcpy(&w[36], "data", 4);
+    memcpy(&w[40], &data, 4);
+    const uint8_t *p = (const uint8_t *)pcm.data();
+    w.insert(w.end(), p, p + data);
+    return w;
+}
+
+static Pcm decodeMP3(const Bytes &mp3) {
+    AudioFileSourcePROGMEM src(mp3.data(), mp3.size());
+    ChoppyOutput out;
+    AudioGeneratorMP3 gen;
+    gen.begin(&src, &out);
+    while (gen.loop()) { /*noop*/ }
+    gen.stop();
+    return out.pcm;
+}
+
+// Play two WAVs of constant level back to back with a crossfade
+static Pcm crossfade(const Pcm &a, const Pcm &b, uint32_t ms, uint32_t rateB = 44100) {
+    Bytes wa = makeWav(a), wb = makeWav(b, rateB);
+    AudioFileSourcePROGMEM srcA(wa.data(), wa.size());
+    AudioFileSourcePROGMEM srcB(wb.data(), wb.size());
+    AudioGeneratorWAV genA, genB;
+    ChoppyOutput out;
+    AudioGeneratorGapless player(&out);
+    player.setCrossfade(ms);
+    player.play(&genA, &srcA);
+    player.queue(&genB, &srcB);
+    do {
+        out.budget = 256;
+    } while (player.loop());
+    return out.pcm;
+}
+
+// Stereo frames [from, to) of pcm
+static Pcm slice(const Pcm &pcm, uint32_t from, uint32_t to) {
+    return Pcm(pcm.begin() + 2 * from, pcm.begin() + 2 * to);
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+    const uint32_t decoderDelay = 529;
+
+    uint32_t frames;
+    Bytes raw = rawFrames(frames);
+    check(frames > 100, "test MP3 parsed");
+    Pcm ref = decodeMP3(raw);
+    printf("%u frames, %u samples decoded\n", frames, (unsigned)(ref.size() / 2));
+
+    // Encoder delay, encoder padding and the decoder's own delay come off
+    uint32_t delayX = 576, paddingX = 1000;
+    Pcm trimX = slice(ref, delayX + decoderDelay, frames * 1152 - paddingX + decoderDelay);
+    Pcm tagged = decodeMP3(withLameTag(raw, frames, delayX, paddingX));
+    check(tagged == trimX, "LAME tag trims delay and padding");
+
+    uint32_t delayY = 1105, paddingY = 700;
+    Pcm trimY = slice(ref, delayY + decoderDelay, frames * 1152 - paddingY + decoderDelay);
+
+    // Two tagged tracks back to back: exactly the trimmed audio of each,
+    // with no sample missing or inserted at the join
+    Bytes x = withLameTag(raw, frames, delayX, paddingX);
+    Bytes y = withLameTag(raw, frames, delayY, paddingY);
+    AudioFileSourcePROGMEM srcX(x.data(), x.size());
+    AudioFileSourcePROGMEM srcY(y.data(), y.size());
+    AudioGeneratorMP3 genX, genY;
+    ChoppyOutput out;
+    AudioGeneratorGapless player(&out);
+    player.play(&genX, &srcX);
+    bool queued = false;
+    while (player.loop()) {
+        if (!queued && srcX.getPos() > srcX.getSize() / 2) {
+            queued = player.queue(&genY, &srcY);
+        }
+    }
+    check(queued && player.current() == nullptr, "queued track played through");
+    Pcm joined = trimX;
+    joined.insert(joined.end(), trimY.begin(), trimY.end());
+    check(out.pcm.size() == joined.size(), "gapless MP3 length is the sum of both tracks");
+    check(out.pcm == joined, "gapless MP3 join is sample exact");
+
+    // A WAV cut in two plays back identical to the whole
+    Pcm wave(2 * 10001);
+    for (size_t i = 0; i < wave.size(); i++) {
+        wave[i] = (int16_t)(i * 7919);
+    }
+    Bytes first = makeWav(slice(wave, 0, 4321));
+    Bytes second = makeWav(slice(wave, 4321, 10001));
+    AudioFileSourcePROGMEM srcA(first.data(), first.size());
+    AudioFileSourcePROGMEM srcB(second.data(), second.size());
+    AudioGeneratorWAV genA, genB;
+    ChoppyOutput wout;
+    AudioGeneratorGapless wplayer(&wout);
+    wplayer.play(&genA, &srcA);
+    wplayer.queue(&genB, &srcB);
+    while (wplayer.loop()) { /*noop*/ }
+    check(wout.pcm == wave, "gapless WAV halves match the original");
+
+    // Crossfades, 50 ms over two 10000 frame tracks
+    const uint32_t len = 10000, fadeMs = 50, fade = 44100 * fadeMs / 1000;
+    Pcm high(2 * len, 10000), low(2 * len, -10000);
+    Pcm same = crossfade(high, high, fadeMs);
+    uint32_t total = same.size() / 2;
+    printf("crossfade: %u frames out of %u\n", total, 2 * len);
+    check(total + fade <= 2 * len + 64 && total + fade + 64 >= 2 * len, "crossfade overlaps the tracks by the fade");
+    bool flat = true;
+    for (size_t i = 0; i < same.size(); i++) {
+        flat = flat && same[i] >= 10000 - 4 && same[i] <= 10000;
+    }
+    check(flat, "equal tracks crossfade at a constant level");
+
+    Pcm swing = crossfade(high, low, fadeMs);
+    bool ramp = swing.size() > 4 && swing.front() == 10000 && swing.back() == -10000;
+    for (size_t i = 2; i < swing.size() && ramp; i++) {
+        ramp = swing[i] <= swing[i - 2];
+    }
+    check(ramp, "crossfade ramps from one track to the other without a step back");
+    uint32_t mid = 0;
+    for (size_t i = 0; i < swing.size(); i += 2) {
+        mid += (swing[i] > -10000 && swing[i] < 10000);
+    }
+    check(mid + 64 >= fade && mid <= fade, "crossfade lasts the fade window");
+
+    Pcm cut = crossfade(high, low, fadeMs, 48000);
+    Pcm joined2 = high;
+    joined2.insert(joined2.end(), low.begin(), low.end());
+    check(cut == joined2, "tracks at different rates join gaplessly instead");
+
+    AudioFileSourcePROGMEM srcC(first.data(), first.size());
+    AudioFileSourcePROGMEM srcD(second.data(), second.size());
+    AudioGeneratorWAV genC, genD;
+    ChoppyOutput mout;
+    AudioGeneratorGapless mplayer(&mout);
+    mplayer.setCrossfade(fadeMs);
+    mplayer.setCrossfade(0);
+    mplayer.play(&genC, &srcC);
+    mplayer.queue(&genD, &srcD);
+    while (mplayer.loop()) { /*noop*/ }
+    check(mout.pcm == wave, "crossfade turned off joins gaplessly through the mixer");
+
+    // A skip stops the player, but the output has to keep running
+    AudioFileSourcePROGMEM srcE(first.data(), first.size());
+    AudioGeneratorWAV genE;
+    ChoppyOutput sout;
+    AudioGeneratorGapless splayer(&sout);
+    splayer.play(&genE, &srcE);
+    splayer.loop();
+    splayer.stop();
+    check(!sout.stops && !splayer.isRunning(), "stopping the player leaves the output running");
+
+    return failures ? 1 : 0;
+}
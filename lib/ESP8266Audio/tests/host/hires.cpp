@@ -0,0 +1,173 @@
+#include <Arduino.h>
+#include <vector>
+#include "AudioFileSourcePROGMEM.h"
+#include "AudioGeneratorFLAC.h"
+#include "AudioGeneratorGapless.h"
+#include "hosttest.h"
+
+#define FLAC "gs-16b-2c-44100hz.flac"
+
+// Sink with 32-bit slots, like the I2S output set up for a 32-bit DAC
+class Capture32Output : public AudioOutput {
+public:
+    virtual bool begin() override {
+        return true;
+    }
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override {
+        for (uint16_t i = 0; i < 2 * count; i++) {
+            pcm.push_back((int32_t)samples[i] << 16);
+        }
+        return count;
+    }
+    virtual uint16_t ConsumeSamples32(int32_t *samples, uint16_t count) override {
+        // Take a little at a time so the generator has to resend the rest
+        if (count > 45) {
+            count = 45;
+        }
+        pcm.insert(pcm.end(), samples, samples + 2 * count);
+        return count;
+    }
+    virtual bool WantsSamples32() override {
+        return true;
+    }
+    virtual bool stop() override {
+        return true;
+    }
+
+    Pcm32 pcm;
+};
+
+// FLAC frame CRC-16, polynomial x^16 + x^15 + x^2 + 1
+static uint16_t crc16(const uint8_t *p, uint32_t len) {
+    uint16_t crc = 0;
+    while (len--) {
+        crc ^= *p++ << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+// A 24-bit stereo 44.1 kHz FLAC of pcm (interleaved, 24-bit values) in
+// VERBATIM subframes, which is all libflac needs to see every bit come through
+static Bytes makeFlac24(const Pcm32 &pcm) {
+    const uint32_t blockSize = 4096;
+    uint32_t frames = pcm.size() / 2;
+    Bytes f = { 'f', 'L', 'a', 'C', 0x80, 0, 0, 34 };
+    uint8_t info[34] = { 0 };
+    info[0] = blockSize >> 8;
+    info[2] = blockSize >> 8;
+    // 44100 Hz (20 bits), 2 channels (3 bits, less one), 24 bits (5 bits, less one), total samples (36 bits)
+    info[10] = 44100 >> 12;
+    info[11] = (44100 >> 4) & 0xff;
+    info[12] = ((44100 & 0x0f) << 4) | (1 << 1) | (23 >> 4);
+    info[13] = ((23 & 0x0f) << 4);
+    info[14] = frames >> 24;
+    info[15] = frames >> 16;
+    info[16] = frames >> 8;
+    info[17] = frames;
+    f.insert(f.end(), info, info + sizeof(info));
+
+    for (uint32_t start = 0, num = 0; start < frames; start += blockSize, num++) {
+        uint32_t n = (frames - start < blockSize) ? frames - start : blockSize;
+        Bytes fr = { 0xff, 0xf8 };
+        // Block size 4096 or an explicit 16-bit one, 44.1 kHz; independent
+        // stereo at 24 bits; frame number, all below 128 so one byte
+        fr.push_back(((n == blockSize) ? 0xc0 : 0x70) | 0x09);
+        fr.push_back(0x10 | (6 << 1));
+        fr.push_back(num);
+        if (n != blockSize) {
+            fr.push_back((n - 1) >> 8);
+            fr.push_back(n - 1);
+        }
+        fr.push_back(crc8(fr.data(), fr.size()));
+        for (int c = 0; c < 2; c++) {
+            fr.push_back(0x02); // VERBATIM, no wasted bits
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t v = (uint32_t)pcm[2 * (start + i) + c];
+                fr.push_back(v >> 16);
+                fr.push_back(v >> 8);
+                fr.push_back(v);
+            }
+        }
+        uint16_t crc = crc16(fr.data(), fr.size());
+        fr.push_back(crc >> 8);
+        fr.push_back(crc);
+        f.insert(f.end(), fr.begin(), fr.end());
+    }
+    return f;
+}
+
+template <class Out>
+static void decode(const Bytes &flac, Out &out) {
+    AudioFileSourcePROGMEM src(flac.data(), flac.size());
+    AudioGeneratorFLAC gen;
+    gen.begin(&src, &out);
+    while (gen.loop()) { /*noop*/ }
+    gen.stop();
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    // Full scale 24-bit noise, so the low byte matters
+    Pcm32 src(2 * 10000);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < src.size(); i++) {
+        seed = seed * 1664525 + 1013904223;
+        src[i] = (int32_t)seed >> 8;
+    }
+    Bytes flac24 = makeFlac24(src);
+
+    Capture32Output wide;
+    decode(flac24, wide);
+    Pcm32 want(src.size());
+    for (size_t i = 0; i < src.size(); i++) {
+        want[i] = (int32_t)((uint32_t)src[i] << 8);
+    }
+    check(wide.pcm == want, "24-bit FLAC reaches a 32-bit output with every bit");
+
+    CaptureOutput narrow;
+    decode(flac24, narrow);
+    bool top = narrow.pcm.size() == src.size();
+    for (size_t i = 0; top && i < src.size(); i++) {
+        top = narrow.pcm[i] == (int16_t)(src[i] >> 8);
+    }
+    check(top, "a 16-bit output still gets the top 16 bits");
+
+    Bytes flac16 = loadFile(FLAC);
+    CaptureOutput ref16;
+    decode(flac16, ref16);
+    Capture32Output wide16;
+    decode(flac16, wide16);
+    bool same = ref16.pcm.size() > 0 && wide16.pcm.size() == ref16.pcm.size();
+    for (size_t i = 0; same && i < ref16.pcm.size(); i++) {
+        same = wide16.pcm[i] == (int32_t)ref16.pcm[i] << 16;
+    }
+    check(same, "16-bit FLAC is unchanged on a 32-bit output");
+
+    // The default ConsumeSamples32() narrows and stops where its sink does
+    CaptureOutput part;
+    part.limit = 70;
+    Pcm32 block(want.begin(), want.begin() + 2 * 100);
+    uint16_t took = part.ConsumeSamples32(block.data(), 100);
+    bool cut = took == 70 && part.pcm.size() == 2 * 70;
+    for (size_t i = 0; cut && i < part.pcm.size(); i++) {
+        cut = part.pcm[i] == (int16_t)(want[i] >> 16);
+    }
+    check(cut, "16-bit outputs narrow 32-bit blocks and take only what fits");
+
+    // Through the gapless player's link
+    AudioFileSourcePROGMEM srcA(flac24.data(), flac24.size());
+    AudioGeneratorFLAC genA;
+    Capture32Output gout;
+    AudioGeneratorGapless player(&gout);
+    player.play(&genA, &srcA);
+    while (player.loop()) { /*noop*/ }
+    check(gout.pcm == want, "the gapless player passes 32-bit blocks on");
+
+    return failures ? 1 : 0;
+}
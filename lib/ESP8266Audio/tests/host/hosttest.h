@@ -0,0 +1,153 @@
+// Shared pieces of the host tests: PASS/FAIL reporting, file loading and an
+// output that records what it is sent.  Each test is its own program, so
+// this is included once per binary.
+
+#ifndef _HOSTTEST_H
+#define _HOSTTEST_H
+
+#include <Arduino.h>
+#include <vector>
+#include "AudioOutput.h"
+
+typedef std::vector<uint8_t> Bytes;
+typedef std::vector<int16_t> Pcm;
+typedef std::vector<int32_t> Pcm32;
+
+// main() returns failures ? 1 : 0
+static int failures = 0;
+
+inline void check(bool ok, const char *what) {
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+inline Bytes loadFile(const char *name) {
+    Bytes b;
+    FILE *f = fopen(name, "rb");
+    if (!f) {
+        return b;
+    }
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        b.insert(b.end(), buf, buf + n);
+    }
+    fclose(f);
+    return b;
+}
+
+// MPEG1 layer III frame length from its header, 0 if it isn't one
+inline uint32_t frameLen(const uint8_t *h) {
+    static const int kbps[16] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 };
+    static const int rate[4] = { 44100, 48000, 32000, 0 };
+    if (h[0] != 0xff || (h[1] & 0xfe) != 0xfa || !kbps[h[2] >> 4] || !rate[(h[2] >> 2) & 3]) {
+        return 0;
+    }
+    return 144000 * kbps[h[2] >> 4] / rate[(h[2] >> 2) & 3] + ((h[2] >> 1) & 1);
+}
+
+// CRC-8 of FLAC frame headers, polynomial 0x07
+inline uint8_t crc8(const uint8_t *p, uint32_t len) {
+    uint8_t crc = 0;
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Records every frame it takes, 16-bit frames in pcm and, with wide set,
+// 32-bit ones in pcm32.  By default it takes everything.  chop() makes it
+// refuse every nth call and take at most so many frames per call, like a
+// full DMA queue, so generators have to hold blocks back and resend them.
+// budget stops it after that many frames until topped up, and limit once
+// pcm holds that many.
+class CaptureOutput : public AudioOutput {
+public:
+    CaptureOutput() : calls(0), frames(0), budget(-1), limit(0), keep(true), wide(false),
+        stops(0), rateSets(0), rate(0), refuseEvery(0), most(0) {}
+    void chop(uint32_t every, uint16_t maxFrames) {
+        refuseEvery = every;
+        most = maxFrames;
+    }
+
+    virtual bool SetRate(int hz) override {
+        rateSets++;
+        rate = hz;
+        return AudioOutput::SetRate(hz);
+    }
+    virtual bool begin() override {
+        return true;
+    }
+    virtual bool ConsumeSample(int16_t sample[2]) override {
+        return ConsumeSamples(sample, 1) == 1;
+    }
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override {
+        count = take(count);
+        if (keep) {
+            pcm.insert(pcm.end(), samples, samples + 2 * count);
+        }
+        return count;
+    }
+    virtual uint16_t ConsumeSamples32(int32_t *samples, uint16_t count) override {
+        if (!wide) {
+            return AudioOutput::ConsumeSamples32(samples, count);
+        }
+        count = take(count);
+        if (keep) {
+            pcm32.insert(pcm32.end(), samples, samples + 2 * count);
+        }
+        return count;
+    }
+    virtual bool WantsSamples32() override {
+        return wide;
+    }
+    virtual bool stop() override {
+        stops++;
+        return true;
+    }
+
+    Pcm pcm;
+    Pcm32 pcm32;
+    uint32_t calls;  // ConsumeSamples() calls
+    uint32_t frames; // Taken in total, kept or not
+    int budget;      // -1 for none
+    uint32_t limit;  // 0 for none
+    bool keep;
+    bool wide;
+    int stops;
+    int rateSets;
+    int rate;
+
+private:
+    uint16_t take(uint16_t count) {
+        calls++;
+        if (refuseEvery && (calls % refuseEvery) == 0) {
+            return 0;
+        }
+        if (most && (count > most)) {
+            count = most;
+        }
+        uint32_t held = (pcm.size() + pcm32.size()) / 2;
+        if (limit && (held + count > limit)) {
+            count = (held < limit) ? limit - held : 0;
+        }
+        if ((budget >= 0) && (count > budget)) {
+            count = budget;
+        }
+        if (budget > 0) {
+            budget -= count;
+        }
+        frames += count;
+        return count;
+    }
+
+    uint32_t refuseEvery;
+    uint16_t most;
+};
+
+#endif
@@ -0,0 +1,613 @@
+#include <Arduino.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <new>
+#include <math.h>
+#include <pthread.h>
+#include "AudioFileSourcePROGMEM.h"
+#include "AudioGeneratorMP3.h"
+#include "AudioGeneratorMP3a.h"
+#include "AudioGeneratorMP3Select.h"
+#include "hosttest.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+// Decodes a corpus through libmad and Helix and reports what each costs per
+// frame, in heap and in stack.  The shipped MP3 is stereo CBR; VBR and mono
+// versions of it are made here by repacking its frames (mono keeps only the
+// first channel), so all four profiles are covered without an encoder.
+// More files can be given on the command line.
+
+#define MP3 "../../examples/PlayMP3FromSPIFFS/data/pno-cs.mp3"
+
+// Heap use of everything linked in, through -Wl,--wrap=malloc etc
+static size_t heapLive = 0, heapPeak = 0;
+
+extern "C" {
+    void *__real_malloc(size_t);
+    void __real_free(void *);
+
+    void *__wrap_malloc(size_t size) {
+        uint8_t *p = (uint8_t *)__real_malloc(size + 16);
+        if (!p) {
+            return nullptr;
+        }
+        *(size_t *)p = size;
+        heapLive += size;
+        heapPeak = (heapLive > heapPeak) ? heapLive : heapPeak;
+        return p + 16;
+    }
+
+    void __wrap_free(void *ptr) {
+        if (ptr) {
+            uint8_t *p = (uint8_t *)ptr - 16;
+            heapLive -= *(size_t *)p;
+            __real_free(p);
+        }
+    }
+
+    void *__wrap_calloc(size_t n, size_t size) {
+        void *p = __wrap_malloc(n * size);
+        if (p) {
+            memset(p, 0, n * size);
+        }
+        return p;
+    }
+
+    void *__wrap_realloc(void *ptr, size_t size) {
+        void *p = __wrap_malloc(size);
+        if (p && ptr) {
+            size_t old = *(size_t *)((uint8_t *)ptr - 16);
+            memcpy(p, ptr, (old < size) ? old : size);
+        }
+        __wrap_free(ptr);
+        return p;
+    }
+}
+
+void *operator new(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+void operator delete(void *p) noexcept {
+    free(p);
+}
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+// Length of an ID3v2 tag at the start, 0 if there is none
+static uint32_t tagBytes(const Bytes &b) {
+    if (b.size() < 10 || memcmp(b.data(), "ID3", 3)) {
+        return 0;
+    }
+    return 10 + ((b[6] & 0x7f) << 21) + ((b[7] & 0x7f) << 14) + ((b[8] & 0x7f) << 7) + (b[9] & 0x7f);
+}
+
+// Bit fields, MSB first
+class BitReader {
+public:
+    BitReader(const uint8_t *data, uint32_t bit = 0) : p(data), pos(bit) {}
+    uint32_t get(int n) {
+        uint32_t v = 0;
+        while (n--) {
+            v = (v << 1) | ((p[pos >> 3] >> (7 - (pos & 7))) & 1);
+            pos++;
+        }
+        return v;
+    }
+    const uint8_t *p;
+    uint32_t pos;
+};
+
+class BitWriter {
+public:
+    void put(uint32_t v, int n) {
+        while (n--) {
+            if ((bits & 7) == 0) {
+                out.push_back(0);
+            }
+            out.back() |= ((v >> n) & 1) << (7 - (bits & 7));
+            bits++;
+        }
+    }
+    void copy(const uint8_t *src, uint32_t from, uint32_t n) {
+        BitReader r(src, from);
+        while (n) {
+            int k = (n > 24) ? 24 : n;
+            put(r.get(k), k);
+            n -= k;
+        }
+    }
+    Bytes out;
+    uint32_t bits = 0;
+};
+
+// An MPEG-1 Layer III frame taken apart: side info without main_data_begin,
+// and its main data as a bit string
+struct Frame {
+    uint8_t header[4];
+    bool mono;
+    Bytes side;     // Side info bits after main_data_begin, in BitWriter form
+    uint32_t sideBits;
+    Bytes main;
+    uint32_t mainBits;
+};
+
+static const uint16_t l3Kbps[15] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 };
+static const uint32_t l3Rates[3] = { 44100, 48000, 32000 };
+
+static uint32_t frameBytes(const uint8_t *h) {
+    return 144000 * l3Kbps[h[2] >> 4] / l3Rates[(h[2] >> 2) & 3] + ((h[2] >> 1) & 1);
+}
+
+static bool isL3Header(const uint8_t *h) {
+    return h[0] == 0xff && (h[1] & 0xfe) == 0xfa && (h[2] >> 4) && (h[2] >> 4) != 15 && ((h[2] >> 2) & 3) != 3;
+}
+
+// Splits an MPEG-1 Layer III stream into frames, optionally keeping only the
+// first channel of each
+static std::vector<Frame> unpack(const Bytes &mp3, bool toMono) {
+    std::vector<Frame> frames;
+    uint32_t pos = tagBytes(mp3);
+    // Main data bytes of all frames in a row, and where each frame's start
+    Bytes stream;
+    struct Raw {
+        const uint8_t *h;
+        uint32_t at;
+    };
+    std::vector<Raw> raw;
+    while (pos + 4 <= mp3.size()) {
+        const uint8_t *h = &mp3[pos];
+        if (!isL3Header(h)) {
+            pos++;
+            continue;
+        }
+        uint32_t len = frameBytes(h);
+        uint32_t side = (((h[3] >> 6) == 3) ? 17 : 32) + ((h[1] & 1) ? 0 : 2);
+        if (pos + len > mp3.size()) {
+            break;
+        }
+        raw.push_back({ h, (uint32_t)stream.size() });
+        stream.insert(stream.end(), h + 4 + side, h + len);
+        pos += len;
+    }
+    for (const Raw &r : raw) {
+        const uint8_t *h = r.h;
+        bool mono = (h[3] >> 6) == 3;
+        int nch = mono ? 1 : 2;
+        BitReader si(h + 4 + ((h[1] & 1) ? 0 : 2));
+        uint32_t mdb = si.get(9);
+        si.get(mono ? 5 : 3);
+        uint32_t scfsi[2];
+        for (int ch = 0; ch < nch; ch++) {
+            scfsi[ch] = si.get(4);
+        }
+        uint32_t part23[2][2];
+        BitWriter granules[2][2];
+        for (int gr = 0; gr < 2; gr++) {
+            for (int ch = 0; ch < nch; ch++) {
+                uint32_t at = si.pos;
+                part23[gr][ch] = si.get(12);
+                si.get(47);
+                granules[gr][ch].copy(h + 4 + ((h[1] & 1) ? 0 : 2), at, 59);
+            }
+        }
+        uint32_t total = 0;
+        for (int gr = 0; gr < 2; gr++) {
+            for (int ch = 0; ch < nch; ch++) {
+                total += part23[gr][ch];
+            }
+        }
+        if (mdb > r.at || r.at - mdb + (total + 7) / 8 > stream.size()) {
+            continue; // Its main data isn't all there
+        }
+        Frame f;
+        memcpy(f.header, h, 4);
+        f.header[1] |= 1; // No CRC
+        f.mono = mono || toMono;
+        BitWriter side, main;
+        side.put(0, f.mono ? 5 : 3);
+        for (int ch = 0; ch < (f.mono ? 1 : nch); ch++) {
+            side.put(scfsi[ch], 4);
+        }
+        uint32_t bit = 0;
+        const uint8_t *md = &stream[r.at - mdb];
+        for (int gr = 0; gr < 2; gr++) {
+            for (int ch = 0; ch < nch; ch++) {
+                if (ch == 0 || !f.mono) {
+                    side.copy(granules[gr][ch].out.data(), 0, 59);
+                    main.copy(md, bit, part23[gr][ch]);
+                }
+                bit += part23[gr][ch];
+            }
+        }
+        if (f.mono) {
+            f.header[3] = (3 << 6) | (f.header[3] & 0x0f);
+        }
+        f.side = side.out;
+        f.sideBits = side.bits;
+        f.main = main.out;
+        f.mainBits = main.bits;
+        frames.push_back(f);
+    }
+    return frames;
+}
+
+// Lays the frames out again at one bit rate (kbpsIndex) or, with 0, each at
+// the lowest one its main data and the bit reservoir allow.  A VBR stream
+// gets a Xing frame in front.  Empty if the frames don't fit the bit rate.
+static Bytes pack(const std::vector<Frame> &frames, int kbpsIndex) {
+    if (frames.empty()) {
+        return Bytes();
+    }
+    uint32_t rate = l3Rates[(frames[0].header[2] >> 2) & 3];
+    uint32_t sideBytes = frames[0].mono ? 17 : 32;
+    Bytes q; // Main data area of all frames in a row
+    std::vector<int> index;
+    std::vector<uint32_t> mdb;
+    uint32_t qEnd = 0;
+    for (const Frame &f : frames) {
+        uint32_t bytes = (f.mainBits + 7) / 8;
+        uint32_t start = (q.size() > 511) ? q.size() - 511 : 0;
+        start = (start < qEnd) ? qEnd : start;
+        int idx = kbpsIndex ? kbpsIndex : 1;
+        for (; idx < 15; idx++) {
+            uint32_t room = 144000 * l3Kbps[idx] / rate - 4 - sideBytes;
+            if (start + bytes <= q.size() + room) {
+                break;
+            }
+            if (kbpsIndex) {
+                return Bytes();
+            }
+        }
+        if (idx == 15) {
+            return Bytes();
+        }
+        mdb.push_back(q.size() - start);
+        index.push_back(idx);
+        size_t end = q.size() + 144000 * l3Kbps[idx] / rate - 4 - sideBytes;
+        q.resize(end, 0);
+        memcpy(&q[start], f.main.data(), f.main.size());
+        qEnd = start + bytes;
+    }
+
+    Bytes out;
+    uint32_t qPos = 0;
+    for (size_t i = 0; i < frames.size(); i++) {
+        const Frame &f = frames[i];
+        uint8_t h[4] = { f.header[0], f.header[1], (uint8_t)((index[i] << 4) | (f.header[2] & 0x0c)), f.header[3] };
+        out.insert(out.end(), h, h + 4);
+        BitWriter side;
+        side.put(mdb[i], 9);
+        side.copy(f.side.data(), 0, f.sideBits);
+        out.insert(out.end(), side.out.begin(), side.out.end());
+        uint32_t room = frameBytes(h) - 4 - sideBytes;
+        out.insert(out.end(), q.begin() + qPos, q.begin() + qPos + room);
+        qPos += room;
+    }
+    if (kbpsIndex) {
+        return out;
+    }
+
+    // Xing frame with the frame and byte counts
+    uint8_t h[4] = { frames[0].header[0], frames[0].header[1], (uint8_t)((9 << 4) | (frames[0].header[2] & 0x0c)), frames[0].header[3] };
+    Bytes xing(frameBytes(h), 0);
+    memcpy(&xing[0], h, 4);
+    uint8_t *x = &xing[4 + sideBytes];
+    memcpy(x, "Xing", 4);
+    uint32_t n = frames.size(), total = out.size() + xing.size();
+    uint32_t v[3] = { 3, n, total };
+    for (int i = 0; i < 3; i++) {
+        x[4 + 4 * i] = v[i] >> 24;
+        x[5 + 4 * i] = v[i] >> 16;
+        x[6 + 4 * i] = v[i] >> 8;
+        x[7 + 4 * i] = v[i];
+    }
+    out.insert(out.begin(), xing.begin(), xing.end());
+    return out;
+}
+
+// The lowest constant bit rate the frames fit into
+static Bytes packCBR(const std::vector<Frame> &frames) {
+    for (int idx = 1; idx < 15; idx++) {
+        Bytes b = pack(frames, idx);
+        if (!b.empty()) {
+            return b;
+        }
+    }
+    return Bytes();
+}
+
+enum Which { LIBMAD, HELIX, AUTO };
+static const char *whichName[] = { "libmad", "helix", "auto" };
+
+static AudioGenerator *makeGen(Which w) {
+    switch (w) {
+    case LIBMAD:
+        return new AudioGeneratorMP3();
+    case HELIX:
+        return new AudioGeneratorMP3a();
+    default:
+        return new AudioGeneratorMP3Select();
+    }
+}
+
+struct Run {
+    const Bytes *mp3;
+    Which which;
+    CaptureOutput *out;
+    uint32_t seekMs;
+    uint64_t cycles;
+    double ns;
+    size_t heap;
+    uint32_t durationMs;
+    AudioGeneratorMP3Select::Backend chosen;
+};
+
+static void *decode(void *arg) {
+    Run *r = reinterpret_cast<Run *>(arg);
+    if (!r->mp3) {
+        return nullptr;
+    }
+    size_t base = heapLive;
+    heapPeak = heapLive;
+    auto t0 = std::chrono::steady_clock::now();
+#ifdef HAVE_TSC
+    uint64_t c0 = __rdtsc();
+#endif
+    {
+        AudioFileSourcePROGMEM src(r->mp3->data(), r->mp3->size());
+        AudioGenerator *gen = makeGen(r->which);
+        gen->begin(&src, r->out);
+        if (r->seekMs) {
+            gen->seekToMs(r->seekMs);
+        }
+        while (gen->loop()) { /*noop*/ }
+        r->durationMs = gen->getDurationMs();
+        if (r->which == AUTO) {
+            r->chosen = static_cast<AudioGeneratorMP3Select *>(gen)->GetBackend();
+        }
+        gen->stop();
+        delete gen;
+    }
+#ifdef HAVE_TSC
+    r->cycles = __rdtsc() - c0;
+#endif
+    r->ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    r->heap = heapPeak - base;
+    return nullptr;
+}
+
+// Runs the decode on a thread whose stack starts out painted, and returns how
+// much more of it was touched than by a thread doing nothing
+static uint8_t threadStack[1 << 20] __attribute__((aligned(4096)));
+
+static size_t stackUsed(Run *r) {
+    memset(threadStack, 0xa5, sizeof(threadStack));
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, threadStack, sizeof(threadStack));
+    pthread_t t;
+    pthread_create(&t, &attr, decode, r);
+    pthread_join(t, nullptr);
+    pthread_attr_destroy(&attr);
+    size_t i = 0;
+    while (i < sizeof(threadStack) && threadStack[i] == 0xa5) {
+        i++;
+    }
+    return sizeof(threadStack) - i;
+}
+
+// Signal to difference ratio of b against a over their common length, in dB
+static double snr(const Pcm &a, const Pcm &b) {
+    double sig = 0, err = 0;
+    size_t n = (a.size() < b.size()) ? a.size() : b.size();
+    for (size_t i = 0; i < n; i++) {
+        sig += (double)a[i] * a[i];
+        err += (double)(a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return err ? 10 * log10(sig / err) : 999;
+}
+
+static AudioGeneratorMP3Select::Backend helixFrom112k(const AudioGeneratorMP3Select::Profile &p) {
+    return (p.kbps >= 112) ? AudioGeneratorMP3Select::HELIX : AudioGeneratorMP3Select::LIBMAD;
+}
+
+struct Entry {
+    std::string name;
+    Bytes mp3;
+};
+
+int main(int argc, char **argv)
+{
+    Bytes orig = loadFile(MP3);
+    check(orig.size() > 0, "test MP3 loaded");
+
+    std::vector<Frame> stereo = unpack(orig, false);
+    std::vector<Frame> mono = unpack(orig, true);
+    std::vector<Entry> corpus = {
+        { "pno-cs.mp3", orig },
+        { "stereo VBR", pack(stereo, 0) },
+        { "mono CBR", packCBR(mono) },
+        { "mono VBR", pack(mono, 0) },
+    };
+    for (int i = 1; i < argc; i++) {
+        corpus.push_back({ argv[i], loadFile(argv[i]) });
+    }
+
+    // What the repacked streams are, and that the profile sees them so
+    const char *want[] = { "stereo CBR", "stereo VBR", "mono CBR", "mono VBR" };
+    for (size_t i = 0; i < 4; i++) {
+        AudioGeneratorMP3Select::Profile p = {};
+        const Bytes &b = corpus[i].mp3;
+        uint32_t skip = tagBytes(b);
+        bool found = b.size() > skip && AudioGeneratorMP3Select::ReadProfile(b.data() + skip, b.size() - skip, p);
+        std::string got = std::string(p.channels == 1 ? "mono" : "stereo") + (p.vbr ? " VBR" : " CBR");
+        std::string what = std::string("profile of ") + corpus[i].name + " is " + want[i];
+        check(found && p.layer == 3 && got == want[i], what.c_str());
+    }
+
+    CaptureOutput madOut[4], helixOut[4];
+    for (int i = 0; i < 4; i++) {
+        Run mad = { &corpus[i].mp3, LIBMAD, &madOut[i], 0, 0, 0, 0, 0, AudioGeneratorMP3Select::AUTO };
+        Run helix = { &corpus[i].mp3, HELIX, &helixOut[i], 0, 0, 0, 0, 0, AudioGeneratorMP3Select::AUTO };
+        decode(&mad);
+        decode(&helix);
+    }
+    printf("%u frames of 1152 samples\n", (unsigned)(madOut[0].pcm.size() / 2304));
+    check(madOut[0].pcm.size() > 48000 * 2 && madOut[1].pcm == madOut[0].pcm, "repacked as VBR, libmad gives the same samples");
+    check(helixOut[1].pcm == helixOut[0].pcm, "repacked as VBR, Helix gives the same samples");
+    check(madOut[2].pcm == madOut[3].pcm && helixOut[2].pcm == helixOut[3].pcm, "mono CBR and VBR give the same samples");
+    bool dual = madOut[2].pcm.size() == madOut[0].pcm.size();
+    for (size_t i = 0; dual && i < madOut[2].pcm.size(); i += 2) {
+        dual = madOut[2].pcm[i] == madOut[2].pcm[i + 1] && helixOut[2].pcm[i] == helixOut[2].pcm[i + 1];
+    }
+    check(dual, "mono comes out on both sides, as long as stereo");
+    double db[4];
+    for (int i = 0; i < 4; i++) {
+        db[i] = snr(madOut[i].pcm, helixOut[i].pcm);
+    }
+    printf("libmad against Helix: %.1f dB stereo, %.1f dB mono\n", db[0], db[2]);
+    check(helixOut[0].pcm.size() == madOut[0].pcm.size() && db[0] > 40 && db[2] > 40, "both decoders agree");
+
+    // The front end is the backend it picked, or the one it was told to use
+    for (int i = 0; i < 4; i++) {
+        CaptureOutput out;
+        Run r = { &corpus[i].mp3, AUTO, &out, 0, 0, 0, 0, 0, AudioGeneratorMP3Select::AUTO };
+        decode(&r);
+        bool same = out.pcm == ((r.chosen == AudioGeneratorMP3Select::HELIX) ? helixOut[i].pcm : madOut[i].pcm);
+        std::string what = std::string("front end decodes ") + corpus[i].name + " as " +
+                           ((r.chosen == AudioGeneratorMP3Select::HELIX) ? "Helix" : "libmad") + " does";
+        check(r.chosen != AudioGeneratorMP3Select::AUTO && same, what.c_str());
+    }
+    {
+        AudioFileSourcePROGMEM src(orig.data(), orig.size());
+        CaptureOutput out;
+        AudioGeneratorMP3Select gen(AudioGeneratorMP3Select::HELIX);
+        gen.begin(&src, &out);
+        while (gen.loop()) { /*noop*/ }
+        gen.stop();
+        bool helix = gen.GetBackend() == AudioGeneratorMP3Select::HELIX && out.pcm == helixOut[0].pcm;
+        gen.SetBackend(AudioGeneratorMP3Select::LIBMAD);
+        AudioFileSourcePROGMEM src2(orig.data(), orig.size());
+        CaptureOutput out2;
+        gen.begin(&src2, &out2);
+        while (gen.loop()) { /*noop*/ }
+        gen.stop();
+        check(helix && gen.GetBackend() == AudioGeneratorMP3Select::LIBMAD && out2.pcm == madOut[0].pcm, "a backend can be forced either way");
+    }
+
+    // A chooser by bit rate
+    {
+        AudioFileSourcePROGMEM src(orig.data(), orig.size());
+        AudioFileSourcePROGMEM src2(corpus[2].mp3.data(), corpus[2].mp3.size());
+        CaptureOutput out, out2;
+        AudioGeneratorMP3Select gen;
+        gen.SetChooser(helixFrom112k);
+        gen.begin(&src, &out);
+        while (gen.loop()) { /*noop*/ }
+        gen.stop();
+        bool high = gen.GetBackend() == AudioGeneratorMP3Select::HELIX && out.pcm == helixOut[0].pcm;
+        gen.begin(&src2, &out2);
+        while (gen.loop()) { /*noop*/ }
+        gen.stop();
+        check(high && gen.GetBackend() == AudioGeneratorMP3Select::LIBMAD && out2.pcm == madOut[2].pcm, "a chooser can go by bit rate");
+    }
+
+    // Helix seeks CBR exactly, lands close on VBR, and knows the length
+    {
+        uint32_t ms = 4321, at = 2 * (ms * 48);
+        CaptureOutput cbr, vbr;
+        Run r = { &corpus[0].mp3, HELIX, &cbr, ms, 0, 0, 0, 0, AudioGeneratorMP3Select::AUTO };
+        decode(&r);
+        Pcm tail(helixOut[0].pcm.begin() + at, helixOut[0].pcm.end());
+        check(cbr.pcm == tail, "Helix seeks to the exact sample in CBR");
+        uint32_t length = helixOut[0].pcm.size() / 2 * 1000 / 48000;
+        check(r.durationMs + 30 > length && r.durationMs < length + 30, "Helix knows how long CBR is");
+        Run v = { &corpus[1].mp3, HELIX, &vbr, ms, 0, 0, 0, 0, AudioGeneratorMP3Select::AUTO };
+        decode(&v);
+        check(vbr.pcm.size() > 0 && vbr.pcm.size() < helixOut[1].pcm.size(), "Helix seeks into VBR");
+    }
+
+    // Cost per profile: best of reps, taking turns, and how far the slowest
+    // rep was from the best, so a difference smaller than that isn't read
+    // as one decoder being faster
+    printf("\n%-14s %-22s %-7s %12s %10s %7s %8s %7s\n", "file", "profile", "decoder", "cycles/frame", "ns/frame", "spread", "heap", "stack");
+    for (const Entry &e : corpus) {
+        AudioGeneratorMP3Select::Profile p = {};
+        uint32_t skip = tagBytes(e.mp3);
+        if (e.mp3.size() <= skip || !AudioGeneratorMP3Select::ReadProfile(e.mp3.data() + skip, e.mp3.size() - skip, p)) {
+            printf("%-14s not an MP3\n", e.name.c_str());
+            continue;
+        }
+        CaptureOutput count;
+        count.keep = false;
+        Run first = { &e.mp3, LIBMAD, &count, 0, 0, 0, 0, 0, AudioGeneratorMP3Select::AUTO };
+        decode(&first);
+        uint32_t frames = count.frames / ((p.sampleRate >= 32000) ? 1152 : 576);
+        uint32_t kbps = p.kbps;
+        if (p.vbr && frames) {
+            kbps = (uint64_t)(e.mp3.size() - skip) * 8 * p.sampleRate / ((p.sampleRate >= 32000) ? 1152 : 576) / frames / 1000;
+        }
+        char profile[64];
+        snprintf(profile, sizeof(profile), "L%d %s %s %uk %uk", p.layer, (p.channels == 1) ? "mono" : "stereo",
+                 p.vbr ? "VBR" : "CBR", (unsigned)kbps, (unsigned)(p.sampleRate / 1000));
+        Run best[2];
+        size_t stack[2];
+        double worst[2] = { 0, 0 };
+        for (int w = 0; w < 2; w++) {
+            CaptureOutput sink;
+            sink.keep = false;
+            best[w] = { &e.mp3, (Which)w, &sink, 0, 0, 0, 0, 0, AudioGeneratorMP3Select::AUTO };
+            Run empty = { nullptr, (Which)w, &sink, 0, 0, 0, 0, 0, AudioGeneratorMP3Select::AUTO };
+            stack[w] = stackUsed(&best[w]) - stackUsed(&empty);
+            best[w].ns = 1e30;
+            best[w].cycles = ~0ULL;
+        }
+        for (int rep = 0; rep < 15; rep++) {
+            for (int w = 0; w < 2; w++) {
+                CaptureOutput sink;
+                sink.keep = false;
+                Run r = { &e.mp3, (Which)w, &sink, 0, 0, 0, 0, 0, AudioGeneratorMP3Select::AUTO };
+                decode(&r);
+                best[w].ns = (r.ns < best[w].ns) ? r.ns : best[w].ns;
+                worst[w] = (r.ns > worst[w]) ? r.ns : worst[w];
+                best[w].cycles = (r.cycles < best[w].cycles) ? r.cycles : best[w].cycles;
+                best[w].heap = r.heap;
+            }
+        }
+        for (int w = 0; w < 2; w++) {
+            printf("%-14s %-22s %-7s %12.0f %10.0f %6.0f%% %8u %7u\n", w ? "" : e.name.c_str(), w ? "" : profile, whichName[w],
+                   frames ? (double)best[w].cycles / frames : 0.0, frames ? best[w].ns / frames : 0.0,
+                   100.0 * (worst[w] - best[w].ns) / best[w].ns, (unsigned)best[w].heap, (unsigned)stack[w]);
+        }
+        AudioGeneratorMP3Select::Backend auto_ = AudioGeneratorMP3Select::DefaultChoice(p);
+        double apart = 100.0 * (best[HELIX].ns - best[LIBMAD].ns) / best[LIBMAD].ns;
+        double spread = 100.0 * ((worst[LIBMAD] - best[LIBMAD].ns) / best[LIBMAD].ns > (worst[HELIX] - best[HELIX].ns) / best[HELIX].ns ?
+                                 (worst[LIBMAD] - best[LIBMAD].ns) / best[LIBMAD].ns : (worst[HELIX] - best[HELIX].ns) / best[HELIX].ns);
+        printf("%-14s %-22s %-7s -> %s; helix %+.0f%% on libmad, %s\n", "", "", whichName[AUTO],
+               (auto_ == AudioGeneratorMP3Select::HELIX) ? "helix" : "libmad", apart,
+               (apart < spread && apart > -spread) ? "inside the spread, no difference" : "outside the spread");
+    }
+#ifndef HAVE_TSC
+    printf("(no cycle counter here, cycles/frame is 0)\n");
+#endif
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+#include <Arduino.h>
+#include <vector>
+#include <chrono>
+#include "AudioFileSourcePROGMEM.h"
+#include "AudioGeneratorMP3.h"
+#include "hosttest.h"
+
+#define MP3 "../../examples/PlayMP3FromSPIFFS/data/pno-cs.mp3"
+
+static void decode(const Bytes &mp3, bool whole, CaptureOutput &out, uint32_t seekMs = 0) {
+    AudioFileSourcePROGMEM src(mp3.data(), mp3.size());
+    AudioGeneratorMP3 gen;
+    gen.SetFrameSynth(whole);
+    gen.begin(&src, &out);
+    if (seekMs) {
+        gen.seekToMs(seekMs);
+    }
+    while (gen.loop()) { /*noop*/ }
+    gen.stop();
+}
+
+// Average ns per MP3 frame over reps decodes
+static double bench(const Bytes &mp3, bool whole, int reps, uint32_t &calls) {
+    double best = 1e30;
+    for (int r = 0; r < reps; r++) {
+        CaptureOutput sink;
+        sink.keep = false;
+        auto t0 = std::chrono::steady_clock::now();
+        decode(mp3, whole, sink);
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / (sink.frames / 1152.0);
+        best = (ns < best) ? ns : best;
+        calls = sink.calls;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    Bytes mp3 = loadFile(MP3);
+    check(mp3.size() > 0, "test MP3 loaded");
+
+    CaptureOutput slot, whole;
+    decode(mp3, false, slot);
+    decode(mp3, true, whole);
+    printf("%u frames decoded\n", (unsigned)(slot.pcm.size() / 2));
+    check(slot.pcm.size() > 44100 && whole.pcm == slot.pcm, "whole frames give the same audio as slots");
+
+    CaptureOutput choppy;
+    choppy.chop(5, 100);
+    decode(mp3, true, choppy);
+    check(choppy.pcm == slot.pcm, "a sink taking part of a frame gets the same audio");
+
+    CaptureOutput seekSlot, seekWhole;
+    decode(mp3, false, seekSlot, 4321);
+    decode(mp3, true, seekWhole, 4321);
+    check(seekSlot.pcm.size() > 0 && seekWhole.pcm == seekSlot.pcm, "seeking lands on the same sample either way");
+
+    // Cost, calls into the output and memory of either mode
+    uint32_t slotCalls = 0, wholeCalls = 0;
+    double slotNs = bench(mp3, false, 5, slotCalls);
+    double wholeNs = bench(mp3, true, 5, wholeCalls);
+    uint32_t mp3Frames = slot.pcm.size() / 2 / 1152;
+    printf("per slot:    %.0f ns/frame, %.1f output calls/frame, %u bytes synth state\n",
+           slotNs, (double)slotCalls / mp3Frames, (unsigned)sizeof(struct mad_synth));
+    printf("whole frame: %.0f ns/frame, %.1f output calls/frame, %u bytes synth state + %u bytes frame buffer\n",
+           wholeNs, (double)wholeCalls / mp3Frames, (unsigned)sizeof(struct mad_synth), (unsigned)(1152 * 2 * sizeof(int16_t)));
+    check(wholeCalls * 30 < slotCalls, "whole frames reach the output in one call each");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,211 @@
+#include <Arduino.h>
+#include <vector>
+#include <string>
+#include <map>
+#include "AudioFileSourcePROGMEM.h"
+#include "AudioFileSourceID3.h"
+#include "AudioGeneratorFLAC.h"
+#include "AudioGeneratorWAV.h"
+#include "AudioGeneratorGapless.h"
+#include "AudioGain.h"
+#include "hosttest.h"
+
+#define FLAC "gs-16b-2c-44100hz.flac"
+
+// Refuses every fifth call and takes at most 37 frames of the rest, so the
+// generators have to hold blocks back and resend them like a full DMA queue
+class ChoppyOutput : public CaptureOutput {
+public:
+    ChoppyOutput() {
+        chop(5, 37);
+    }
+};
+
+typedef std::map<std::string, std::string> Tags;
+
+static void keepTag(void *cbData, const char *type, bool isUnicode, const char *string) {
+    (void)isUnicode;
+    (*reinterpret_cast<Tags*>(cbData))[type] = string;
+}
+
+static void put32be(Bytes &b, uint32_t v) {
+    b.push_back(v >> 24);
+    b.push_back(v >> 16);
+    b.push_back(v >> 8);
+    b.push_back(v);
+}
+
+static void put32le(Bytes &b, uint32_t v) {
+    b.push_back(v);
+    b.push_back(v >> 8);
+    b.push_back(v >> 16);
+    b.push_back(v >> 24);
+}
+
+// An ID3v2.3 frame
+static void frame(Bytes &tag, const char *id, const Bytes &body) {
+    tag.insert(tag.end(), id, id + 4);
+    put32be(tag, body.size());
+    tag.push_back(0);
+    tag.push_back(0);
+    tag.insert(tag.end(), body.begin(), body.end());
+}
+
+static Bytes latin1(const char *desc, const char *value) {
+    Bytes b(1, 0);
+    b.insert(b.end(), desc, desc + strlen(desc) + 1);
+    b.insert(b.end(), value, value + strlen(value));
+    return b;
+}
+
+// UTF-16 with a byte order mark on each string, as most taggers write it
+static Bytes utf16(const char *desc, const char *value) {
+    Bytes b(1, 1);
+    for (const char *s : { desc, value }) {
+        b.push_back(0xff);
+        b.push_back(0xfe);
+        for (; *s; s++) {
+            b.push_back(*s);
+            b.push_back(0);
+        }
+        if (s == desc + strlen(desc)) {
+            b.push_back(0); // Only the description is terminated
+            b.push_back(0);
+        }
+    }
+    return b;
+}
+
+// An ID3v2.3 tag with padding, in front of body
+static Bytes withID3(const Bytes &frames, const Bytes &body) {
+    Bytes tag = { 'I', 'D', '3', 3, 0, 0 };
+    uint32_t size = frames.size() + 32;
+    tag.push_back((size >> 21) & 0x7f);
+    tag.push_back((size >> 14) & 0x7f);
+    tag.push_back((size >> 7) & 0x7f);
+    tag.push_back(size & 0x7f);
+    tag.insert(tag.end(), frames.begin(), frames.end());
+    tag.resize(tag.size() + 32, 0);
+    tag.insert(tag.end(), body.begin(), body.end());
+    return tag;
+}
+
+// The FLAC with a VORBIS_COMMENT block of comments added after its others
+static Bytes withComments(const Bytes &flac, const std::vector<std::string> &comments) {
+    Bytes out(flac.begin(), flac.begin() + 4);
+    uint32_t pos = 4;
+    bool last = false;
+    while (!last && pos + 4 <= flac.size()) {
+        last = flac[pos] & 0x80;
+        uint32_t len = (flac[pos + 1] << 16) | (flac[pos + 2] << 8) | flac[pos + 3];
+        out.push_back(flac[pos] & 0x7f);
+        out.insert(out.end(), flac.begin() + pos + 1, flac.begin() + pos + 4 + len);
+        pos += 4 + len;
+    }
+    Bytes vc;
+    const char *vendor = "test";
+    put32le(vc, strlen(vendor));
+    vc.insert(vc.end(), vendor, vendor + strlen(vendor));
+    put32le(vc, comments.size());
+    for (const std::string &c : comments) {
+        put32le(vc, c.size());
+        vc.insert(vc.end(), c.begin(), c.end());
+    }
+    out.push_back(0x80 | 4);
+    out.push_back(vc.size() >> 16);
+    out.push_back(vc.size() >> 8);
+    out.push_back(vc.size());
+    out.insert(out.end(), vc.begin(), vc.end());
+    out.insert(out.end(), flac.begin() + pos, flac.end());
+    return out;
+}
+
+static Bytes makeWav(const Pcm &pcm) {
+    uint32_t data = pcm.size() * 2, rate = 44100;
+    Bytes w(44);
+    memcpy(&w[0], "RIFF", 4);
+    uint32_t riff = 36 + data;
+    memcpy(&w[4], &riff, 4);
+    memcpy(&w[8], "WAVEfmt ", 8);
+    uint32_t fmtLen = 16, byteRate = rate * 4;
+    uint16_t fmt = 1, chans = 2, align = 4, bits = 16;
+    memcpy(&w[16], &fmtLen, 4);
+    memcpy(&w[20], &fmt, 2);
+    memcpy(&w[22], &chans, 2);
+    memcpy(&w[24], &rate, 4);
+    memcpy(&w[28], &byteRate, 4);
+    memcpy(&w[32], &align, 2);
+    memcpy(&w[34], &bits, 2);
+    memcpy(&w[36], "data", 4);
+    memcpy(&w[40], &data, 4);
+    const uint8_t *p = (const uint8_t *)pcm.data();
+    w.insert(w.end(), p, p + data);
+    return w;
+}
+
+static Pcm ramp(uint32_t frames, int step) {
+    Pcm p(2 * frames);
+    for (size_t i = 0; i < p.size(); i++) {
+        p[i] = (int16_t)(i * step);
+    }
+    return p;
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    // ID3 TXXX frames, latin1 and UTF-16, among ordinary ones
+    Bytes frames;
+    frame(frames, "TIT2", { 0, 'S', 'o', 'n', 'g' });
+    frame(frames, "TXXX", latin1("REPLAYGAIN_TRACK_GAIN", "-7.25 dB"));
+    frame(frames, "TXXX", utf16("replaygain_album_gain", "-8.50 dB"));
+    frame(frames, "TXXX", latin1("REPLAYGAIN_TRACK_PEAK", "0.912345"));
+    Bytes body = { 0xff, 0xfb, 0x90, 0x00, 1, 2, 3, 4, 5, 6, 7, 8 };
+    Bytes mp3 = withID3(frames, body);
+    Tags id3Tags;
+    AudioFileSourcePROGMEM mem(mp3.data(), mp3.size());
+    AudioFileSourceID3 id3(&mem);
+    id3.RegisterMetadataCB(keepTag, &id3Tags);
+    Bytes got(64);
+    got.resize(id3.read(got.data(), got.size()));
+    check(id3Tags["REPLAYGAIN_TRACK_GAIN"] == "-7.25 dB", "TXXX in latin1 comes out as name and value");
+    check(id3Tags["replaygain_album_gain"] == "-8.50 dB", "TXXX in UTF-16 comes out as name and value");
+    check(id3Tags["REPLAYGAIN_TRACK_PEAK"] == "0.912345" && id3Tags["Title"] == "Song", "frames after and before a TXXX still parse");
+    check(got == body, "the audio after the tag is untouched");
+
+    // FLAC Vorbis comments
+    Bytes flac = withComments(loadFile(FLAC), { "TITLE=Tone", "REPLAYGAIN_TRACK_GAIN=+2.10 dB", "R128_TRACK_GAIN=-1234", "BROKEN" });
+    Tags flacTags;
+    AudioFileSourcePROGMEM fsrc(flac.data(), flac.size());
+    ChoppyOutput sink;
+    AudioGeneratorFLAC fgen;
+    fgen.RegisterMetadataCB(keepTag, &flacTags);
+    fgen.begin(&fsrc, &sink);
+    for (int i = 0; i < 10 && fgen.loop(); i++) { /*noop*/ }
+    fgen.stop();
+    check(flacTags["REPLAYGAIN_TRACK_GAIN"] == "+2.10 dB" && flacTags["R128_TRACK_GAIN"] == "-1234", "FLAC comments come out as name and value");
+    check(flacTags["TITLE"] == "Tone" && flacTags.count("BROKEN") == 0, "comments without a value are left out");
+
+    // Two tracks, the second at half level: the gain starts exactly at the
+    // join, and frames the sink refuses aren't scaled twice
+    Pcm a = ramp(5000, 7), b = ramp(7000, -13);
+    Bytes wa = makeWav(a), wb = makeWav(b);
+    AudioFileSourcePROGMEM srcA(wa.data(), wa.size());
+    AudioFileSourcePROGMEM srcB(wb.data(), wb.size());
+    AudioGeneratorWAV genA, genB;
+    ChoppyOutput out;
+    AudioGeneratorGapless player(&out);
+    player.play(&genA, &srcA);
+    player.queue(&genB, &srcB);
+    check(player.setTrackGain(&genB, AudioGain::unity / 2), "a queued track takes a gain");
+    check(!player.setTrackGain(nullptr, AudioGain::unity), "no gain for a track that isn't there");
+    while (player.loop()) { /*noop*/ }
+    Pcm want = a, half = b;
+    AudioGain::Apply(half.data(), half.size() / 2, AudioGain::unity / 2);
+    want.insert(want.end(), half.begin(), half.end());
+    check(out.pcm == want, "track gain covers the queued track, and only it");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,233 @@
+#include <Arduino.h>
+#include <vector>
+#include <chrono>
+#include <math.h>
+#include "AudioOutputFilterResample.h"
+#include "hosttest.h"
+
+static Pcm tone(float hz, int rate, uint32_t frames, float amp) {
+    Pcm p(2 * frames);
+    for (uint32_t i = 0; i < frames; i++) {
+        p[2 * i] = (int16_t)lrint(amp * sin(2 * M_PI * hz * i / rate));
+        p[2 * i + 1] = (int16_t)lrint(amp * cos(2 * M_PI * hz * i / rate));
+    }
+    return p;
+}
+
+// Feed pcm in uneven blocks, resending whatever isn't taken
+static void feed(AudioOutputFilterResample &rs, Pcm pcm) {
+    uint32_t frames = pcm.size() / 2, at = 0, n = 1;
+    while (at < frames) {
+        uint16_t want = (frames - at < n) ? frames - at : n;
+        at += rs.ConsumeSamples(&pcm[2 * at], want);
+        rs.loop();
+        n = (n * 7 + 3) % 200 + 1;
+    }
+    for (int i = 0; i < 100; i++) {
+        rs.loop();
+    }
+}
+
+// The same with 32-bit blocks, into a sink that keeps them
+static Pcm32 resample32(Pcm32 in, int inRate, int outRate, AudioOutputFilterResample::Quality q, bool picky) {
+    CaptureOutput out;
+    out.wide = true;
+    if (picky) {
+        out.chop(4, 29);
+    }
+    AudioOutputFilterResample rs(&out, outRate, q);
+    rs.SetRate(inRate);
+    rs.begin();
+    uint32_t frames = in.size() / 2, at = 0, n = 1;
+    while (at < frames) {
+        uint16_t want = (frames - at < n) ? frames - at : n;
+        at += rs.ConsumeSamples32(&in[2 * at], want);
+        rs.loop();
+        n = (n * 7 + 3) % 200 + 1;
+    }
+    for (int i = 0; i < 100; i++) {
+        rs.loop();
+    }
+    return out.pcm32;
+}
+
+// A tone as 32-bit samples, amp in 16-bit LSBs
+static Pcm32 tone32(float hz, int rate, uint32_t frames, double amp) {
+    Pcm32 p(2 * frames);
+    for (uint32_t i = 0; i < frames; i++) {
+        p[2 * i] = (int32_t)lrint(65536 * amp * sin(2 * M_PI * hz * i / rate));
+        p[2 * i + 1] = (int32_t)lrint(65536 * amp * cos(2 * M_PI * hz * i / rate));
+    }
+    return p;
+}
+
+// snr() for 32-bit output
+static float snr32(const Pcm32 &got, float hz, int outRate, double amp) {
+    Pcm32 want = tone32(hz, outRate, got.size() / 2, amp);
+    double sig = 0, err = 0;
+    for (size_t i = got.size() / 4; i < got.size() * 3 / 4; i++) {
+        sig += (double)want[i] * want[i];
+        err += ((double)got[i] - want[i]) * ((double)got[i] - want[i]);
+    }
+    return 10 * log10(sig / (err + 1e-9));
+}
+
+static Pcm resample(const Pcm &in, int inRate, int outRate, AudioOutputFilterResample::Quality q, bool picky = true) {
+    CaptureOutput out;
+    if (picky) {
+        out.chop(4, 29);
+    }
+    AudioOutputFilterResample rs(&out, outRate, q);
+    rs.SetRate(inRate);
+    rs.begin();
+    feed(rs, in);
+    return out.pcm;
+}
+
+// Level of the difference to an ideal tone at the output rate, in dB below
+// the tone, over the middle of the output (the ends see the filter ramp)
+static float snr(const Pcm &got, float hz, int outRate, float amp) {
+    Pcm want = tone(hz, outRate, got.size() / 2, amp);
+    double sig = 0, err = 0;
+    for (size_t i = got.size() / 4; i < got.size() * 3 / 4; i++) {
+        sig += (double)want[i] * want[i];
+        err += (double)(got[i] - want[i]) * (got[i] - want[i]);
+    }
+    return 10 * log10(sig / (err + 1e-9));
+}
+
+static float level(const Pcm &got, float amp) {
+    double e = 0;
+    size_t n = 0;
+    for (size_t i = got.size() / 4; i < got.size() * 3 / 4; i++, n++) {
+        e += (double)got[i] * got[i];
+    }
+    return 10 * log10(e / n / (amp * amp / 2) + 1e-12);
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+    typedef AudioOutputFilterResample R;
+    static const char *names[] = { "FAST", "GOOD", "BEST" };
+
+    // Matching rates pass through untouched
+    Pcm noise(2 * 5000);
+    for (size_t i = 0; i < noise.size(); i++) {
+        noise[i] = (int16_t)(i * 7919);
+    }
+    check(resample(noise, 44100, 44100, R::GOOD) == noise, "same rate passes through bit exact");
+
+    Pcm dc(2 * 4800, 12345);
+    Pcm dcOut = resample(dc, 48000, 44100, R::BEST);
+    bool flat = dcOut.size() > 1000;
+    for (size_t i = 200; i < dcOut.size() - 200 && flat; i++) {
+        flat = dcOut[i] == 12345;
+    }
+    check(flat, "DC goes through unchanged");
+
+    const float amp = 16000;
+    Pcm in48 = tone(1000, 48000, 48000, amp);
+    Pcm steady = resample(in48, 48000, 44100, R::GOOD, false);
+    Pcm choppy = resample(in48, 48000, 44100, R::GOOD, true);
+    check(choppy == steady, "a sink that refuses and takes odd amounts gets the same audio");
+    int32_t expect = 44100;
+    int32_t got = steady.size() / 2;
+    check(got <= expect && got + 32 >= expect, "48 kHz in gives 44.1 kHz out");
+
+    Pcm in22 = tone(1000, 22050, 22050, amp);
+    Pcm up = resample(in22, 22050, 44100, R::GOOD, false);
+    printf("22.05 -> 44.1 kHz, GOOD: %.1f dB\n", snr(up, 1000, 44100, amp));
+    check(snr(up, 1000, 44100, amp) > 60, "upsampling keeps a tone clean");
+
+    // Quality per tier: a 1 kHz and a 10 kHz tone, and how much of a tone
+    // just above the 44.1 kHz Nyquist, and one further up, folds back into
+    // the output, the worse of the two
+    Pcm hf48 = tone(10000, 48000, 48000, amp);
+    Pcm edge48 = tone(22200, 48000, 48000, amp);
+    Pcm alias48 = tone(23000, 48000, 48000, amp);
+    float lo[3], hi[3], alias[3];
+    for (int q = 0; q < 3; q++) {
+        lo[q] = snr(resample(in48, 48000, 44100, (R::Quality)q, false), 1000, 44100, amp);
+        hi[q] = snr(resample(hf48, 48000, 44100, (R::Quality)q, false), 10000, 44100, amp);
+        float atEdge = level(resample(edge48, 48000, 44100, (R::Quality)q, false), amp);
+        float above = level(resample(alias48, 48000, 44100, (R::Quality)q, false), amp);
+        alias[q] = (atEdge > above) ? atEdge : above;
+        printf("%s: 1 kHz %.1f dB, 10 kHz %.1f dB, 22.2 kHz alias %.1f dB, 23 kHz alias %.1f dB\n", names[q], lo[q], hi[q], atEdge, above);
+    }
+    check(lo[R::FAST] > 40 && lo[R::GOOD] > 70 && lo[R::BEST] > 75, "1 kHz tone is clean in every tier");
+    check(hi[R::GOOD] > 50 && hi[R::BEST] > 50 && hi[R::FAST] < hi[R::GOOD] - 30, "filtered tiers keep 10 kHz clean");
+    check(alias[R::GOOD] < alias[R::FAST] - 10 && alias[R::BEST] < alias[R::GOOD] - 3, "higher tiers let less alias through");
+    check(alias[R::GOOD] < -65 && alias[R::BEST] < -75, "nothing above the output Nyquist folds back louder than -65 dB (GOOD) or -75 dB (BEST)");
+
+    // 32-bit blocks stay 32-bit: a loud tone as clean as through 16 bits,
+    // and one below the 16-bit LSB that the 16-bit path would lose
+    Pcm32 loud32 = tone32(1000, 48000, 48000, amp);
+    Pcm32 wide = resample32(loud32, 48000, 44100, R::BEST, false);
+    float wideSnr = snr32(wide, 1000, 44100, amp);
+    printf("BEST, 32-bit: 1 kHz %.1f dB\n", wideSnr);
+    check(wide.size() >= 44100 - 32 && wideSnr > lo[R::BEST] + 6, "32-bit blocks resample in 32 bits, with the finer table");
+    check(resample32(loud32, 48000, 44100, R::BEST, true) == wide, "a 32-bit sink that refuses and takes odd amounts gets the same audio");
+    float faint = snr32(resample32(tone32(1000, 48000, 48000, 0.4), 48000, 44100, R::GOOD, false), 1000, 44100, 0.4);
+    printf("GOOD, 32-bit: 1 kHz at 0.4 LSB %.1f dB\n", faint);
+    check(faint > 60, "detail below 16 bits comes through");
+
+    // A 16-bit track then a 32-bit one, the history carried across
+    CaptureOutput both;
+    both.wide = true;
+    R mixed(&both, 44100, R::GOOD);
+    mixed.SetRate(48000);
+    mixed.begin();
+    Pcm dc16(2 * 2400, 12345);
+    Pcm32 dc32(2 * 2400, 12345 << 16);
+    for (uint32_t at = 0; at < 2400; at += 100) {
+        mixed.ConsumeSamples(&dc16[2 * at], 100);
+    }
+    for (uint32_t at = 0; at < 2400; at += 100) {
+        mixed.ConsumeSamples32(&dc32[2 * at], 100);
+    }
+    bool even = (both.pcm.size() > 1000) && (both.pcm32.size() > 1000);
+    for (size_t i = 200; i < both.pcm.size() && even; i++) {
+        even = both.pcm[i] == 12345;
+    }
+    for (size_t i = 0; i < both.pcm32.size() && even; i++) {
+        even = both.pcm32[i] == (12345 << 16);
+    }
+    check(even, "switching from 16-bit to 32-bit blocks keeps the signal level");
+
+    // The sink is set to its rate once, however often the input changes
+    CaptureOutput sink;
+    R rs(&sink, 44100, R::GOOD);
+    rs.begin();
+    rs.SetRate(48000);
+    rs.begin();
+    rs.SetRate(44100);
+    rs.begin();
+    rs.SetRate(32000);
+    rs.begin();
+    check(sink.rateSets == 1 && sink.rate == 44100, "the sink rate is never reprogrammed");
+
+    // CPU cost per tier
+    Pcm bench = tone(1000, 48000, 4800, amp);
+    for (int q = 0; q < 3; q++) {
+        CaptureOutput out;
+        R r(&out, 44100, (R::Quality)q);
+        r.SetRate(48000);
+        r.begin();
+        const int reps = 50;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < reps; i++) {
+            out.pcm.clear();
+            Pcm b = bench;
+            for (uint32_t at = 0; at < 4800; at += 128) {
+                r.ConsumeSamples(&b[2 * at], 128);
+            }
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / (reps * 4410.0);
+        printf("%s: %d MACs per output frame, %.1f ns per frame\n", names[q], r.MacsPerFrame(), ns);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,336 @@
+#include <Arduino.h>
+#include <vector>
+#include "AudioFileSourcePROGMEM.h"
+#include "AudioGeneratorMP3.h"
+#include "AudioGeneratorFLAC.h"
+#include "AudioGeneratorWAV.h"
+#include "hosttest.h"
+
+#define MP3 "../../examples/PlayMP3FromSPIFFS/data/pno-cs.mp3"
+#define FLAC "gs-16b-2c-44100hz.flac"
+
+// Counts the seeks the decoder asks for
+class CountingSource : public AudioFileSourcePROGMEM {
+public:
+    CountingSource(const void *data, uint32_t len) : AudioFileSourcePROGMEM(data, len), seeks(0) {}
+    virtual bool seek(int32_t pos, int dir) override {
+        seeks++;
+        return AudioFileSourcePROGMEM::seek(pos, dir);
+    }
+
+    uint32_t seeks;
+};
+
+// The bare frames of the test MP3, repeated so the file is long enough that
+// far seeks estimate instead of walking every header
+static Bytes rawFrames(int copies, uint32_t &frames) {
+    Bytes in = loadFile(MP3);
+    uint32_t start = 0;
+    if (in.size() > 10 && !memcmp(in.data(), "ID3", 3)) {
+        start = 10 + ((in[6] << 21) | (in[7] << 14) | (in[8] << 7) | in[9]);
+    }
+    Bytes out;
+    frames = 0;
+    for (int c = 0; c < copies; c++) {
+        uint32_t pos = start;
+        uint32_t len;
+        while (pos + 4 <= in.size() && (len = frameLen(&in[pos])) && pos + len <= in.size()) {
+            out.insert(out.end(), in.begin() + pos, in.begin() + pos + len);
+            pos += len;
+            frames++;
+        }
+    }
+    return out;
+}
+
+// Prepend an Info frame with a real TOC and a LAME tag
+static Bytes withXingTag(const Bytes &raw, uint32_t frames, uint32_t delay, uint32_t padding) {
+    uint32_t len = frameLen(raw.data());
+    Bytes tag(len, 0);
+    memcpy(tag.data(), raw.data(), 4);
+    tag[1] |= 1;
+    uint32_t off = 4 + 32;
+    memcpy(&tag[off], "Info", 4);
+    tag[off + 7] = 0x0f;
+    uint32_t bytes = len + raw.size();
+    for (int i = 0; i < 4; i++) {
+        tag[off + 8 + i] = frames >> (24 - 8 * i);
+        tag[off + 12 + i] = bytes >> (24 - 8 * i);
+    }
+    // TOC: where each percent of the frames starts, in 256ths of the file
+    uint32_t pos = 0, f = 0;
+    for (int i = 0; i < 100; i++) {
+        while (f < frames * i / 100) {
+            pos += frameLen(&raw[pos]);
+            f++;
+        }
+        tag[off + 16 + i] = (uint64_t)(len + pos) * 256 / bytes;
+    }
+    off += 8 + 4 + 4 + 100 + 4;
+    memcpy(&tag[off], "LAME3.100", 9);
+    tag[off + 21] = delay >> 4;
+    tag[off + 22] = ((delay & 0x0f) << 4) | (padding >> 8);
+    tag[off + 23] = padding;
+    tag.insert(tag.end(), raw.begin(), raw.end());
+    return tag;
+}
+
+template <class Gen>
+static Pcm decode(const Bytes &data) {
+    AudioFileSourcePROGMEM src(data.data(), data.size());
+    CaptureOutput out;
+    Gen gen;
+    gen.begin(&src, &out);
+    while (gen.loop()) { /*noop*/ }
+    gen.stop();
+    return out.pcm;
+}
+
+// Seek straight after begin(), as a resume does, and decode a little.
+// sent is how many frames the output took in total.
+template <class Gen>
+static Pcm decodeFrom(const Bytes &data, uint32_t ms, uint32_t frames, uint32_t *posMs = nullptr, uint32_t *sent = nullptr, uint32_t *seeks = nullptr) {
+    CountingSource src(data.data(), data.size());
+    CaptureOutput out;
+    Gen gen;
+    out.limit = frames;
+    gen.begin(&src, &out);
+    if (!gen.seekToMs(ms)) {
+        return Pcm();
+    }
+    gen.loop();
+    if (posMs) {
+        *posMs = gen.getPositionMs();
+    }
+    if (sent) {
+        *sent = out.pcm.size() / 2;
+    }
+    if (seeks) {
+        *seeks = src.seeks;
+    }
+    out.pcm.resize(2 * frames);
+    return out.pcm;
+}
+
+// Length of a valid fixed blocksize FLAC frame header at p, 0 if there isn't one
+static uint32_t flacHeaderLen(const Bytes &b, uint32_t pos) {
+    if (pos + 16 > b.size()) {
+        return 0;
+    }
+    const uint8_t *p = &b[pos];
+    if (p[0] != 0xff || p[1] != 0xf8) {
+        return 0;
+    }
+    uint32_t len = 4;
+    // UTF-8 coded frame number
+    for (uint8_t lead = p[4]; lead & 0x80; lead <<= 1) {
+        len++;
+    }
+    len += (p[4] & 0x80) ? 0 : 1;
+    uint8_t bs = p[2] >> 4, sr = p[2] & 0x0f;
+    len += (bs == 6) ? 1 : (bs == 7) ? 2 : 0;
+    len += (sr == 12) ? 1 : (sr == 13 || sr == 14) ? 2 : 0;
+    return (crc8(p, len) == p[len]) ? len + 1 : 0;
+}
+
+// Put a SEEKTABLE with a point every pointEvery frames into the test file's
+// PADDING block, so no frame moves
+static Bytes withSeekTable(const Bytes &in, uint32_t pointEvery, uint32_t &points) {
+    Bytes out = in;
+    uint32_t pos = 4, padding = 0;
+    bool last = false;
+    while (!last && pos + 4 <= in.size()) {
+        last = in[pos] & 0x80;
+        uint32_t len = (in[pos + 1] << 16) | (in[pos + 2] << 8) | in[pos + 3];
+        if ((in[pos] & 0x7f) == 1) {
+            padding = pos;
+        }
+        pos += 4 + len;
+    }
+    uint32_t firstFrame = pos;
+    uint32_t blockSize = (in[8 + 2] << 8) | in[8 + 3]; // STREAMINFO max blocksize
+    std::vector<uint32_t> starts;
+    for (uint32_t at = firstFrame; at < in.size(); at++) {
+        if (flacHeaderLen(in, at)) {
+            starts.push_back(at - firstFrame);
+        }
+    }
+    points = 0;
+    if (!padding) {
+        return out;
+    }
+    uint32_t room = (in[padding + 1] << 16) | (in[padding + 2] << 8) | in[padding + 3];
+    uint32_t o = padding + 4;
+    for (uint32_t f = 0; f < starts.size() && 18 * (points + 1) + 4 <= room; f += pointEvery, points++) {
+        uint64_t sample = (uint64_t)f * blockSize;
+        for (int i = 0; i < 8; i++) {
+            out[o + i] = sample >> (56 - 8 * i);
+            out[o + 8 + i] = (uint64_t)starts[f] >> (56 - 8 * i);
+        }
+        out[o + 16] = blockSize >> 8;
+        out[o + 17] = blockSize;
+        o += 18;
+    }
+    uint32_t tableLen = 18 * points;
+    out[padding] = 3;
+    out[padding + 1] = tableLen >> 16;
+    out[padding + 2] = tableLen >> 8;
+    out[padding + 3] = tableLen;
+    uint32_t rest = room - tableLen - 4;
+    out[o] = (in[padding] & 0x80) | 1;
+    out[o + 1] = rest >> 16;
+    out[o + 2] = rest >> 8;
+    out[o + 3] = rest;
+    memset(&out[o + 4], 0, rest);
+    return out;
+}
+
+static Bytes makeWav(const Pcm &pcm, uint32_t rate) {
+    uint32_t data = pcm.size() * 2;
+    Bytes w(44);
+    memcpy(&w[0], "RIFF", 4);
+    uint32_t riff = 36 + data;
+    memcpy(&w[4], &riff, 4);
+    memcpy(&w[8], "WAVEfmt ", 8);
+    uint32_t fmtLen = 16, byteRate = rate * 4;
+    uint16_t fmt = 1, chans = 2, align = 4, bits = 16;
+    memcpy(&w[16], &fmtLen, 4);
+    memcpy(&w[20], &fmt, 2);
+    memcpy(&w[22], &chans, 2);
+    memcpy(&w[24], &rate, 4);
+    memcpy(&w[28], &byteRate, 4);
+    memcpy(&w[32], &align, 2);
+    memcpy(&w[34], &bits, 2);
+    memcpy(&w[36], "data", 4);
+    memcpy(&w[40], &data, 4);
+    const uint8_t *p = (const uint8_t *)pcm.data();
+    w.insert(w.end(), p, p + data);
+    return w;
+}
+
+static bool matchesAt(const Pcm &ref, const Pcm &got, uint32_t at) {
+    return got.size() && 2 * at + got.size() <= ref.size() && std::equal(got.begin(), got.end(), ref.begin() + 2 * at);
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+    const uint32_t rate = 48000;
+    const uint32_t window = 4800;
+
+    uint32_t frames;
+    Bytes raw = rawFrames(4, frames);
+    Pcm ref = decode<AudioGeneratorMP3>(raw);
+    check(ref.size() == 2 * frames * 1152, "reference decodes every frame");
+
+    // Untagged CBR: near seeks walk headers, far ones use the bit rate
+    static const uint32_t targets[] = { 0, 20, 1234, 17000, 45678, 79000 };
+    for (uint32_t ms : targets) {
+        uint32_t pos, sent;
+        Pcm got = decodeFrom<AudioGeneratorMP3>(raw, ms, window, &pos, &sent);
+        char what[80];
+        snprintf(what, sizeof(what), "CBR seek to %u ms is sample exact", ms);
+        check(matchesAt(ref, got, ms * rate / 1000), what);
+        snprintf(what, sizeof(what), "CBR position after seek to %u ms", ms);
+        check(pos == (ms * rate / 1000 + sent) * 1000 / rate, what);
+    }
+
+    // Seeking back and forth in one generator reuses the frame index
+    {
+        AudioFileSourcePROGMEM src(raw.data(), raw.size());
+        CaptureOutput out;
+        AudioGeneratorMP3 gen;
+        out.limit = window;
+        gen.begin(&src, &out);
+        bool ok = true;
+        static const uint32_t hops[] = { 30000, 1000, 30500, 12, 5000 };
+        for (uint32_t ms : hops) {
+            out.pcm.clear();
+            ok = ok && gen.seekToMs(ms);
+            gen.loop();
+            out.pcm.resize(2 * window);
+            ok = ok && matchesAt(ref, out.pcm, ms * rate / 1000);
+        }
+        check(ok, "repeated seeks in one generator are sample exact");
+    }
+
+    // LAME tagged: positions are in trimmed time, and TOC estimates still
+    // land on a frame so the output lines up with the reference somewhere
+    // close to the target
+    uint32_t delay = 576, padding = 1000;
+    Bytes tagged = withXingTag(raw, frames, delay, padding);
+    uint32_t skip = delay + 529;
+    {
+        Pcm got = decodeFrom<AudioGeneratorMP3>(tagged, 2500, window);
+        check(matchesAt(ref, got, skip + 2500 * rate / 1000), "tagged near seek is sample exact");
+    }
+    {
+        uint32_t ms = 60000;
+        uint32_t pos;
+        Pcm got = decodeFrom<AudioGeneratorMP3>(tagged, ms, window, &pos);
+        uint32_t want = skip + ms * rate / 1000;
+        bool found = false;
+        for (int32_t d = -20 * 1152; d <= 20 * 1152 && !found; d += 1) {
+            found = matchesAt(ref, got, want + d);
+        }
+        check(found, "TOC seek lands within 20 frames of the target");
+        check(pos + 500 > ms && pos < ms + 1000, "TOC seek position is close");
+    }
+
+    // FLAC: libflac bisects on frame headers, or starts from the nearest
+    // SEEKTABLE point when there is one.  Both land on the exact sample.
+    {
+        const uint32_t flacRate = 44100;
+        Bytes flac = loadFile(FLAC);
+        Pcm fref = decode<AudioGeneratorFLAC>(flac);
+        check(fref.size() > 2 * 10 * flacRate, "FLAC reference decodes");
+        uint32_t points;
+        Bytes tabled = withSeekTable(flac, 4, points);
+        check(points > 10 && decode<AudioGeneratorFLAC>(tabled) == fref, "FLAC with SEEKTABLE decodes the same");
+
+        static const uint32_t flacTargets[] = { 0, 1, 999, 4321, 9000, 15000 };
+        uint32_t bisectSeeks = 0, tableSeeks = 0;
+        for (uint32_t ms : flacTargets) {
+            uint32_t pos, sent, seeks;
+            char what[80];
+            Pcm got = decodeFrom<AudioGeneratorFLAC>(flac, ms, window, &pos, &sent, &seeks);
+            bisectSeeks += seeks;
+            snprintf(what, sizeof(what), "FLAC seek to %u ms is sample exact", ms);
+            check(matchesAt(fref, got, (uint64_t)ms * flacRate / 1000), what);
+            snprintf(what, sizeof(what), "FLAC position after seek to %u ms", ms);
+            check(pos == ((uint64_t)ms * flacRate / 1000 + sent) * 1000 / flacRate, what);
+
+            got = decodeFrom<AudioGeneratorFLAC>(tabled, ms, window, nullptr, nullptr, &seeks);
+            tableSeeks += seeks;
+            snprintf(what, sizeof(what), "FLAC SEEKTABLE seek to %u ms is sample exact", ms);
+            check(matchesAt(fref, got, (uint64_t)ms * flacRate / 1000), what);
+        }
+        printf("FLAC seeks: %u bisecting, %u with SEEKTABLE\n", bisectSeeks, tableSeeks);
+        check(tableSeeks < bisectSeeks, "SEEKTABLE saves seeks");
+        check(decodeFrom<AudioGeneratorFLAC>(flac, 60000, window).empty(), "FLAC seek past the end fails");
+    }
+
+    // WAV: a straight offset into the data chunk
+    {
+        const uint32_t wavRate = 22050;
+        Pcm wave(2 * 3 * wavRate);
+        for (size_t i = 0; i < wave.size(); i++) {
+            wave[i] = (int16_t)(i * 7919);
+        }
+        Bytes wav = makeWav(wave, wavRate);
+        check(decode<AudioGeneratorWAV>(wav) == wave, "WAV decodes");
+        bool ok = true;
+        static const uint32_t wavTargets[] = { 0, 7, 1500, 2990 };
+        for (uint32_t ms : wavTargets) {
+            uint32_t pos, sent;
+            Pcm got = decodeFrom<AudioGeneratorWAV>(wav, ms, 200, &pos, &sent);
+            ok = ok && matchesAt(wave, got, ms * wavRate / 1000);
+            ok = ok && pos == (ms * wavRate / 1000 + sent) * 1000 / wavRate;
+        }
+        check(ok, "WAV seeks are sample exact with the right position");
+        check(decodeFrom<AudioGeneratorWAV>(wav, 3000, 200).empty(), "WAV seek past the end fails");
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,322 @@
+// ReplayGain
+// Per-track loudness normalization.
+//
+// Tags arrive as name/value pairs from the decoders' metadata callbacks: ID3
+// TXXX frames from AudioFileSourceID3, Vorbis comments from the FLAC
+// decoder.  REPLAYGAIN_* and the Opus-style R128_* gains are understood.
+// The gain for a track is worked out once, as it is opened, and handed to
+// the player as a Q16 integer, so the samples only ever see an integer
+// multiply.
+//
+// Untagged files can be measured with Meter, an EBU R128 (ITU-R BS.1770)
+// integrated loudness meter, in the background.  The result is kept in
+// /index.rg next to /index: one little-endian int16 per entry, the gain in
+// 1/100 dB with the file's peak already allowed for, or one of the markers
+// below.  /index entries are never renumbered, so neither are these.
+
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace ReplayGain
+{
+
+static constexpr int32_t unity = 1 << 16; // Q16, as AudioGain
+static constexpr int32_t maxGain = 4 << 16;
+static constexpr float referenceLufs = -18.0f; // ReplayGain 2.0 target
+static constexpr size_t entrySize = sizeof(int16_t);
+static constexpr int16_t unknown = -32768; // Not measured yet
+static constexpr int16_t tagged = 32767;   // Carries its own tags, nothing to measure
+
+enum Mode
+{
+    OFF,
+    TRACK,
+    ALBUM
+};
+
+// Gains in dB, peaks linear with 1.0 as full scale (0 when not tagged)
+struct Tags
+{
+    float trackGain;
+    float trackPeak;
+    float albumGain;
+    float albumPeak;
+    bool hasTrack;
+    bool hasAlbum;
+};
+
+inline bool sameName(const char *a, const char *b)
+{
+    for (; *a && *b; a++, b++)
+    {
+        char x = (*a >= 'a' && *a <= 'z') ? *a - 32 : *a;
+        if (x != *b)
+            return false;
+    }
+    return *a == *b;
+}
+
+// Take in one tag; true if it was a loudness tag.  Names are matched without
+// regard to case, values are "-6.20 dB" style for REPLAYGAIN_*, and a Q7.8
+// integer relative to -23 LUFS for R128_*.
+inline bool parse(Tags &t, const char *name, const char *value)
+{
+    if (!name || !value)
+        return false;
+    float v = strtof(value, nullptr);
+    if (sameName(name, "REPLAYGAIN_TRACK_GAIN"))
+    {
+        t.trackGain = v;
+        t.hasTrack = true;
+    }
+    else if (sameName(name, "REPLAYGAIN_TRACK_PEAK"))
+    {
+        t.trackPeak = v;
+    }
+    else if (sameName(name, "REPLAYGAIN_ALBUM_GAIN"))
+    {
+        t.albumGain = v;
+        t.hasAlbum = true;
+    }
+    else if (sameName(name, "REPLAYGAIN_ALBUM_PEAK"))
+    {
+        t.albumPeak = v;
+    }
+    else if (sameName(name, "R128_TRACK_GAIN"))
+    {
+        t.trackGain = atoi(value) / 256.0f + (referenceLufs + 23.0f);
+        t.hasTrack = true;
+    }
+    else if (sameName(name, "R128_ALBUM_GAIN"))
+    {
+        t.albumGain = atoi(value) / 256.0f + (referenceLufs + 23.0f);
+        t.hasAlbum = true;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Q16 gain for db, held down so peak doesn't go past full scale
+inline int32_t toQ16(float db, float peak)
+{
+    float g = powf(10.0f, db / 20.0f);
+    if (peak > 0.0f && g * peak > 1.0f)
+        g = 1.0f / peak;
+    int32_t q = (int32_t)lrintf(g * unity);
+    return (q > maxGain) ? maxGain : (q < 0) ? 0 : q;
+}
+
+// The gain to play a track at.  Album mode falls back to the track gain, and
+// both to what Meter measured (cached, from /index.rg), then to no change.
+// preampDb is added to tagged and measured gains alike.
+inline int32_t gainFor(const Tags &t, Mode mode, int16_t cached, float preampDb)
+{
+    if (mode == OFF)
+        return unity;
+    if (mode == ALBUM && t.hasAlbum)
+        return toQ16(t.albumGain + preampDb, t.albumPeak);
+    if (t.hasTrack)
+        return toQ16(t.trackGain + preampDb, t.trackPeak);
+    if (cached != unknown && cached != tagged)
+        return toQ16(cached / 100.0f + preampDb, 0.0f);
+    return unity;
+}
+
+// Cached gain of entry idx, unknown past the end of the file
+template <class F>
+int16_t lookup(F &cache, uint32_t idx)
+{
+    uint8_t raw[entrySize];
+    if ((idx + 1) * entrySize > cache.size() || !cache.seek(idx * entrySize) || cache.read(raw, entrySize) != entrySize)
+        return unknown;
+    return (int16_t)(raw[0] | (raw[1] << 8));
+}
+
+// Record the gain of entry idx, marking any entries skipped over as unknown.
+// cache must be open for update ("r+").
+template <class F>
+bool store(F &cache, uint32_t idx, int16_t centiDb)
+{
+    uint8_t raw[entrySize] = {(uint8_t)(unknown & 0xff), (uint8_t)((uint16_t)unknown >> 8)};
+    uint32_t have = cache.size() / entrySize;
+    if (have < idx && !cache.seek(have * entrySize))
+        return false;
+    for (; have < idx; have++)
+        if (cache.write(raw, entrySize) != entrySize)
+            return false;
+    raw[0] = centiDb & 0xff;
+    raw[1] = (uint16_t)centiDb >> 8;
+    return cache.seek(idx * entrySize) && cache.write(raw, entrySize) == entrySize;
+}
+
+// EBU R128 integrated loudness of 16-bit PCM.  Samples are K-weighted, their
+// power summed in 100 ms steps, and every 400 ms window (75% overlap) lands
+// in a 0.25 LU histogram.  The absolute (-70 LUFS) and relative (-10 LU)
+// gates are applied to the histogram at the end, so memory doesn't grow with
+// the length of the track.  Floats are fine here, this runs in the
+// background, not on the playback path.
+class Meter
+{
+public:
+    Meter() { begin(44100, 2); }
+
+    void begin(uint32_t rate, int channels)
+    {
+        chans = (channels == 1) ? 1 : 2;
+        hopFrames = rate / 10;
+        // BS.1770 pre-filter (high shelf) and RLB high-pass for this rate
+        double K = tan(M_PI * 1681.974450955533 / rate);
+        double Q = 0.7071752369554196;
+        double Vh = pow(10.0, 3.999843853973347 / 20.0);
+        double Vb = pow(Vh, 0.4996667741545416);
+        double a0 = 1.0 + K / Q + K * K;
+        shelf[0] = (Vh + Vb * K / Q + K * K) / a0;
+        shelf[1] = 2.0 * (K * K - Vh) / a0;
+        shelf[2] = (Vh - Vb * K / Q + K * K) / a0;
+        shelf[3] = 2.0 * (K * K - 1.0) / a0;
+        shelf[4] = (1.0 - K / Q + K * K) / a0;
+        K = tan(M_PI * 38.13547087602444 / rate);
+        Q = 0.5003270373238773;
+        a0 = 1.0 + K / Q + K * K;
+        high[0] = 1.0f;
+        high[1] = -2.0f;
+        high[2] = 1.0f;
+        high[3] = 2.0 * (K * K - 1.0) / a0;
+        high[4] = (1.0 - K / Q + K * K) / a0;
+        memset(z, 0, sizeof(z));
+        memset(hops, 0, sizeof(hops));
+        memset(count, 0, sizeof(count));
+        memset(energy, 0, sizeof(energy));
+        hopSum = 0;
+        hopLen = 0;
+        hopCount = 0;
+        peakAbs = 0;
+    }
+
+    // count interleaved stereo frames; with one channel only the left is used
+    void add(const int16_t *frames, uint32_t frameCount)
+    {
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            for (int c = 0; c < chans; c++)
+            {
+                int16_t s = frames[2 * i + c];
+                int a = (s < 0) ? -s : s;
+                peakAbs = (a > peakAbs) ? a : peakAbs;
+                float y = weigh(z[c][0], shelf, s * (1.0f / 32768.0f));
+                y = weigh(z[c][1], high, y);
+                hopSum += y * y;
+            }
+            if (++hopLen == hopFrames)
+                endHop();
+        }
+    }
+
+    // Integrated loudness in LUFS, -70 with nothing above the absolute gate
+    float loudness() const
+    {
+        double sum = 0;
+        uint32_t n = 0;
+        for (int b = 0; b < bins; b++)
+        {
+            sum += energy[b];
+            n += count[b];
+        }
+        if (!n)
+            return floorLufs;
+        float gate = toLufs(sum / n) - 10.0f;
+        sum = 0;
+        n = 0;
+        for (int b = 0; b < bins; b++)
+        {
+            if (floorLufs + (b + 0.5f) * binLu > gate)
+            {
+                sum += energy[b];
+                n += count[b];
+            }
+        }
+        return n ? toLufs(sum / n) : floorLufs;
+    }
+
+    // Largest sample, 1.0 at full scale
+    float peak() const { return peakAbs / 32768.0f; }
+
+    // What to cache: the gain to the reference level, kept below the gain
+    // that would take the peak past full scale
+    int16_t gainCentiDb() const
+    {
+        float db = referenceLufs - loudness();
+        if (peakAbs > 0)
+        {
+            float limit = -20.0f * log10f(peak());
+            db = (db > limit) ? limit : db;
+        }
+        db = (db > 300.0f) ? 300.0f : (db < -300.0f) ? -300.0f : db;
+        return (int16_t)lrintf(db * 100.0f);
+    }
+
+private:
+    static constexpr float floorLufs = -70.0f;
+    static constexpr float binLu = 0.25f;
+    static constexpr int bins = 320; // -70 .. +10 LUFS
+
+    // Direct Form I, which holds up in single precision with the high-pass
+    // pole this close to 1.0
+    static inline float weigh(float *s, const float *c, float x)
+    {
+        float y = c[0] * x + c[1] * s[0] + c[2] * s[1] - c[3] * s[2] - c[4] * s[3];
+        s[1] = s[0];
+        s[0] = x;
+        s[3] = s[2];
+        s[2] = y;
+        return y;
+    }
+
+    static float toLufs(double meanSquare)
+    {
+        return -0.691f + 10.0f * log10f((float)meanSquare + 1e-20f);
+    }
+
+    // A 100 ms step is done; once there are four, the window ending here is
+    // one gating block
+    void endHop()
+    {
+        hops[hopCount % 4] = hopSum / hopFrames;
+        hopCount++;
+        hopSum = 0;
+        hopLen = 0;
+        if (hopCount < 4)
+            return;
+        double ms = (hops[0] + hops[1] + hops[2] + hops[3]) / 4;
+        float l = toLufs(ms);
+        if (l <= floorLufs)
+            return;
+        int b = (int)((l - floorLufs) / binLu);
+        b = (b >= bins) ? bins - 1 : b;
+        count[b]++;
+        energy[b] += ms;
+    }
+
+    int chans;
+    uint32_t hopFrames;
+    float shelf[5];
+    float high[5];
+    float z[2][2][4];
+    double hopSum;
+    uint32_t hopLen;
+    uint32_t hopCount;
+    double hops[4];
+    uint32_t count[bins];
+    double energy[bins];
+    int peakAbs;
+};
+
+} // namespace ReplayGain
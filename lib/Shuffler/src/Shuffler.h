@@ -0,0 +1,150 @@
+// Shuffler
+// Shuffled playback order without per-track bookkeeping.
+//
+// The order is a keyed 4-round Feistel permutation over the smallest power of
+// two that covers the library.  Walking a cursor through that domain and
+// skipping values >= total visits every track exactly once per cycle.  The
+// domain is less than twice the library, so next() and prev() cost O(1)
+// expected.  Going back is the same walk in reverse, so no history is kept.
+//
+// The whole state is a seed and a cursor (plus the track count), small enough
+// to go into the bookmark.
+//
+// The library may grow during a cycle.  Tracks whose slot is still ahead of
+// the cursor join the current cycle and the rest come up in the next one.
+// Growing past the power-of-two domain changes the permutation, so that
+// starts a fresh cycle.
+
+#pragma once
+
+#include <stdint.h>
+
+class Shuffler
+{
+public:
+    Shuffler(uint32_t total = 0, uint32_t seed = 0)
+    {
+        restore(total, seed, 0);
+    }
+
+    // Resume a saved order.  cursor is the value returned by cursor().
+    void restore(uint32_t total, uint32_t seed, uint32_t cursor)
+    {
+        this->total = total;
+        this->key = seed;
+        bits = bitsFor(total);
+        pos = cursor <= domain() ? cursor : 0;
+    }
+
+    void grow(uint32_t newTotal)
+    {
+        if (newTotal <= total)
+            return;
+        total = newTotal;
+        if (bitsFor(total) != bits)
+        {
+            bits = bitsFor(total);
+            newCycle();
+        }
+    }
+
+    // Next track of the cycle; a new cycle with a new key starts when this
+    // one is used up.  Returns -1 only for an empty library.
+    int next()
+    {
+        if (total == 0)
+            return -1;
+        for (;;)
+        {
+            if (pos >= domain())
+                newCycle();
+            uint32_t v = permute(pos++);
+            if (v < total)
+                return v;
+        }
+    }
+
+    // Step back to the track played before the current one and return it,
+    // or -1 at the start of a cycle.
+    int prev()
+    {
+        int32_t cur = validBefore(pos);
+        if (cur < 0)
+            return -1;
+        int32_t before = validBefore(cur);
+        if (before < 0)
+            return -1;
+        pos = before + 1;
+        return permute(before);
+    }
+
+    uint32_t seed() const { return key; }
+    uint32_t cursor() const { return pos; }
+    uint32_t size() const { return total; }
+
+private:
+    uint32_t total;
+    uint32_t key;
+    uint32_t pos;
+    uint8_t bits;
+
+    static uint8_t bitsFor(uint32_t n)
+    {
+        uint8_t b = 1;
+        while (b < 32 && (1u << b) < n)
+            b++;
+        return b;
+    }
+
+    uint32_t domain() const { return bits >= 32 ? 0xffffffffu : (1u << bits); }
+
+    static uint32_t mix(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352d;
+        x ^= x >> 15;
+        x *= 0x846ca68b;
+        x ^= x >> 16;
+        return x;
+    }
+
+    void newCycle()
+    {
+        key = mix(key + 0x9e3779b9);
+        pos = 0;
+    }
+
+    // Last slot below end whose value is a track, or -1
+    int32_t validBefore(uint32_t end) const
+    {
+        while (end > 0)
+        {
+            end--;
+            if (permute(end) < total)
+                return end;
+        }
+        return -1;
+    }
+
+    // Unbalanced Feistel network on a bits-wide value.  Each round moves the
+    // low half up and xors a keyed hash of it into the old high half, so the
+    // two halves may differ in width by one bit.
+    uint32_t permute(uint32_t x) const
+    {
+        uint8_t hiBits = bits / 2;
+        uint8_t loBits = bits - hiBits;
+        for (uint32_t round = 0; round < 4; round++)
+        {
+            uint32_t loMask = (1u << loBits) - 1;
+            uint32_t hiMask = (1u << hiBits) - 1;
+            uint32_t hi = x >> loBits;
+            uint32_t lo = x & loMask;
+            uint32_t f = mix(lo ^ mix(key + round));
+            x = (lo << hiBits) | ((hi ^ f) & hiMask);
+            uint8_t t = hiBits;
+            hiBits = loBits;
+            loBits = t;
+        }
+        return x;
+    }
+};
@@ -0,0 +1,191 @@
+// TrackIndex
+// Fixed-width offset table for the /index playlist.
+//
+// /index holds one path per line.  /index.off holds one little-endian uint32
+// per entry: the byte offset of that entry's line in /index.  Looking up any
+// track is then one seek + one read in each file, no matter where in the
+// library it sits.
+//
+// Entries are never moved or renumbered once written, so shuffle state and
+// bookmarks stay valid.  A removed file is tombstoned by setting the top bit
+// of its offset, and lookup() then refuses it.
+//
+// The helpers are templates over the file type so the same code runs on the
+// SD card (fs::File) and in the host tests.  F needs seek(pos), position(),
+// size(), read(uint8_t *, size_t) and write(const uint8_t *, size_t).
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace TrackIndex
+{
+
+static constexpr size_t maxPathLen = 256;
+static constexpr size_t offsetSize = sizeof(uint32_t);
+static constexpr uint32_t tombstoneBit = 0x80000000;
+
+inline void putLE32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+inline uint32_t getLE32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Number of entries in the offset table
+template <class F>
+uint32_t count(F &offsets)
+{
+    return offsets.size() / offsetSize;
+}
+
+// Append one path to /index and its offset to /index.off
+template <class F>
+bool append(F &index, F &offsets, const char *path)
+{
+    uint8_t raw[offsetSize];
+    putLE32(raw, index.position());
+    size_t len = strlen(path);
+    if (index.write((const uint8_t *)path, len) != len || index.write((const uint8_t *)"\n", 1) != 1)
+        return false;
+    return offsets.write(raw, offsetSize) == offsetSize;
+}
+
+// Copy entry idx into path (NUL terminated, line ending stripped).  The entry
+// length comes from the next offset, so only the path bytes themselves are read.
+template <class F>
+bool lookup(F &index, F &offsets, uint32_t idx, char *path, size_t pathLen)
+{
+    uint32_t total = count(offsets);
+    if (idx >= total || pathLen == 0)
+        return false;
+
+    uint8_t raw[2 * offsetSize];
+    size_t want = (idx + 1 < total) ? 2 * offsetSize : offsetSize;
+    if (!offsets.seek(idx * offsetSize) || offsets.read(raw, want) != want)
+        return false;
+
+    uint32_t start = getLE32(raw);
+    uint32_t end = (want == 2 * offsetSize) ? (getLE32(raw + offsetSize) & ~tombstoneBit) : (uint32_t)index.size();
+    if ((start & tombstoneBit) || end < start)
+        return false;
+
+    size_t len = end - start;
+    if (len > pathLen - 1)
+        len = pathLen - 1;
+    if (!index.seek(start) || index.read((uint8_t *)path, len) != len)
+        return false;
+
+    while (len > 0 && (path[len - 1] == '\n' || path[len - 1] == '\r'))
+        len--;
+    path[len] = 0;
+    return len > 0;
+}
+
+// Mark entry idx as removed.  offsets must be open for update ("r+").
+template <class F>
+bool tombstone(F &offsets, uint32_t idx)
+{
+    uint8_t raw[offsetSize];
+    if (idx >= count(offsets) || !offsets.seek(idx * offsetSize) || offsets.read(raw, offsetSize) != offsetSize)
+        return false;
+    putLE32(raw, getLE32(raw) | tombstoneBit);
+    return offsets.seek(idx * offsetSize) && offsets.write(raw, offsetSize) == offsetSize;
+}
+
+// Walk /index front to back, calling fn(idx, path) for every live entry.
+// Used for bulk work such as an incremental rescan, where per-entry lookups
+// would cost two seeks each.  /index.off is read alongside in chunks so
+// tombstoned entries can be skipped.
+template <class F, class Fn>
+uint32_t forEach(F &index, F &offsets, Fn fn)
+{
+    uint8_t buf[512];
+    uint8_t offBuf[128 * offsetSize];
+    size_t offLen = 0;
+    size_t offPos = 0;
+    char path[maxPathLen];
+    size_t len = 0;
+    uint32_t entries = 0;
+
+    auto emit = [&]()
+    {
+        if (offPos == offLen)
+        {
+            offLen = offsets.read(offBuf, sizeof(offBuf)) / offsetSize;
+            offPos = 0;
+        }
+        bool live = offPos < offLen && !(getLE32(offBuf + offPos * offsetSize) & tombstoneBit);
+        offPos++;
+        path[len] = 0;
+        if (live)
+            fn(entries, (const char *)path);
+        entries++;
+    };
+
+    index.seek(0);
+    offsets.seek(0);
+    size_t n;
+    while ((n = index.read(buf, sizeof(buf))) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            if (buf[i] == '\n')
+            {
+                if (len > 0)
+                    emit();
+                len = 0;
+            }
+            else if (buf[i] != '\r' && len < maxPathLen - 1)
+            {
+                path[len++] = buf[i];
+            }
+        }
+    }
+    if (len > 0)
+        emit();
+    return entries;
+}
+
+// Regenerate /index.off from an existing /index in one sequential pass, for
+// cards indexed before the offset table existed.  Returns the entry count.
+template <class F>
+uint32_t rebuildOffsets(F &index, F &offsets)
+{
+    uint8_t buf[512];
+    uint8_t raw[offsetSize];
+    uint32_t entries = 0;
+    uint32_t pos = 0;
+    bool lineStart = true;
+
+    index.seek(0);
+    size_t n;
+    while ((n = index.read(buf, sizeof(buf))) > 0)
+    {
+        for (size_t i = 0; i < n; i++, pos++)
+        {
+            if (lineStart && buf[i] != '\n' && buf[i] != '\r')
+            {
+                putLE32(raw, pos);
+                offsets.write(raw, offsetSize);
+                entries++;
+                lineStart = false;
+            }
+            else if (buf[i] == '\n')
+            {
+                lineStart = true;
+            }
+        }
+    }
+    return entries;
+}
+
+} // namespace TrackIndex
@@ -6,15 +6,26 @@ SemaphoreHandle_t sdMutex;
 #include <vector>
 #include <SD.h>
 #include <AudioFileSourceSD.h>
-#include <AudioGeneratorMP3.h>
+#include <AudioFileSourceRing.h>
+#include <AudioFileSourceID3.h>
+#include <AudioGeneratorMP3Select.h>
 #include <AudioGeneratorWAV.h>
 #include <AudioGeneratorFLAC.h>
+#include <AudioGeneratorGapless.h>
 #include <AudioOutputI2S.h>
+#include <AudioOutputFilterResample.h>
+#include <AudioOutputFilterEQ.h>
 #include "esp_system.h"
 #include <freertos/queue.h>
 #include <WiFi.h>
 #include <unordered_set>
+#include <unordered_map>
+#include <string>
 #include <Button.h>
+#include <TrackIndex.h>
+#include <Shuffler.h>
+#include <Bookmark.h>
+#include <ReplayGain.h>
 
 // ESP32 Dev Kit                   SD Card Module
 // ┌──────────────┐                ┌─────────────┐
@@ -55,61 +66,41 @@ SemaphoreHandle_t sdMutex;
 #define I2S_BCLK 26
 #define I2S_LRC 25
 #define I2S_DOUT 22
+// The PCM5102A takes 32-bit slots: 24-bit FLAC reaches it whole, resampled
+// or not, and the volume is applied before anything is cut off.  16 for
+// 16-bit-only DACs.
+#define I2S_SLOT_BITS 32
+// Every track is converted to this rate, so the I2S clock is set once and
+// never retuned between a 44.1 kHz track and a 48 kHz one
+#define OUTPUT_RATE 44100
+// FAST, GOOD or BEST: more filter taps cost more CPU per frame
+#define RESAMPLE_QUALITY AudioOutputFilterResample::GOOD
+// MP3 decoder: AudioGeneratorMP3Select::AUTO picks libmad or Helix per file
+// (see MP3_HELIX_MIN_KBPS), ::LIBMAD or ::HELIX always use that one
+#define MP3_BACKEND AudioGeneratorMP3Select::AUTO
 #define BTN_VOL_UP GPIO_NUM_33
 #define BTN_VOL_DN GPIO_NUM_27
 #define LED_PIN 2
+#define READ_RING_BYTES (32 * 1024)
+// Buffered bytes of the next track before its decoder is started
+#define PREFETCH_BYTES (8 * 1024)
+// Overlap between tracks, 0 for a plain gapless join, up to 10 s
+#define CROSSFADE_MS 0
+// With a crossfade the next track is opened this long before the fade starts
+#define CROSSFADE_LEAD_MS 3000
+// Volume steps slide over this long instead of jumping, which clicks
+#define VOLUME_RAMP_MS 30
+// Tracks fade in as they start and out when stopped or skipped mid-way
+#define FADE_IN_MS 20
+#define FADE_OUT_MS 40
+// Loudness normalization from ReplayGain/R128 tags: ReplayGain::TRACK,
+// ReplayGain::ALBUM or ReplayGain::OFF, plus a preamp on top of the tag's gain
+#define REPLAYGAIN_MODE ReplayGain::TRACK
+#define REPLAYGAIN_PREAMP_DB 0.0f
+// Measure untagged tracks in the background (a second decoder, so memory
+// permitting) and keep the result in /index.rg
+#define LOUDNESS_SCAN 0
 
-class LazyShuffler
-{
-public:
-    LazyShuffler(int start, int end)
-        : start(start), end(end), total(end - start + 1), remaining(total)
-    {
-    }
-
-    int next()
-    {
-        if (remaining == 0)
-        {
-            remaining = total;
-            used.clear();
-            history.clear();
-        }
-
-        int val;
-        do
-        {
-            val = start + esp_random() % total;
-        } while (used.find(val) != used.end());
-
-        used.insert(val);
-        history.push_back(val);
-        remaining--;
-        return val;
-    }
-
-    int last()
-    {
-        if (history.size() < 2)
-            return -1;
-        // Remove the latest number
-        used.erase(history.back());
-        history.pop_back();
-        int prev = history.back();
-        return prev;
-    }
-
-private:
-    int start, end, total, remaining;
-    std::unordered_set<int> used;
-    std::vector<int> history;
-};
-
-AudioFileSourceSD *fileSrc = nullptr;
-AudioGeneratorMP3 *mp3 = nullptr;
-AudioGeneratorWAV *wav = nullptr;
-AudioGeneratorFLAC *flac = nullptr;
-AudioOutputI2S *audioOut = nullptr;
 enum AudioType
 {
     TYPE_MP3,
@@ -117,12 +108,35 @@ enum AudioType
     TYPE_FLAC,
     TYPE_UNKNOWN
 };
-AudioType currentType = TYPE_UNKNOWN;
-int totalFiles = -1;
+// One track on its way to the DAC: the SD file, the ring readerTask fills
+// from it, and the decoder reading the ring.  Only readerTask touches file
+// itself.  The ring pointers change under sdMutex.
+struct TrackSlot
+{
+    AudioFileSourceSD *file;
+    AudioFileSourceRing *ring;
+    AudioFileSourceID3 *id3; // Tag reader between ring and MP3 decoder, or null
+    AudioGenerator *gen;
+    AudioType type;
+    int idx;
+    int16_t measuredGain; // From /index.rg
+    ReplayGain::Tags tags;
+};
+static const TrackSlot emptySlot = {nullptr, nullptr, nullptr, nullptr, TYPE_UNKNOWN, -1, ReplayGain::unknown, {}};
+// The playing track, and the one opened while it plays out so the player
+// can run straight into it
+TrackSlot current = emptySlot;
+TrackSlot upcoming = emptySlot;
+AudioOutputI2S *audioOut = nullptr;
+AudioOutputFilterResample *resampler = nullptr;
+AudioOutputFilterEQ *eq = nullptr;
+AudioGeneratorGapless *player = nullptr;
+// Written by indexTask as entries are published, read by the player
+volatile int totalFiles = -1;
+volatile bool indexDone = false;
 int currentIdx = -1;
 unsigned long lastBookmarkMs = 0;
-LazyShuffler shuffler(0, 0);
-bool lockLoop = false;
+Shuffler shuffler;
 unsigned long lastSkip = 0;
 
 // fixed volume steps
@@ -135,83 +149,415 @@ const int VOL_COUNT = sizeof(volSteps) / sizeof(volSteps[0]);
 
 int volIndex = 7; // start at 0.05 (index 3)
 
+// EQ bands, in dB; all flat as shipped, and a band at 0 dB costs nothing
+struct EqBand
+{
+    int type;
+    float hz, Q, gainDb;
+};
+const EqBand eqBands[] = {
+    {bq_type_lowshelf, 100, 0.707f, 0},
+    {bq_type_peak, 400, 1.0f, 0},
+    {bq_type_peak, 1500, 1.0f, 0},
+    {bq_type_peak, 5000, 1.0f, 0},
+    {bq_type_highshelf, 10000, 0.707f, 0}};
+const int EQ_COUNT = sizeof(eqBands) / sizeof(eqBands[0]);
+
+// Whole bookmark records, snapshotted by playerTask, which owns the track,
+// shuffle and volume state; bookmarkTask only numbers and writes them
 QueueHandle_t bookmarkQueue;
+
+enum PlayerCommandType
+{
+    CMD_PLAY,   // track, offset or positionMs
+    CMD_SEEK,   // position in the current track, like the bookmark
+    CMD_NEXT,
+    CMD_PREVIOUS,
+    CMD_VOLUME_UP,
+    CMD_VOLUME_DOWN
+};
+struct PlayerCommand
+{
+    PlayerCommandType type;
+    int32_t track;
+    uint32_t offset;
+    uint32_t positionMs; // used instead of offset when set and the decoder can
+};
+QueueHandle_t playerQueue;
 File bookmarkFile;
+// Recently started tracks; bookmarkTask fills in the rest of the record
+Bookmark::Record bookmarkState = {};
 
-bool writeIndexFile()
+static bool isAudioFile(const String &n)
+{
+    return n.endsWith(".mp3") || n.endsWith(".MP3") ||
+           n.endsWith(".wav") || n.endsWith(".WAV") ||
+           n.endsWith(".flac") || n.endsWith(".FLAC");
+}
+
+// One line of /index.dirs: "<stamp>\t<files>\t<path>" for every directory the
+// last scan walked.  The root is stored with an empty path.
+struct DirRecord
+{
+    String path;
+    time_t stamp;
+    int files;
+};
+
+static void readDirManifest(std::vector<DirRecord> &dirs)
+{
+    File f = SD.open("/index.dirs", FILE_READ);
+    if (!f)
+        return;
+    while (f.available())
+    {
+        String line = f.readStringUntil('\n');
+        int a = line.indexOf('\t');
+        int b = line.indexOf('\t', a + 1);
+        if (a < 0 || b < 0)
+            continue;
+        dirs.push_back({line.substring(b + 1), (time_t)line.substring(0, a).toInt(), (int)line.substring(a + 1, b).toInt()});
+    }
+    f.close();
+}
+
+static bool writeDirManifest(const std::vector<DirRecord> &dirs)
 {
+    File f = SD.open("/index.dirs", FILE_WRITE);
+    if (!f)
+        return false;
+    for (const DirRecord &d : dirs)
+        f.printf("%ld\t%d\t%s\n", (long)d.stamp, d.files, d.path.c_str());
+    f.close();
+    return true;
+}
+
+// The scan runs beside playback and shares the card with it.  Hand the bus
+// back after a bounded amount of work (a directory entry costs 8, an index
+// line 1) so the decoder never waits on a whole folder listing.
+static void scanYield(int cost)
+{
+    static int budget = 0;
+    budget += cost;
+    if (budget < 64)
+        return;
+    budget = 0;
+    xSemaphoreGive(sdMutex);
+    vTaskDelay(1);
     xSemaphoreTake(sdMutex, portMAX_DELAY);
+}
 
-    if (SD.exists("/index"))
+// Appends entries to /index and makes them visible to playTrack() in
+// batches: totalFiles only ever counts entries already flushed to the card.
+struct IndexWriter
+{
+    File indexFile;
+    File offFile;
+    int entries;
+    int pending;
+
+    void add(const String &path)
     {
-        LOGLN("Index found");
-        xSemaphoreGive(sdMutex);
-        return true;
+        TrackIndex::append(indexFile, offFile, path.c_str());
+        entries++;
+        // Publish the very first entry at once so playback can start
+        if (++pending >= 32 || totalFiles <= 0)
+            publish();
     }
 
-    File indexFile = SD.open("/index", FILE_WRITE);
-    if (!indexFile)
+    void publish()
     {
-        LOGLN("Failed to create index file");
-        xSemaphoreGive(sdMutex);
-        return false;
+        indexFile.flush();
+        offFile.flush();
+        totalFiles = entries;
+        pending = 0;
+    }
+};
+
+// Append every audio file below dir to the index, recording each directory
+// visited.  Returns the number of files added.
+static int scanTree(File dir, const String &path, IndexWriter &out, std::vector<DirRecord> &dirs)
+{
+    size_t slot = dirs.size();
+    dirs.push_back({path, dir.getLastWrite(), 0});
+    int added = 0;
+    while (File f = dir.openNextFile())
+    {
+        String n = f.name();
+        if (f.isDirectory())
+        {
+            // Skip folders that start with '.'
+            if (!n.startsWith("."))
+                added += scanTree(f, path + "/" + n, out, dirs);
+        }
+        else if (isAudioFile(n))
+        {
+            out.add(path + "/" + n);
+            dirs[slot].files++;
+            added++;
+        }
+        f.close();
+        scanYield(8);
+    }
+    return added;
+}
+
+// Record every directory below dir with no stamp and an unknown file count,
+// so the next updateIndexFile() lists each of them once
+static void listDirs(File dir, const String &path, std::vector<DirRecord> &dirs)
+{
+    dirs.push_back({path, 0, -1});
+    while (File f = dir.openNextFile())
+    {
+        String n = f.name();
+        if (f.isDirectory() && !n.startsWith("."))
+            listDirs(f, path + "/" + n, dirs);
+        f.close();
+        scanYield(8);
     }
+}
+
+// Bring an existing /index up to date by re-listing only the directories whose
+// last-write stamp moved since /index.dirs was written.  Removed files are
+// tombstoned and new ones appended, so existing track numbers never change.
+static void updateIndexFile(std::vector<DirRecord> &dirs, IndexWriter &out)
+{
+    struct DirChange
+    {
+        size_t rec;
+        bool gone;
+        time_t stamp;
+        int found;
+        std::unordered_set<std::string> names; // on the card but not (yet) found in /index
+    };
+    std::vector<DirChange> changes;
+    std::vector<String> newDirs;
+    std::unordered_set<std::string> known;
+    for (const DirRecord &d : dirs)
+        known.insert(d.path.c_str());
 
-    // Helper lambda to recursively walk and write file paths
-    std::function<void(File, String)> writePaths;
-    int fileCount = 0;
-    writePaths = [&](File dir, String path)
+    for (size_t i = 0; i < dirs.size(); i++)
     {
+        scanYield(8);
+        File dir = SD.open(dirs[i].path.isEmpty() ? "/" : dirs[i].path.c_str());
+        if (!dir || !dir.isDirectory())
+        {
+            dir.close();
+            changes.push_back({i, true, 0, 0, {}});
+            continue;
+        }
+        time_t stamp = dir.getLastWrite();
+        // FAT keeps no stamp on the root, so that one is always listed
+        if (stamp != 0 && stamp == dirs[i].stamp)
+        {
+            dir.close();
+            continue;
+        }
+
+        DirChange c = {i, false, stamp, 0, {}};
+        bool newSubdir = false;
         while (File f = dir.openNextFile())
         {
+            String n = f.name();
             if (f.isDirectory())
             {
-                String folder = path + "/" + f.name();
-                // Skip folders that start with '.'
-                if (!String(f.name()).startsWith("."))
+                String sub = dirs[i].path + "/" + n;
+                if (!n.startsWith(".") && !known.count(sub.c_str()))
                 {
-                    writePaths(f, folder);
+                    newDirs.push_back(sub);
+                    newSubdir = true;
                 }
             }
-            else
+            else if (isAudioFile(n))
             {
-                String n = f.name();
-                if (n.endsWith(".mp3") || n.endsWith(".MP3") ||
-                    n.endsWith(".wav") || n.endsWith(".WAV") ||
-                    n.endsWith(".flac") || n.endsWith(".FLAC"))
-                {
-                    String fullPath = path + "/" + n;
-                    indexFile.println(fullPath);
-                    fileCount++;
-                }
+                c.names.insert(n.c_str());
             }
             f.close();
+            scanYield(8);
         }
-    };
+        dir.close();
+        c.found = c.names.size();
+
+        // Without a stamp a matching file count is the best evidence we have
+        if (stamp == 0 && !newSubdir && (int)c.names.size() == dirs[i].files)
+            continue;
+        changes.push_back(std::move(c));
+    }
+
+    if (changes.empty() && newDirs.empty())
+    {
+        LOGLN("Index up to date");
+        return;
+    }
+
+    std::unordered_map<std::string, DirChange *> byPath;
+    for (DirChange &c : changes)
+        byPath[dirs[c.rec].path.c_str()] = &c;
+
+    // One sequential pass over /index decides which entries are stale and
+    // which files on the card are already indexed
+    std::vector<uint32_t> stale;
+    TrackIndex::forEach(out.indexFile, out.offFile, [&](uint32_t idx, const char *path)
+    {
+        scanYield(1);
+        const char *slash = strrchr(path, '/');
+        if (!slash)
+            return;
+        auto it = byPath.find(std::string(path, slash - path));
+        if (it == byPath.end())
+            return;
+        DirChange *c = it->second;
+        if (c->gone || c->names.erase(slash + 1) == 0)
+            stale.push_back(idx);
+    });
+
+    for (uint32_t idx : stale)
+    {
+        TrackIndex::tombstone(out.offFile, idx);
+        scanYield(8);
+    }
+
+    out.indexFile.seek(out.indexFile.size());
+    out.offFile.seek(out.offFile.size());
+    int added = 0;
+    for (DirChange &c : changes)
+    {
+        DirRecord &d = dirs[c.rec];
+        for (const std::string &n : c.names)
+        {
+            out.add(d.path + "/" + n.c_str());
+            added++;
+        }
+        d.files = c.gone ? -1 : c.found;
+        d.stamp = c.stamp;
+    }
+    for (const String &sub : newDirs)
+    {
+        File dir = SD.open(sub.c_str());
+        if (dir)
+            added += scanTree(dir, sub, out, dirs);
+        dir.close();
+    }
+
+    // Drop directories that vanished
+    std::vector<DirRecord> kept;
+    for (DirRecord &d : dirs)
+        if (d.files >= 0)
+            kept.push_back(d);
+    dirs.swap(kept);
+
+    LOG("Index updated: %d dirs changed, %u removed, %d added\n", (int)changes.size(), (unsigned)stale.size(), added);
+}
+
+bool writeIndexFile()
+{
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+
+    std::vector<DirRecord> dirs;
+    IndexWriter out = {};
+    if (SD.exists("/index"))
+    {
+        LOGLN("Index found");
+        if (!SD.exists("/index.off"))
+        {
+            // Index written by older firmware, add the offset table once
+            File indexFile = SD.open("/index", FILE_READ);
+            File offFile = SD.open("/index.off", FILE_WRITE);
+            if (indexFile && offFile)
+            {
+                uint32_t entries = TrackIndex::rebuildOffsets(indexFile, offFile);
+                LOG("Index offsets rebuilt: %u entries\n", entries);
+            }
+            indexFile.close();
+            offFile.close();
+        }
+        out.indexFile = SD.open("/index", "r+");
+        out.offFile = SD.open("/index.off", "r+");
+        if (!out.indexFile || !out.offFile)
+        {
+            LOGLN("Failed to open index file");
+            out.indexFile.close();
+            out.offFile.close();
+            xSemaphoreGive(sdMutex);
+            return false;
+        }
+
+        // Everything indexed on an earlier boot is playable straight away
+        out.entries = TrackIndex::count(out.offFile);
+        out.publish();
+        readDirManifest(dirs);
+        if (dirs.empty())
+        {
+            // Index from older firmware without /index.dirs: check every
+            // directory against it once, then later boots go by the stamps
+            LOGLN("No directory manifest, checking every directory");
+            File root = SD.open("/");
+            if (root)
+                listDirs(root, "", dirs);
+            root.close();
+        }
+        if (!dirs.empty())
+        {
+            updateIndexFile(dirs, out);
+            out.publish();
+            writeDirManifest(dirs);
+        }
+        out.indexFile.close();
+        out.offFile.close();
+        xSemaphoreGive(sdMutex);
+        LOG("Total files: %d\n", totalFiles);
+        return totalFiles > 0;
+    }
 
-    // Write all file paths (unsorted) to the index file
+    // Measured gains go by index entry, a new index numbers them afresh
+    SD.remove("/index.rg");
+    out.indexFile = SD.open("/index", FILE_WRITE);
+    out.offFile = SD.open("/index.off", FILE_WRITE);
+    if (!out.indexFile || !out.offFile)
+    {
+        LOGLN("Failed to create index file");
+        out.indexFile.close();
+        out.offFile.close();
+        xSemaphoreGive(sdMutex);
+        return false;
+    }
+
+    // Write all file paths (unsorted) to the index file, publishing as we go
     File root = SD.open("/");
-    writePaths(root, "");
+    int fileCount = scanTree(root, "", out, dirs);
     root.close();
-    indexFile.flush();
-    indexFile.close();
-    delay(1000);
+    out.publish();
+    out.indexFile.close();
+    out.offFile.close();
 
     if (fileCount == 0)
     {
         SD.remove("/index");
+        SD.remove("/index.off");
+        SD.remove("/index.dirs");
+        SD.remove("/index.rg");
         LOGLN("No audio files found for index.");
         xSemaphoreGive(sdMutex);
         return false;
     }
 
+    writeDirManifest(dirs);
     LOGLN("Index file created");
     xSemaphoreGive(sdMutex);
-    totalFiles = fileCount;
     LOG("Total files: %d\n", totalFiles);
     return true;
 }
 
+// Builds or refreshes the index in the background so setup() can start
+// playing the first track as soon as one is published.
+void indexTask(void *pv)
+{
+    if (!writeIndexFile())
+        LOGLN("Index has no playable files");
+    indexDone = true;
+    vTaskDelete(NULL);
+}
+
 TaskHandle_t blinkTaskHandle = NULL;
 void blinkLed(int times)
 {
@@ -308,34 +654,6 @@ void blinkWelcomeMessage()
         "morseBlink", 1024, (void *)morse, 1, &blinkTaskHandle);
 }
 
-void stopPlayback()
-{
-    if (mp3 && mp3->isRunning())
-    {
-        mp3->stop();
-        delete mp3;
-        mp3 = nullptr;
-    }
-    if (wav && wav->isRunning())
-    {
-        wav->stop();
-        delete wav;
-        wav = nullptr;
-    }
-    if (flac && flac->isRunning())
-    {
-        flac->stop();
-        delete flac;
-        flac = nullptr;
-    }
-    if (fileSrc)
-    {
-        fileSrc->close();
-        delete fileSrc;
-        fileSrc = nullptr;
-    }
-}
-
 uint32_t skipID3v2Tag(AudioFileSource *src)
 {
     char header[10];
@@ -359,153 +677,572 @@ uint32_t skipID3v2Tag(AudioFileSource *src)
     return skipBytes;
 }
 
-void playTrack(int idx, uint32_t off)
+// Free a slot's decoder, ring and file.  The player must already have
+// stopped the decoder.
+static void releaseSlot(TrackSlot &slot)
 {
-    LOG("playTrack() called with idx=%d\n", idx);
+    delete slot.gen;
+    delete slot.id3;
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+    delete slot.ring;
+    if (slot.file)
+    {
+        slot.file->close();
+        delete slot.file;
+    }
+    slot = emptySlot;
+    xSemaphoreGive(sdMutex);
+}
+
+// The filters in front of audioOut: the resampler, then the EQ, so the EQ
+// only ever runs at OUTPUT_RATE
+static void makeFilters()
+{
+    eq = new AudioOutputFilterEQ(audioOut, EQ_COUNT);
+    for (int i = 0; i < EQ_COUNT; i++)
+        eq->SetSection(i, eqBands[i].type, eqBands[i].hz, eqBands[i].Q, eqBands[i].gainDb);
+    resampler = new AudioOutputFilterResample(eq, OUTPUT_RATE, RESAMPLE_QUALITY);
+}
+
+// Bring the output down to silence and play the fade out before the caller
+// cuts the track, so stopping or skipping doesn't click
+static void fadeOut()
+{
+    if (!audioOut || !player || !player->current())
+        return;
+    audioOut->FadeGain(0.0f, FADE_OUT_MS);
+    while (audioOut->IsRamping() && player->loop())
+        audioOut->WaitForSpace(20);
+    // Whatever is still queued in the DMA is the end of the fade
+    resampler->flush();
+}
 
+void stopPlayback()
+{
+    fadeOut();
+    if (player)
+        player->stop();
+    // Skips keep the output running, only here does playback really end
+    if (resampler)
+        resampler->stop();
+    releaseSlot(upcoming);
+    releaseSlot(current);
+}
+
+static AudioType typeOf(const String &path)
+{
+    if (path.endsWith(".mp3") || path.endsWith(".MP3"))
+        return TYPE_MP3;
+    if (path.endsWith(".wav") || path.endsWith(".WAV"))
+        return TYPE_WAV;
+    if (path.endsWith(".flac") || path.endsWith(".FLAC"))
+        return TYPE_FLAC;
+    return TYPE_UNKNOWN;
+}
+
+// Look up track idx and open it behind a fresh ring.  readerTask starts
+// filling the ring right away; the decoder comes later from makeGenerator().
+static bool openSlot(TrackSlot &slot, int idx)
+{
     if (idx < 0 || idx >= totalFiles)
     {
         LOG("Invalid track index: %d\n", idx);
-        return;
+        return false;
     }
 
-    String currentPath;
-
-    LOGLN("Opening index file for reading path");
     xSemaphoreTake(sdMutex, portMAX_DELAY);
+    // One seek + read in /index.off gives the entry's offset and length in /index
+    char pathBuf[TrackIndex::maxPathLen];
+    File indexFile = SD.open("/index", FILE_READ);
+    File offFile = SD.open("/index.off", FILE_READ);
+    bool found = indexFile && offFile && TrackIndex::lookup(indexFile, offFile, idx, pathBuf, sizeof(pathBuf));
+    indexFile.close();
+    offFile.close();
+    if (!found)
+    {
+        LOGLN("Failed to read path from /index");
+        xSemaphoreGive(sdMutex);
+        return false;
+    }
 
-    lockLoop = true;
-    xQueueReset(bookmarkQueue);
-
-    // Stop any running decoder and cleanup
-    if (mp3 && mp3->isRunning())
+    String path = pathBuf;
+    AudioType type = typeOf(path);
+    if (type == TYPE_UNKNOWN)
     {
-        mp3->stop();
-        delete mp3;
-        mp3 = nullptr;
+        LOG("unsupported file type: %s\n", path.c_str());
+        xSemaphoreGive(sdMutex);
+        return false;
     }
-    if (wav && wav->isRunning())
+
+    AudioFileSourceSD *file = new AudioFileSourceSD();
+    if (!file->open(path.c_str()))
     {
-        wav->stop();
-        delete wav;
-        wav = nullptr;
+        LOGLN("file open failed");
+        delete file;
+        xSemaphoreGive(sdMutex);
+        return false;
     }
-    if (flac && flac->isRunning())
+    slot.file = file;
+    slot.ring = new AudioFileSourceRing(file, READ_RING_BYTES);
+    slot.type = type;
+    slot.idx = idx;
+    if (REPLAYGAIN_MODE != ReplayGain::OFF && SD.exists("/index.rg"))
     {
-        flac->stop();
-        delete flac;
-        flac = nullptr;
+        File rgFile = SD.open("/index.rg", FILE_READ);
+        if (rgFile)
+            slot.measuredGain = ReplayGain::lookup(rgFile, idx);
+        rgFile.close();
     }
-    if (fileSrc)
+    xSemaphoreGive(sdMutex);
+
+    LOG("Opened %s\n", path.c_str());
+    return true;
+}
+
+// Hand the slot's loudness gain to the player.  Worked out once per track
+// (and again if a tag turns up late), the samples only see the Q16 multiply.
+static void applyTrackGain(const TrackSlot &slot)
+{
+    if (!player || !slot.gen)
+        return;
+    int32_t gain = ReplayGain::gainFor(slot.tags, REPLAYGAIN_MODE, slot.measuredGain, REPLAYGAIN_PREAMP_DB);
+    player->setTrackGain(slot.gen, gain);
+}
+
+// Tags from the ID3 reader or the FLAC decoder.  cbData is the decoder, which
+// stays put while its slot moves from upcoming to current.  Runs in
+// playerTask, like everything else touching the slots' decoders.
+static void onTrackTag(void *cbData, const char *type, bool isUnicode, const char *string)
+{
+    AudioGenerator *gen = reinterpret_cast<AudioGenerator *>(cbData);
+    TrackSlot *slot = (current.gen == gen) ? &current : (upcoming.gen == gen) ? &upcoming : nullptr;
+    if (slot && ReplayGain::parse(slot->tags, type, string))
     {
-        fileSrc->close();
-        delete fileSrc;
-        fileSrc = nullptr;
+        LOG("%s: %s\n", type, string);
+        applyTrackGain(*slot);
     }
+}
 
-    File indexFile = SD.open("/index", FILE_READ);
-    if (indexFile)
+// What the slot's decoder reads from
+static AudioFileSource *sourceOf(TrackSlot &slot)
+{
+    if (slot.id3)
+        return slot.id3;
+    return slot.ring;
+}
+
+// Decoder for an opened slot, with its ring positioned at byte off
+static AudioGenerator *makeGenerator(TrackSlot &slot, uint32_t off)
+{
+    AudioGenerator *gen = nullptr;
+    switch (slot.type)
     {
-        for (int i = 0; i <= idx; ++i)
+    case TYPE_MP3:
+        if (off == 0 && REPLAYGAIN_MODE != ReplayGain::OFF)
         {
-            currentPath = indexFile.readStringUntil('\n');
+            // Read through the ID3v2 tag instead of skipping it, for its
+            // ReplayGain frames
+            slot.id3 = new AudioFileSourceID3(slot.ring);
         }
-        indexFile.close();
-        currentPath.trim();
-        xSemaphoreGive(sdMutex);
-    }
-    else
-    {
-        LOGLN("Failed to open /index for reading path");
-        xSemaphoreGive(sdMutex);
-        lockLoop = false;
-        return;
+        else if (off == 0)
+        {
+            uint32_t skipped = skipID3v2Tag(slot.ring);
+            LOG("Skipped %u bytes of ID3v2 tag\n", skipped);
+        }
+        else
+        {
+            slot.ring->seek(off, SEEK_SET);
+        }
+        gen = new AudioGeneratorMP3Select(MP3_BACKEND);
+        break;
+    case TYPE_WAV:
+        gen = new AudioGeneratorWAV();
+        break;
+    case TYPE_FLAC:
+        // libflac has to read STREAMINFO first and seeks by time itself, so
+        // a bare byte offset (bookmark from older firmware) restarts the track
+        if (off != 0)
+            LOG("FLAC can't resume at byte %u, starting over\n", off);
+        gen = new AudioGeneratorFLAC();
+        break;
+    default:
+        return nullptr;
     }
+    gen->RegisterMetadataCB(onTrackTag, gen);
+    if (slot.id3)
+        slot.id3->RegisterMetadataCB(onTrackTag, gen);
+    return gen;
+}
 
-    xSemaphoreTake(sdMutex, portMAX_DELAY);
+// The MP3 front end has picked its decoder once the slot's generator is begun
+static void logDecoder(TrackSlot &slot)
+{
+    if (slot.type == TYPE_MP3)
+        LOG("MP3 decoder: %s\n",
+            static_cast<AudioGeneratorMP3Select *>(slot.gen)->GetBackend() == AudioGeneratorMP3Select::HELIX ? "Helix" : "libmad");
+}
 
-    fileSrc = new AudioFileSourceSD();
-    if (currentPath.isEmpty() || !fileSrc->open(currentPath.c_str()))
-    {
-        LOGLN("file open failed");
-        delete fileSrc;
-        fileSrc = nullptr;
-        xSemaphoreGive(sdMutex);
-        lockLoop = false;
+// Forget the prepared next track and hand its shuffle step back, so the
+// same track still comes next after a seek or jump
+static void dropUpcoming()
+{
+    if (!upcoming.ring)
         return;
-    }
+    if (upcoming.gen)
+        player->dequeue();
+    releaseSlot(upcoming);
+    shuffler.prev();
+}
+
+void playTrack(int idx, uint32_t off, uint32_t ms = 0)
+{
+    LOG("playTrack() called with idx=%d\n", idx);
+
+    xQueueReset(bookmarkQueue);
 
     // Ensure audioOut is allocated
     if (!audioOut)
     {
         audioOut = new AudioOutputI2S();
         audioOut->SetPinout(I2S_BCLK, I2S_LRC, I2S_DOUT);
+        audioOut->SetSlotBits(I2S_SLOT_BITS);
+        audioOut->SetRate(OUTPUT_RATE);
         audioOut->begin();
         audioOut->SetGain(volSteps[volIndex]);
+        audioOut->SetGainRamp(VOLUME_RAMP_MS);
+        makeFilters();
+    }
+    if (!player)
+    {
+        player = new AudioGeneratorGapless(resampler);
+        player->setCrossfade(CROSSFADE_MS);
     }
 
-    if (currentPath.endsWith(".mp3") || currentPath.endsWith(".MP3"))
+    // A jump, not a track running out: drop what's playing and queued
+    fadeOut();
+    dropUpcoming();
+    player->stop();
+    releaseSlot(current);
+
+    if (!openSlot(current, idx))
+        return;
+
+    // From here on the decoders only see the ring, which readerTask fills.
+    // A time lands the decoder on a frame boundary, a byte offset is for
+    // formats that can't seek by time.
+    current.gen = makeGenerator(current, ms ? 0 : off);
+    if (!current.gen || !player->play(current.gen, sourceOf(current)))
     {
-        currentIdx = idx;
-        currentType = TYPE_MP3;
-        if (off == 0)
-        {
-            uint32_t skipped = skipID3v2Tag(fileSrc);
-            LOG("Skipped %u bytes of ID3v2 tag\n", skipped);
-        }
-        else
+        LOGLN("decoder failed to start");
+        return;
+    }
+    // Tags the decoder read while starting up came before the player knew it
+    applyTrackGain(current);
+    logDecoder(current);
+    if (ms && !current.gen->seekToMs(ms))
+        LOG("Seek to %u ms failed\n", ms);
+    currentIdx = idx;
+
+    // Up from silence, whatever the last track faded to
+    audioOut->FadeGain(0.0f, 0);
+    audioOut->FadeGain(volSteps[volIndex], FADE_IN_MS);
+}
+
+// The player has run from the current track into the queued one
+static void promoteUpcoming()
+{
+    TrackSlot finished = current;
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+    current = upcoming;
+    upcoming = emptySlot;
+    xSemaphoreGive(sdMutex);
+    releaseSlot(finished);
+
+    currentIdx = current.idx;
+    Bookmark::pushHistory(bookmarkState, currentIdx);
+    xQueueReset(bookmarkQueue);
+    LOG("Continuing gapless with track %d\n", currentIdx);
+}
+
+static int pickNext()
+{
+    shuffler.grow(totalFiles);
+    int next = shuffler.next();
+    if (currentIdx == next)
+    {
+        next = shuffler.next();
+    }
+    return next;
+}
+
+// True once the current track is close enough to its end that the next one
+// has to be decoding by the time the crossfade starts
+static bool crossfadeDue()
+{
+    if (CROSSFADE_MS == 0 || !current.gen)
+        return false;
+    uint32_t duration = current.gen->getDurationMs();
+    return duration && current.gen->getPositionMs() + CROSSFADE_MS + CROSSFADE_LEAD_MS >= duration;
+}
+
+// Once the current file is all in its ring, or a crossfade is coming up,
+// open the next one so readerTask moves on to it, and queue its decoder when
+// enough is buffered that parsing the headers won't wait on the card
+static void prepareUpcoming()
+{
+    if (!current.ring || upcoming.gen || totalFiles <= 0)
+        return;
+
+    if (!upcoming.ring)
+    {
+        if (current.ring->isBuffered() || crossfadeDue())
+            openSlot(upcoming, pickNext());
+        return;
+    }
+
+    if (!upcoming.ring->isBuffered() && upcoming.ring->getFillLevel() < PREFETCH_BYTES)
+        return;
+    upcoming.gen = makeGenerator(upcoming, 0);
+    if (!upcoming.gen || !player->queue(upcoming.gen, sourceOf(upcoming)))
+    {
+        LOG("Could not queue track %d\n", upcoming.idx);
+        releaseSlot(upcoming);
+        return;
+    }
+    applyTrackGain(upcoming);
+    logDecoder(upcoming);
+}
+
+// The only task that reads audio data from the card.  Keeps the rings topped
+// up in sector-aligned chunks so the decoder never waits on the SD bus,
+// whatever the index scan or bookmark writes are doing.  The current track
+// comes first, the upcoming one only gets what's left over.
+void readerTask(void *pv)
+{
+    for (;;)
+    {
+        xSemaphoreTake(sdMutex, portMAX_DELAY);
+        bool busy = current.ring && current.ring->fill();
+        if (!busy)
+            busy = upcoming.ring && upcoming.ring->fill();
+        xSemaphoreGive(sdMutex);
+        if (!busy)
+            vTaskDelay(2);
+    }
+}
+
+#if LOUDNESS_SCAN
+// A card file for a decoder outside the playback path, which isn't behind a
+// ring, so each access takes sdMutex itself
+class LockedSDSource : public AudioFileSourceSD
+{
+public:
+    virtual uint32_t read(void *data, uint32_t len) override
+    {
+        xSemaphoreTake(sdMutex, portMAX_DELAY);
+        uint32_t n = AudioFileSourceSD::read(data, len);
+        xSemaphoreGive(sdMutex);
+        return n;
+    }
+    virtual bool seek(int32_t pos, int dir) override
+    {
+        xSemaphoreTake(sdMutex, portMAX_DELAY);
+        bool ok = AudioFileSourceSD::seek(pos, dir);
+        xSemaphoreGive(sdMutex);
+        return ok;
+    }
+    virtual bool close() override
+    {
+        xSemaphoreTake(sdMutex, portMAX_DELAY);
+        bool ok = AudioFileSourceSD::close();
+        xSemaphoreGive(sdMutex);
+        return ok;
+    }
+};
+
+// Feeds decoded audio to a loudness meter, a slice per call to refill() so
+// the decoder comes back and the scan can yield
+class MeterOutput : public AudioOutput
+{
+public:
+    MeterOutput(ReplayGain::Meter *m) : meter(m), budget(0), fresh(true)
+    {
+        hertz = 44100;
+        channels = 2;
+    }
+    virtual bool SetRate(int hz) override
+    {
+        fresh = fresh || (hz != hertz);
+        hertz = hz;
+        return true;
+    }
+    virtual bool SetChannels(int chan) override
+    {
+        fresh = fresh || (chan != channels);
+        channels = chan;
+        return true;
+    }
+    virtual bool begin() override { return true; }
+    virtual bool ConsumeSample(int16_t sample[2]) override { return ConsumeSamples(sample, 1) == 1; }
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override
+    {
+        if (fresh)
         {
-            fileSrc->seek(off, SEEK_SET);
+            meter->begin(hertz, channels);
+            fresh = false;
         }
-        mp3 = new AudioGeneratorMP3();
-        mp3->begin(fileSrc, audioOut);
+        count = (count > budget) ? budget : count;
+        meter->add(samples, count);
+        budget -= count;
+        return count;
+    }
+    virtual bool stop() override { return true; }
+    void refill(uint32_t frames) { budget = frames; }
+
+private:
+    ReplayGain::Meter *meter;
+    uint32_t budget;
+    bool fresh;
+};
+
+static void onScanTag(void *cbData, const char *type, bool isUnicode, const char *string)
+{
+    ReplayGain::parse(*reinterpret_cast<ReplayGain::Tags *>(cbData), type, string);
+}
+
+// Decode track idx into meter and return the gain to cache for it:
+// ReplayGain::tagged as soon as it turns out to have tags of its own,
+// ReplayGain::unknown if it can't be read
+static int16_t measureTrack(int idx, ReplayGain::Meter *meter)
+{
+    char pathBuf[TrackIndex::maxPathLen];
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+    File indexFile = SD.open("/index", FILE_READ);
+    File offFile = SD.open("/index.off", FILE_READ);
+    bool found = indexFile && offFile && TrackIndex::lookup(indexFile, offFile, idx, pathBuf, sizeof(pathBuf));
+    indexFile.close();
+    offFile.close();
+    xSemaphoreGive(sdMutex);
+    AudioType type = found ? typeOf(pathBuf) : TYPE_UNKNOWN;
+    if (type == TYPE_UNKNOWN)
+        return ReplayGain::unknown;
+
+    LockedSDSource *file = new LockedSDSource();
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+    bool opened = file->open(pathBuf);
+    xSemaphoreGive(sdMutex);
+    if (!opened)
+    {
+        delete file;
+        return ReplayGain::unknown;
     }
-    else if (currentPath.endsWith(".wav") || currentPath.endsWith(".WAV"))
+
+    ReplayGain::Tags tags = {};
+    AudioFileSource *src = file;
+    AudioFileSourceID3 *id3 = nullptr;
+    AudioGenerator *gen;
+    if (type == TYPE_MP3)
     {
-        currentIdx = idx;
-        currentType = TYPE_WAV;
-        wav = new AudioGeneratorWAV();
-        wav->begin(fileSrc, audioOut);
+        id3 = new AudioFileSourceID3(file);
+        id3->RegisterMetadataCB(onScanTag, &tags);
+        src = id3;
+        gen = new AudioGeneratorMP3Select(MP3_BACKEND);
     }
-    else if (currentPath.endsWith(".flac") || currentPath.endsWith(".FLAC"))
+    else if (type == TYPE_WAV)
     {
-        currentIdx = idx;
-        currentType = TYPE_FLAC;
-        fileSrc->seek(off, SEEK_SET);
-        flac = new AudioGeneratorFLAC();
-        flac->begin(fileSrc, audioOut);
+        gen = new AudioGeneratorWAV();
     }
     else
     {
-        currentType = TYPE_UNKNOWN;
-        LOGLN("unsupported file type");
+        gen = new AudioGeneratorFLAC();
     }
-    lockLoop = false;
-    LOG("Playing %s\n", currentPath.c_str());
-    xSemaphoreGive(sdMutex);
+    gen->RegisterMetadataCB(onScanTag, &tags);
+
+    MeterOutput out(meter);
+    out.refill(4096);
+    bool running = gen->begin(src, &out);
+    while (running && !tags.hasTrack)
+    {
+        running = gen->loop();
+        out.refill(4096);
+        // Second place to playback, and out of the way of the watchdog
+        vTaskDelay(1);
+    }
+    gen->stop();
+    delete gen;
+    delete id3;
+    delete file;
+
+    if (tags.hasTrack)
+        return ReplayGain::tagged;
+    int16_t gain = meter->gainCentiDb();
+    LOG("Loudness of %s: %.1f LUFS, gain %.2f dB\n", pathBuf, meter->loudness(), gain / 100.0f);
+    return gain;
 }
 
+// Works through the index once it is complete, measuring every track the
+// cache has nothing for.  Each result is written as it comes, so a restart
+// picks up where the scan left off.
+void loudnessTask(void *pv)
+{
+    while (!indexDone)
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    ReplayGain::Meter *meter = new ReplayGain::Meter();
+    int total = totalFiles;
+    for (int idx = 0; idx < total; idx++)
+    {
+        xSemaphoreTake(sdMutex, portMAX_DELAY);
+        int16_t cached = ReplayGain::unknown;
+        if (SD.exists("/index.rg"))
+        {
+            File rgFile = SD.open("/index.rg", FILE_READ);
+            if (rgFile)
+                cached = ReplayGain::lookup(rgFile, idx);
+            rgFile.close();
+        }
+        xSemaphoreGive(sdMutex);
+        if (cached != ReplayGain::unknown)
+            continue;
+
+        int16_t gain = measureTrack(idx, meter);
+        if (gain == ReplayGain::unknown)
+            continue;
+        xSemaphoreTake(sdMutex, portMAX_DELAY);
+        File rgFile = SD.exists("/index.rg") ? SD.open("/index.rg", "r+") : SD.open("/index.rg", FILE_WRITE);
+        if (!rgFile || !ReplayGain::store(rgFile, idx, gain))
+            LOGLN("Failed to write /index.rg");
+        rgFile.close();
+        xSemaphoreGive(sdMutex);
+    }
+    delete meter;
+    LOGLN("Loudness scan done");
+    vTaskDelete(NULL);
+}
+#endif
+
 void bookmarkTask(void *pv)
 {
-    uint32_t pos;
+    Bookmark::Record rec;
+    uint32_t seq = bookmarkState.seq;
     for (;;)
     {
-        if (xQueueReceive(bookmarkQueue, &pos, portMAX_DELAY) == pdTRUE)
+        if (xQueueReceive(bookmarkQueue, &rec, portMAX_DELAY) == pdTRUE)
         {
             if (!bookmarkFile)
                 continue;
 
+            rec.seq = ++seq;
+
+            // One whole sector into the next ring slot, nothing to read back
             xSemaphoreTake(sdMutex, portMAX_DELAY);
-            bookmarkFile.seek(0);
-            // Save: currentIdx, pos, currentMode, currentFolderIdx
-            bookmarkFile.printf("%d %d %u %d\n", totalFiles, currentIdx, pos, volIndex);
+            Bookmark::append(bookmarkFile, rec);
             bookmarkFile.flush();
             xSemaphoreGive(sdMutex);
         }
     }
 }
 
-bool readBookmark(int &idx, uint32_t &off, int &files, int &vol)
+bool readBookmark(Bookmark::Record &rec)
 {
     xSemaphoreTake(sdMutex, portMAX_DELAY);
     if (!SD.exists("/bookmark"))
@@ -521,25 +1258,55 @@ bool readBookmark(int &idx, uint32_t &off, int &files, int &vol)
         return false;
     }
 
-    String line = f.readStringUntil('\n');
+    bool found = Bookmark::recover(f, rec);
+    if (!found)
+    {
+        // Text line from older firmware, the shuffle starts over
+        f.seek(0);
+        String line = f.readStringUntil('\n');
+        found = Bookmark::parseLegacy(line.c_str(), rec);
+    }
     f.close();
     xSemaphoreGive(sdMutex);
-
-    int read = sscanf(line.c_str(), "%d %d %u %d", &files, &idx, &off, &vol);
-
-    return true;
+    return found;
 }
 
-void nextTrack()
+// skipped is true for the Next button, false when the track ran out
+void nextTrack(bool skipped)
 {
     LOGLN("nextTrack() called");
 
-    int next = shuffler.next();
-    if (currentIdx == next)
+    // Already decoding the next one, just cut over to it.  A skip leaves the
+    // current track mid-way, so fade it out and the next one in.
+    if (upcoming.gen)
     {
-        next = shuffler.next();
+        if (skipped)
+            fadeOut();
+        // The fade may have run into it already
+        if (player->current() == upcoming.gen || player->advance())
+        {
+            promoteUpcoming();
+            if (skipped)
+            {
+                audioOut->FadeGain(0.0f, 0);
+                audioOut->FadeGain(volSteps[volIndex], FADE_IN_MS);
+            }
+            return;
+        }
     }
 
+    int next;
+    if (upcoming.ring)
+    {
+        next = upcoming.idx;
+        releaseSlot(upcoming);
+    }
+    else
+    {
+        next = pickNext();
+    }
+
+    Bookmark::pushHistory(bookmarkState, next);
     playTrack(next, 0);
 }
 
@@ -547,6 +1314,7 @@ void previousTrack()
 {
     LOGLN("previousTrack() called");
 
+    dropUpcoming();
     unsigned long now = millis();
     if (now - lastSkip > 5000)
     {
@@ -554,7 +1322,12 @@ void previousTrack()
     }
     else
     {
-        int last = shuffler.last();
+        // The shuffler steps back within its cycle, the history ring
+        // covers the jump back into the previous one
+        int last = shuffler.prev();
+        int recent = Bookmark::popHistory(bookmarkState);
+        if (last < 0)
+            last = recent;
         if (last < 0)
         {
             LOGLN("No previous track available");
@@ -590,14 +1363,22 @@ static void volumeUp()
     }
 }
 
+// Buttons only post commands; playerTask carries them out between blocks
+static void postCommand(PlayerCommandType type, int32_t track = 0, uint32_t offset = 0, uint32_t positionMs = 0)
+{
+    PlayerCommand cmd = {type, track, offset, positionMs};
+    if (xQueueSend(playerQueue, &cmd, 0) != pdTRUE)
+        LOGLN("Player queue full, command dropped");
+}
+
 static void onVolumeUpButtonSingleClick(void *button_handle, void *user_data)
 {
-    volumeUp();
+    postCommand(CMD_VOLUME_UP);
 }
 
 static void onVolumeDownButtonSingleClick(void *button_handle, void *user_data)
 {
-    volumeDown();
+    postCommand(CMD_VOLUME_DOWN);
 }
 
 bool volume_up_button_hold = false;
@@ -630,6 +1411,9 @@ static void onVolumeUpButtonLongPressStart(void *button_handle, void *user_data)
         xSemaphoreTake(sdMutex, portMAX_DELAY);
         SD.remove("/bookmark");
         SD.remove("/index");
+        SD.remove("/index.off");
+        SD.remove("/index.dirs");
+        SD.remove("/index.rg");
         xSemaphoreGive(sdMutex);
         blinkLed(50);
         LOGLN("Bookmark and index deleted");
@@ -637,7 +1421,7 @@ static void onVolumeUpButtonLongPressStart(void *button_handle, void *user_data)
     }
     else
     {
-        nextTrack();
+        postCommand(CMD_NEXT);
     }
 }
 
@@ -648,13 +1432,99 @@ static void onVolumeDownButtonLongPressStart(void *button_handle, void *user_dat
         xSemaphoreTake(sdMutex, portMAX_DELAY);
         SD.remove("/bookmark");
         SD.remove("/index");
+        SD.remove("/index.off");
+        SD.remove("/index.dirs");
+        SD.remove("/index.rg");
         xSemaphoreGive(sdMutex);
         LOGLN("Bookmark and index deleted");
         esp_restart();
     }
     else
     {
+        postCommand(CMD_PREVIOUS);
+    }
+}
+
+static void runCommand(const PlayerCommand &cmd)
+{
+    switch (cmd.type)
+    {
+    case CMD_PLAY:
+        playTrack(cmd.track, cmd.offset, cmd.positionMs);
+        break;
+    case CMD_SEEK:
+        playTrack(currentIdx, cmd.offset, cmd.positionMs);
+        break;
+    case CMD_NEXT:
+        nextTrack(true);
+        break;
+    case CMD_PREVIOUS:
         previousTrack();
+        break;
+    case CMD_VOLUME_UP:
+        volumeUp();
+        break;
+    case CMD_VOLUME_DOWN:
+        volumeDown();
+        break;
+    }
+}
+
+// Playback engine, the only task touching the decoders.  Commands are picked
+// up between decode steps; while the output is full the task sleeps on the
+// I2S DMA instead of spinning.
+void playerTask(void *pv)
+{
+    for (;;)
+    {
+        PlayerCommand cmd;
+        while (xQueueReceive(playerQueue, &cmd, 0) == pdTRUE)
+            runCommand(cmd);
+
+        bool active = player && player->loop();
+        if (upcoming.gen && player->current() == upcoming.gen)
+            promoteUpcoming();
+
+        if (!active)
+        {
+            LOGLN("track finished, playing next");
+            vTaskDelay(pdMS_TO_TICKS(10));
+            nextTrack(false);
+            continue;
+        }
+
+        unsigned long now = millis();
+        if (now - lastBookmarkMs > 1000)
+        {
+            // Taken here, between commands, so a skip can't land between
+            // the position and the track it belongs to
+            Bookmark::Record rec = bookmarkState;
+            // The shuffler's own count, so restore() rebuilds the same permutation
+            rec.totalFiles = shuffler.size();
+            rec.track = currentIdx;
+            rec.volume = volIndex;
+            rec.shuffleSeed = shuffler.seed();
+            rec.shuffleCursor = shuffler.cursor();
+            rec.offset = 0;
+            rec.positionMs = 0;
+            // The decoder's position, not the reader's, which runs ahead
+            if (current.ring && current.ring->isOpen())
+            {
+                rec.offset = current.ring->getPos();
+                rec.positionMs = current.gen ? current.gen->getPositionMs() : 0;
+            }
+            else
+            {
+                LOGLN("track not open during bookmark getPos()");
+            }
+            xQueueSend(bookmarkQueue, &rec, 0);
+            lastBookmarkMs = now;
+            LOG("Queued bookmark %u @ %u bytes, %u ms\n", currentIdx, rec.offset, rec.positionMs);
+        }
+
+        prepareUpcoming();
+
+        audioOut->WaitForSpace(20);
     }
 }
 
@@ -688,61 +1558,100 @@ void setup()
     }
     LOGLN("SD OK");
 
+    // Reader on core 0.  Decoding runs in playerTask on core 1, started once
+    // the first track is queued; loop() has nothing left to do.
+    xTaskCreatePinnedToCore(readerTask, "readerTask", 4096, NULL, 3, NULL, 0);
+
     if (!audioOut)
     {
         audioOut = new AudioOutputI2S();
         audioOut->SetPinout(I2S_BCLK, I2S_LRC, I2S_DOUT);
+        audioOut->SetSlotBits(I2S_SLOT_BITS);
+        audioOut->SetRate(OUTPUT_RATE);
         audioOut->begin();
+        audioOut->SetGainRamp(VOLUME_RAMP_MS);
+        makeFilters();
         LOGLN("I²S OK");
     }
 
-    if (!writeIndexFile())
+    Bookmark::Record saved = {};
+    saved.shuffleSeed = esp_random();
+    bool bookmarkFound = readBookmark(saved);
+    LOGLN(bookmarkFound ? "Bookmark file opened" : "No bookmark found");
+
+    // Scan on the other core and start playing as soon as the first entry is published
+    xTaskCreatePinnedToCore(indexTask, "indexTask", 8192, NULL, 1, NULL, 0);
+    while (totalFiles <= 0 && !indexDone)
+        delay(10);
+
+    if (totalFiles <= 0)
     {
         LOGLN("No MP3s");
         while (1)
             delay(1000);
     }
 
-    int idx = 0;
-    uint32_t off = 0;
-    int total = totalFiles;
-    int vol = volIndex;
-    bool bookmarkFound = readBookmark(idx, off, total, vol);
-    LOGLN(bookmarkFound ? "Bookmark file opened" : "No bookmark found");
-
-    if (total <= 0)
-        LOGLN("No files found.");
-
-    while (total <= 0)
-        delay(100);
-
-    totalFiles = total;
-
-    volIndex = vol;
+    if (bookmarkFound && saved.volume < VOL_COUNT)
+        volIndex = saved.volume;
     if (audioOut)
         audioOut->SetGain(volSteps[volIndex]);
 
-    shuffler = LazyShuffler(0, totalFiles - 1);
+    if (bookmarkFound)
+    {
+        // Continue the saved order; tracks indexed since then join it
+        shuffler.restore(saved.totalFiles, saved.shuffleSeed, saved.shuffleCursor);
+        shuffler.grow(totalFiles);
+        bookmarkState = saved;
+    }
+    else
+    {
+        shuffler = Shuffler(totalFiles, esp_random());
+    }
 
-    bookmarkFile = SD.open("/bookmark", FILE_WRITE);
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+    bookmarkFile = SD.open("/bookmark", "r+");
+    if (!bookmarkFile || bookmarkFile.size() != Bookmark::slotCount * Bookmark::slotSize)
+    {
+        // First boot or a text bookmark: lay out the whole ring once
+        bookmarkFile.close();
+        bookmarkFile = SD.open("/bookmark", FILE_WRITE);
+        if (bookmarkFile)
+        {
+            Bookmark::format(bookmarkFile);
+            bookmarkFile.flush();
+        }
+    }
+    xSemaphoreGive(sdMutex);
     if (!bookmarkFile)
     {
         LOGLN("Failed to open bookmark for writing");
     }
 
-    bookmarkQueue = xQueueCreate(5, sizeof(uint32_t));
+    bookmarkQueue = xQueueCreate(5, sizeof(Bookmark::Record));
+    playerQueue = xQueueCreate(8, sizeof(PlayerCommand));
     xTaskCreatePinnedToCore(bookmarkTask, "bookmarkTask", 4096, NULL, 2, NULL, 1);
 
-    if (bookmarkFound)
+    // A fresh scan may not have reached the bookmarked entry yet
+    if (bookmarkFound && saved.track >= 0 && saved.track < totalFiles)
     {
-        LOG("Bookmark: %d %u %u\n", idx, off, total, vol);
-        LOG("Resume track %d @ byte %u\n", idx, off);
-        playTrack(idx, off);
+        LOG("Bookmark: %d %u %u %u\n", saved.track, saved.offset, saved.totalFiles, saved.volume);
+        LOG("Resume track %d @ byte %u, %u ms\n", saved.track, saved.offset, saved.positionMs);
+        if (bookmarkState.historyCount == 0)
+            Bookmark::pushHistory(bookmarkState, saved.track);
+        postCommand(CMD_PLAY, saved.track, saved.offset, saved.positionMs);
     }
     else
     {
-        playTrack(shuffler.next(), 0);
+        int first = shuffler.next();
+        Bookmark::pushHistory(bookmarkState, first);
+        postCommand(CMD_PLAY, first, 0);
     }
+    xTaskCreatePinnedToCore(playerTask, "playerTask", 8192, NULL, 5, NULL, 1);
+#if LOUDNESS_SCAN
+    // Below everything else on the reader's core
+    if (REPLAYGAIN_MODE != ReplayGain::OFF)
+        xTaskCreatePinnedToCore(loudnessTask, "loudnessTask", 8192, NULL, 0, NULL, 0);
+#endif
 
     pinMode(LED_PIN, OUTPUT);
     digitalWrite(LED_PIN, LOW); // LED off by default
@@ -762,60 +1671,6 @@ void setup()
 
 void loop()
 {
-    unsigned long now = millis();
-
-    if (lockLoop)
-    {
-        LOGLN("Loop locked.");
-        return;
-    }
-
-    bool active = false;
-    xSemaphoreTake(sdMutex, portMAX_DELAY);
-    switch (currentType)
-    {
-    case TYPE_MP3:
-        if (mp3)
-            active = mp3->isRunning() && mp3->loop();
-        break;
-    case TYPE_WAV:
-        if (wav)
-            active = wav->isRunning() && wav->loop();
-        break;
-    case TYPE_FLAC:
-        if (flac)
-            active = flac->isRunning() && flac->loop();
-        break;
-    default:
-        active = false;
-        break;
-    }
-    xSemaphoreGive(sdMutex);
-
-    if (!active)
-    {
-        LOGLN("track finished, playing next");
-        delay(10);
-        nextTrack();
-        return;
-    }
-    else if (now - lastBookmarkMs > 1000)
-    {
-        unsigned long now = millis();
-        uint32_t pos = 0;
-        if (fileSrc && fileSrc->isOpen())
-        {
-            pos = fileSrc->getPos();
-        }
-        else
-        {
-            LOGLN("fileSrc not open during bookmark getPos()");
-        }
-        if (pos >= 0)
-        {
-            xQueueSend(bookmarkQueue, &pos, 0);
-            lastBookmarkMs = now;
-            LOG("Queued bookmark %u @ %u bytes\n", currentIdx, pos);
-        }
-    }
+    // Playback lives in playerTask, nothing left to poll here
+    vTaskDelete(NULL);
 }
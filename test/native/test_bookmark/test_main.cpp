@@ -0,0 +1,230 @@
+// Host tests for the binary bookmark record (pio test -e native)
+
+#include <unity.h>
+#include <vector>
+#include <Bookmark.h>
+
+// In-memory stand-in for fs::File that counts writes
+class MemFile
+{
+public:
+    bool seek(uint32_t p)
+    {
+        if (p > data.size())
+            return false;
+        pos = p;
+        return true;
+    }
+    size_t read(uint8_t *buf, size_t len)
+    {
+        if (len > data.size() - pos)
+            len = data.size() - pos;
+        memcpy(buf, data.data() + pos, len);
+        pos += len;
+        return len;
+    }
+    size_t write(const uint8_t *buf, size_t len)
+    {
+        writes++;
+        if (pos + len > data.size())
+            data.resize(pos + len);
+        memcpy(data.data() + pos, buf, len);
+        pos += len;
+        return len;
+    }
+
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+    int writes = 0;
+};
+
+static Bookmark::Record sample()
+{
+    Bookmark::Record r = {};
+    r.seq = 77;
+    r.totalFiles = 48213;
+    r.track = 1234;
+    r.offset = 0x00abcdef;
+    r.positionMs = 183456;
+    r.volume = 7;
+    r.shuffleSeed = 0xdeadbeef;
+    r.shuffleCursor = 40000;
+    for (uint32_t t = 100; t < 105; t++)
+        Bookmark::pushHistory(r, t);
+    return r;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_round_trip()
+{
+    Bookmark::Record in = sample();
+    uint8_t buf[Bookmark::recordSize];
+    TEST_ASSERT_EQUAL_UINT32(Bookmark::recordSize, Bookmark::encode(in, buf));
+
+    Bookmark::Record out = {};
+    TEST_ASSERT_TRUE(Bookmark::decode(buf, sizeof(buf), out));
+    TEST_ASSERT_EQUAL_UINT32(in.seq, out.seq);
+    TEST_ASSERT_EQUAL_UINT32(in.totalFiles, out.totalFiles);
+    TEST_ASSERT_EQUAL_INT32(in.track, out.track);
+    TEST_ASSERT_EQUAL_UINT32(in.offset, out.offset);
+    TEST_ASSERT_EQUAL_UINT32(in.positionMs, out.positionMs);
+    TEST_ASSERT_EQUAL_UINT8(in.volume, out.volume);
+    TEST_ASSERT_EQUAL_UINT32(in.shuffleSeed, out.shuffleSeed);
+    TEST_ASSERT_EQUAL_UINT32(in.shuffleCursor, out.shuffleCursor);
+    TEST_ASSERT_EQUAL_UINT8(5, out.historyCount);
+    TEST_ASSERT_EQUAL_UINT32(104, out.history[4]);
+}
+
+void test_rejects_other_versions_and_text()
+{
+    uint8_t buf[Bookmark::recordSize];
+    Bookmark::Record r = sample();
+    Bookmark::encode(r, buf);
+    buf[3] = Bookmark::version + 1;
+    TEST_ASSERT_FALSE(Bookmark::decode(buf, sizeof(buf), r));
+    Bookmark::encode(r, buf);
+    TEST_ASSERT_FALSE(Bookmark::decode(buf, Bookmark::recordSize - 1, r));
+
+    Bookmark::encode(r, buf);
+    buf[20] ^= 0x01;
+    TEST_ASSERT_FALSE(Bookmark::decode(buf, sizeof(buf), r));
+
+    const char *text = "120 5 4096 7\n";
+    TEST_ASSERT_FALSE(Bookmark::decode((const uint8_t *)text, strlen(text), r));
+}
+
+void test_reads_version_2_records()
+{
+    // A v2 record is the v3 layout without the play time
+    Bookmark::Record in = sample();
+    uint8_t buf[Bookmark::recordSize];
+    Bookmark::encode(in, buf);
+    buf[3] = 2;
+    Bookmark::detail::put32(buf + Bookmark::recordSizeV2 - 4, Bookmark::detail::crc32(buf, Bookmark::recordSizeV2 - 4));
+
+    Bookmark::Record out = {};
+    out.positionMs = 1;
+    TEST_ASSERT_TRUE(Bookmark::decode(buf, Bookmark::recordSizeV2, out));
+    TEST_ASSERT_EQUAL_INT32(in.track, out.track);
+    TEST_ASSERT_EQUAL_UINT32(in.offset, out.offset);
+    TEST_ASSERT_EQUAL_UINT32(0, out.positionMs);
+    TEST_ASSERT_EQUAL_UINT32(104, out.history[4]);
+}
+
+void test_parses_legacy_text_line()
+{
+    Bookmark::Record r = {};
+    TEST_ASSERT_TRUE(Bookmark::parseLegacy("120 5 4096 7\n", r));
+    TEST_ASSERT_EQUAL_UINT32(120, r.totalFiles);
+    TEST_ASSERT_EQUAL_INT32(5, r.track);
+    TEST_ASSERT_EQUAL_UINT32(4096, r.offset);
+    TEST_ASSERT_EQUAL_UINT8(7, r.volume);
+    TEST_ASSERT_FALSE(Bookmark::parseLegacy("garbage", r));
+}
+
+void test_history_keeps_newest_entries()
+{
+    Bookmark::Record r = {};
+    for (uint32_t t = 0; t < 20; t++)
+        Bookmark::pushHistory(r, t);
+    TEST_ASSERT_EQUAL_UINT8(Bookmark::historySize, r.historyCount);
+    TEST_ASSERT_EQUAL_UINT32(12, r.history[0]);
+    TEST_ASSERT_EQUAL_UINT32(19, r.history[Bookmark::historySize - 1]);
+
+    TEST_ASSERT_EQUAL_INT(18, Bookmark::popHistory(r));
+    TEST_ASSERT_EQUAL_INT(17, Bookmark::popHistory(r));
+    while (r.historyCount > 1)
+        Bookmark::popHistory(r);
+    TEST_ASSERT_EQUAL_INT(-1, Bookmark::popHistory(r));
+}
+
+void test_journal_recovers_newest_record()
+{
+    MemFile f;
+    TEST_ASSERT_TRUE(Bookmark::format(f));
+    TEST_ASSERT_EQUAL_UINT32(Bookmark::slotCount * Bookmark::slotSize, f.data.size());
+
+    Bookmark::Record r = sample();
+    TEST_ASSERT_FALSE(Bookmark::recover(f, r));
+
+    // Several laps of the ring
+    for (uint32_t seq = 1; seq <= 3 * Bookmark::slotCount + 5; seq++)
+    {
+        r.seq = seq;
+        r.offset = seq * 1000;
+        TEST_ASSERT_TRUE(Bookmark::append(f, r));
+    }
+    TEST_ASSERT_EQUAL_UINT32(Bookmark::slotCount * Bookmark::slotSize, f.data.size());
+
+    Bookmark::Record out = {};
+    TEST_ASSERT_TRUE(Bookmark::recover(f, out));
+    TEST_ASSERT_EQUAL_UINT32(3 * Bookmark::slotCount + 5, out.seq);
+    TEST_ASSERT_EQUAL_UINT32(out.seq * 1000, out.offset);
+}
+
+void test_journal_survives_torn_write()
+{
+    MemFile f;
+    Bookmark::format(f);
+    Bookmark::Record r = sample();
+    for (uint32_t seq = 1; seq <= 20; seq++)
+    {
+        r.seq = seq;
+        Bookmark::append(f, r);
+    }
+
+    // Power lost halfway through the write of record 20
+    size_t slot = (20 % Bookmark::slotCount) * Bookmark::slotSize;
+    memset(f.data.data() + slot + Bookmark::recordSize / 2, 0xff, Bookmark::recordSize / 2);
+
+    Bookmark::Record out = {};
+    TEST_ASSERT_TRUE(Bookmark::recover(f, out));
+    TEST_ASSERT_EQUAL_UINT32(19, out.seq);
+}
+
+void test_journal_sequence_wraps()
+{
+    MemFile f;
+    Bookmark::format(f);
+    Bookmark::Record r = sample();
+    for (uint32_t seq = 0xfffffff8; seq != 6; seq++)
+    {
+        r.seq = seq;
+        Bookmark::append(f, r);
+    }
+
+    Bookmark::Record out = {};
+    TEST_ASSERT_TRUE(Bookmark::recover(f, out));
+    TEST_ASSERT_EQUAL_UINT32(5, out.seq);
+}
+
+void test_journal_writes_one_slot_per_save()
+{
+    MemFile f;
+    Bookmark::format(f);
+    f.writes = 0;
+    Bookmark::Record r = sample();
+    for (uint32_t seq = 1; seq <= 100; seq++)
+    {
+        r.seq = seq;
+        Bookmark::append(f, r);
+    }
+    TEST_ASSERT_EQUAL_INT(100, f.writes);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_rejects_other_versions_and_text);
+    RUN_TEST(test_reads_version_2_records);
+    RUN_TEST(test_parses_legacy_text_line);
+    RUN_TEST(test_history_keeps_newest_entries);
+    RUN_TEST(test_journal_recovers_newest_record);
+    RUN_TEST(test_journal_survives_torn_write);
+    RUN_TEST(test_journal_sequence_wraps);
+    RUN_TEST(test_journal_writes_one_slot_per_save);
+    return UNITY_END();
+}
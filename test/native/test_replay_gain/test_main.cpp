@@ -0,0 +1,183 @@
+// Host tests for ReplayGain tags, the gain cache and the R128 meter
+// (pio test -e native)
+
+#include <unity.h>
+#include <math.h>
+#include <vector>
+#include <ReplayGain.h>
+
+// In-memory stand-in for fs::File
+class MemFile
+{
+public:
+    bool seek(uint32_t p)
+    {
+        if (p > data.size())
+            return false;
+        pos = p;
+        return true;
+    }
+    size_t size() const { return data.size(); }
+    size_t read(uint8_t *buf, size_t len)
+    {
+        if (len > data.size() - pos)
+            len = data.size() - pos;
+        memcpy(buf, data.data() + pos, len);
+        pos += len;
+        return len;
+    }
+    size_t write(const uint8_t *buf, size_t len)
+    {
+        if (pos + len > data.size())
+            data.resize(pos + len);
+        memcpy(data.data() + pos, buf, len);
+        pos += len;
+        return len;
+    }
+
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+};
+
+// Stereo sine at amplitude dBFS, both channels the same
+static std::vector<int16_t> sine(float hz, float dbfs, uint32_t rate, float seconds)
+{
+    uint32_t frames = rate * seconds;
+    std::vector<int16_t> p(2 * frames);
+    float amp = 32767.0f * powf(10.0f, dbfs / 20.0f);
+    for (uint32_t i = 0; i < frames; i++)
+        p[2 * i] = p[2 * i + 1] = (int16_t)lrintf(amp * sinf(2 * M_PI * hz * i / rate));
+    return p;
+}
+
+static float measure(const std::vector<int16_t> &pcm, uint32_t rate)
+{
+    ReplayGain::Meter *m = new ReplayGain::Meter();
+    m->begin(rate, 2);
+    // Odd sized pieces, like decoder blocks
+    for (size_t at = 0; at < pcm.size() / 2;)
+    {
+        size_t n = (pcm.size() / 2 - at < 1151) ? pcm.size() / 2 - at : 1151;
+        m->add(&pcm[2 * at], n);
+        at += n;
+    }
+    float l = m->loudness();
+    delete m;
+    return l;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_parses_replaygain_and_r128_tags()
+{
+    ReplayGain::Tags t = {};
+    TEST_ASSERT_TRUE(ReplayGain::parse(t, "REPLAYGAIN_TRACK_GAIN", "-6.20 dB"));
+    TEST_ASSERT_TRUE(ReplayGain::parse(t, "replaygain_track_peak", "0.988"));
+    TEST_ASSERT_TRUE(ReplayGain::parse(t, "ReplayGain_Album_Gain", "+1.50 dB"));
+    TEST_ASSERT_FALSE(ReplayGain::parse(t, "TITLE", "Something"));
+    TEST_ASSERT_TRUE(t.hasTrack && t.hasAlbum);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -6.2f, t.trackGain);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.988f, t.trackPeak);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.5f, t.albumGain);
+
+    // R128 gains are to -23 LUFS, 5 dB below the ReplayGain reference
+    ReplayGain::Tags r = {};
+    TEST_ASSERT_TRUE(ReplayGain::parse(r, "R128_TRACK_GAIN", "-512"));
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 3.0f, r.trackGain);
+}
+
+void test_picks_gain_by_mode_and_peak()
+{
+    using namespace ReplayGain;
+    Tags t = {};
+    parse(t, "REPLAYGAIN_TRACK_GAIN", "-6.02 dB");
+    parse(t, "REPLAYGAIN_ALBUM_GAIN", "-12.04 dB");
+    TEST_ASSERT_INT32_WITHIN(40, unity / 2, gainFor(t, TRACK, unknown, 0));
+    TEST_ASSERT_INT32_WITHIN(40, unity / 4, gainFor(t, ALBUM, unknown, 0));
+    TEST_ASSERT_EQUAL_INT32(unity, gainFor(t, OFF, unknown, 0));
+    TEST_ASSERT_INT32_WITHIN(40, unity, gainFor(t, TRACK, unknown, 6.02f));
+
+    // Album mode without album tags uses the track gain
+    Tags only = {};
+    parse(only, "REPLAYGAIN_TRACK_GAIN", "-6.02 dB");
+    TEST_ASSERT_INT32_WITHIN(40, unity / 2, gainFor(only, ALBUM, unknown, 0));
+
+    // A boost stops where the peak reaches full scale
+    Tags loud = {};
+    parse(loud, "REPLAYGAIN_TRACK_GAIN", "+10 dB");
+    parse(loud, "REPLAYGAIN_TRACK_PEAK", "0.5");
+    TEST_ASSERT_INT32_WITHIN(2, 2 * unity, gainFor(loud, TRACK, unknown, 0));
+
+    // Untagged: what was measured, or nothing
+    Tags none = {};
+    TEST_ASSERT_INT32_WITHIN(40, unity / 2, gainFor(none, TRACK, -602, 0));
+    TEST_ASSERT_EQUAL_INT32(unity, gainFor(none, TRACK, unknown, 0));
+    TEST_ASSERT_EQUAL_INT32(unity, gainFor(none, TRACK, tagged, 0));
+}
+
+void test_cache_stores_by_index()
+{
+    MemFile f;
+    TEST_ASSERT_EQUAL_INT16(ReplayGain::unknown, ReplayGain::lookup(f, 0));
+    TEST_ASSERT_TRUE(ReplayGain::store(f, 5, -734));
+    TEST_ASSERT_EQUAL(6 * ReplayGain::entrySize, f.data.size());
+    TEST_ASSERT_EQUAL_INT16(-734, ReplayGain::lookup(f, 5));
+    for (uint32_t i = 0; i < 5; i++)
+        TEST_ASSERT_EQUAL_INT16(ReplayGain::unknown, ReplayGain::lookup(f, i));
+    TEST_ASSERT_TRUE(ReplayGain::store(f, 2, ReplayGain::tagged));
+    TEST_ASSERT_TRUE(ReplayGain::store(f, 5, 250));
+    TEST_ASSERT_EQUAL_INT16(ReplayGain::tagged, ReplayGain::lookup(f, 2));
+    TEST_ASSERT_EQUAL_INT16(250, ReplayGain::lookup(f, 5));
+    TEST_ASSERT_EQUAL_INT16(ReplayGain::unknown, ReplayGain::lookup(f, 6));
+    TEST_ASSERT_EQUAL(6 * ReplayGain::entrySize, f.data.size());
+}
+
+// EBU Tech 3341 case 1: a -23 dBFS 1 kHz sine in both channels is -23 LUFS
+void test_meter_reads_reference_tone()
+{
+    TEST_ASSERT_FLOAT_WITHIN(0.1f, -23.0f, measure(sine(1000, -23, 48000, 20), 48000));
+    TEST_ASSERT_FLOAT_WITHIN(0.1f, -23.0f, measure(sine(1000, -23, 44100, 20), 44100));
+    TEST_ASSERT_FLOAT_WITHIN(0.1f, -33.0f, measure(sine(1000, -33, 44100, 20), 44100));
+}
+
+// Tech 3341 case 3 in spirit: quiet stretches below the relative gate don't
+// pull the level down
+void test_meter_gates_quiet_parts()
+{
+    std::vector<int16_t> pcm = sine(1000, -36, 48000, 10);
+    std::vector<int16_t> loud = sine(1000, -23, 48000, 60);
+    std::vector<int16_t> quiet = sine(1000, -72, 48000, 10);
+    pcm.insert(pcm.end(), loud.begin(), loud.end());
+    pcm.insert(pcm.end(), quiet.begin(), quiet.end());
+    TEST_ASSERT_FLOAT_WITHIN(0.1f, -23.0f, measure(pcm, 48000));
+    TEST_ASSERT_EQUAL_FLOAT(-70.0f, measure(std::vector<int16_t>(2 * 48000 * 5, 0), 48000));
+}
+
+void test_meter_gain_respects_peak()
+{
+    ReplayGain::Meter *m = new ReplayGain::Meter();
+    std::vector<int16_t> pcm = sine(1000, -23, 44100, 5);
+    m->begin(44100, 2);
+    m->add(pcm.data(), pcm.size() / 2);
+    // 5 dB up to -18 LUFS, which the -23 dBFS peak leaves room for
+    TEST_ASSERT_INT_WITHIN(10, 500, m->gainCentiDb());
+    std::vector<int16_t> quiet = sine(1000, -40, 44100, 5);
+    quiet[1000] = 32000; // One loud click
+    m->begin(44100, 2);
+    m->add(quiet.data(), quiet.size() / 2);
+    TEST_ASSERT_INT_WITHIN(10, (int)lrintf(-2000.0f * log10f(32000 / 32768.0f)), m->gainCentiDb());
+    delete m;
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_parses_replaygain_and_r128_tags);
+    RUN_TEST(test_picks_gain_by_mode_and_peak);
+    RUN_TEST(test_cache_stores_by_index);
+    RUN_TEST(test_meter_reads_reference_tone);
+    RUN_TEST(test_meter_gates_quiet_parts);
+    RUN_TEST(test_meter_gain_respects_peak);
+    return UNITY_END();
+}
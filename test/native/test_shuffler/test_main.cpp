@@ -0,0 +1,120 @@
+// Host tests for the shuffled play order (pio test -e native)
+
+#include <unity.h>
+#include <vector>
+#include <Shuffler.h>
+
+// Draw one full cycle and check every index in [0,total) shows up exactly once
+static void checkCycle(Shuffler &s, uint32_t total)
+{
+    std::vector<uint8_t> seen(total, 0);
+    for (uint32_t i = 0; i < total; i++)
+    {
+        int v = s.next();
+        TEST_ASSERT_TRUE(v >= 0 && (uint32_t)v < total);
+        TEST_ASSERT_EQUAL_UINT8(0, seen[v]);
+        seen[v] = 1;
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_every_index_once_per_cycle()
+{
+    const uint32_t sizes[] = {1, 2, 3, 7, 64, 65, 1000, 1023, 1024, 1025, 50000};
+    for (uint32_t total : sizes)
+    {
+        Shuffler s(total, total * 7919u);
+        // Several cycles in a row, each with its own key
+        for (int cycle = 0; cycle < 3; cycle++)
+            checkCycle(s, total);
+    }
+}
+
+void test_cycles_use_different_orders()
+{
+    Shuffler s(1000, 42);
+    std::vector<int> first, second;
+    for (int i = 0; i < 1000; i++)
+        first.push_back(s.next());
+    for (int i = 0; i < 1000; i++)
+        second.push_back(s.next());
+    TEST_ASSERT_FALSE(first == second);
+}
+
+void test_prev_walks_back_through_the_cycle()
+{
+    Shuffler s(500, 7);
+    std::vector<int> played;
+    for (int i = 0; i < 100; i++)
+        played.push_back(s.next());
+
+    for (int i = 98; i >= 0; i--)
+        TEST_ASSERT_EQUAL_INT(played[i], s.prev());
+    TEST_ASSERT_EQUAL_INT(-1, s.prev());
+
+    // After going back, next() replays the same order
+    for (int i = 1; i < 100; i++)
+        TEST_ASSERT_EQUAL_INT(played[i], s.next());
+}
+
+void test_restore_resumes_the_same_order()
+{
+    Shuffler a(3000, 1234);
+    for (int i = 0; i < 777; i++)
+        a.next();
+
+    Shuffler b;
+    b.restore(a.size(), a.seed(), a.cursor());
+    for (int i = 0; i < 5000; i++)
+        TEST_ASSERT_EQUAL_INT(a.next(), b.next());
+}
+
+void test_growth_within_domain_never_repeats()
+{
+    // 600 and 1000 share the 1024 domain, so the cycle carries on
+    Shuffler s(600, 99);
+    std::vector<uint8_t> seen(1000, 0);
+    for (int i = 0; i < 300; i++)
+    {
+        int v = s.next();
+        TEST_ASSERT_EQUAL_UINT8(0, seen[v]);
+        seen[v] = 1;
+    }
+    s.grow(1000);
+    uint32_t drawn = 300;
+    while (s.cursor() < 1024)
+    {
+        uint32_t before = s.cursor();
+        int v = s.next();
+        if (s.cursor() < before)
+            break; // wrapped into the next cycle
+        TEST_ASSERT_EQUAL_UINT8(0, seen[v]);
+        seen[v] = 1;
+        drawn++;
+    }
+    TEST_ASSERT_TRUE(drawn > 600);
+}
+
+void test_next_cost_is_bounded()
+{
+    // Worst case for skipping: one past a power of two
+    Shuffler s(4097, 5);
+    uint32_t start = s.cursor();
+    for (int i = 0; i < 4097; i++)
+        s.next();
+    TEST_ASSERT_TRUE(s.cursor() - start <= 8192);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_every_index_once_per_cycle);
+    RUN_TEST(test_cycles_use_different_orders);
+    RUN_TEST(test_prev_walks_back_through_the_cycle);
+    RUN_TEST(test_restore_resumes_the_same_order);
+    RUN_TEST(test_growth_within_domain_never_repeats);
+    RUN_TEST(test_next_cost_is_bounded);
+    return UNITY_END();
+}
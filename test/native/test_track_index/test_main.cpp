@@ -0,0 +1,195 @@
+// Host tests for the /index offset table (pio test -e native)
+
+#include <unity.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <TrackIndex.h>
+
+// In-memory stand-in for fs::File that counts the calls a lookup makes
+class MemFile
+{
+public:
+    bool seek(uint32_t p)
+    {
+        seeks++;
+        if (p > data.size())
+            return false;
+        pos = p;
+        return true;
+    }
+    size_t position() const { return pos; }
+    size_t size() const { return data.size(); }
+    size_t read(uint8_t *buf, size_t len)
+    {
+        reads++;
+        if (len > data.size() - pos)
+            len = data.size() - pos;
+        memcpy(buf, data.data() + pos, len);
+        pos += len;
+        bytesRead += len;
+        return len;
+    }
+    size_t write(const uint8_t *buf, size_t len)
+    {
+        if (pos + len > data.size())
+            data.resize(pos + len);
+        memcpy(data.data() + pos, buf, len);
+        pos += len;
+        return len;
+    }
+    void resetCounters() { seeks = reads = bytesRead = 0; }
+
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+    int seeks = 0;
+    int reads = 0;
+    size_t bytesRead = 0;
+};
+
+static const uint32_t numPaths = 50000;
+static MemFile indexFile;
+static MemFile offsetFile;
+
+static std::string pathFor(uint32_t i)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/Artist %u/Album %u/%05u - Track.%s", i % 97, i % 13, i, (i % 3) ? "mp3" : "flac");
+    return buf;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_builds_one_offset_per_entry()
+{
+    TEST_ASSERT_EQUAL_UINT32(numPaths, TrackIndex::count(offsetFile));
+    TEST_ASSERT_EQUAL_UINT32(numPaths * TrackIndex::offsetSize, offsetFile.size());
+}
+
+void test_lookup_returns_exact_path()
+{
+    char path[TrackIndex::maxPathLen];
+    const uint32_t probes[] = {0, 1, 8000, 31337, numPaths - 2, numPaths - 1};
+    for (uint32_t idx : probes)
+    {
+        TEST_ASSERT_TRUE(TrackIndex::lookup(indexFile, offsetFile, idx, path, sizeof(path)));
+        TEST_ASSERT_EQUAL_STRING(pathFor(idx).c_str(), path);
+    }
+    TEST_ASSERT_FALSE(TrackIndex::lookup(indexFile, offsetFile, numPaths, path, sizeof(path)));
+}
+
+void test_lookup_cost_is_constant()
+{
+    char path[TrackIndex::maxPathLen];
+    const uint32_t probes[] = {0, 8000, 49998};
+    for (uint32_t idx : probes)
+    {
+        indexFile.resetCounters();
+        offsetFile.resetCounters();
+        TEST_ASSERT_TRUE(TrackIndex::lookup(indexFile, offsetFile, idx, path, sizeof(path)));
+        // One seek and one read per file, and only the entry itself is read
+        TEST_ASSERT_EQUAL_INT(1, offsetFile.seeks);
+        TEST_ASSERT_EQUAL_INT(1, offsetFile.reads);
+        TEST_ASSERT_EQUAL_INT(1, indexFile.seeks);
+        TEST_ASSERT_EQUAL_INT(1, indexFile.reads);
+        TEST_ASSERT_EQUAL_UINT32(pathFor(idx).size() + 1, indexFile.bytesRead);
+    }
+}
+
+void test_rebuild_from_crlf_index()
+{
+    // Older firmware wrote /index with println(), i.e. CRLF and no table
+    MemFile legacy, rebuilt;
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+        std::string line = pathFor(i) + "\r\n";
+        legacy.write((const uint8_t *)line.data(), line.size());
+    }
+    TEST_ASSERT_EQUAL_UINT32(1000, TrackIndex::rebuildOffsets(legacy, rebuilt));
+
+    char path[TrackIndex::maxPathLen];
+    TEST_ASSERT_TRUE(TrackIndex::lookup(legacy, rebuilt, 0, path, sizeof(path)));
+    TEST_ASSERT_EQUAL_STRING(pathFor(0).c_str(), path);
+    TEST_ASSERT_TRUE(TrackIndex::lookup(legacy, rebuilt, 999, path, sizeof(path)));
+    TEST_ASSERT_EQUAL_STRING(pathFor(999).c_str(), path);
+}
+
+void test_tombstone_hides_entry_but_keeps_numbering()
+{
+    MemFile idx, off;
+    for (uint32_t i = 0; i < 10; i++)
+        TrackIndex::append(idx, off, pathFor(i).c_str());
+
+    TEST_ASSERT_TRUE(TrackIndex::tombstone(off, 4));
+    TEST_ASSERT_TRUE(TrackIndex::tombstone(off, 9));
+    TEST_ASSERT_FALSE(TrackIndex::tombstone(off, 10));
+    TEST_ASSERT_EQUAL_UINT32(10, TrackIndex::count(off));
+
+    char path[TrackIndex::maxPathLen];
+    TEST_ASSERT_FALSE(TrackIndex::lookup(idx, off, 4, path, sizeof(path)));
+    TEST_ASSERT_FALSE(TrackIndex::lookup(idx, off, 9, path, sizeof(path)));
+    // Neighbours of a tombstone keep their exact paths
+    TEST_ASSERT_TRUE(TrackIndex::lookup(idx, off, 3, path, sizeof(path)));
+    TEST_ASSERT_EQUAL_STRING(pathFor(3).c_str(), path);
+    TEST_ASSERT_TRUE(TrackIndex::lookup(idx, off, 8, path, sizeof(path)));
+    TEST_ASSERT_EQUAL_STRING(pathFor(8).c_str(), path);
+
+    // Appending after tombstones continues the numbering
+    idx.seek(idx.size());
+    off.seek(off.size());
+    TrackIndex::append(idx, off, "/new.mp3");
+    TEST_ASSERT_TRUE(TrackIndex::lookup(idx, off, 10, path, sizeof(path)));
+    TEST_ASSERT_EQUAL_STRING("/new.mp3", path);
+}
+
+void test_for_each_visits_entries_in_order()
+{
+    uint32_t visited = 0;
+    bool inOrder = true;
+    uint32_t n = TrackIndex::forEach(indexFile, offsetFile, [&](uint32_t idx, const char *path)
+    {
+        inOrder = inOrder && idx == visited && pathFor(idx) == path;
+        visited++;
+    });
+    TEST_ASSERT_EQUAL_UINT32(numPaths, n);
+    TEST_ASSERT_EQUAL_UINT32(numPaths, visited);
+    TEST_ASSERT_TRUE(inOrder);
+}
+
+void test_for_each_skips_tombstones()
+{
+    MemFile idx, off;
+    for (uint32_t i = 0; i < 300; i++)
+        TrackIndex::append(idx, off, pathFor(i).c_str());
+    TrackIndex::tombstone(off, 0);
+    TrackIndex::tombstone(off, 200);
+
+    std::vector<uint32_t> seen;
+    uint32_t n = TrackIndex::forEach(idx, off, [&](uint32_t i, const char *path)
+    {
+        if (pathFor(i) == path)
+            seen.push_back(i);
+    });
+    TEST_ASSERT_EQUAL_UINT32(300, n);
+    TEST_ASSERT_EQUAL_UINT32(298, seen.size());
+    TEST_ASSERT_EQUAL_UINT32(1, seen.front());
+    TEST_ASSERT_EQUAL_UINT32(199, seen[198]);
+    TEST_ASSERT_EQUAL_UINT32(201, seen[199]);
+}
+
+int main(int argc, char **argv)
+{
+    for (uint32_t i = 0; i < numPaths; i++)
+        TrackIndex::append(indexFile, offsetFile, pathFor(i).c_str());
+
+    UNITY_BEGIN();
+    RUN_TEST(test_builds_one_offset_per_entry);
+    RUN_TEST(test_lookup_returns_exact_path);
+    RUN_TEST(test_lookup_cost_is_constant);
+    RUN_TEST(test_rebuild_from_crlf_index);
+    RUN_TEST(test_tombstone_hides_entry_but_keeps_numbering);
+    RUN_TEST(test_for_each_visits_entries_in_order);
+    RUN_TEST(test_for_each_skips_tombstones);
+    return UNITY_END();
+}